@@ -0,0 +1,122 @@
+#include "benchmark.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+
+namespace Sibyl {
+
+BenchmarkRunner::BenchmarkRunner(
+  const string& filter, 
+  double min_time
+) : filter_(filter),
+    min_time_(min_time) {
+}
+
+double BenchmarkRunner::Time(const function<void(long)>& fn, long n) {
+  auto start = chrono::steady_clock::now();
+  fn(n);
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void BenchmarkRunner::Run(
+  const string& name, function<void(long)> fn, double items_per_op
+) {
+  if (!filter_.empty() && name.find(filter_) == string::npos) return;
+
+  // Calibrate so that each measured run takes about min_time seconds.
+  long n = 1;
+  double elapsed = Time(fn, n);
+  while (elapsed < min_time_ / 10 && n < (1L << 40)) {
+    n *= 2;
+    elapsed = Time(fn, n);
+  }
+  n = std::max(1L, long(n * min_time_ / std::max(elapsed, 1e-9)));
+
+  vector<double> samples;
+  for (int i = 0; i < BENCHMARK_REPETITIONS; i++) {
+    samples.push_back(Time(fn, n) * 1e9 / n);
+  }
+  sort(samples.begin(), samples.end());
+
+  BenchmarkResult result { name, samples[samples.size() / 2], n, items_per_op };
+  results_.push_back(result);
+
+  printf("%-40s %14.1f ns/op %12ld iterations", name.c_str(), result.ns_per_op, n);
+  if (items_per_op > 0) printf(" %10.2f M/s", items_per_op * 1e3 / result.ns_per_op);
+  printf("\n");
+}
+
+void BenchmarkRunner::WriteJson(const string& filename) {
+  ofstream f(filename);
+  if (!f.is_open()) {
+    cout << "Could not write " << filename << endl;
+    return;
+  }
+
+  f << fixed << setprecision(1);
+  f << "{" << endl << "  \"benchmarks\": {" << endl;
+  for (int i = 0; i < results_.size(); i++) {
+    const BenchmarkResult& r = results_[i];
+    f << "    \"" << r.name << "\": {\"ns_per_op\": " << r.ns_per_op 
+      << ", \"iterations\": " << r.iterations;
+    if (r.items_per_op > 0) 
+      f << ", \"m_items_per_s\": " << r.items_per_op * 1e3 / r.ns_per_op;
+    f << "}" << ((i + 1 < results_.size()) ? "," : "") << endl;
+  }
+  f << "  }" << endl << "}" << endl;
+}
+
+// Only reads the format written by WriteJson: one benchmark per line.
+map<string, double> BenchmarkRunner::ReadJson(const string& filename) {
+  map<string, double> results;
+  ifstream f(filename);
+  if (!f.is_open()) return results;
+
+  string line;
+  while (getline(f, line)) {
+    size_t name_start = line.find('"');
+    size_t name_end = line.find('"', name_start + 1);
+    size_t value = line.find("\"ns_per_op\":");
+    if (name_start == string::npos || name_end == string::npos || value == string::npos) 
+      continue;
+
+    string name = line.substr(name_start + 1, name_end - name_start - 1);
+    results[name] = atof(line.c_str() + value + 12);
+  }
+  return results;
+}
+
+// Returns the number of benchmarks that got slower than the baseline by more
+// than the threshold, given as a fraction. Benchmarks missing from the 
+// baseline are reported but never fail.
+int BenchmarkRunner::Compare(const string& filename, double threshold) {
+  map<string, double> baseline = ReadJson(filename);
+  if (baseline.empty()) {
+    cout << "No baseline results in " << filename << endl;
+    return 0;
+  }
+
+  int regressions = 0;
+  printf("\n%-40s %14s %14s %9s\n", "benchmark", "baseline", "current", "change");
+  for (auto& r : results_) {
+    auto it = baseline.find(r.name);
+    if (it == baseline.end() || it->second <= 0) {
+      printf("%-40s %14s %14.1f %9s\n", r.name.c_str(), "-", r.ns_per_op, "new");
+      continue;
+    }
+
+    double change = r.ns_per_op / it->second - 1.0;
+    bool regressed = change > threshold;
+    if (regressed) regressions++;
+    printf(
+      "%-40s %14.1f %14.1f %+8.1f%%%s\n", r.name.c_str(), it->second, 
+      r.ns_per_op, change * 100, (regressed) ? "  REGRESSION" : ""
+    );
+  }
+  return regressions;
+}
+
+} // End of namespace.
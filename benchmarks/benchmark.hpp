@@ -0,0 +1,51 @@
+#ifndef _BENCHMARK_HPP_
+#define _BENCHMARK_HPP_
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "config.h"
+
+namespace Sibyl {
+
+// Keeps the compiler from discarding a value computed by a benchmark.
+template<class T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchmarkResult {
+  std::string name;
+  double ns_per_op;
+  long iterations;
+  double items_per_op;
+};
+
+// Minimal microbenchmark runner. Each benchmark is a function that runs the
+// operation n times. The runner grows n until a run takes a measurable 
+// amount of time, then reports the median of several runs. Results are
+// written as JSON and can be compared against a baseline file in the same
+// format.
+class BenchmarkRunner {
+  std::vector<BenchmarkResult> results_;
+  std::string filter_;
+  double min_time_;
+
+  double Time(const std::function<void(long)>&, long);
+
+ public:
+  BenchmarkRunner(const std::string& filter, double min_time);
+
+  void Run(const std::string&, std::function<void(long)>, double items_per_op = 0);
+  void WriteJson(const std::string&);
+  int Compare(const std::string&, double);
+
+  static std::map<std::string, double> ReadJson(const std::string&);
+};
+
+} // End of namespace.
+
+#endif
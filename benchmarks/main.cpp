@@ -0,0 +1,752 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include "benchmark.hpp"
+#include "ioc_container.hpp"
+#include "game_state.hpp"
+#include "renderer.hpp"
+#include "terrain.hpp"
+#include "clipmap.hpp"
+#include "building.hpp"
+#include "entity_manager.hpp"
+#include "plotter.hpp"
+#include "thread_pool.hpp"
+#include "physics.hpp"
+#include "software_rasterizer.hpp"
+#include "software_shaders.hpp"
+#include "heightfield_renderer.hpp"
+
+using namespace Sibyl;
+
+// Throughput of the software rasterizer at the window resolution, in 
+// triangles per second for small triangles and pixels per second for full 
+// screen quads, plus the terrain as seen from the start position.
+void RunSoftwareRasterizerBenchmarks(
+  BenchmarkRunner& runner, 
+  const vector< vector<float> >& height_map
+) {
+  shared_ptr<ThreadPool> thread_pool = make_shared<ThreadPool>();
+  SoftwareRasterizer rasterizer(thread_pool, WINDOW_WIDTH, WINDOW_HEIGHT);
+  SoftwareFramebuffer framebuffer;
+  framebuffer.Resize(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+  // Triangles with about 16 pixels each, already in clip space.
+  mt19937 rng(7);
+  uniform_real_distribution<float> ndc(-1, 1);
+  uniform_real_distribution<float> depth(-0.9f, 0.9f);
+  const int num_triangles = 65536;
+  vector<glm::vec3> vertices;
+  vector<glm::vec2> uvs;
+  float dx = 8.0f / WINDOW_WIDTH;
+  float dy = 8.0f / WINDOW_HEIGHT;
+  for (int i = 0; i < num_triangles; i++) {
+    glm::vec3 p(ndc(rng), ndc(rng), depth(rng));
+    vertices.push_back(p);
+    vertices.push_back(p + glm::vec3(dx, 0, 0));
+    vertices.push_back(p + glm::vec3(0, dy, 0));
+    uvs.push_back(glm::vec2(0.5, 0.5));
+    uvs.push_back(glm::vec2(0.5, 0.5));
+    uvs.push_back(glm::vec2(0.5, 0.5));
+  }
+
+  BuildingShader shader;
+  shader.vertices = &vertices;
+  shader.uvs = &uvs;
+  shader.MVP = glm::mat4(1.0);
+  runner.Run("software_raster_triangles", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      rasterizer.Clear(framebuffer, glm::vec3(0));
+      rasterizer.Draw(shader, vertices.size());
+      rasterizer.Flush(framebuffer);
+    }
+  }, num_triangles);
+
+  // Back to front, so every pixel passes the depth test.
+  const int num_layers = 8;
+  vector<glm::vec3> quads;
+  vector<glm::vec2> quad_uvs;
+  for (int i = 0; i < num_layers; i++) {
+    float z = 0.9f - 0.2f * i;
+    glm::vec3 corners[6] = {
+      glm::vec3(-1, -1, z), glm::vec3(1, -1, z), glm::vec3(-1, 1, z),
+      glm::vec3(-1, 1, z), glm::vec3(1, -1, z), glm::vec3(1, 1, z)
+    };
+    quads.insert(quads.end(), corners, corners + 6);
+    quad_uvs.insert(quad_uvs.end(), 6, glm::vec2(0.5, 0.5));
+  }
+
+  shader.vertices = &quads;
+  shader.uvs = &quad_uvs;
+  runner.Run("software_raster_fill", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      rasterizer.Clear(framebuffer, glm::vec3(0));
+      rasterizer.Draw(shader, quads.size());
+      rasterizer.Flush(framebuffer);
+    }
+  }, num_layers * WINDOW_WIDTH * WINDOW_HEIGHT);
+
+  // The same grid as SoftwareRenderer::LoadTerrain, without normals.
+  int size = height_map.size();
+  vector<glm::vec3> terrain;
+  vector<glm::vec3> normals(size * size, glm::vec3(0, 1, 0));
+  vector<unsigned int> indices;
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      terrain.push_back(glm::vec3(
+        2000 + (i - size / 2) * TILE_SIZE, 
+        MAX_HEIGHT / 2 + height_map[i][j], 
+        2000 + (j - size / 2) * TILE_SIZE
+      ));
+    }
+  }
+  for (int i = 0; i + 1 < size; i++) {
+    for (int j = 0; j + 1 < size; j++) {
+      unsigned int v = i * size + j;
+      unsigned int quad[6] = { v, v + 1, v + size, v + size, v + 1, v + size + 1 };
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+
+  Player player;
+  glm::vec3 direction(sin(player.h_angle), 0, cos(player.h_angle));
+  TerrainShader terrain_shader;
+  terrain_shader.vertices = &terrain;
+  terrain_shader.normals = &normals;
+  terrain_shader.V = glm::lookAt(player.position, player.position + direction, glm::vec3(0, 1, 0));
+  terrain_shader.MVP = glm::perspective(glm::radians(PLAYER_FOV), 4.0f / 3.0f, NEAR_CLIPPING, FAR_CLIPPING) * terrain_shader.V;
+  terrain_shader.light_cameraspace = glm::vec3(0, 1, 0);
+  runner.Run("software_raster_terrain", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      rasterizer.Clear(framebuffer, glm::vec3(0));
+      rasterizer.Draw(terrain_shader, terrain.size(), &indices[0], indices.size());
+      rasterizer.Flush(framebuffer);
+    }
+  }, indices.size() / 3);
+}
+
+// Far plane distances for comparing the ray cast terrain with the clipmaps.
+// The clipmap levels needed grow with the distance, the rays per frame stay
+// the same.
+static const float kTerrainFarPlanes[] = { 250, 500, 1000, 2000, 4000 };
+
+static glm::mat4 TerrainBenchmarkView() {
+  Player player;
+  glm::vec3 direction(sin(player.h_angle), 0, cos(player.h_angle));
+  return glm::lookAt(player.position, player.position + direction, glm::vec3(0, 1, 0));
+}
+
+static glm::mat4 TerrainBenchmarkProjection(float far) {
+  return glm::perspective(glm::radians(PLAYER_FOV), 4.0f / 3.0f, NEAR_CLIPPING, far);
+}
+
+// Rays per second for the ray cast terrain from the start position.
+void RunHeightfieldBenchmarks(
+  BenchmarkRunner& runner, 
+  const vector< vector<float> >& height_map
+) {
+  shared_ptr<ThreadPool> thread_pool = make_shared<ThreadPool>();
+  HeightfieldRenderer heightfield(thread_pool, height_map);
+  SoftwareFramebuffer framebuffer;
+  framebuffer.Resize(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+  glm::mat4 view = TerrainBenchmarkView();
+  for (float far : kTerrainFarPlanes) {
+    glm::mat4 projection = TerrainBenchmarkProjection(far);
+    runner.Run("heightfield_raycast_far_" + to_string(int(far)), [&](long n) {
+      for (long i = 0; i < n; i++) {
+        framebuffer.Clear(glm::vec3(0));
+        heightfield.Render(framebuffer, projection, view);
+      }
+    }, WINDOW_WIDTH * WINDOW_HEIGHT);
+  }
+}
+
+// A grid of 4 x 4 rooms, 50 by 50 per storey, each with a slab, two walls
+// and a pillar, until there are count boxes.
+static vector<Floor> GenerateFloors(int count) {
+  vector<Floor> floors;
+  for (int i = 0; floors.size() < count; i++) {
+    glm::vec3 p = glm::vec3(1000 + 4 * (i % 50), 200 + 3 * (i / 2500), 1000 + 4 * ((i / 50) % 50));
+    floors.push_back(Floor(p, 4, 0.25f, 4));
+    floors.push_back(Floor(p, 4, 3, 0.25f));
+    floors.push_back(Floor(p, 0.25f, 3, 4));
+    floors.push_back(Floor(p + glm::vec3(2, 0, 2), 0.5f, 3, 0.5f));
+  }
+  floors.resize(count, floors[0]);
+  return floors;
+}
+
+// The boost based loader that Renderer::ParseObj used before the mapped
+// parser, kept only as a baseline. It allocates a string per token and
+// only reads triangles with all three indices.
+static bool LegacyParseObj(
+  const string& filename, vector<glm::vec3>& vertices, vector<glm::vec2>& uvs, 
+  vector<glm::vec3>& normals, vector<unsigned int>& indices
+) {
+  ifstream f(filename);
+  if (!f.is_open()) return false;
+
+  vector<glm::vec3> vertex_lookup;
+  vector<glm::vec2> uv_lookup;
+  vector<glm::vec3> normal_lookup;
+
+  string line;
+  while (getline(f, line)) {
+    vector<string> tokens;
+    boost::split(tokens, line, boost::is_any_of(" "));
+    if (!tokens.size()) continue;
+
+    string type = tokens[0];
+    if (type == "v") {
+      glm::vec3 vertex;
+      vertex.x = boost::lexical_cast<float>(tokens[1]); 
+      vertex.y = boost::lexical_cast<float>(tokens[2]);
+      vertex.z = boost::lexical_cast<float>(tokens[3]);
+      vertex_lookup.push_back(vertex);
+    } else if (type == "vt") {
+      glm::vec2 uv_coordinate;
+      uv_coordinate.x = boost::lexical_cast<float>(tokens[1]); 
+      uv_coordinate.y = boost::lexical_cast<float>(tokens[2]);
+      uv_lookup.push_back(uv_coordinate);
+    } else if (type == "vn") {
+      glm::vec3 normal;
+      normal.x = boost::lexical_cast<float>(tokens[1]); 
+      normal.y = boost::lexical_cast<float>(tokens[2]);
+      normal.z = boost::lexical_cast<float>(tokens[3]);
+      normal_lookup.push_back(normal);
+    } else if (type == "f") {
+      vector<unsigned int> vertex_ids;
+      vector<unsigned int> uv_ids;
+      vector<unsigned int> normal_ids;
+      for (int i = 1; i < tokens.size(); i++) {
+        string& s = tokens[i];
+        size_t j = s.find_first_of("/", 0);
+        vertex_ids.push_back(boost::lexical_cast<unsigned int>(s.substr(0, j)) - 1); 
+
+        size_t k = s.find_first_of("/", j+1);
+        uv_ids.push_back(boost::lexical_cast<unsigned int>(s.substr(j+1, k-j-1)) - 1); 
+
+        normal_ids.push_back(boost::lexical_cast<unsigned int>(s.substr(k+1)) - 1); 
+      }
+  
+      for (int i = 0; i < 3; i++) { 
+        vertices.push_back(vertex_lookup[vertex_ids[i]]);
+        uvs.push_back(uv_lookup[uv_ids[i]]);
+        normals.push_back(normal_lookup[normal_ids[i]]);
+        indices.push_back(vertices.size()-1);
+      }
+    }
+  }
+  return true;
+}
+
+// Writes a grid of 1M triangles with full v/vt/vn indices, about 75 MB, as
+// an exporter would lay it out.
+static void WriteGridObj(const string& filename, int width, int height) {
+  FILE* f = fopen(filename.c_str(), "w");
+  if (!f) return;
+
+  for (int z = 0; z <= height; z++) 
+    for (int x = 0; x <= width; x++) 
+      fprintf(f, "v %f %f %f\n", x * 0.1f, 0.01f * ((x * z) % 97), z * 0.1f);
+  for (int z = 0; z <= height; z++) 
+    for (int x = 0; x <= width; x++) 
+      fprintf(f, "vt %f %f\n", x / float(width), z / float(height));
+  fprintf(f, "vn 0 1 0\n");
+
+  for (int z = 0; z < height; z++) {
+    for (int x = 0; x < width; x++) {
+      int a = z * (width + 1) + x + 1, b = a + 1, c = a + width + 1, d = c + 1;
+      fprintf(f, "f %d/%d/1 %d/%d/1 %d/%d/1\n", a, a, c, c, b, b);
+      fprintf(f, "f %d/%d/1 %d/%d/1 %d/%d/1\n", b, b, c, c, d, d);
+    }
+  }
+  fclose(f);
+}
+
+// The legacy loader against the mapped parser on one large file, and the
+// mapped parser on one file per worker at once.
+void RunObjParserBenchmarks(BenchmarkRunner& runner) {
+  const string filename = "obj_parse_benchmark.obj";
+  const int num_triangles = 1000000;
+  WriteGridObj(filename, 500, 1000);
+
+  typedef bool (*ParseFunction)(const string&, vector<glm::vec3>&, 
+    vector<glm::vec2>&, vector<glm::vec3>&, vector<unsigned int>&);
+  auto parse = [filename](ParseFunction fn) {
+    vector<glm::vec3> vertices, normals;
+    vector<glm::vec2> uvs;
+    vector<unsigned int> indices;
+    fn(filename, vertices, uvs, normals, indices);
+    DoNotOptimize(indices.size());
+  };
+
+  runner.Run("obj_parse_1m_triangles_legacy", [&](long n) {
+    for (long i = 0; i < n; i++) parse(LegacyParseObj);
+  }, num_triangles);
+
+  runner.Run("obj_parse_1m_triangles_mapped", [&](long n) {
+    for (long i = 0; i < n; i++) parse(Renderer::ParseObj);
+  }, num_triangles);
+
+  shared_ptr<ThreadPool> thread_pool = make_shared<ThreadPool>();
+  vector<function<void()>> tasks(thread_pool->size(), [&]() { 
+    parse(Renderer::ParseObj); 
+  });
+  runner.Run("obj_parse_1m_triangles_concurrent", [&](long n) {
+    for (long i = 0; i < n; i++) thread_pool->Run(tasks);
+  }, double(num_triangles) * tasks.size());
+
+  remove(filename.c_str());
+}
+
+// Benchmarks that only need the CPU side of each subsystem.
+void RunCpuBenchmarks(BenchmarkRunner& runner) {
+  vector< vector<float> > height_map = Terrain::LoadHeightMap("meshes/terrain.data");
+  if (height_map.empty()) {
+    cout << "Run the benchmarks from the repository root." << endl;
+    exit(1);
+  }
+
+  runner.Run("terrain_load_height_map", [](long n) {
+    for (long i = 0; i < n; i++) 
+      DoNotOptimize(Terrain::LoadHeightMap("meshes/terrain.data"));
+  });
+
+  // Clipmaps are too big for the stack.
+  unique_ptr<Clipmap> clipmap(new Clipmap(height_map, 1, false));
+  glm::vec3 center(2000, 0, 2000);
+  clipmap->Update(center);
+
+  runner.Run("clipmap_update_point", [&](long n) {
+    float height;
+    glm::vec3 normal;
+    for (long i = 0; i < n; i++) {
+      clipmap->UpdatePoint(i % (CLIPMAP_SIZE + 1), (i / (CLIPMAP_SIZE + 1)) % (CLIPMAP_SIZE + 1), &height, &normal);
+      DoNotOptimize(height);
+      DoNotOptimize(normal);
+    }
+  });
+
+  // Jumping far away invalidates the whole ring, so each op is a full refill.
+  runner.Run("clipmap_update_full", [&](long n) {
+    for (long i = 0; i < n; i++) 
+      clipmap->Update(center + glm::vec3((i % 2) ? 1000 : 0, 0, 0));
+  }, (CLIPMAP_SIZE + 1) * (CLIPMAP_SIZE + 1));
+
+  runner.Run("clipmap_update_step", [&](long n) {
+    for (long i = 0; i < n; i++) 
+      clipmap->Update(center + glm::vec3(2 * (i % 64), 0, 0));
+  });
+
+  mt19937 rng(42);
+  uniform_real_distribution<float> coord(1900, 2100);
+  vector<glm::vec2> points(4096);
+  for (auto& p : points) p = glm::vec2(coord(rng), coord(rng));
+
+  runner.Run("terrain_get_height", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      const glm::vec2& p = points[i % points.size()];
+      DoNotOptimize(clipmap->GetHeight(p.x, p.y));
+    }
+  });
+
+  // The building only needs the renderer to draw.
+  Building building(nullptr);
+  uniform_real_distribution<float> offset(-5, 25);
+  uniform_real_distribution<float> angle(0, 6.28f);
+  vector<glm::vec3> positions(4096);
+  vector<glm::vec3> directions(4096);
+  for (int i = 0; i < positions.size(); i++) {
+    positions[i] = glm::vec3(1995, 205, 1995) + glm::vec3(offset(rng), offset(rng), offset(rng));
+    float a = angle(rng);
+    directions[i] = glm::vec3(sin(a), 0, cos(a));
+  }
+
+  runner.Run("building_collide", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      glm::vec3 pos = positions[i % positions.size()];
+      glm::vec3 speed(0.1f, -0.1f, 0.1f);
+      bool can_jump = false;
+      BoundingBox box(pos.x - 0.35, pos.y - 1.5, pos.z - 0.35, 0.7, 1.5, 0.7);
+      building.Collide(pos, pos - speed, can_jump, speed, box);
+      DoNotOptimize(pos);
+    }
+  });
+
+  runner.Run("building_point_intersection", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      int j = i % positions.size();
+      DoNotOptimize(building.GetPointIntersection(positions[j], directions[j]));
+    }
+  });
+
+  // Long steps through the building and over the terrain, eight ticks of
+  // running speed each.
+  runner.Run("building_sweep", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      int j = i % positions.size();
+      glm::vec3 pos = positions[j];
+      BoundingBox box(pos.x - 0.35, pos.y - 1.5, pos.z - 0.35, 0.7, 1.5, 0.7);
+      glm::vec3 normal;
+      DoNotOptimize(building.Sweep(box, directions[j] * 8.0f, &normal));
+    }
+  });
+
+  runner.Run("terrain_time_of_impact", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      const glm::vec2& p = points[i % points.size()];
+      glm::vec3 start(p.x, clipmap->GetHeight(p.x, p.y) + 1.0f, p.y);
+      DoNotOptimize(clipmap->GetTimeOfImpact(start, glm::vec3(5, -1, 5)));
+    }
+  });
+
+  // The player inside generated buildings. Collision cost should barely grow
+  // with the number of boxes. Rays test every box, eight at a time.
+  for (int count : { 1000, 100000 }) {
+    Building generated(nullptr);
+    generated.SetFloors(GenerateFloors(count));
+
+    uniform_int_distribution<int> floor(0, count - 1);
+    uniform_real_distribution<float> inside(0, 4);
+    vector<glm::vec3> starts(4096);
+    for (auto& s : starts) {
+      s = generated.floors()[floor(rng)].position + glm::vec3(inside(rng), 1.6f, inside(rng));
+    }
+
+    runner.Run("building_collide_generated_" + to_string(count), [&](long n) {
+      for (long i = 0; i < n; i++) {
+        glm::vec3 pos = starts[i % starts.size()];
+        glm::vec3 speed(0.1f, -0.1f, 0.1f);
+        bool can_jump = false;
+        BoundingBox box(pos.x - 0.35, pos.y - 1.5, pos.z - 0.35, 0.7, 1.5, 0.7);
+        generated.Collide(pos, pos - speed, can_jump, speed, box);
+        DoNotOptimize(pos);
+      }
+    });
+
+    runner.Run("building_point_intersection_generated_" + to_string(count), [&](long n) {
+      for (long i = 0; i < n; i++) {
+        int j = i % starts.size();
+        DoNotOptimize(generated.GetPointIntersection(starts[j], directions[j]));
+      }
+    });
+  }
+
+  // Boxes and spheres dropped on the default building and the terrain. They
+  // settle for a second first, so most steps have resting contacts.
+  shared_ptr<ThreadPool> thread_pool = make_shared<ThreadPool>();
+  shared_ptr<Building> physics_building = make_shared<Building>(nullptr);
+  for (int count : { 1000, 10000, 100000 }) {
+    Physics physics(thread_pool, physics_building, clipmap.get());
+    int side = ceil(sqrt(count));
+    for (int i = 0; i < count; i++) {
+      float x = 2000 + 1.2f * (i % side - side / 2);
+      float z = 2000 + 1.2f * (i / side - side / 2);
+      glm::vec3 position(x, max(clipmap->GetHeight(x, z), 210.0f) + 2.0f * (i % 4), z);
+      if (i % 2) {
+        physics.AddBody(RigidBody(BODY_SPHERE, position, glm::vec3(0.4f), 1.0f));
+      } else {
+        physics.AddBody(RigidBody(BODY_BOX, position, glm::vec3(0.5f), 2.0f));
+      }
+    }
+    physics.Step(SIMULATION_TICK_RATE);
+
+    runner.Run("physics_step_" + to_string(count), [&](long n) {
+      for (long i = 0; i < n; i++) physics.Step();
+    }, count);
+  }
+
+  // From inside the ground floor, looking at the walls.
+  OcclusionBuffer occlusion_buffer;
+  glm::vec3 eye(2000, 207, 2000);
+  glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.3f, -0.1f, 1), glm::vec3(0, 1, 0));
+  glm::mat4 projection = glm::perspective(glm::radians(PLAYER_FOV), 4.0f / 3.0f, NEAR_CLIPPING, FAR_CLIPPING);
+  runner.Run("occlusion_rasterize_building", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      occlusion_buffer.Begin(projection, view);
+      building.RasterizeOccluders(occlusion_buffer);
+    }
+  });
+
+  runner.Run("occlusion_test_box", [&](long n) {
+    for (long i = 0; i < n; i++) {
+      glm::vec3 p = positions[i % positions.size()] + glm::vec3(0, 0, 20);
+      DoNotOptimize(occlusion_buffer.IsVisible(p, p + glm::vec3(2)));
+    }
+  });
+
+  // Frustum culling of scattered boxes around the same view, through the
+  // hierarchy and one by one. Both are counted per box. Picking looks for
+  // the boxes near the view axis, and should cost about the same at any
+  // count.
+  uniform_real_distribution<float> spread(0, 4000);
+  uniform_real_distribution<float> size(0.5f, 3);
+  for (int count : { 100, 1000, 100000 }) {
+    vector<glm::vec3> mins(count), maxs(count);
+    for (int i = 0; i < count; i++) {
+      mins[i] = glm::vec3(spread(rng), 150 + spread(rng) / 40, spread(rng));
+      maxs[i] = mins[i] + glm::vec3(size(rng));
+    }
+
+    Bvh bvh;
+    bvh.Build(mins, maxs);
+    Frustum frustum(projection * view);
+    vector<int> visible;
+    runner.Run("bvh_frustum_query_" + to_string(count), [&](long n) {
+      for (long i = 0; i < n; i++) {
+        visible.clear();
+        bvh.Query(frustum, visible);
+        DoNotOptimize(visible.size());
+      }
+    }, count);
+
+    runner.Run("frustum_linear_" + to_string(count), [&](long n) {
+      for (long i = 0; i < n; i++) {
+        int visible = 0;
+        for (int j = 0; j < count; j++) visible += frustum.Intersects(mins[j], maxs[j]);
+        DoNotOptimize(visible);
+      }
+    }, count);
+
+    Frustum pick(projection * view, 2.0f);
+    runner.Run("bvh_pick_query_" + to_string(count), [&](long n) {
+      for (long i = 0; i < n; i++) {
+        visible.clear();
+        bvh.Query(pick, visible);
+        DoNotOptimize(visible.size());
+      }
+    });
+  }
+
+  RunSoftwareRasterizerBenchmarks(runner, height_map);
+  RunHeightfieldBenchmarks(runner, height_map);
+
+  for (string mesh : { "book_stand", "scroll", "sculpture" }) {
+    runner.Run("obj_parse_" + mesh, [mesh](long n) {
+      for (long i = 0; i < n; i++) {
+        vector<glm::vec3> vertices, normals;
+        vector<glm::vec2> uvs;
+        vector<unsigned int> indices;
+        Renderer::ParseObj("meshes/" + mesh + ".obj", vertices, uvs, normals, indices);
+        DoNotOptimize(indices.size());
+      }
+    });
+  }
+  RunObjParserBenchmarks(runner);
+
+  for (string mesh : { "book_stand", "scroll", "sculpture" }) {
+    vector<glm::vec3> vertices, normals;
+    vector<glm::vec2> uvs;
+    vector<unsigned int> indices;
+    Renderer::ParseObj("meshes/" + mesh + ".obj", vertices, uvs, normals, indices);
+
+    MeshStats stats;
+    runner.Run("mesh_optimize_" + mesh, [&](long n) {
+      for (long i = 0; i < n; i++) {
+        vector<glm::vec3> v = vertices, nn = normals;
+        vector<glm::vec2> uv = uvs;
+        vector<unsigned int> idx = indices;
+        stats = OptimizeMesh(v, uv, nn, idx);
+        DoNotOptimize(idx.size());
+      }
+    }, indices.size() / 3);
+    if (stats.vertices_before > 0) {
+      printf("  %zu -> %zu vertices, ACMR %.3f -> %.3f\n", stats.vertices_before, 
+        stats.vertices_after, stats.acmr_before, stats.acmr_after);
+    }
+
+    // What Renderer::LoadMesh does on the CPU without and with a current
+    // .smesh cache.
+    string source = "meshes/" + mesh + ".obj";
+    string cache = mesh + "_benchmark.smesh";
+    runner.Run("mesh_load_obj_" + mesh, [&](long n) {
+      for (long i = 0; i < n; i++) {
+        vector<glm::vec3> v, nn;
+        vector<glm::vec2> uv;
+        vector<unsigned int> idx;
+        Renderer::ParseObj(source, v, uv, nn, idx);
+        OptimizeMesh(v, uv, nn, idx);
+
+        VertexFormat format;
+        vector<char> packed;
+        PackVertices(MESH_POSITION_ENCODING, &v[0], &uv[0], &nn[0], v.size(), format, packed);
+        DoNotOptimize(packed.size());
+      }
+    });
+
+    vector<glm::vec3> v = vertices, nn = normals;
+    vector<glm::vec2> uv = uvs;
+    vector<unsigned int> idx = indices;
+    MeshStats mesh_stats = OptimizeMesh(v, uv, nn, idx);
+
+    VertexFormat format;
+    vector<char> packed;
+    PackVertices(MESH_POSITION_ENCODING, &v[0], &uv[0], &nn[0], v.size(), format, packed);
+    printf("  vertex buffer %zu -> %zu bytes\n", 
+      v.size() * (2 * sizeof(glm::vec3) + sizeof(glm::vec2)), packed.size());
+
+    SmeshFile::Write(cache, source, format, packed, idx, mesh_stats);
+    runner.Run("mesh_load_smesh_" + mesh, [&](long n) {
+      for (long i = 0; i < n; i++) {
+        SmeshFile smesh;
+        if (smesh.Open(cache, source, MESH_POSITION_ENCODING)) 
+          DoNotOptimize(smesh.indices()[0]);
+      }
+    });
+    remove(cache.c_str());
+  }
+}
+
+// Benchmarks that upload to or draw with GL. They need a context, which
+// can be headless (see --headless).
+void RunGlBenchmarks(BenchmarkRunner& runner) {
+  static IoC::Container& container = IoC::Container::Get();
+  container.RegisterInstance<GameState, GameState>();
+  container.RegisterInstance<Renderer, Renderer>();
+  container.RegisterInstance<TextEditor, TextEditor, GameState, Renderer>();
+  container.RegisterInstance<Building, Building, Renderer>();
+  container.RegisterInstance<Plotter, Plotter, GameState, Renderer, TextEditor>();
+
+  shared_ptr<GameState> game_state = container.Resolve<GameState>();
+  shared_ptr<Renderer> renderer = container.Resolve<Renderer>();
+  shared_ptr<TextEditor> text_editor = container.Resolve<TextEditor>();
+  shared_ptr<Building> building = container.Resolve<Building>();
+  shared_ptr<Plotter> plotter = container.Resolve<Plotter>();
+
+  vector< vector<float> > height_map = Terrain::LoadHeightMap("meshes/terrain.data");
+  unique_ptr<Clipmap> clipmap(new Clipmap(height_map, 1));
+  glm::vec3 center(2000, 0, 2000);
+  runner.Run("clipmap_update_full_upload", [&](long n) {
+    for (long i = 0; i < n; i++) 
+      clipmap->Update(center + glm::vec3((i % 2) ? 1000 : 0, 0, 0));
+    glFinish();
+  }, (CLIPMAP_SIZE + 1) * (CLIPMAP_SIZE + 1));
+
+  // The same terrain drawn with as many clipmap levels as the far plane
+  // needs, and ray cast then composited. Level L reaches about 100 * 2^(L-1)
+  // meters from the center.
+  renderer->CreateFramebuffer("benchmark screen", WINDOW_WIDTH, WINDOW_HEIGHT);
+  Shader terrain_shader("terrain", "v_terrain", "f_terrain", "g_terrain");
+  Player player;
+  vector< unique_ptr<Clipmap> > levels;
+  for (int level = 1; level <= 7; level++) {
+    levels.emplace_back(new Clipmap(height_map, level));
+    levels.back()->Update(player.position);
+  }
+
+  shared_ptr<ThreadPool> thread_pool = make_shared<ThreadPool>();
+  HeightfieldRenderer heightfield(thread_pool, height_map);
+  SoftwareFramebuffer framebuffer;
+  framebuffer.Resize(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+  glm::mat4 view = TerrainBenchmarkView();
+  for (float far : kTerrainFarPlanes) {
+    glm::mat4 projection = TerrainBenchmarkProjection(far);
+    int num_levels = 1;
+    while (num_levels < levels.size() && 100 * (1 << (num_levels - 1)) < far) num_levels++;
+
+    CommandList commands;
+    commands.UseProgram(&terrain_shader);
+    for (int i = 0; i < num_levels; i++) {
+      levels[i]->Render(commands, player.position, &terrain_shader, projection, view, i == 0);
+    }
+    commands.Clear();
+
+    runner.Run("terrain_clipmap_far_" + to_string(int(far)), [&](long n) {
+      renderer->SetFBO("benchmark screen");
+      for (long i = 0; i < n; i++) {
+        renderer->Clear(0, 0, 0);
+        commands.Execute();
+      }
+      glFinish();
+    });
+
+    runner.Run("terrain_heightfield_far_" + to_string(int(far)), [&](long n) {
+      renderer->SetFBO("benchmark screen");
+      for (long i = 0; i < n; i++) {
+        renderer->Clear(0, 0, 0);
+        framebuffer.Clear(glm::vec3(0));
+        heightfield.Render(framebuffer, projection, view);
+        renderer->CompositePixels("benchmark screen", &framebuffer.color[0], &framebuffer.depth[0]);
+      }
+      glFinish();
+    });
+  }
+
+  runner.Run("renderer_load_mesh", [&](long n) {
+    for (long i = 0; i < n; i++) renderer->LoadMesh("sculpture");
+    glFinish();
+  });
+
+  renderer->CreateFramebuffer("benchmark plot", 1024, 1024);
+  runner.Run("plotter_update_plot", [&](long n) {
+    for (long i = 0; i < n; i++) plotter->UpdatePlot("files/plot1.txt", "benchmark plot");
+    glFinish();
+  });
+
+  // The constructor loads files/entities.txt, creating a plot per entry.
+  runner.Run("entity_manager_load", [&](long n) {
+    for (long i = 0; i < n; i++) 
+      EntityManager(game_state, renderer, text_editor, building, plotter);
+    glFinish();
+  });
+}
+
+int main(int argc, char** argv) {
+  vector<string> args = GameState::ParseOptions(argc, argv);
+
+  string filter;
+  string output = BENCHMARK_RESULTS_FILE;
+  string baseline = BENCHMARK_BASELINE_FILE;
+  double threshold = BENCHMARK_REGRESSION_THRESHOLD;
+  double min_time = 0.2;
+  bool gl = false;
+  bool update_baseline = false;
+  for (int i = 0; i < args.size(); i++) {
+    if (args[i] == "--gl") {
+      gl = true;
+    } else if (args[i] == "--update-baseline") {
+      update_baseline = true;
+    } else if (i + 1 < args.size()) {
+      if (args[i] == "--filter") filter = args[++i];
+      else if (args[i] == "--output") output = args[++i];
+      else if (args[i] == "--baseline") baseline = args[++i];
+      else if (args[i] == "--threshold") threshold = atof(args[++i].c_str());
+      else if (args[i] == "--min-time") min_time = atof(args[++i].c_str());
+    }
+  }
+
+  // Headless mode implies a GL context is wanted.
+  if (GameState::options().headless) gl = true;
+
+  // The eight wide box tests depend on it, so results are only comparable
+  // between builds with the same instruction set.
+#if defined(__AVX__)
+  cout << "SIMD: AVX" << endl;
+#elif defined(__SSE2__)
+  cout << "SIMD: SSE2 (configure with -DSIBYL_NATIVE=ON for AVX)" << endl;
+#else
+  cout << "SIMD: none" << endl;
+#endif
+
+  BenchmarkRunner runner(filter, min_time);
+  RunCpuBenchmarks(runner);
+  if (gl) RunGlBenchmarks(runner);
+
+  runner.WriteJson(output);
+  if (update_baseline) {
+    runner.WriteJson(baseline);
+    cout << "Updated " << baseline << endl;
+    return 0;
+  }
+
+  int regressions = runner.Compare(baseline, threshold);
+  if (regressions > 0) {
+    cout << regressions << " benchmarks regressed by more than " 
+         << threshold * 100 << "%" << endl;
+    return 1;
+  }
+  return 0;
+}
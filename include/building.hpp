@@ -20,6 +20,9 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include "renderer.hpp"
+#include "software_renderer.hpp"
+#include "occlusion_buffer.hpp"
+#include "bvh.hpp"
 #include "text_editor.hpp"
 #include "shaders.h"
 #include "config.h"
@@ -93,6 +96,18 @@ class Building {
   std::string opened_document_;
 
   std::vector<Floor> floors_;
+  bool dirty_ = true;
+
+  // Shared by culling and collision. Floor i is indices [36i, 36i + 36) of
+  // the baked mesh.
+  Bvh floor_bvh_;
+
+  // The floor boxes as structure of arrays, padded to a multiple of eight,
+  // for the vectorized ray test.
+  std::vector<float> floor_min_[3];
+  std::vector<float> floor_max_[3];
+  std::vector<int> visible_floors_;
+  std::vector<glm::ivec2> floor_ranges_;
   GLuint intersect_fb_;
 
  protected:
@@ -101,19 +116,35 @@ class Building {
   Shader shader2_;
 
   void CreateFloor(glm::vec3, float, bool);
+  void CreateMesh();
+  void BuildBounds();
   void DrawFloor(glm::mat4, glm::mat4, glm::vec3);
-  void CollideFloor(Floor&, glm::vec3&, glm::vec3, bool&, glm::vec3&, BoundingBox&);
+  void CollideFloor(const Floor&, glm::vec3&, glm::vec3, bool&, glm::vec3&, BoundingBox&) const;
 
  public:
   Building(shared_ptr<Renderer>);
 
   void Draw(glm::mat4, glm::mat4, glm::vec3);
-  void Collide(glm::vec3&, glm::vec3, bool&, glm::vec3&, BoundingBox&);
-  void DryCollide(vec3&, BoundingBox&);
-  PointIntersection GetPointIntersection(Floor& f, vec3, vec3);
-  PointIntersection GetPointIntersection(vec3, vec3);
-
-  std::vector<Floor>& floors() { return floors_; }
+  void Draw(SoftwareRenderer&);
+  void Record(CommandList&, glm::mat4, glm::mat4);
+  void RasterizeOccluders(OcclusionBuffer&);
+  void Collide(glm::vec3&, glm::vec3, bool&, glm::vec3&, BoundingBox&) const;
+  void DryCollide(vec3&, BoundingBox&) const;
+
+  // Time of impact in [0, 1] of the box moving by the displacement, and the
+  // normal of the face it hits. Returns 1 if nothing is hit. Floors the box
+  // already overlaps are ignored, Collide pushes the box out of those.
+  float Sweep(const BoundingBox&, vec3, vec3*) const;
+  PointIntersection GetPointIntersection(const Floor& f, vec3, vec3) const;
+  PointIntersection GetPointIntersection(vec3, vec3) const;
+
+  // The floor boxes are the items. The queries above read it from the
+  // simulation and physics threads, so it is only rebuilt by SetFloors,
+  // which must run before the simulation starts.
+  const Bvh& floor_bvh() const { return floor_bvh_; }
+
+  const std::vector<Floor>& floors() const { return floors_; }
+  void SetFloors(std::vector<Floor>);
 };
 
 } // End of namespace.
@@ -0,0 +1,66 @@
+#ifndef _BVH_HPP_
+#define _BVH_HPP_
+
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+#include "metrics.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// The six planes of a view frustum, facing inwards. They are not
+// normalized, which is enough for the sign tests below.
+struct Frustum {
+  glm::vec4 planes[6];
+
+  Frustum() {}
+  Frustum(const glm::mat4&);
+
+  // The prism around the view axis where clip space x and y are within the
+  // given distance and z is positive. Used to look for objects near the
+  // center of the screen.
+  Frustum(const glm::mat4&, float);
+
+  bool Intersects(const glm::vec3&, const glm::vec3&) const;
+};
+
+// Eight children per node, with their bounds stored as structure of arrays
+// so a frustum plane is tested against all of them with one AVX compare (or
+// two SSE compares). Leaves are items: child ~i refers to item i. Unused
+// slots have inverted bounds, so they fail every test.
+struct BvhNode {
+  float min_x[8], min_y[8], min_z[8];
+  float max_x[8], max_y[8], max_z[8];
+  int children[8];
+};
+
+// Static bounding volume hierarchy over axis aligned boxes. It is rebuilt
+// from scratch when the boxes change, so it suits scenery that rarely
+// moves.
+class Bvh {
+  std::vector<BvhNode> nodes_;
+  std::vector<glm::vec3> mins_;
+  std::vector<glm::vec3> maxs_;
+  std::vector<int> items_;
+
+  int BuildNode(int, int);
+  void Split(int, int, int, std::vector<glm::ivec2>&);
+
+ public:
+  void Build(const std::vector<glm::vec3>&, const std::vector<glm::vec3>&);
+
+  // Appends the items whose boxes intersect the frustum.
+  void Query(const Frustum&, std::vector<int>&) const;
+
+  // Appends the items whose boxes overlap or touch the box.
+  void Query(const glm::vec3&, const glm::vec3&, std::vector<int>&) const;
+
+  int size() const { return mins_.size(); }
+  const std::vector<glm::vec3>& mins() const { return mins_; }
+  const std::vector<glm::vec3>& maxs() const { return maxs_; }
+};
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _CAMERA_PATH_HPP_
+#define _CAMERA_PATH_HPP_
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "config.h"
+
+namespace Sibyl {
+
+struct CameraKeyframe {
+  double time;
+  glm::vec3 position;
+  float h_angle;
+  float v_angle;
+};
+
+// Scripted camera flight through a list of keyframes, interpolated with a
+// Catmull-Rom spline. The file has one keyframe per line:
+//
+// <time> <x> <y> <z> <h angle> <v angle>
+//
+// Lines starting with # are ignored.
+class CameraPath {
+  std::vector<CameraKeyframe> keyframes_;
+
+ public:
+  CameraPath() {}
+
+  void Load(const std::string&);
+  CameraKeyframe Evaluate(double);
+
+  bool empty() { return keyframes_.empty(); }
+  double duration() { return (keyframes_.empty()) ? 0 : keyframes_.back().time; }
+};
+
+} // End of namespace.
+
+#endif
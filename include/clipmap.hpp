@@ -17,6 +17,8 @@
 #include <glm/gtx/rotate_vector.hpp> 
 #include "shaders.h"
 #include "subregion.hpp"
+#include "command_list.hpp"
+#include "occlusion_buffer.hpp"
 #include "config.h"
 
 namespace Sibyl {
@@ -39,16 +41,25 @@ class Clipmap {
   unsigned int level_;
   HeightBuffer height_buffer_;
 
-  GLuint vertex_buffer_;
-  GLuint uv_buffer_;
-  GLuint element_buffer_;
+  // Shared by the subregions, which only bring their element buffers.
+  GLuint vertex_array_ = 0;
+  GLuint vertex_buffer_ = 0;
+  GLuint uv_buffer_ = 0;
+  GLuint element_buffer_ = 0;
 
-  GLuint height_texture_;
-  GLuint normals_texture_;
+  GLuint height_texture_ = 0;
+  GLuint normals_texture_ = 0;
   GLuint tangents_texture_;
   GLuint bitangents_texture_;
 
   glm::ivec2 top_left_;
+
+  // Height range of the whole map, including the flat ground around it.
+  float min_height_ = MAX_HEIGHT / 2;
+  float max_height_ = MAX_HEIGHT / 2;
+
+  // Bound on the gradient of GetHeight, for conservative advancement.
+  float max_slope_ = 0;
   int num_invalid_ = (CLIPMAP_SIZE+1) * (CLIPMAP_SIZE+1);
   glm::vec3 vertices_[(CLIPMAP_SIZE+1) * (CLIPMAP_SIZE+1)];
 
@@ -61,17 +72,22 @@ class Clipmap {
   glm::ivec2 GridToBufferCoordinates(glm::ivec2);
   glm::ivec2 BufferToGridCoordinates(glm::ivec2);
   void InvalidateOuterBuffer(glm::ivec2);
+  bool IsOccluded(int, glm::ivec2, float, float, const OcclusionBuffer*);
+  void CreateBuffers();
 
  public:
   Clipmap();
-  Clipmap(vector< vector<float> >, unsigned int);
+  Clipmap(vector< vector<float> >, unsigned int, bool gpu = true);
 
-  void Render(glm::vec3, Shader*, glm::mat4, glm::mat4, bool);
-  void RenderWater(glm::vec3, Shader*, glm::mat4, glm::mat4, glm::vec3, bool);
-  void Init();
+  void Render(CommandList&, glm::vec3, Shader*, glm::mat4, glm::mat4, bool, const OcclusionBuffer* = nullptr);
+  void RenderWater(CommandList&, glm::vec3, Shader*, glm::mat4, glm::mat4, glm::vec3, GLfloat, bool, const OcclusionBuffer* = nullptr);
+  void Init(bool);
   void Update(glm::vec3);
   void UpdatePoint(int, int, float*, glm::vec3*);
   float GetGridHeight(float, float);
+  float GetHeight(float, float);
+  void GetHeights(const glm::vec3*, int, float*);
+  float GetTimeOfImpact(glm::vec3, glm::vec3);
 };
 
 } // End of namespace.
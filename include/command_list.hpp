@@ -0,0 +1,93 @@
+#ifndef _COMMAND_LIST_HPP_
+#define _COMMAND_LIST_HPP_
+
+#include <vector>
+#include <functional>
+#include <cstddef>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "shaders.h"
+#include "frame_arena.hpp"
+#include "metrics.hpp"
+
+namespace Sibyl {
+
+enum CommandType {
+  CMD_USE_PROGRAM = 0,
+  CMD_UNIFORM_MAT4,
+  CMD_UNIFORM_MAT3,
+  CMD_UNIFORM_VEC3,
+  CMD_UNIFORM_FLOAT,
+  CMD_UNIFORM_INT,
+  CMD_UNIFORM_IVEC2,
+  CMD_BIND_TEXTURE,
+  CMD_BIND_TEXTURE_UNIT,
+  CMD_BIND_VERTEX_ARRAY,
+  CMD_DRAW_ELEMENTS,
+  CMD_DRAW_ARRAYS,
+  CMD_ENABLE,
+  CMD_DISABLE,
+  CMD_CLEAR,
+  CMD_CALLBACK
+};
+
+struct Command {
+  CommandType type;
+  Shader* shader;
+  const char* name;
+  GLuint id;
+  GLint a;
+  GLint b;
+  size_t offset;
+};
+
+// A list of draw commands that can be recorded on any thread and replayed 
+// later on the thread that owns the GL context. Recording only stores 
+// values: uniform locations are resolved and GL is called during Execute.
+// Uniform and sampler names must outlive the list (string literals).
+//
+// Lists recorded every frame take their storage from the frame arena of the
+// render queue, so they must be executed before it is reset.
+class CommandList {
+  Shader* shader_ = nullptr;
+  std::vector<Command, ArenaAllocator<Command>> commands_;
+  std::vector<float, ArenaAllocator<float>> data_;
+  std::vector<std::function<void()>, ArenaAllocator<std::function<void()>>> callbacks_;
+
+  void Push(CommandType, const char* = nullptr, GLuint = 0, GLint = 0, GLint = 0, size_t = 0);
+  size_t PushData(const float*, int);
+
+ public:
+  CommandList(FrameArena* arena = nullptr)
+    : commands_(ArenaAllocator<Command>(arena)),
+      data_(ArenaAllocator<float>(arena)),
+      callbacks_(ArenaAllocator<std::function<void()>>(arena)) {
+  }
+
+  void UseProgram(Shader*);
+  void Uniform(const char*, const glm::mat4&);
+  void Uniform(const char*, const glm::mat3&);
+  void Uniform(const char*, const glm::vec3&);
+  void Uniform(const char*, GLfloat);
+  void Uniform(const char*, GLint);
+  void Uniform(const char*, const glm::ivec2&);
+  void BindTexture(const char*, GLuint, GLenum = GL_TEXTURE_2D);
+  void BindTexture(const char*, GLuint, GLenum, int);
+  void BindVertexArray(GLuint);
+  void DrawElements(GLuint, GLsizei, GLint = 0);
+  void DrawArrays(GLsizei);
+  void Enable(GLenum);
+  void Disable(GLenum);
+  void Clear();
+  void Callback(std::function<void()>);
+
+  void Execute();
+  void Reset();
+
+  size_t size() { return commands_.size(); }
+  bool empty() { return commands_.empty(); }
+};
+
+} // End of namespace.
+
+#endif
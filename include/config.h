@@ -26,11 +26,46 @@
 #define RIGHT_BORDER  1
 #define GRAVITY 0.016
 #define JUMP_FORCE 0.016
+#define SIMULATION_TICK_RATE 60
 #define DEBOUNCE_DELAY 0.2
 #define TYPE_DELAY 0.2
 #define TYPE_SPEED 0.05
 #define LINE_HEIGHT 18
 #define FULLSCREEN false
+#define PROFILER_BUFFER_SIZE 65536
+#define PROFILER_TRACE_FILE "trace.json"
+#define METRICS_CSV_FILE "metrics.csv"
+#define HEADLESS_FRAMES 600
+#define BENCHMARK_FILE "benchmark.json"
+#define BENCHMARK_CAMERA_PATH "benchmarks/flyover.path"
+#define BENCHMARK_WARMUP_FRAMES 60
+#define BENCHMARK_REPETITIONS 5
+#define BENCHMARK_RESULTS_FILE "benchmark_results.json"
+#define BENCHMARK_BASELINE_FILE "benchmarks/baseline.json"
+#define BENCHMARK_REGRESSION_THRESHOLD 0.1
+#define SOFTWARE_TILE_SIZE 64
+#define SOFTWARE_MAX_VARYINGS 8
+#define SOFTWARE_GUARD_BAND 4.0f
+#define SOFTWARE_CHUNK_SIZE 1024
+#define HEIGHTFIELD_STRIP_WIDTH 16
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 160
+#define OCCLUSION_MIN_OCCLUDER_AREA 4.0f
+#define OCCLUSION_GUARD_BAND 2.0f
+#define RAY_TEST_MARGIN 0.001f
+#define TERRAIN_MIN_ADVANCE 0.01f
+#define TERRAIN_MAX_ADVANCE_STEPS 64
+#define SIMULATION_MAX_STEP_TICKS 8
+#define PHYSICS_SOLVER_ITERATIONS 4
+#define PHYSICS_RESTITUTION 0.2f
+#define PHYSICS_FRICTION 0.9f
+#define PHYSICS_DAMPING 0.99f
+#define PHYSICS_HEIGHT_BATCH 64
+#define FRAME_ARENA_SIZE (1 << 20)
+#define MESH_CACHE_SIZE 16
+#define MESH_OVERDRAW_THRESHOLD 1.05f
+#define SMESH_VERSION 2
+#define MESH_POSITION_ENCODING POSITION_UNORM16
 
 namespace Sibyl {
 
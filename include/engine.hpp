@@ -9,6 +9,8 @@
 #include <memory>
 #include <thread>
 #include <chrono>
+#include <iomanip>
+#include <sstream>
 
 #include "game_state.hpp"
 #include "terrain.hpp"
@@ -17,6 +19,13 @@
 #include "building.hpp"
 #include "texture.hpp"
 #include "renderer.hpp"
+#include "software_renderer.hpp"
+#include "heightfield_renderer.hpp"
+#include "occlusion_buffer.hpp"
+#include "thread_pool.hpp"
+#include "simulation.hpp"
+#include "profiler.hpp"
+#include "metrics.hpp"
 #include "shaders.h"
 #include "config.h"
 
@@ -31,6 +40,18 @@ class Engine {
   double pressed_backspace_at_ = 0.0;
   double pressed_enter_at_ = 0.0;
   GameMode game_mode_ = FREE;
+  bool dump_render_queue_ = false;
+  bool show_metrics_ = false;
+  vector<string> hud_lines_;
+  vector<double> benchmark_frame_times_;
+  double benchmark_start_ = 0;
+
+  // Per pass totals of a benchmark run. They are added up every frame since
+  // the profiler ring only holds the events of the last few thousand frames.
+  uint64_t benchmark_events_read_ = 0;
+  vector<ProfileEvent> benchmark_events_;
+  vector<pair<string, double>> benchmark_pass_times_[2];
+  bool benchmark_events_lost_ = false;
 
   Player player_;
 
@@ -47,8 +68,18 @@ class Engine {
   shared_ptr<TextEditor> text_editor_;
   shared_ptr<Terrain> terrain_;
   shared_ptr<SkyDome> sky_dome_;
+  shared_ptr<ThreadPool> thread_pool_;
+  shared_ptr<Simulation> simulation_;
+  shared_ptr<Physics> physics_;
+  shared_ptr<SoftwareRenderer> software_renderer_;
+  shared_ptr<HeightfieldRenderer> heightfield_renderer_;
+  SoftwareFramebuffer heightfield_framebuffer_;
+  OcclusionBuffer occlusion_buffer_;
+  const OcclusionBuffer* frame_occlusion_buffer_ = nullptr;
+  vector<function<void()>> record_tasks_;
 
   GLuint LoadTexture(const std::string&, const std::string&);
+  void CreateBodies(int);
   void Move(Direction, float);
   void CreateWindow();
   void CreateEntities();
@@ -56,12 +87,15 @@ class Engine {
   void ProcessTerminalInput();
   void ProcessTextInput();
   void Render();
-  void UpdateForces();
+  void RenderSoftware();
+  void DrawMetrics();
+  void AddBenchmarkPassTimes();
+  bool WriteBenchmarkReport();
 
  public:
-  Engine(shared_ptr<GameState>, shared_ptr<Renderer>, shared_ptr<EntityManager>, shared_ptr<TextEditor>);
+  Engine(shared_ptr<GameState>, shared_ptr<Renderer>, shared_ptr<EntityManager>, shared_ptr<TextEditor>, shared_ptr<ThreadPool>);
 
-  void Run();
+  int Run();
 };
 
 } // End of namespace.
@@ -25,6 +25,7 @@
 #include "renderer.hpp"
 #include "text_editor.hpp"
 #include "building.hpp"
+#include "bvh.hpp"
 #include "terrain.hpp"
 #include "plotter.hpp"
 #include "shaders.h"
@@ -101,8 +102,28 @@ class EntityManager {
   vector<Scroll> scrolls_;
   vector<Plot> plots_;
 
+  // Per mesh instance lists, reused across frames to avoid reallocations.
+  unordered_map<string, vector<MeshInstance>> instances_;
+
+  // Items are numbered scrolls first, then objects, then plots. The
+  // hierarchy is rebuilt when entities are added, removed or placed.
+  Bvh bvh_;
+  bool bvh_dirty_ = true;
+  vector<int> visible_;
+  vector<int> visible_plots_;
+  vector<int> pick_candidates_;
+  int highlighted_item_ = -1;
+
   int CreatePlot(const string&, vec3, GLfloat);
   string GetNewFilename(const string&);
+  mat4 GetModelMatrix(const Object&);
+  void GetBounds(const string&, const mat4&, vec3*, vec3*);
+  bool IsOccluded(const string&, const mat4&, const OcclusionBuffer*);
+  Object* GetItem(int);
+  void BuildBvh();
+  void QueryVisible();
+  void Pick(const mat4&);
+  void CollectInstances(const OcclusionBuffer* = nullptr);
   void Init();
   void Load(const string&);
   void Save(const string&);
@@ -119,9 +140,14 @@ class EntityManager {
   void Update();
   void Interact(bool);
   void Draw();
+  void Submit(RenderQueue&, const OcclusionBuffer* = nullptr);
+  void RasterizeOccluders(OcclusionBuffer&);
+  void Draw(SoftwareRenderer&);
   void DrawCreateObject();
   void Collide(glm::vec3&, glm::vec3, bool&, glm::vec3&);
+  void Move(glm::vec3&, glm::vec3, bool&, glm::vec3&);
   void set_terrain(shared_ptr<Terrain> terrain) { terrain_ = terrain; } 
+  shared_ptr<Building> building() { return building_; }
 };
 
 } // End of namespace.
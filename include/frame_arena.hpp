@@ -0,0 +1,114 @@
+#ifndef _FRAME_ARENA_HPP_
+#define _FRAME_ARENA_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "metrics.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Linear allocator for data that only lives until the end of the frame.
+// Allocating bumps an offset, so it is safe from any thread, and nothing is
+// freed until Reset. When a frame needs more than the buffer holds, the
+// extra blocks come from the heap and the buffer grows at the next Reset,
+// so steady state frames never touch the heap.
+class FrameArena {
+  struct Destructor {
+    void (*destroy)(void*);
+    void* object;
+    Destructor* next;
+  };
+
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+  std::atomic<size_t> offset_;
+  std::atomic<Destructor*> destructors_;
+
+  // Heap blocks taken when the buffer was full.
+  std::mutex mutex_;
+  std::vector<void*> overflow_;
+  size_t overflow_bytes_ = 0;
+
+  template <typename T>
+  static void Destroy(void* object) { static_cast<T*>(object)->~T(); }
+
+ public:
+  FrameArena(size_t = FRAME_ARENA_SIZE);
+  FrameArena(FrameArena const&) = delete;
+  void operator=(FrameArena const&) = delete;
+  ~FrameArena();
+
+  void* Allocate(size_t, size_t = alignof(std::max_align_t));
+
+  // Constructs an object that is destroyed at the next Reset.
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    T* object = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      Destructor* d = static_cast<Destructor*>(Allocate(sizeof(Destructor), alignof(Destructor)));
+      d->destroy = &Destroy<T>;
+      d->object = object;
+      d->next = destructors_.load(std::memory_order_relaxed);
+      while (!destructors_.compare_exchange_weak(d->next, d)) {}
+    }
+    return object;
+  }
+
+  // Null terminated copy of the string.
+  const char* Copy(const std::string&);
+
+  // Destroys the objects made with New, newest first, and frees everything.
+  // No other thread may be allocating.
+  void Reset();
+
+  size_t capacity() const { return capacity_; }
+  size_t used() const { return offset_.load(std::memory_order_relaxed); }
+};
+
+// Standard allocator on top of an arena. Deallocating is a no-op, so
+// containers that grow waste the blocks they leave behind until the arena
+// is reset. Without an arena it falls back to the heap, so the same
+// container type serves both per frame and long lived data.
+template <typename T>
+class ArenaAllocator {
+  template <typename U> friend class ArenaAllocator;
+  FrameArena* arena_;
+
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  ArenaAllocator(FrameArena* arena = nullptr) : arena_(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {}
+
+  T* allocate(size_t n) {
+    if (!arena_) return static_cast<T*>(::operator new(n * sizeof(T)));
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* p, size_t) {
+    if (!arena_) ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena_; }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena_; }
+};
+
+} // End of namespace.
+
+#endif
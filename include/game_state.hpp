@@ -15,6 +15,11 @@
 #include <memory>
 #include <string>
 #include <queue>
+#include <vector>
+#include <cstdlib>
+#include <set>
+#include "input_recorder.hpp"
+#include "camera_path.hpp"
 #include "config.h"
 
 using namespace std;
@@ -36,11 +41,21 @@ enum Direction {
   DOWN
 };
 
-struct KeyPress {
-  int key; 
-  int scancode; 
-  int action; 
-  int mods;
+// Command line options shared by main and the tools.
+struct Options {
+  bool headless = false;
+  bool benchmark = false;
+  bool software = false;
+  bool heightfield = false;
+  bool occlusion_culling = true;
+  bool keep_mesh_data = false;
+  int frames = HEADLESS_FRAMES;
+  int physics_bodies = 0;
+  int max_frame_allocations = -1;
+  string record;
+  string replay;
+  string camera_path;
+  string output = BENCHMARK_FILE;
 };
 
 struct Camera {
@@ -64,6 +79,9 @@ class GameState {
   static queue<KeyPress> input_queue_;
   static void PressCharCallback(GLFWwindow*, unsigned int);
   static void PressKeyCallback(GLFWwindow*, int, int, int, int);
+  static Options options_;
+  static set<int> keys_down_;
+  static FrameInput frame_input_;
 
   GLFWwindow* window_;
   int window_width_ = WINDOW_WIDTH;
@@ -74,6 +92,11 @@ class GameState {
   glm::vec3 front_;
 
   GameMode mode_ = FREE;
+  int frame_ = 0;
+  double time_ = 0.0;
+  bool replay_finished_ = false;
+  InputRecorder recorder_;
+  CameraPath camera_path_;
   mat4 projection_matrix_;
   mat4 view_matrix_;
 
@@ -83,7 +106,16 @@ class GameState {
   int width() { return window_width_; }
   int height() { return window_height_; }
 
+  static vector<string> ParseOptions(int, char**);
+  static Options& options() { return options_; }
+
   void Init();
+  void BeginFrame();
+  void SwapBuffers();
+  bool ShouldClose();
+  bool IsKeyDown(int);
+  void GetMouseDelta(double*, double*);
+  bool FollowCameraPath();
   bool ReadBuffer(string*);
   bool ReadKeyPress(KeyPress*);
   bool ChangeMode(GameMode);
@@ -93,6 +125,10 @@ class GameState {
   void Look(Direction, GLfloat);
   void Jump();
 
+  bool headless() { return options_.headless; }
+  int frame() { return frame_; }
+  double time() { return time_; }
+  bool deterministic() { return !options_.replay.empty() || !camera_path_.empty(); }
   Camera camera() { return camera_; }
   GameMode mode() { return mode_; }
   mat4 projection_matrix() { return projection_matrix_; }
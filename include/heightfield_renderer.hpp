@@ -0,0 +1,67 @@
+#ifndef _HEIGHTFIELD_RENDERER_HPP_
+#define _HEIGHTFIELD_RENDERER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "thread_pool.hpp"
+#include "software_rasterizer.hpp"
+#include "metrics.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Draws the terrain by casting one ray per pixel against the height map
+// (see --heightfield), so its cost depends on the resolution instead of the
+// view distance. Rays skip empty space with a max mip pyramid, where each
+// cell holds the highest point below it. The surface is the same pair of
+// triangles per tile as Clipmap::GetHeight and the ground outside the map
+// is flat, like Clipmap::GetGridHeight.
+//
+// The screen is split into strips of columns that are handed out to the
+// thread pool. Rays are traversed one at a time, then four adjacent pixels
+// are shaded, depth tested and written together.
+class HeightfieldRenderer {
+  struct Hit {
+    float t;
+    float slope_x;
+    float slope_z;
+  };
+
+  std::shared_ptr<ThreadPool> thread_pool_;
+  int size_ = 0;
+  std::vector<float> heights_;
+  std::vector< std::vector<float> > max_mips_;
+  std::vector<int> mip_sizes_;
+  std::atomic<int> next_strip_;
+
+  // The view of the current Render, read by the strip workers. The workers
+  // only capture this and are built once, so running them does not allocate.
+  struct View {
+    SoftwareFramebuffer* framebuffer = nullptr;
+    float near, far;
+    float p22, p32, p23, p33;
+    glm::vec3 camera, dx, dy, corner, grid_scale, origin;
+  };
+  View view_;
+  std::vector<std::function<void()>> strip_workers_;
+
+  void BuildMaxMips();
+  void RenderStrips();
+  bool Intersect(const glm::vec3&, const glm::vec3&, float, float, Hit*, int*) const;
+
+ public:
+  HeightfieldRenderer(std::shared_ptr<ThreadPool>, const std::vector< std::vector<float> >&);
+
+  // Composites the terrain into the framebuffer, keeping the pixels that are
+  // already closer. The depth matches the GL depth buffer for the same
+  // matrices. The projection must be a symmetric perspective projection.
+  void Render(SoftwareFramebuffer&, const glm::mat4&, const glm::mat4&);
+};
+
+} // End of namespace.
+
+#endif
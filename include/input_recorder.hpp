@@ -0,0 +1,49 @@
+#ifndef _INPUT_RECORDER_HPP_
+#define _INPUT_RECORDER_HPP_
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "config.h"
+
+namespace Sibyl {
+
+struct KeyPress {
+  int key; 
+  int scancode; 
+  int action; 
+  int mods;
+};
+
+// Everything the game reads from the window during one frame.
+struct FrameInput {
+  double time = 0.0;
+  double mouse_x = 0.0;
+  double mouse_y = 0.0;
+  std::vector<KeyPress> keys;
+  std::string chars;
+};
+
+// Reads and writes input recordings. The file has one line per frame:
+//
+// <time> <mouse x> <mouse y> <n> [<key> <scancode> <action> <mods>]*n <m> [<char code>]*m
+class InputRecorder {
+  std::ofstream out_;
+  std::ifstream in_;
+
+ public:
+  InputRecorder() {}
+
+  void OpenForWriting(const std::string&);
+  void OpenForReading(const std::string&);
+  void Write(const FrameInput&);
+  bool Read(FrameInput*);
+
+  bool recording() { return out_.is_open(); }
+  bool replaying() { return in_.is_open(); }
+};
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _MAPPED_FILE_HPP_
+#define _MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <string>
+
+namespace Sibyl {
+
+// Read only view of a whole file, mapped into memory so it can be parsed in
+// place without copying it into a buffer first. The data is not null
+// terminated.
+class MappedFile {
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool open_ = false;
+
+ public:
+  MappedFile(const std::string&);
+  MappedFile(MappedFile const&) = delete;
+  void operator=(MappedFile const&) = delete;
+  ~MappedFile();
+
+  bool is_open() const { return open_; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+};
+
+} // End of namespace.
+
+#endif
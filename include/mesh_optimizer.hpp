@@ -0,0 +1,66 @@
+#ifndef _MESH_OPTIMIZER_HPP_
+#define _MESH_OPTIMIZER_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "config.h"
+
+namespace Sibyl {
+
+struct MeshStats {
+  size_t vertices_before = 0;
+  size_t vertices_after = 0;
+  float acmr_before = 0;
+  float acmr_after = 0;
+};
+
+// Average cache miss ratio: vertices transformed per triangle with a FIFO
+// post transform cache of the given size. 3 means no reuse at all, and a
+// well ordered regular grid gets close to 0.5.
+float ComputeAcmr(const std::vector<unsigned int>&, size_t, int = MESH_CACHE_SIZE);
+
+// Merges vertices whose position, uv and normal are bit for bit equal and
+// rewrites the indices to match. Returns the new vertex count.
+size_t WeldVertices(
+  std::vector<glm::vec3>&,
+  std::vector<glm::vec2>&,
+  std::vector<glm::vec3>&,
+  std::vector<unsigned int>&
+);
+
+// Reorders triangles so consecutive ones share vertices (Forsyth, "Linear
+// speed vertex cache optimisation").
+void OptimizeVertexCache(std::vector<unsigned int>&, size_t);
+
+// Splits the cache ordered triangles into clusters where the cache starts
+// cold anyway and sorts the clusters so that those facing outwards from
+// the center of the mesh draw first, which lets the depth test reject more
+// of what is behind them. The new order is only kept if the ACMR grows by
+// less than the threshold factor.
+void OptimizeOverdraw(
+  std::vector<unsigned int>&,
+  const std::vector<glm::vec3>&,
+  float = MESH_OVERDRAW_THRESHOLD
+);
+
+// Renumbers vertices in the order the indices first use them, so the
+// vertex fetch reads the buffers mostly sequentially.
+void OptimizeVertexFetch(
+  std::vector<glm::vec3>&,
+  std::vector<glm::vec2>&,
+  std::vector<glm::vec3>&,
+  std::vector<unsigned int>&
+);
+
+// All of the above in order, on the unindexed arrays ParseObj produces.
+MeshStats OptimizeMesh(
+  std::vector<glm::vec3>&,
+  std::vector<glm::vec2>&,
+  std::vector<glm::vec3>&,
+  std::vector<unsigned int>&
+);
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "config.h"
+
+namespace Sibyl {
+
+// Monotonic count. Hot paths keep a reference in a function local static, 
+// so incrementing costs a single relaxed atomic add.
+class Counter {
+  std::atomic<int64_t> value_;
+
+ public:
+  constexpr Counter() : value_(0) {}
+
+  void Add(int64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() { return value_.load(std::memory_order_relaxed); }
+};
+
+// Last value set.
+class Gauge {
+  std::atomic<double> value_;
+
+ public:
+  Gauge() : value_(0) {}
+
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  double value() { return value_.load(std::memory_order_relaxed); }
+};
+
+// Fixed width buckets over [0, max). Values above max land in the last 
+// bucket. Reset after each CSV row, so percentiles cover the last second.
+class Histogram {
+  double max_;
+  std::vector<std::atomic<uint32_t>> buckets_;
+  std::atomic<uint32_t> count_;
+
+ public:
+  Histogram(double, int);
+
+  void Record(double);
+  double Percentile(double);
+  void Reset();
+
+  uint32_t count() { return count_.load(std::memory_order_relaxed); }
+};
+
+// Named counters, gauges and histograms. Lookups take a lock and are meant
+// to happen once per call site; the returned references stay valid for the
+// lifetime of the program.
+class Metrics {
+  std::mutex mutex_;
+  std::map<std::string, Counter*> counters_;
+  std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+  std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+  std::vector<std::unique_ptr<Counter>> owned_counters_;
+
+  // Counter values at the start of the current frame and second.
+  std::map<std::string, int64_t> frame_start_;
+  std::map<std::string, int64_t> frame_values_;
+  std::map<std::string, int64_t> second_start_;
+
+  std::ofstream csv_;
+  std::string csv_header_;
+  std::string csv_header_buffer_;
+  std::string csv_row_;
+  double last_row_time_ = -1.0;
+
+  Metrics();
+
+ public:
+  static Metrics& GetInstance();
+  Metrics(Metrics const&) = delete;
+  void operator=(Metrics const&) = delete;
+
+  Counter& GetCounter(const std::string&);
+  Gauge& GetGauge(const std::string&);
+  Histogram& GetHistogram(const std::string&, double = 100.0, int = 200);
+
+  void EndFrame(double);
+  void GetHudLines(std::vector<std::string>&);
+};
+
+// Heap allocations made through operator new since the program started.
+extern Counter heap_allocations;
+
+// Counts a triangle draw call of a number of vertices, once per instance.
+inline void CountDraw(int64_t vertices, int64_t instances = 1) {
+  static Counter& draw_calls = Metrics::GetInstance().GetCounter("draw_calls");
+  static Counter& triangles = Metrics::GetInstance().GetCounter("triangles");
+  draw_calls.Add();
+  triangles.Add(instances * vertices / 3);
+}
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _OBJ_PARSER_HPP_
+#define _OBJ_PARSER_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace Sibyl {
+
+// Reads a Wavefront OBJ into unindexed vertex arrays, one vertex per face
+// corner. Faces with more than three corners are split into a fan. Corners
+// without a uv get (0, 0) and corners without a normal get the normal of
+// their triangle. Negative indices count back from the last element read.
+// Only v, vt, vn and f lines are used; everything else is skipped.
+//
+// The file is mapped and parsed in place, so nothing is allocated per line.
+// There is no shared state, so several files can be parsed at once from
+// different threads. Returns false if the file cannot be read or is
+// malformed, leaving whatever was parsed so far in the output arrays.
+bool ParseObj(
+  const std::string&,
+  std::vector<glm::vec3>&,
+  std::vector<glm::vec2>&,
+  std::vector<glm::vec3>&,
+  std::vector<unsigned int>&
+);
+
+// Same as above, on a buffer that is already in memory. The buffer does
+// not need to be null terminated.
+bool ParseObj(
+  const char*, size_t,
+  std::vector<glm::vec3>&,
+  std::vector<glm::vec2>&,
+  std::vector<glm::vec3>&,
+  std::vector<unsigned int>&
+);
+
+} // End of namespace.
+
+#endif
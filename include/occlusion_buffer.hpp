@@ -0,0 +1,57 @@
+#ifndef _OCCLUSION_BUFFER_HPP_
+#define _OCCLUSION_BUFFER_HPP_
+
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+#include "metrics.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Low resolution depth buffer for software occlusion culling. The large
+// building boxes are rasterized into it at the start of the frame, then
+// everything else is tested against it before being submitted, so the
+// terrain and the objects behind the walls are skipped when the player is
+// inside.
+//
+// A pixel only counts as covered when the occluder covers all of it, and
+// it keeps the farthest depth of the occluder inside it, so a box is only
+// culled when it is behind the walls everywhere it may be seen. Pixels on
+// the seams between the faces of a box are left uncovered, which only
+// costs some culling. Depth is in window coordinates, like the GL depth
+// buffer, and 1 where nothing was drawn.
+class OcclusionBuffer {
+  int width_;
+  int height_;
+  glm::mat4 view_projection_;
+  glm::vec3 camera_;
+  std::vector<float> depth_;
+
+  void RasterizeQuad(const glm::vec4*);
+  void RasterizePolygon(const glm::vec3*, int);
+
+ public:
+  OcclusionBuffer(int = OCCLUSION_BUFFER_WIDTH, int = OCCLUSION_BUFFER_HEIGHT);
+
+  // Clears the buffer for a new frame.
+  void Begin(const glm::mat4&, const glm::mat4&);
+
+  // Only the faces that look towards the camera are rasterized.
+  void RasterizeBox(const glm::vec3&, const glm::vec3&);
+
+  // True unless the box is behind the occluders at every pixel it covers.
+  // Boxes that cross the near plane are always visible.
+  bool IsVisible(const glm::vec3&, const glm::vec3&) const;
+
+  // True if some pixel has no occluder, so the sky may be seen.
+  bool IsBackgroundVisible() const;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  const std::vector<float>& depth() const { return depth_; }
+};
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef _PHYSICS_HPP_
+#define _PHYSICS_HPP_
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "thread_pool.hpp"
+#include "building.hpp"
+#include "clipmap.hpp"
+#include "metrics.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+enum BodyShape {
+  BODY_BOX = 0,
+  BODY_SPHERE
+};
+
+// Velocities are displacements per tick, like Player::speed. Spheres use
+// half_extents.x as the radius.
+struct RigidBody {
+  BodyShape shape;
+  glm::vec3 position;
+  glm::vec3 velocity;
+  glm::vec3 half_extents;
+  float inverse_mass;
+
+  RigidBody(
+    BodyShape shape,
+    glm::vec3 position,
+    glm::vec3 half_extents,
+    float mass
+  ) : shape(shape),
+      position(position),
+      velocity(0),
+      half_extents(half_extents),
+      inverse_mass((mass > 0) ? 1.0f / mass : 0.0f) {
+  }
+};
+
+// Dynamic boxes and spheres falling on the building floors, the terrain and
+// each other. Each tick:
+//
+// 1. Bodies are integrated and pushed out of the floors and the terrain,
+//    in chunks on the thread pool. Terrain heights are read in batches.
+// 2. Sweep and prune on x, in bands along z, finds the overlapping pairs.
+//    A single axis would test every body in the same column, which grows
+//    with the square root of the number of bodies. The sort order is kept
+//    across ticks, so an insertion sort is enough, and the sweep is split
+//    in chunks on the thread pool.
+// 3. Pairs are grouped into islands of touching bodies, which share no
+//    bodies, so they are solved on different threads.
+class Physics {
+  std::shared_ptr<ThreadPool> thread_pool_;
+  std::shared_ptr<Building> building_;
+
+  // Owned by the terrain.
+  Clipmap* clipmap_;
+
+  std::vector<RigidBody> bodies_;
+
+  // Work of the current tick is split in num_chunks_ chunks. The chunk
+  // functions only capture this and are built once, and each chunk has its
+  // own scratch vectors, so steady-state ticks do not allocate.
+  int num_chunks_ = 1;
+  const Bvh* floors_ = nullptr;
+  Bvh no_floors_;
+  std::function<void(int, int)> integrate_chunks_;
+  std::function<void(int, int)> find_pairs_chunks_;
+  std::function<void(int, int)> solve_chunks_;
+  std::vector< std::vector<int> > chunk_candidates_;
+
+  // Broadphase. Bodies are sorted by band along z, then along x.
+  std::vector<int> order_;
+  std::vector<int> band_;
+  std::vector<float> min_x_;
+  std::vector<float> max_x_;
+  std::vector< std::vector<glm::ivec2> > chunk_pairs_;
+  std::vector<glm::ivec2> pairs_;
+  float max_width_ = 0;
+
+  // Islands as ranges of island_pairs_.
+  std::vector<int> parent_;
+  std::vector<int> island_;
+  std::vector<int> island_start_;
+  std::vector<int> island_next_;
+  std::vector<int> pair_islands_;
+  std::vector<glm::ivec2> island_pairs_;
+
+  int Find(int);
+  bool Before(int, int) const;
+  void Integrate(int);
+  void SortAxis();
+  void FindPairs(int);
+  void FindPairs();
+  void BuildIslands();
+  void SolveIsland(int);
+
+ public:
+  Physics(std::shared_ptr<ThreadPool>, std::shared_ptr<Building>, Clipmap*);
+  Physics(Physics const&) = delete;
+  void operator=(Physics const&) = delete;
+
+  int AddBody(const RigidBody&);
+  void Clear();
+  void Step(int = 1);
+
+  const std::vector<RigidBody>& bodies() const { return bodies_; }
+  int num_pairs() const { return pairs_.size(); }
+  int num_islands() const { return std::max(int(island_start_.size()) - 1, 0); }
+};
+
+} // End of namespace.
+
+#endif
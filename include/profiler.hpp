@@ -0,0 +1,105 @@
+#ifndef _PROFILER_HPP_
+#define _PROFILER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "config.h"
+
+namespace Sibyl {
+
+enum ProfileTrack {
+  TRACK_CPU = 0,
+  TRACK_GPU
+};
+
+struct ProfileEvent {
+  char name[32];
+  ProfileTrack track;
+  int thread_id;
+  double start;    // Microseconds since the profiler was created.
+  double duration; // Microseconds.
+};
+
+// Collects CPU and GPU pass timings into a fixed size ring buffer that 
+// can be exported as a Chrome trace (chrome://tracing or ui.perfetto.dev).
+// CPU events may be recorded from any thread without locking. GPU timers
+// use GL_TIME_ELAPSED queries and must be issued on the GL thread; their
+// results are read back a few frames later by Collect, so they never stall 
+// the pipeline.
+class Profiler {
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    ProfileEvent event;
+    Slot() : sequence(0) {}
+  };
+
+  struct GpuQuery {
+    GLuint query;
+    char name[32];
+    double start;
+  };
+
+  std::chrono::steady_clock::time_point start_time_;
+  std::vector<Slot> slots_;
+  std::atomic<uint64_t> head_;
+  std::atomic<int> next_thread_id_;
+
+  // Queries waiting for their results, in issue order. Collect erases the
+  // finished ones from the front, which keeps the capacity, so once the
+  // vector fits a few frames of queries it stops allocating.
+  std::vector<GLuint> free_queries_;
+  std::vector<GpuQuery> pending_queries_;
+  int gpu_depth_ = 0;
+  double gpu_end_ = 0;
+
+  Profiler();
+
+ public:
+  static Profiler& GetInstance();
+  Profiler(Profiler const&) = delete;
+  void operator=(Profiler const&) = delete;
+
+  double Now();
+  int ThreadId();
+  void Record(const char*, ProfileTrack, double, double);
+  void BeginGpu(const char*);
+  void EndGpu();
+  void Collect();
+  std::vector<ProfileEvent> GetEvents();
+  bool ReadEvents(uint64_t*, std::vector<ProfileEvent>&);
+  void ExportChromeTrace(const std::string&);
+};
+
+// Times the enclosing scope on the CPU.
+class ScopedTimer {
+  const char* name_;
+  double start_;
+
+ public:
+  ScopedTimer(const char* name) 
+    : name_(name), 
+      start_(Profiler::GetInstance().Now()) {
+  }
+
+  ~ScopedTimer() {
+    Profiler& profiler = Profiler::GetInstance();
+    profiler.Record(name_, TRACK_CPU, start_, profiler.Now() - start_);
+  }
+};
+
+// Times the enclosing scope on the GPU. Only valid on the GL thread. 
+// GL_TIME_ELAPSED queries cannot nest, so inner GPU timers are ignored.
+class GpuTimer {
+ public:
+  GpuTimer(const char* name) { Profiler::GetInstance().BeginGpu(name); }
+  ~GpuTimer() { Profiler::GetInstance().EndGpu(); }
+};
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef _RENDER_QUEUE_HPP_
+#define _RENDER_QUEUE_HPP_
+
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <functional>
+#include <string>
+#include <cstdint>
+#include <mutex>
+#include <cstring>
+#include <GL/glew.h>
+#include "command_list.hpp"
+#include "frame_arena.hpp"
+#include "profiler.hpp"
+#include "metrics.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Passes are executed in this order. Translucent passes are sorted back to
+// front, all the others front to back.
+enum RenderPass {
+  PASS_SKY = 0,
+  PASS_OPAQUE,
+  PASS_WATER,
+  PASS_TRANSLUCENT,
+  PASS_OVERLAY
+};
+
+// The name and the draw closure live in the frame arena of the queue.
+struct DrawItem {
+  uint64_t key;
+  const char* name;
+  const char* group;
+  void (*draw)(void*);
+  void* closure;
+  CommandList commands;
+
+  DrawItem(
+    uint64_t key,
+    const char* name,
+    void (*draw)(void*),
+    void* closure,
+    const char* group
+  ) : key(key),
+      name(name),
+      group(group),
+      draw(draw),
+      closure(closure) {
+  }
+
+  DrawItem(
+    uint64_t key,
+    const char* name,
+    CommandList&& commands,
+    const char* group
+  ) : key(key),
+      name(name),
+      group(group),
+      draw(nullptr),
+      closure(nullptr),
+      commands(std::move(commands)) {
+  }
+};
+
+// Collects the draw calls for a frame and submits them sorted by a 64 bit 
+// state key so that draws sharing a program, texture and mesh end up next 
+// to each other. The key layout (most significant bits first) is:
+//
+// Opaque:      pass (4) | program (12) | texture (12) | mesh (12) | depth (24)
+// Translucent: pass (4) | depth (24)   | program (12) | texture (12) | mesh (12)
+//
+// Items may be submitted from worker threads, but the queue is sorted and 
+// executed on the GL thread. Consecutive items sharing a group (the item 
+// name if none is given) are timed as one pass by the profiler.
+//
+// Everything recorded for a frame lives in the arena, which is reset when
+// the queue is cleared. Once the item and order vectors and the arena have
+// grown to the size of a frame, submitting and flushing do not allocate.
+class RenderQueue {
+  std::vector<DrawItem> items_;
+  std::vector<std::pair<uint64_t, int>> order_;
+  std::mutex mutex_;
+  FrameArena arena_;
+
+  template <typename Draw>
+  static void Call(void* closure) { (*static_cast<Draw*>(closure))(); }
+
+  void Submit(uint64_t, const std::string&, void (*)(void*), void*, const char*);
+
+ public:
+  RenderQueue() {}
+
+  static uint64_t MakeKey(RenderPass, GLuint, GLuint, GLuint, float);
+  static RenderPass GetPass(uint64_t key) { return static_cast<RenderPass>(key >> 60); }
+
+  // The closure is moved into the arena, so capturing matrices by value
+  // does not allocate like a std::function would.
+  template <typename Draw>
+  void Submit(uint64_t key, const std::string& name, Draw draw, const char* group = nullptr) {
+    Submit(key, name, &Call<Draw>, arena_.New<Draw>(std::move(draw)), group);
+  }
+
+  void Submit(uint64_t, const std::string&, CommandList&&, const char* group = nullptr);
+  void Sort();
+  void Execute();
+  void Flush(std::ostream* dump = nullptr);
+  void Dump(std::ostream&);
+  void Clear();
+
+  // For command lists submitted to this queue.
+  FrameArena* arena() { return &arena_; }
+
+  const std::vector<DrawItem>& items() { return items_; }
+};
+
+} // End of namespace.
+
+#endif
@@ -8,6 +8,7 @@
 #include <fstream>
 #include <unordered_map>
 #include <cstring>
+#include <cstddef>
 #include <sstream>
 #include <math.h>
 #include <GL/glew.h>
@@ -22,6 +23,12 @@
 #include <ft2build.h>
 #include "texture.hpp"
 #include "shaders.h"
+#include "render_queue.hpp"
+#include "obj_parser.hpp"
+#include "mesh_optimizer.hpp"
+#include "smesh_file.hpp"
+#include "vertex_format.hpp"
+#include "metrics.hpp"
 #include "config.h"
 #include FT_FREETYPE_H
 
@@ -34,19 +41,53 @@ struct Character {
   glm::ivec2 Size;      // Size of glyph
   glm::ivec2 Bearing;   // Offset from baseline to left/top of glyph
   GLuint     Advance;   // Offset to advance to next glyph
+  vector<unsigned char> Bitmap; // CPU copy for the software renderer
+};
+
+struct MeshInstance {
+  glm::mat4 model;
+  GLfloat highlight;
+
+  MeshInstance(
+    glm::mat4 model,
+    GLfloat highlight
+  ) : model(model),
+      highlight(highlight) {
+  }
 };
 
 struct Mesh {
   Shader shader_;
-  GLuint vertex_buffer_;
-  GLuint uv_buffer_;
-  GLuint normal_buffer_;
-  GLuint element_buffer_;
+
+  // Set up once on upload with the attributes and the element buffer, so
+  // drawing the mesh only binds it.
+  GLuint vertex_array_ = 0;
+  GLuint vertex_buffer_ = 0;
+  GLuint uv_buffer_ = 0;
+  GLuint element_buffer_ = 0;
+  GLuint instance_buffer_ = 0;
+  size_t instance_capacity_ = 0;
+  size_t num_vertices_ = 0;
+  size_t num_indices_ = 0;
+
+  // Meshes with normals keep all their attributes interleaved in
+  // vertex_buffer_ and leave uv_buffer_ unused.
+  bool interleaved_ = false;
+  VertexFormat format_;
+
+  // CPU copies of the buffers, only kept with --keep-mesh-data.
   std::vector<glm::vec3> vertices_;
   std::vector<glm::vec2> uvs_;
   std::vector<glm::vec3> normals_;
   std::vector<unsigned int> indices_;
 
+  // Object space bounds of the vertices, for culling.
+  glm::vec3 min_ = glm::vec3(0);
+  glm::vec3 max_ = glm::vec3(0);
+
+  // Set for meshes loaded from OBJ files.
+  MeshStats stats_;
+
   Mesh() {}
 };
 
@@ -56,6 +97,10 @@ struct FBO {
   GLuint width;
   GLuint height;
   GLuint depth_rbo;
+
+  // Color and depth textures for CompositePixels, created on first use.
+  GLuint composite_color = 0;
+  GLuint composite_depth = 0;
 };
 
 class Renderer {
@@ -69,13 +114,18 @@ class Renderer {
   GLuint vbo_;
   GLuint uv_;
   unordered_map<string, GLuint> vbos_;
+  unordered_map<string, GLuint> vaos_;
   unordered_map<string, Mesh> meshes_;
+  bool keep_mesh_data_;
   glm::mat4 projection_;
+  RenderQueue render_queue_;
 
   void CreateShaders();
   void CreateVBOs();
   void LoadFonts();
   void LoadMeshes();
+  Mesh& UploadMesh(const string&, const vec3*, const vec2*, size_t, const unsigned int*, size_t);
+  Mesh& UploadMesh(const string&, const VertexFormat&, const char*, size_t, const unsigned int*, size_t);
 
  public:
   Renderer();
@@ -93,19 +143,45 @@ class Renderer {
   void CreateFramebuffer(const string&, int, int);
   void DrawChar(char, float, float, vec3 = {1.0, 1.0, 1.0}, GLfloat = 1.0);
   void DrawText(const string&, float, float, vec3 = {1.0, 1.0, 1.0}, GLfloat = 1.0, bool center = false);
-  void DrawMesh(string, glm::mat4, glm::mat4, glm::vec3, glm::vec3, GLfloat, bool);
+  void DrawMesh(const string&, glm::mat4, glm::mat4, glm::vec3, glm::vec3, GLfloat, bool);
+  void DrawMeshInstanced(const string&, glm::mat4, glm::mat4, const vector<MeshInstance>&);
+  void DrawMeshInstanced(const string&, glm::mat4, glm::mat4, const MeshInstance*, int);
   void DrawRectangle(GLfloat, GLfloat, GLfloat, GLfloat, vec3);
-  void DrawCube(mat4, mat4, vec3, vec3, vec3, GLfloat);
+  void AppendCube(vec3, vec3, vector<vec3>&, vector<vec2>&, vector<unsigned int>&);
+  void DrawBuilding(const string&, mat4, mat4);
+  void RecordBuilding(CommandList&, const string&, mat4, mat4, const vector<ivec2>* = nullptr);
   void DrawPoint(vec2, GLfloat, vec3);
   void DrawLine(vec2, vec2, GLfloat, vec3);
   void DrawArrow(vec2, vec2, GLfloat, vec3);
   void DrawCartesianGrid(int, int, int);
+  static bool ParseObj(const string&, vector<glm::vec3>&, vector<glm::vec2>&, vector<glm::vec3>&, vector<unsigned int>&);
   void LoadMesh(const string&);
   void LoadMesh(const string&, vector<glm::vec3>&, vector<glm::vec2>&, vector<unsigned int>&);
   void LoadMesh(const string&, vector<glm::vec3>&, vector<glm::vec2>&, vector<glm::vec3>&, vector<unsigned int>&);
-  void DrawHighlightedObject(string, mat4, mat4, vec3, vec3, GLfloat, bool, GLuint, GLfloat alpha = 1.0);
+  void DeleteMesh(const string&);
+  void DrawHighlightedObject(const string&, mat4, mat4, vec3, vec3, GLfloat, bool, GLuint, GLfloat alpha = 1.0);
   FBO GetFBO(const string& name) { return fbos_[name]; }
+  Shader* GetShader(const string& name) { 
+    auto it = shaders_.find(name);
+    return (it == shaders_.end()) ? nullptr : &it->second; 
+  }
+  GLuint GetProgramId(const string& name) { 
+    Shader* shader = GetShader(name);
+    return (shader) ? shader->program_id() : 0; 
+  }
+  const Mesh* GetMesh(const string& name) { 
+    auto it = meshes_.find(name);
+    return (it == meshes_.end()) ? nullptr : &it->second; 
+  }
+  const unordered_map<GLchar, Character>& characters() { return characters_; }
+  GLuint GetMeshId(const string& name) { 
+    auto it = meshes_.find(name);
+    return (it == meshes_.end()) ? 0 : it->second.vertex_buffer_; 
+  }
+  RenderQueue& render_queue() { return render_queue_; }
   void DrawFBO(const string&, ivec2);
+  void DrawPixels(const string&, const void*);
+  void CompositePixels(const string&, const void*, const float*);
 
   void SetFBO(const string& name) {
     glBindFramebuffer(GL_FRAMEBUFFER, fbos_[name].framebuffer);
@@ -18,7 +18,6 @@ namespace Sibyl {
 class Shader {
   GLuint program_id_;
   std::map<std::string, GLuint> glsl_variables_;
-  std::vector<int> buffer_slots_;
   int available_texture_slot_;
 
  public:
@@ -31,12 +30,19 @@ class Shader {
 
   GLuint GetUniformId(const std::string&);
   void BindTexture(const std::string&, const GLuint&, const GLenum& = GL_TEXTURE_2D);
-  void BindBuffer(const GLuint&, int, int dimension = 3);
   void Clear();
 
   GLuint program_id() { return program_id_; }
 };
 
+// A vertex array records which buffers feed each attribute slot, so it is
+// set up once when the buffers are created and a draw only binds it. The
+// setters act on the bound vertex array.
+GLuint CreateVertexArray();
+void SetVertexAttribute(const GLuint&, int, int dimension = 3);
+void SetVertexAttribute(const GLuint&, int, int, GLenum, GLboolean, GLsizei, size_t);
+void SetInstanceAttribute(const GLuint&, int, int, GLsizei, size_t);
+
 } // End of namespace.
 
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path);
@@ -0,0 +1,80 @@
+#ifndef _SIMULATION_HPP_
+#define _SIMULATION_HPP_
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "game_state.hpp"
+#include "entity_manager.hpp"
+#include "terrain.hpp"
+#include "physics.hpp"
+#include "triple_buffer.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Player intent sampled by the render thread. Held directions are applied
+// once per tick, so the movement speed does not depend on the frame rate.
+struct PlayerInput {
+  bool move[4] = { false, false, false, false }; // Forward, back, left, right.
+  bool jump = false;
+  float h_angle = 0.0f;
+  float v_angle = 0.0f;
+};
+
+// Immutable state published by the simulation at the end of each tick.
+struct Snapshot {
+  unsigned long tick = 0;
+  double time = 0.0;
+  Player player;
+};
+
+// Runs the player physics on its own thread at a fixed tick rate. The render
+// thread reads the two most recent snapshots and interpolates between them.
+class Simulation {
+  shared_ptr<EntityManager> entity_manager_;
+  shared_ptr<Terrain> terrain_;
+  shared_ptr<Physics> physics_;
+
+  Player player_;
+  PlayerInput input_;
+  std::mutex input_mutex_;
+
+  TripleBuffer<Snapshot> snapshots_;
+  Snapshot previous_;
+  Snapshot current_;
+
+  std::thread thread_;
+  std::atomic<bool> running_;
+  unsigned long tick_ = 0;
+  double tick_duration_;
+  double next_tick_time_ = -1.0;
+
+  void Run();
+  void Step(const PlayerInput&, int = 1);
+  void Publish(double);
+
+ public:
+  Simulation(shared_ptr<EntityManager>, shared_ptr<Terrain>, const Player&);
+  Simulation(Simulation const&) = delete;
+  void operator=(Simulation const&) = delete;
+  ~Simulation();
+
+  void Start();
+  void Stop();
+  void StepTo(double);
+  void SetInput(const PlayerInput&);
+  Player Interpolate(double);
+
+  double tick_duration() { return tick_duration_; }
+
+  // Optional. Stepped along with the player, so set it before Start.
+  void set_physics(shared_ptr<Physics> physics) { physics_ = physics; }
+};
+
+} // End of namespace.
+
+#endif
@@ -17,6 +17,7 @@
 #include "shaders.h"
 #include "config.h"
 #include "clipmap.hpp"
+#include "render_queue.hpp"
 
 namespace Sibyl {
 
@@ -24,6 +25,7 @@ class SkyDome {
   Shader shader_;
 
   GLuint texture_;
+  GLuint vertex_array_;
   GLuint vertex_buffer_;
   GLuint uv_buffer_;
   GLuint element_buffer_;
@@ -38,6 +40,8 @@ class SkyDome {
   SkyDome();
 
   void Draw(glm::mat4, glm::mat4, glm::vec3, glm::vec3);
+  void Submit(RenderQueue&, glm::mat4, glm::mat4, glm::vec3, glm::vec3, const OcclusionBuffer* = nullptr);
+  void Record(CommandList&, glm::mat4, glm::mat4, glm::vec3, glm::vec3);
 };
 
 } // End of namespace.
@@ -0,0 +1,72 @@
+#ifndef _SMESH_FILE_HPP_
+#define _SMESH_FILE_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "mapped_file.hpp"
+#include "mesh_optimizer.hpp"
+#include "vertex_format.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Header of a .smesh file, the binary cache of a processed OBJ mesh. The
+// header is followed by the interleaved vertices (see vertex_format.hpp)
+// and the indices, in the machine's own byte order, so both can be handed
+// to glBufferData straight from the mapping. The cache is stale when the
+// version, the position encoding or the source's modification time or
+// size differ.
+struct SmeshHeader {
+  char magic[4];
+  uint32_t version;
+  int64_t source_mtime;
+  uint64_t source_size;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t vertices_before;
+  float acmr_before;
+  float acmr_after;
+  uint32_t encoding;
+  float position_offset[3];
+  float position_scale[3];
+  float min[3];
+  float max[3];
+};
+
+class SmeshFile {
+  std::unique_ptr<MappedFile> file_;
+  const SmeshHeader* header_ = nullptr;
+
+  const char* data(size_t offset) const { return file_->data() + offset; }
+
+ public:
+  // Maps the cache file if it is valid and current for the source file and
+  // its vertices use the given encoding.
+  bool Open(const std::string&, const std::string&, PositionEncoding);
+
+  // Writes the cache for the source file. Writes go to a temporary file
+  // that is renamed over the old one, so a reader never sees half a file.
+  static bool Write(
+    const std::string&,
+    const std::string&,
+    const VertexFormat&,
+    const std::vector<char>&,
+    const std::vector<unsigned int>&,
+    const MeshStats&
+  );
+
+  size_t num_vertices() const { return header_->num_vertices; }
+  size_t num_indices() const { return header_->num_indices; }
+  MeshStats stats() const;
+  VertexFormat format() const;
+
+  const char* vertices() const { return data(sizeof(SmeshHeader)); }
+  const unsigned int* indices() const;
+};
+
+} // End of namespace.
+
+#endif
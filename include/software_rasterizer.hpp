@@ -0,0 +1,162 @@
+#ifndef _SOFTWARE_RASTERIZER_HPP_
+#define _SOFTWARE_RASTERIZER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "thread_pool.hpp"
+#include "metrics.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Colors are RGBA8 with red in the low byte, so the buffer can be uploaded
+// as GL_RGBA / GL_UNSIGNED_BYTE. Row 0 is the bottom row, like in GL.
+struct SoftwareFramebuffer {
+  int width = 0;
+  int height = 0;
+  std::vector<uint32_t> color;
+  std::vector<float> depth;
+
+  void Resize(int, int);
+  void Clear(glm::vec3, float = 1.0f);
+};
+
+// Bilinear sampling with clamp to edge, or wrapping when repeat is set.
+// Texel rows start at v = 0, like a GL upload.
+struct SoftwareTexture {
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  bool repeat = false;
+  std::vector<uint8_t> texels;
+
+  glm::vec4 Sample(glm::vec2) const;
+};
+
+// Clip space position and the attributes interpolated for the fragment
+// stage.
+struct SoftwareVertex {
+  glm::vec4 position;
+  float varyings[SOFTWARE_MAX_VARYINGS];
+};
+
+// C++ counterpart of a GLSL program. Both stages run concurrently on the
+// thread pool, so they must not modify the shader. Vertex uniforms may
+// change between draws, but anything the fragment stage reads has to stay
+// valid until the next Flush.
+class SoftwareShader {
+ public:
+  int num_varyings = 0;
+  bool depth_test = true;
+  bool depth_write = true;
+  bool cull_back = true;
+
+  // Source alpha, one minus source alpha.
+  bool blend = false;
+
+  virtual ~SoftwareShader() {}
+  virtual void Vertex(int, SoftwareVertex*) const = 0;
+
+  // Returns false to discard the fragment.
+  virtual bool Fragment(const float*, glm::vec4*) const = 0;
+};
+
+// Sort-middle tile renderer. Draw runs the vertex stage, clips and sets up
+// triangles in parallel chunks, and bins each triangle into the screen
+// tiles it overlaps. Flush then rasterizes the tiles in parallel, each
+// worker owning whole tiles, so no locking is needed on the framebuffer.
+// Within a tile, triangles are shaded in submission order.
+class SoftwareRasterizer {
+  struct Triangle {
+    const SoftwareShader* shader;
+    int min_x, min_y, max_x, max_y;
+
+    // Edge i is opposite to vertex i: E(x, y) = a * x + b * y + c.
+    float a[3], b[3], c[3];
+    bool top_left[3];
+    float inv_area;
+
+    // Depth plane through the first vertex. Interpolating the depth with
+    // the edge functions would scale it by their rounding error.
+    float z0, ref_x, ref_y, dzdx, dzdy;
+    float inv_w[3];
+    float varyings[3][SOFTWARE_MAX_VARYINGS];
+  };
+
+  // Triangles set up by one chunk of a draw, with the list of triangles
+  // that overlap each tile.
+  struct Batch {
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> bins;
+  };
+
+  std::shared_ptr<ThreadPool> thread_pool_;
+  int width_;
+  int height_;
+  int tiles_x_;
+  int tiles_y_;
+  std::vector<Batch> batches_;
+  int num_batches_ = 0;
+  std::vector<SoftwareVertex> vertices_;
+  std::atomic<int> next_tile_;
+  SoftwareFramebuffer* clear_target_ = nullptr;
+  uint32_t clear_color_ = 0;
+
+  // The stages of the current Draw and Flush. Their functions only capture
+  // this and are built once, so handing them to the pool does not allocate.
+  const SoftwareShader* draw_shader_ = nullptr;
+  const unsigned int* draw_indices_ = nullptr;
+  int draw_num_triangles_ = 0;
+  int draw_chunk_size_ = 0;
+  int draw_first_batch_ = 0;
+  SoftwareFramebuffer* flush_target_ = nullptr;
+  bool flush_clear_ = false;
+  std::function<void(int, int)> vertex_stage_;
+  std::function<void(int, int)> setup_stage_;
+  std::vector<std::function<void()>> tile_workers_;
+
+  int NewBatch();
+  void Setup(const SoftwareShader&, const unsigned int*, int, int, Batch&);
+  void SetupTriangle(const SoftwareShader&, const SoftwareVertex**, Batch&);
+  void ClipTriangle(const SoftwareShader&, const SoftwareVertex**, Batch&);
+  void RasterizeTiles();
+  void RasterizeTile(int, SoftwareFramebuffer&, bool);
+  int RasterizeTriangle(const Triangle&, int, int, int, int, SoftwareFramebuffer&);
+
+ public:
+  SoftwareRasterizer(std::shared_ptr<ThreadPool>, int, int);
+
+  // Draws indexed triangles. Vertex(i) is called once for each i in
+  // [0, num_vertices).
+  void Draw(const SoftwareShader&, int, const unsigned int*, int);
+  void Draw(const SoftwareShader&, int);
+  void Flush(SoftwareFramebuffer&);
+
+  // The clear is deferred to the next Flush of the framebuffer, so each
+  // tile is cleared by its worker while it is in cache.
+  void Clear(SoftwareFramebuffer&, glm::vec3);
+
+  int width() { return width_; }
+  int height() { return height_; }
+};
+
+inline uint32_t PackChannel(float c) {
+  return uint32_t(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+inline uint32_t PackColor(const glm::vec4& c) {
+  return PackChannel(c.x) | (PackChannel(c.y) << 8) | (PackChannel(c.z) << 16) | (PackChannel(c.w) << 24);
+}
+
+inline glm::vec4 UnpackColor(uint32_t c) {
+  return glm::vec4(c & 0xff, (c >> 8) & 0xff, (c >> 16) & 0xff, c >> 24) / 255.0f;
+}
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _SOFTWARE_RENDERER_HPP_
+#define _SOFTWARE_RENDERER_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "renderer.hpp"
+#include "texture.hpp"
+#include "thread_pool.hpp"
+#include "software_rasterizer.hpp"
+#include "software_shaders.hpp"
+#include "heightfield_renderer.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// Draws the scene on the CPU (see --software). Meshes and glyphs come from
+// the CPU copies kept by the Renderer and the terrain is a static grid built
+// from the height map. GL is only used by Present to put the finished frame
+// in the window.
+class SoftwareRenderer {
+  shared_ptr<Renderer> renderer_;
+  SoftwareRasterizer rasterizer_;
+  SoftwareFramebuffer scene_;
+  SoftwareFramebuffer screen_;
+  SoftwareTexture glyphs_;
+  SoftwareTexture water_dudv_;
+  SoftwareTexture water_normal_;
+  unordered_map<GLchar, glm::vec4> glyph_uvs_;
+
+  glm::mat4 projection_;
+  glm::mat4 view_;
+  glm::vec3 light_cameraspace_;
+  float water_move_factor_ = 0;
+
+  vector<glm::vec3> terrain_vertices_;
+  vector<glm::vec3> terrain_normals_;
+  vector<unsigned int> terrain_indices_;
+  vector<glm::vec3> water_vertices_;
+  vector<glm::vec4> text_vertices_;
+
+  ObjectShader object_shader_;
+  BuildingShader building_shader_;
+  TerrainShader terrain_shader_;
+  WaterShader water_shader_;
+  TextShader text_shader_;
+  ScreenShader screen_shader_;
+
+  void CreateGlyphAtlas();
+  void LoadTexture(const string&, SoftwareTexture&);
+
+ public:
+  SoftwareRenderer(shared_ptr<Renderer>, shared_ptr<ThreadPool>, int, int);
+
+  void LoadTerrain(const vector< vector<float> >&);
+  void BeginFrame(glm::mat4, glm::mat4, glm::vec3);
+  void DrawMeshInstanced(const string&, const vector<MeshInstance>&);
+  void DrawBuilding(const string&);
+  void DrawTerrain();
+  void DrawHeightfield(HeightfieldRenderer&);
+  void DrawWater(glm::vec3);
+  void DrawScreen(bool);
+  void DrawText(const string&, float, float, glm::vec3 = {1.0, 1.0, 1.0}, GLfloat = 1.0);
+  void Present();
+
+  SoftwareFramebuffer& framebuffer() { return screen_; }
+};
+
+} // End of namespace.
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef _SOFTWARE_SHADERS_HPP_
+#define _SOFTWARE_SHADERS_HPP_
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "software_rasterizer.hpp"
+#include "config.h"
+
+namespace Sibyl {
+
+// C++ versions of the GLSL programs in shaders/ used by the software
+// renderer. Vertex attributes are read from CPU side arrays that must stay
+// alive during the Draw call. Values that the GLSL programs pass as flat
+// outputs (highlight, text color) are passed as varyings.
+
+// shaders/v_object and shaders/f_object.
+class ObjectShader : public SoftwareShader {
+ public:
+  const std::vector<glm::vec3>* vertices = nullptr;
+  const std::vector<glm::vec2>* uvs = nullptr;
+  const std::vector<glm::vec3>* normals = nullptr;
+  glm::mat4 MVP;
+  glm::mat4 MV;
+  float highlight = 0;
+  glm::vec3 light_cameraspace;
+
+  ObjectShader();
+  void Vertex(int, SoftwareVertex*) const;
+  bool Fragment(const float*, glm::vec4*) const;
+};
+
+// shaders/v_building and shaders/f_building. Vertices are in world space.
+class BuildingShader : public SoftwareShader {
+ public:
+  const std::vector<glm::vec3>* vertices = nullptr;
+  const std::vector<glm::vec2>* uvs = nullptr;
+  glm::mat4 MVP;
+
+  BuildingShader();
+  void Vertex(int, SoftwareVertex*) const;
+  bool Fragment(const float*, glm::vec4*) const;
+};
+
+// shaders/v_terrain and shaders/f_terrain, without the clipmap indirection.
+// Vertices and normals are in world space.
+class TerrainShader : public SoftwareShader {
+ public:
+  const std::vector<glm::vec3>* vertices = nullptr;
+  const std::vector<glm::vec3>* normals = nullptr;
+  glm::mat4 MVP;
+  glm::mat4 V;
+  glm::vec3 light_cameraspace;
+
+  TerrainShader();
+  void Vertex(int, SoftwareVertex*) const;
+  bool Fragment(const float*, glm::vec4*) const;
+};
+
+// shaders/v_water and shaders/f_water. Vertices are in world space.
+class WaterShader : public SoftwareShader {
+ public:
+  const std::vector<glm::vec3>* vertices = nullptr;
+  const SoftwareTexture* dudv_map = nullptr;
+  const SoftwareTexture* normal_map = nullptr;
+  glm::mat4 MVP;
+  glm::vec3 camera;
+  float move_factor = 0;
+
+  WaterShader();
+  void Vertex(int, SoftwareVertex*) const;
+  bool Fragment(const float*, glm::vec4*) const;
+};
+
+// shaders/v_text and shaders/f_text. Each vertex is (x, y, u, v) in window
+// coordinates, like the GL text VBO.
+class TextShader : public SoftwareShader {
+ public:
+  const std::vector<glm::vec4>* vertices = nullptr;
+  const SoftwareTexture* glyphs = nullptr;
+  glm::mat4 projection;
+  glm::vec3 color;
+
+  TextShader();
+  void Vertex(int, SoftwareVertex*) const;
+  bool Fragment(const float*, glm::vec4*) const;
+};
+
+// shaders/v_screen and shaders/f_screen. Draws a full screen quad (six
+// vertices) sampling another framebuffer.
+class ScreenShader : public SoftwareShader {
+ public:
+  const SoftwareFramebuffer* source = nullptr;
+  float blur = 0;
+
+  ScreenShader();
+  void Vertex(int, SoftwareVertex*) const;
+  bool Fragment(const float*, glm::vec4*) const;
+};
+
+} // End of namespace.
+
+#endif
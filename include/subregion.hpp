@@ -14,6 +14,7 @@
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/rotate_vector.hpp> 
 #include "shaders.h"
+#include "command_list.hpp"
 #include "config.h"
 
 namespace Sibyl {
@@ -48,7 +49,10 @@ class Subregion {
   Subregion() {}
   Subregion(SubregionLabel, int);
 
-  void Draw(glm::ivec2, glm::ivec2, bool);
+  void Draw(CommandList&, glm::ivec2, glm::ivec2, bool);
+
+  // World space corners of the region on the xz plane.
+  void GetBounds(glm::ivec2, glm::ivec2, glm::ivec2*, glm::ivec2*);
 };
 
 } // End of namespace.
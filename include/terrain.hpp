@@ -7,6 +7,7 @@
 #include <memory>
 #include <fstream>
 #include <cstring>
+#include <cstdio>
 #include <math.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -18,6 +19,8 @@
 #include "shaders.h"
 #include "config.h"
 #include "clipmap.hpp"
+#include "render_queue.hpp"
+#include "profiler.hpp"
 
 namespace Sibyl {
 
@@ -31,6 +34,8 @@ class Terrain {
   GLuint sand_texture_id_;
   GLuint water_diffuse_texture_id_;
   GLuint water_normal_texture_id_;
+  GLfloat water_move_factor_ = 0;
+  bool draw_terrain_ = true;
 
  public:
   Terrain(
@@ -40,9 +45,22 @@ class Terrain {
     GLuint water_normal_texture_id
   );
 
+  static vector< vector<float> > LoadHeightMap(const string&);
+
   void LoadTerrain(const string& filename);
+  const vector< vector<float> >& height_map() { return height_map_; }
+
+  // The water is still drawn when the clipmap terrain is off (see
+  // --heightfield).
+  void set_draw_terrain(bool draw_terrain) { draw_terrain_ = draw_terrain; }
   float GetHeight(float x , float y);
+  Clipmap* clipmap() { return &clipmaps_[0]; }
+  float GetTimeOfImpact(glm::vec3, glm::vec3);
   void Draw(glm::mat4, glm::mat4, glm::vec3, glm::vec3);
+  void Update(glm::vec3);
+  void RecordTerrain(CommandList&, glm::mat4, glm::mat4, glm::vec3, glm::vec3, const OcclusionBuffer* = nullptr);
+  void RecordWater(CommandList&, glm::mat4, glm::mat4, glm::vec3, glm::vec3, const OcclusionBuffer* = nullptr);
+  void Submit(RenderQueue&, glm::mat4, glm::mat4, glm::vec3, glm::vec3, const OcclusionBuffer* = nullptr);
 };
 
 } // End of namespace.
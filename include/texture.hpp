@@ -4,7 +4,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <vector>
 #include <GL/glew.h>
+#include "metrics.hpp"
 
 class Texture {
   GLuint texture_id_;
@@ -15,6 +17,8 @@ class Texture {
   Texture() {}
   Texture(const std::string&);
 
+  static bool ReadBitmap(const char*, std::vector<unsigned char>&, unsigned int&, unsigned int&);
+
   GLuint texture_id() { return texture_id_; }
 };
 
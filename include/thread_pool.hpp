@@ -0,0 +1,63 @@
+#ifndef _THREAD_POOL_HPP_
+#define _THREAD_POOL_HPP_
+
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace Sibyl {
+
+// Fixed set of worker threads created once at startup. Tasks must not make
+// GL calls, since the context is only current on the main thread.
+class ThreadPool {
+  // Either a function or a range of a ParallelFor, which points to the
+  // caller's function instead of copying it. Tasks of a Run or ParallelFor
+  // count down their batch, so a caller only waits for its own tasks and
+  // not for batches submitted from other threads.
+  struct Task {
+    std::function<void()> fn;
+    const std::function<void(int, int)>* range_fn;
+    int begin;
+    int end;
+    int* batch;
+  };
+
+  std::vector<std::thread> workers_;
+
+  // Tasks from next_task_ on are waiting. The vector is cleared when it
+  // runs empty, which keeps its capacity, so unlike a deque it stops
+  // allocating once it has grown to the largest batch.
+  std::vector<Task> tasks_;
+  size_t next_task_ = 0;
+  std::mutex mutex_;
+  std::condition_variable task_cv_;
+  std::condition_variable done_cv_;
+  int pending_ = 0;
+  bool stop_ = false;
+
+  void Work();
+  void Push(Task);
+  void WaitBatch(int*);
+
+ public:
+  ThreadPool();
+  ThreadPool(int);
+  ThreadPool(ThreadPool const&) = delete;
+  void operator=(ThreadPool const&) = delete;
+  ~ThreadPool();
+
+  void Enqueue(std::function<void()>);
+  void Wait();
+  void Run(const std::vector<std::function<void()>>&);
+  void ParallelFor(int, int, const std::function<void(int, int)>&);
+
+  int size() { return workers_.size(); }
+};
+
+} // End of namespace.
+
+#endif
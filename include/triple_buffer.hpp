@@ -0,0 +1,45 @@
+#ifndef _TRIPLE_BUFFER_HPP_
+#define _TRIPLE_BUFFER_HPP_
+
+#include <atomic>
+
+namespace Sibyl {
+
+// Lock-free single producer, single consumer triple buffer. The writer fills
+// the back buffer and publishes it by swapping it with the middle one. The
+// reader swaps the middle buffer into the front when something new was 
+// published. Neither side ever waits for the other.
+template<class T>
+class TripleBuffer {
+  static const int kDirty = 4;
+  static const int kIndexMask = 3;
+
+  T buffers_[3];
+  std::atomic<int> middle_;
+  int back_ = 0;
+  int front_ = 2;
+
+ public:
+  TripleBuffer() : middle_(1) {}
+
+  // Writer side.
+  T& back() { return buffers_[back_]; }
+
+  void Publish() {
+    back_ = middle_.exchange(back_ | kDirty, std::memory_order_acq_rel) & kIndexMask;
+  }
+
+  // Reader side. Returns true if a new value was published since the last
+  // call.
+  bool Update() {
+    if (!(middle_.load(std::memory_order_acquire) & kDirty)) return false;
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+    return true;
+  }
+
+  const T& front() { return buffers_[front_]; }
+};
+
+} // End of namespace.
+
+#endif
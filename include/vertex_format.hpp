@@ -0,0 +1,69 @@
+#ifndef _VERTEX_FORMAT_HPP_
+#define _VERTEX_FORMAT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace Sibyl {
+
+enum PositionEncoding {
+  POSITION_FLOAT = 0,   // Three floats.
+  POSITION_HALF = 1,    // Three half floats relative to the center of the bounds.
+  POSITION_UNORM16 = 2  // Three normalized shorts spanning the bounds.
+};
+
+// Byte offsets of the attributes in an interleaved vertex. The normal is
+// octahedral encoded in two signed bytes and the uv is two half floats.
+struct VertexLayout {
+  int stride;
+  int position;
+  int normal;
+  int uv;
+};
+
+// How the packed positions map back to object space: offset + scale * p,
+// where p is the stored value after the GL conversion (normalized shorts
+// arrive in [0, 1]). The bounds are those of the original positions.
+struct VertexFormat {
+  PositionEncoding encoding = POSITION_FLOAT;
+  glm::vec3 position_offset = glm::vec3(0);
+  glm::vec3 position_scale = glm::vec3(1);
+  glm::vec3 min = glm::vec3(0);
+  glm::vec3 max = glm::vec3(0);
+};
+
+VertexLayout GetVertexLayout(PositionEncoding);
+
+uint16_t FloatToHalf(float);
+float HalfToFloat(uint16_t);
+void EncodeOctahedral(const glm::vec3&, int8_t*);
+glm::vec3 DecodeOctahedral(const int8_t*);
+
+// Interleaves the arrays into the layout for the encoding. Normals are
+// expected to be unit length.
+void PackVertices(
+  PositionEncoding,
+  const glm::vec3*,
+  const glm::vec2*,
+  const glm::vec3*,
+  size_t,
+  VertexFormat&,
+  std::vector<char>&
+);
+
+// Decodes packed vertices back into separate arrays, for code that works
+// on the CPU copies.
+void UnpackVertices(
+  const VertexFormat&,
+  const char*,
+  size_t,
+  std::vector<glm::vec3>&,
+  std::vector<glm::vec2>&,
+  std::vector<glm::vec3>&
+);
+
+} // End of namespace.
+
+#endif
@@ -1,4 +1,9 @@
 #include "building.hpp"
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 using namespace glm;
@@ -22,6 +27,21 @@ Building::Building(shared_ptr<Renderer> renderer) : renderer_(renderer) {
   floors_.push_back(Floor(pos + vec3(4,  0, 2), 0.25, 4, 13));
 
   floors_.push_back(Floor(pos + vec3(14, 0, 5), 1, 1, 9));
+  BuildBounds();
+}
+
+void Building::SetFloors(vector<Floor> floors) {
+  floors_ = std::move(floors);
+  dirty_ = true;
+  BuildBounds();
+}
+
+// Scratch for the floor queries, which run on the simulation, physics and
+// benchmark threads alike, so each thread keeps its own.
+static vector<int>& CollidingFloors() {
+  thread_local vector<int> floors;
+  floors.clear();
+  return floors;
 }
 
 void Building::CreateFloor(glm::vec3 position, float s, bool door) {
@@ -60,7 +80,7 @@ void Building::CreateFloor(glm::vec3 position, float s, bool door) {
   }
 }
 
-void Building::CollideFloor(Floor& f, glm::vec3& player_pos, glm::vec3 prev_pos, bool& can_jump, glm::vec3& speed, BoundingBox& p) {
+void Building::CollideFloor(const Floor& f, glm::vec3& player_pos, glm::vec3 prev_pos, bool& can_jump, glm::vec3& speed, BoundingBox& p) const {
   // AABB collision.
   if (
       p.x >= f.position.x + f.width  || p.x + p.width  <= f.position.x ||
@@ -73,7 +93,7 @@ void Building::CollideFloor(Floor& f, glm::vec3& player_pos, glm::vec3 prev_pos,
 
   // Collision point between the player and each box face in collision 
   // vector coordinates.
-  vector<double> collision_magnitude {
+  double collision_magnitude[6] = {
     (f.position.y + f.height + 1.50 - prev_pos.y) / collision.y, // Top.
     (f.position.y - prev_pos.y                 )  / collision.y, // Bottom.
     (f.position.x + f.width  + 0.35 - prev_pos.x) / collision.x, // Right.
@@ -133,7 +153,7 @@ k = (10 - point.x) / direction.x
 vec3 intersection = point + direction * k
 
 */
-PointIntersection Building::GetPointIntersection(Floor& f, vec3 point, vec3 direction) {
+PointIntersection Building::GetPointIntersection(const Floor& f, vec3 point, vec3 direction) const {
   // The direction must be a unit vector. 
   direction /= length(direction); 
 
@@ -150,7 +170,7 @@ PointIntersection Building::GetPointIntersection(Floor& f, vec3 point, vec3 dire
   vec3 k_rtf = (rtf - point) / direction;
   float k[6] = { k_lbb.x, k_lbb.y, k_lbb.z, k_rtf.x, k_rtf.y, k_rtf.z };
 
-  vector<vec3> normals = { 
+  static const vec3 normals[6] = { 
     vec3(-1, 0, 0), vec3(0, -1, 0), vec3(0, 0, -1),
     vec3(+1, 0, 0), vec3(0, +1, 0), vec3(0, 0, +1) 
   };
@@ -179,24 +199,158 @@ PointIntersection Building::GetPointIntersection(Floor& f, vec3 point, vec3 dire
   }
 }
 
-PointIntersection Building::GetPointIntersection(vec3 point, vec3 direction) {
+// Slab test of the ray against floors [first, first + 8), with the boxes
+// grown by RAY_TEST_MARGIN so rounding never rejects a hit. Returns a bit
+// per floor that the ray may hit no farther than max_distance. The AVX
+// path needs a build with AVX enabled, see SIBYL_NATIVE in CMakeLists.txt.
+static int SlabTest(
+  const vector<float>* lo, const vector<float>* hi, int first,
+  vec3 point, vec3 inverse, float max_distance
+) {
+  const float margin = RAY_TEST_MARGIN;
+#if defined(__AVX__)
+  __m256 t_near = _mm256_set1_ps(-numeric_limits<float>::max());
+  __m256 t_far = _mm256_set1_ps(max_distance);
+  for (int axis = 0; axis < 3; axis++) {
+    __m256 p = _mm256_set1_ps(point[axis]);
+    __m256 inv = _mm256_set1_ps(inverse[axis]);
+    __m256 m = _mm256_set1_ps(margin);
+    __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(&lo[axis][first]), m), p), inv);
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(&hi[axis][first]), m), p), inv);
+    t_near = _mm256_max_ps(t_near, _mm256_min_ps(t0, t1));
+    t_far = _mm256_min_ps(t_far, _mm256_max_ps(t0, t1));
+  }
+  __m256 hit = _mm256_and_ps(
+    _mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ),
+    _mm256_cmp_ps(t_far, _mm256_setzero_ps(), _CMP_GE_OQ)
+  );
+  return _mm256_movemask_ps(hit);
+#elif defined(__SSE2__)
+  int mask = 0;
+  for (int half = 0; half < 8; half += 4) {
+    __m128 t_near = _mm_set1_ps(-numeric_limits<float>::max());
+    __m128 t_far = _mm_set1_ps(max_distance);
+    for (int axis = 0; axis < 3; axis++) {
+      __m128 p = _mm_set1_ps(point[axis]);
+      __m128 inv = _mm_set1_ps(inverse[axis]);
+      __m128 m = _mm_set1_ps(margin);
+      __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&lo[axis][first + half]), m), p), inv);
+      __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&hi[axis][first + half]), m), p), inv);
+      t_near = _mm_max_ps(t_near, _mm_min_ps(t0, t1));
+      t_far = _mm_min_ps(t_far, _mm_max_ps(t0, t1));
+    }
+    __m128 hit = _mm_and_ps(_mm_cmple_ps(t_near, t_far), _mm_cmpge_ps(t_far, _mm_setzero_ps()));
+    mask |= _mm_movemask_ps(hit) << half;
+  }
+  return mask;
+#else
+  int mask = 0;
+  for (int lane = 0; lane < 8; lane++) {
+    float t_near = -numeric_limits<float>::max();
+    float t_far = max_distance;
+    for (int axis = 0; axis < 3; axis++) {
+      float t0 = (lo[axis][first + lane] - margin - point[axis]) * inverse[axis];
+      float t1 = (hi[axis][first + lane] + margin - point[axis]) * inverse[axis];
+      t_near = std::max(t_near, std::min(t0, t1));
+      t_far = std::min(t_far, std::max(t0, t1));
+    }
+    if (t_near <= t_far && t_far >= 0) mask |= 1 << lane;
+  }
+  return mask;
+#endif
+}
+
+// The slab test picks the floors the ray may hit before the nearest hit so
+// t_far, and only those go through the exact test above, in order, so the
+// result is the same as testing every floor.
+PointIntersection Building::GetPointIntersection(vec3 point, vec3 direction) const {
+  vec3 unit = direction / length(direction);
+  vec3 inverse = 1.0f / unit;
+
   PointIntersection p;
-  for (auto& f : floors_) {
-    PointIntersection aux = GetPointIntersection(f, point, direction);
-    if (!aux.valid) continue;
-    if (aux.distance < p.distance) p = aux;
+  for (int first = 0; first < floors_.size(); first += 8) {
+    int mask = SlabTest(floor_min_, floor_max_, first, point, inverse, p.distance);
+    if (!mask) continue;
+
+    int lanes = std::min(int(floors_.size()) - first, 8);
+    for (int lane = 0; lane < lanes; lane++) {
+      if (!(mask & (1 << lane))) continue;
+
+      PointIntersection aux = GetPointIntersection(floors_[first + lane], point, direction);
+      if (!aux.valid) continue;
+      if (aux.distance < p.distance) p = aux;
+    }
   }
   return p;
 }
 
-void Building::Collide(glm::vec3& player_pos, glm::vec3 prev_pos, bool& can_jump, glm::vec3& speed, BoundingBox& p) {
-  for (auto& f : floors_) {
-    CollideFloor(f, player_pos, prev_pos, can_jump, speed, p);
+// Only the floors near the box swept from the previous position are
+// tested, in their original order since each one may move the player.
+void Building::Collide(glm::vec3& player_pos, glm::vec3 prev_pos, bool& can_jump, glm::vec3& speed, BoundingBox& p) const {
+  vec3 box_min(p.x, p.y, p.z);
+  vec3 box_max = box_min + vec3(p.width, p.height, p.length);
+  vec3 step = prev_pos - player_pos;
+  vector<int>& colliding_floors = CollidingFloors();
+  floor_bvh_.Query(box_min + glm::min(step, vec3(0)), box_max + glm::max(step, vec3(0)), colliding_floors);
+  sort(colliding_floors.begin(), colliding_floors.end());
+
+  for (int i : colliding_floors) {
+    CollideFloor(floors_[i], player_pos, prev_pos, can_jump, speed, p);
   }
 }
 
-void Building::DryCollide(vec3& pos, BoundingBox& p) {
-  for (auto& f : floors_) {
+// Each floor is grown by the box size, so the sweep becomes a ray from the
+// box corner, tested with the same slabs as GetPointIntersection.
+float Building::Sweep(const BoundingBox& p, vec3 displacement, vec3* normal) const {
+  vec3 box_min(p.x, p.y, p.z);
+  vec3 size(p.width, p.height, p.length);
+  vector<int>& colliding_floors = CollidingFloors();
+  floor_bvh_.Query(
+    box_min + glm::min(displacement, vec3(0)), 
+    box_min + size + glm::max(displacement, vec3(0)), 
+    colliding_floors
+  );
+
+  float toi = 1.0f;
+  for (int index : colliding_floors) {
+    const Floor& f = floors_[index];
+    vec3 lo = f.position - size;
+    vec3 hi = f.position + vec3(f.width, f.height, f.length);
+
+    float t_near = -numeric_limits<float>::max();
+    float t_far = numeric_limits<float>::max();
+    int axis = -1;
+    for (int i = 0; i < 3; i++) {
+      if (displacement[i] == 0) {
+        if (box_min[i] <= lo[i] || box_min[i] >= hi[i]) t_near = t_far = -1;
+        continue;
+      }
+      float t0 = (lo[i] - box_min[i]) / displacement[i];
+      float t1 = (hi[i] - box_min[i]) / displacement[i];
+      if (t0 > t1) swap(t0, t1);
+      if (t0 > t_near) {
+        t_near = t0;
+        axis = i;
+      }
+      t_far = std::min(t_far, t1);
+    }
+
+    if (axis == -1 || t_near >= t_far || t_near < 0 || t_near >= toi) continue;
+    toi = t_near;
+    *normal = vec3(0);
+    (*normal)[axis] = (displacement[axis] > 0) ? -1 : 1;
+  }
+  return toi;
+}
+
+void Building::DryCollide(vec3& pos, BoundingBox& p) const {
+  vec3 box_min(p.x, p.y, p.z);
+  vector<int>& colliding_floors = CollidingFloors();
+  floor_bvh_.Query(box_min, box_min + vec3(p.width, p.height, p.length), colliding_floors);
+  sort(colliding_floors.begin(), colliding_floors.end());
+
+  for (int index : colliding_floors) {
+    const Floor& f = floors_[index];
     // AABB collision.
     if (
         p.x >= f.position.x + f.width  || p.x + p.width  <= f.position.x ||
@@ -208,7 +362,7 @@ void Building::DryCollide(vec3& pos, BoundingBox& p) {
     vec3 collision = vec3(pos.x + p.width/2, pos.y + p.height/2, pos.z + p.length/2);
     collision -= f.position + vec3(f.width, f.height, f.length);
 
-    vector<GLfloat> components {
+    GLfloat components[6] = {
       (collision.y > 0) ? collision.y : numeric_limits<GLfloat>::max(),
       (collision.y < 0) ? -collision.y : numeric_limits<GLfloat>::max(),
       (collision.x > 0) ? collision.x : numeric_limits<GLfloat>::max(),
@@ -219,7 +373,7 @@ void Building::DryCollide(vec3& pos, BoundingBox& p) {
 
     int min_index = -1;
     GLfloat minimum = numeric_limits<GLfloat>::max();
-    for (int i = 0; i < components.size(); i++) {
+    for (int i = 0; i < 6; i++) {
       if (components[i] < minimum) {
         minimum = components[i];
         min_index = i;
@@ -249,11 +403,96 @@ void Building::DryCollide(vec3& pos, BoundingBox& p) {
   }
 }
 
-void Building::Draw(glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, glm::vec3 camera) {
+// Bakes all floors into a single static mesh so the whole building can be
+// drawn with one call. Only needs to run again when floors_ changes.
+void Building::CreateMesh() {
+  vector<vec3> vertices;
+  vector<vec2> uvs;
+  vector<unsigned int> indices;
+  vertices.reserve(floors_.size() * 24);
+  uvs.reserve(floors_.size() * 24);
+  indices.reserve(floors_.size() * 36);
+
   for (auto& f : floors_) {
     vec3 dimensions(f.width, f.length, f.height);
-    renderer_->DrawCube(ProjectionMatrix, ViewMatrix, camera, f.position, dimensions, 0.0);
+    renderer_->AppendCube(f.position, dimensions, vertices, uvs, indices);
+  }
+
+  // With no floors left the old mesh would still be drawn.
+  if (indices.empty()) {
+    renderer_->DeleteMesh("building");
+  } else {
+    renderer_->LoadMesh("building", vertices, uvs, indices);
+  }
+  dirty_ = false;
+}
+
+void Building::BuildBounds() {
+  vector<vec3> mins, maxs;
+  mins.reserve(floors_.size());
+  maxs.reserve(floors_.size());
+  for (auto& f : floors_) {
+    mins.push_back(f.position);
+    maxs.push_back(f.position + vec3(f.width, f.height, f.length));
+  }
+  floor_bvh_.Build(mins, maxs);
+
+  int padded = (floors_.size() + 7) & ~7;
+  for (int axis = 0; axis < 3; axis++) {
+    floor_min_[axis].assign(padded, 0.0f);
+    floor_max_[axis].assign(padded, 0.0f);
+    for (int i = 0; i < floors_.size(); i++) {
+      floor_min_[axis][i] = mins[i][axis];
+      floor_max_[axis][i] = maxs[i][axis];
+    }
+  }
+}
+
+void Building::Draw(glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, glm::vec3 camera) {
+  if (dirty_) CreateMesh();
+  renderer_->DrawBuilding("building", ProjectionMatrix, ViewMatrix);
+}
+
+void Building::Draw(SoftwareRenderer& software_renderer) {
+  if (dirty_) CreateMesh();
+  software_renderer.DrawBuilding("building");
+}
+
+// Walls and slabs are the occluders. Stairs and thin rails hide little and
+// would only cost rasterization time.
+void Building::RasterizeOccluders(OcclusionBuffer& occlusion_buffer) {
+  for (auto& f : floors_) {
+    float area = std::max(f.width * f.height, std::max(f.width * f.length, f.height * f.length));
+    if (area < OCCLUSION_MIN_OCCLUDER_AREA) continue;
+
+    vec3 dimensions(f.width, f.height, f.length);
+    occlusion_buffer.RasterizeBox(f.position, f.position + dimensions);
+  }
+}
+
+// When the mesh is stale it has to be rebuilt on the GL thread, so the whole
+// draw is deferred to replay time. Otherwise only the floors inside the
+// frustum are drawn, merging neighbours in the mesh into a single call.
+void Building::Record(CommandList& commands, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix) {
+  if (dirty_) {
+    commands.Callback([=]() { Draw(ProjectionMatrix, ViewMatrix, vec3(0)); });
+    return;
+  }
+
+  visible_floors_.clear();
+  floor_bvh_.Query(Frustum(ProjectionMatrix * ViewMatrix), visible_floors_);
+  if (visible_floors_.empty()) return;
+  sort(visible_floors_.begin(), visible_floors_.end());
+
+  floor_ranges_.clear();
+  for (int i : visible_floors_) {
+    if (!floor_ranges_.empty() && floor_ranges_.back().x + floor_ranges_.back().y == 36 * i) {
+      floor_ranges_.back().y += 36;
+    } else {
+      floor_ranges_.push_back(ivec2(36 * i, 36));
+    }
   }
+  renderer_->RecordBuilding(commands, "building", ProjectionMatrix, ViewMatrix, &floor_ranges_);
 }
 
 } // End of namespace.
@@ -0,0 +1,236 @@
+#include "bvh.hpp"
+#include <cfloat>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace Sibyl {
+
+// Rows of the view projection matrix, combined as in Gribb and Hartmann.
+Frustum::Frustum(const glm::mat4& m) {
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+  planes[0] = rows[3] + rows[0];
+  planes[1] = rows[3] - rows[0];
+  planes[2] = rows[3] + rows[1];
+  planes[3] = rows[3] - rows[1];
+  planes[4] = rows[3] + rows[2];
+  planes[5] = rows[3] - rows[2];
+}
+
+// Same rows, but bounded by a constant instead of w. The last plane always
+// passes.
+Frustum::Frustum(const glm::mat4& m, float distance) {
+  glm::vec4 rows[3];
+  for (int i = 0; i < 3; i++) rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+  glm::vec4 d(0, 0, 0, distance);
+  planes[0] = d + rows[0];
+  planes[1] = d - rows[0];
+  planes[2] = d + rows[1];
+  planes[3] = d - rows[1];
+  planes[4] = rows[2];
+  planes[5] = glm::vec4(0, 0, 0, 1);
+}
+
+// A box is outside when its corner farthest along the plane normal is
+// behind the plane.
+bool Frustum::Intersects(const glm::vec3& min, const glm::vec3& max) const {
+  for (int i = 0; i < 6; i++) {
+    const glm::vec4& p = planes[i];
+    glm::vec3 corner(
+      (p.x > 0) ? max.x : min.x,
+      (p.y > 0) ? max.y : min.y,
+      (p.z > 0) ? max.z : min.z
+    );
+    if (p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0) return false;
+  }
+  return true;
+}
+
+void Bvh::Build(const vector<glm::vec3>& mins, const vector<glm::vec3>& maxs) {
+  mins_ = mins;
+  maxs_ = maxs;
+  nodes_.clear();
+  items_.resize(mins_.size());
+  for (int i = 0; i < items_.size(); i++) items_[i] = i;
+  if (items_.empty()) return;
+
+  BuildNode(0, items_.size());
+}
+
+// Splits items_[begin, end) at the median centroid of its widest axis, three
+// times, which gives up to eight groups of about the same size.
+void Bvh::Split(int begin, int end, int levels, vector<glm::ivec2>& groups) {
+  if (levels == 0 || end - begin <= 1) {
+    groups.push_back(glm::ivec2(begin, end));
+    return;
+  }
+
+  glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  for (int i = begin; i < end; i++) {
+    glm::vec3 c = mins_[items_[i]] + maxs_[items_[i]];
+    lo = glm::min(lo, c);
+    hi = glm::max(hi, c);
+  }
+  glm::vec3 extent = hi - lo;
+  int axis = (extent.x > extent.y) ? 0 : 1;
+  if (extent.z > extent[axis]) axis = 2;
+
+  int mid = (begin + end) / 2;
+  nth_element(items_.begin() + begin, items_.begin() + mid, items_.begin() + end,
+    [&](int a, int b) {
+      return mins_[a][axis] + maxs_[a][axis] < mins_[b][axis] + maxs_[b][axis];
+    }
+  );
+
+  Split(begin, mid, levels - 1, groups);
+  Split(mid, end, levels - 1, groups);
+}
+
+// Returns the index of the node for items_[begin, end). Children are built
+// first, so the node is only written once its slots are known.
+int Bvh::BuildNode(int begin, int end) {
+  vector<glm::ivec2> groups;
+  if (end - begin <= 8) {
+    for (int i = begin; i < end; i++) groups.push_back(glm::ivec2(i, i + 1));
+  } else {
+    Split(begin, end, 3, groups);
+  }
+
+  BvhNode node;
+  for (int slot = 0; slot < 8; slot++) {
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    int child = 0;
+    if (slot < groups.size()) {
+      glm::ivec2 g = groups[slot];
+      for (int i = g.x; i < g.y; i++) {
+        lo = glm::min(lo, mins_[items_[i]]);
+        hi = glm::max(hi, maxs_[items_[i]]);
+      }
+      child = (g.y - g.x == 1) ? ~items_[g.x] : BuildNode(g.x, g.y);
+    }
+
+    node.min_x[slot] = lo.x;
+    node.min_y[slot] = lo.y;
+    node.min_z[slot] = lo.z;
+    node.max_x[slot] = hi.x;
+    node.max_y[slot] = hi.y;
+    node.max_z[slot] = hi.z;
+    node.children[slot] = child;
+  }
+
+  nodes_.push_back(node);
+  return nodes_.size() - 1;
+}
+
+// Returns a bit per child slot whose box intersects the frustum.
+static int TestChildren(const BvhNode& node, const Frustum& frustum) {
+  int mask = 0xff;
+  for (int i = 0; i < 6 && mask; i++) {
+    const glm::vec4& p = frustum.planes[i];
+    const float* x = (p.x > 0) ? node.max_x : node.min_x;
+    const float* y = (p.y > 0) ? node.max_y : node.min_y;
+    const float* z = (p.z > 0) ? node.max_z : node.min_z;
+
+#if defined(__AVX__)
+    __m256 d = _mm256_set1_ps(p.w);
+    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(p.x), _mm256_loadu_ps(x)));
+    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(p.y), _mm256_loadu_ps(y)));
+    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(p.z), _mm256_loadu_ps(z)));
+    mask &= _mm256_movemask_ps(_mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+#elif defined(__SSE2__)
+    for (int half = 0; half < 8; half += 4) {
+      __m128 d = _mm_set1_ps(p.w);
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.x), _mm_loadu_ps(x + half)));
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.y), _mm_loadu_ps(y + half)));
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.z), _mm_loadu_ps(z + half)));
+      mask &= ~(((~_mm_movemask_ps(_mm_cmpge_ps(d, _mm_setzero_ps()))) & 0xf) << half);
+    }
+#else
+    for (int slot = 0; slot < 8; slot++) {
+      if (p.x * x[slot] + p.y * y[slot] + p.z * z[slot] + p.w < 0) mask &= ~(1 << slot);
+    }
+#endif
+  }
+  return mask;
+}
+
+// Returns a bit per child slot whose box overlaps [min, max].
+static int TestChildren(const BvhNode& node, const glm::vec3& min, const glm::vec3& max) {
+  const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+  const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+
+  int mask = 0xff;
+  for (int axis = 0; axis < 3 && mask; axis++) {
+#if defined(__AVX__)
+    __m256 overlap = _mm256_and_ps(
+      _mm256_cmp_ps(_mm256_loadu_ps(lo[axis]), _mm256_set1_ps(max[axis]), _CMP_LE_OQ),
+      _mm256_cmp_ps(_mm256_loadu_ps(hi[axis]), _mm256_set1_ps(min[axis]), _CMP_GE_OQ)
+    );
+    mask &= _mm256_movemask_ps(overlap);
+#elif defined(__SSE2__)
+    for (int half = 0; half < 8; half += 4) {
+      __m128 overlap = _mm_and_ps(
+        _mm_cmple_ps(_mm_loadu_ps(lo[axis] + half), _mm_set1_ps(max[axis])),
+        _mm_cmpge_ps(_mm_loadu_ps(hi[axis] + half), _mm_set1_ps(min[axis]))
+      );
+      mask &= ~(((~_mm_movemask_ps(overlap)) & 0xf) << half);
+    }
+#else
+    for (int slot = 0; slot < 8; slot++) {
+      if (lo[axis][slot] > max[axis] || hi[axis][slot] < min[axis]) mask &= ~(1 << slot);
+    }
+#endif
+  }
+  return mask;
+}
+
+// Walks the nodes whose slots pass the test, which returns a mask of slots
+// as above.
+template <typename Test>
+static void Traverse(const vector<BvhNode>& nodes, Test test, vector<int>& result) {
+  static Counter& visited = Metrics::GetInstance().GetCounter("bvh_nodes_visited");
+  if (nodes.empty()) return;
+
+  // Median splits keep the depth at about log8(n), so each level leaves at
+  // most seven siblings on the stack.
+  int stack[128];
+  int size = 0;
+  stack[size++] = nodes.size() - 1;
+  while (size > 0) {
+    const BvhNode& node = nodes[stack[--size]];
+    visited.Add();
+
+    int mask = test(node);
+    for (int slot = 0; slot < 8; slot++) {
+      if (!(mask & (1 << slot))) continue;
+
+      int child = node.children[slot];
+      if (child < 0) {
+        result.push_back(~child);
+      } else {
+        stack[size++] = child;
+      }
+    }
+  }
+}
+
+void Bvh::Query(const Frustum& frustum, vector<int>& result) const {
+  Traverse(nodes_, [&](const BvhNode& node) {
+    return TestChildren(node, frustum);
+  }, result);
+}
+
+void Bvh::Query(const glm::vec3& min, const glm::vec3& max, vector<int>& result) const {
+  Traverse(nodes_, [&](const BvhNode& node) {
+    return TestChildren(node, min, max);
+  }, result);
+}
+
+} // End of namespace.
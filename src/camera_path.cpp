@@ -0,0 +1,61 @@
+#include "camera_path.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace Sibyl {
+
+void CameraPath::Load(const string& filename) {
+  ifstream f(filename);
+  if (!f.is_open()) throw runtime_error("Could not open camera path " + filename + ".");
+
+  keyframes_.clear();
+  string line;
+  while (getline(f, line)) {
+    if (line.empty() || line[0] == '#') continue;
+
+    CameraKeyframe k;
+    stringstream ss(line);
+    if (ss >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.h_angle >> k.v_angle)
+      keyframes_.push_back(k);
+  }
+
+  if (keyframes_.size() < 2) 
+    throw runtime_error("Camera path " + filename + " needs at least two keyframes.");
+}
+
+template<class T>
+static T CatmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float t) {
+  float t2 = t * t;
+  float t3 = t2 * t;
+  return 0.5f * (
+    (2.0f * p1) + 
+    (p2 - p0) * t + 
+    (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + 
+    (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3
+  );
+}
+
+// Times past the last keyframe clamp to it.
+CameraKeyframe CameraPath::Evaluate(double time) {
+  int n = keyframes_.size();
+  int i = 0;
+  while (i < n - 2 && keyframes_[i + 1].time <= time) i++;
+
+  const CameraKeyframe& k0 = keyframes_[std::max(i - 1, 0)];
+  const CameraKeyframe& k1 = keyframes_[i];
+  const CameraKeyframe& k2 = keyframes_[i + 1];
+  const CameraKeyframe& k3 = keyframes_[std::min(i + 2, n - 1)];
+
+  float t = (time - k1.time) / (k2.time - k1.time);
+  t = std::min(std::max(t, 0.0f), 1.0f);
+
+  CameraKeyframe k;
+  k.time = time;
+  k.position = CatmullRom(k0.position, k1.position, k2.position, k3.position, t);
+  k.h_angle = CatmullRom(k0.h_angle, k1.h_angle, k2.h_angle, k3.h_angle, t);
+  k.v_angle = CatmullRom(k0.v_angle, k1.v_angle, k2.v_angle, k3.v_angle, t);
+  return k;
+}
+
+} // End of namespace.
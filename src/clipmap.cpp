@@ -1,17 +1,58 @@
 #include "clipmap.hpp"
+#include <climits>
 
 namespace Sibyl {
 
 Clipmap::Clipmap() {}
 
+// Without the GPU resources the clipmap can still stream heights and answer
+// height queries, which lets the CPU side run without a GL context.
 Clipmap::Clipmap(
   vector< vector<float> > height_map,
-  unsigned int level
+  unsigned int level,
+  bool gpu
 ) : height_map_(height_map), level_(level) {
-  Init();
+  for (auto& row : height_map_) {
+    for (float h : row) {
+      min_height_ = std::min(min_height_, MAX_HEIGHT / 2 + h);
+      max_height_ = std::max(max_height_, MAX_HEIGHT / 2 + h);
+    }
+  }
+
+  // Each triangle in GetHeight has the height steps between neighbour
+  // samples as its gradient components. Outside the map the offset is 0.
+  int size = height_map_.size();
+  float max_step = 0;
+  for (int x = -1; x < size; x++) {
+    for (int y = -1; y < size; y++) {
+      bool inside = x >= 0 && y >= 0;
+      float h = (inside) ? height_map_[x][y] : 0;
+      float right = (x + 1 < size && y >= 0) ? height_map_[x + 1][y] : 0;
+      float down = (y + 1 < size && x >= 0) ? height_map_[x][y + 1] : 0;
+      max_step = std::max(max_step, std::max(fabs(right - h), fabs(down - h)));
+    }
+  }
+  max_slope_ = sqrt(2.0f) * max_step / TILE_SIZE;
+  Init(gpu);
 }
 
-void Clipmap::Init() {
+void Clipmap::Init(bool gpu) {
+  for (int z = 0; z <= CLIPMAP_SIZE; z++) {
+    for (int x = 0; x <= CLIPMAP_SIZE; x++) {
+      vertices_[z * (CLIPMAP_SIZE + 1) + x] = glm::vec3(x, 0, z);
+    }
+  }
+
+  for (int z = 0; z < CLIPMAP_SIZE+1; z++) {
+    height_buffer_.valid_rows[z] = 0;
+    height_buffer_.valid_columns[z] = 0;
+  }
+
+  if (gpu) CreateBuffers();
+}
+
+void Clipmap::CreateBuffers() {
+  vertex_array_ = CreateVertexArray();
   glGenBuffers(1, &vertex_buffer_);
   glGenBuffers(1, &uv_buffer_);
   glGenBuffers(1, &element_buffer_);
@@ -19,7 +60,6 @@ void Clipmap::Init() {
   std::vector<glm::vec2> uvs;
   for (int z = 0; z <= CLIPMAP_SIZE; z++) {
     for (int x = 0; x <= CLIPMAP_SIZE; x++) {
-      vertices_[z * (CLIPMAP_SIZE + 1) + x] = glm::vec3(x, 0, z);
       uvs.push_back(glm::vec2(x * GetTileSize(), z * GetTileSize()));
     }
   }
@@ -29,11 +69,9 @@ void Clipmap::Init() {
 
   glBindBuffer(GL_ARRAY_BUFFER, uv_buffer_);
   glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
-
-  for (int z = 0; z < CLIPMAP_SIZE+1; z++) {
-    height_buffer_.valid_rows[z] = 0;
-    height_buffer_.valid_columns[z] = 0;
-  }
+  SetVertexAttribute(vertex_buffer_, 0, 3);
+  SetVertexAttribute(uv_buffer_, 1, 2);
+  glBindVertexArray(0);
 
   glGenTextures(1, &height_texture_);
   glBindTexture(GL_TEXTURE_RECTANGLE, height_texture_);
@@ -132,6 +170,88 @@ float Clipmap::GetGridHeight(float x, float y) {
   // return 200.0f + long_wave;
 }
 
+// Interpolates the height inside a tile from its two triangles.
+float Clipmap::GetHeight(float x, float y) { 
+  glm::ivec2 top_left = (glm::ivec2(x, y) / TILE_SIZE) * TILE_SIZE;
+  if (x < 0 && fabs(top_left.x - x) > 0.00001) top_left.x -= TILE_SIZE;
+  if (y < 0 && fabs(top_left.y - y) > 0.00001) top_left.y -= TILE_SIZE;
+
+  float v[4];
+  v[0] = GetGridHeight(top_left.x                  , top_left.y                  );
+  v[1] = GetGridHeight(top_left.x                  , top_left.y + TILE_SIZE + 0.1);
+  v[2] = GetGridHeight(top_left.x + TILE_SIZE + 0.1, top_left.y + TILE_SIZE + 0.1);
+  v[3] = GetGridHeight(top_left.x + TILE_SIZE + 0.1, top_left.y                  );
+
+  glm::vec2 tile_v = (glm::vec2(x, y) - glm::vec2(top_left)) / float(TILE_SIZE);
+
+  // Top triangle.
+  if (tile_v.x + tile_v.y < 1.0f) {
+    return v[0] + tile_v.x * (v[3] - v[0]) + tile_v.y * (v[1] - v[0]);
+
+  // Bottom triangle.
+  } else {
+    tile_v = glm::vec2(1.0f) - tile_v; 
+    return v[2] + tile_v.x * (v[1] - v[2]) + tile_v.y * (v[3] - v[2]);
+  }
+}
+
+// Heights under n points, reading their x and z, as GetHeight. Neighbouring
+// points usually fall on the same tile, so its corners are only looked up
+// when the tile changes. Only reads the height map, so batches can be
+// queried from several threads at once.
+void Clipmap::GetHeights(const glm::vec3* points, int n, float* heights) {
+  glm::ivec2 tile(INT_MIN);
+  float v[4];
+  for (int i = 0; i < n; i++) {
+    float x = points[i].x;
+    float y = points[i].z;
+    glm::ivec2 top_left = (glm::ivec2(x, y) / TILE_SIZE) * TILE_SIZE;
+    if (x < 0 && fabs(top_left.x - x) > 0.00001) top_left.x -= TILE_SIZE;
+    if (y < 0 && fabs(top_left.y - y) > 0.00001) top_left.y -= TILE_SIZE;
+
+    if (top_left != tile) {
+      tile = top_left;
+      v[0] = GetGridHeight(top_left.x                  , top_left.y                  );
+      v[1] = GetGridHeight(top_left.x                  , top_left.y + TILE_SIZE + 0.1);
+      v[2] = GetGridHeight(top_left.x + TILE_SIZE + 0.1, top_left.y + TILE_SIZE + 0.1);
+      v[3] = GetGridHeight(top_left.x + TILE_SIZE + 0.1, top_left.y                  );
+    }
+
+    glm::vec2 tile_v = (glm::vec2(x, y) - glm::vec2(top_left)) / float(TILE_SIZE);
+    if (tile_v.x + tile_v.y < 1.0f) {
+      heights[i] = v[0] + tile_v.x * (v[3] - v[0]) + tile_v.y * (v[1] - v[0]);
+    } else {
+      tile_v = glm::vec2(1.0f) - tile_v; 
+      heights[i] = v[2] + tile_v.x * (v[1] - v[2]) + tile_v.y * (v[3] - v[2]);
+    }
+  }
+}
+
+// First t in [0, 1] where the point moving by the displacement is at or
+// below the ground, or a value above 1 if it stays above. This is
+// conservative advancement: the gap closes at most at the slope bound times
+// the horizontal speed plus the downward speed, so stepping by gap / rate
+// never jumps over the ground. Steps shorter than TERRAIN_MIN_ADVANCE are
+// rounded up so the loop ends.
+float Clipmap::GetTimeOfImpact(glm::vec3 start, glm::vec3 displacement) {
+  float horizontal = glm::length(glm::vec2(displacement.x, displacement.z));
+  float rate = max_slope_ * horizontal + std::max(-displacement.y, 0.0f);
+  if (rate <= 0) return (start.y <= GetHeight(start.x, start.z)) ? 0.0f : 2.0f;
+
+  float min_step = TERRAIN_MIN_ADVANCE / glm::length(displacement);
+  float t = 0;
+  for (int i = 0; i < TERRAIN_MAX_ADVANCE_STEPS && t <= 1.0f; i++) {
+    glm::vec3 p = start + displacement * t;
+    float gap = p.y - GetHeight(p.x, p.z);
+    if (gap <= 0) return t;
+    t += std::max(gap / rate, min_step);
+  }
+
+  // Too many steps along the ground. The end point is still tested.
+  glm::vec3 end = start + displacement;
+  return (end.y <= GetHeight(end.x, end.z)) ? 1.0f : 2.0f;
+}
+
 void Clipmap::UpdatePoint(int x, int y, float* p_height, glm::vec3* p_normal) {
   glm::ivec2 grid_coords = BufferToGridCoordinates(glm::ivec2(x, y));
   glm::vec3 world_coords = GridToWorldCoordinates(grid_coords);
@@ -159,17 +279,25 @@ void Clipmap::Update(glm::vec3 player_pos) {
   if (top_left_ == new_top_left && num_invalid_ == 0) return;
   top_left_ = new_top_left;
 
+  static Counter& texels = Metrics::GetInstance().GetCounter("clipmap_texels");
+  static Counter& upload_bytes = Metrics::GetInstance().GetCounter("texture_upload_bytes");
+  const int line_bytes = (CLIPMAP_SIZE + 1) * (sizeof(GLfloat) + sizeof(glm::vec3));
+
   // Rows.
   for (int y = 0; y < CLIPMAP_SIZE + 1; y++) {
     if (height_buffer_.valid_rows[y]) continue;
     for (int x = 0; x < CLIPMAP_SIZE + 1; x++) {
       UpdatePoint(x, y, &height_buffer_.row_heights[y][x], &height_buffer_.row_normals[y][x]);
     }
+    height_buffer_.valid_rows[y] = true;
+    texels.Add(CLIPMAP_SIZE + 1);
+    if (!height_texture_) continue;
+
     glBindTexture(GL_TEXTURE_RECTANGLE, height_texture_);
     glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, y, CLIPMAP_SIZE + 1, 1, GL_RED, GL_FLOAT, &height_buffer_.row_heights[y][0]);
     glBindTexture(GL_TEXTURE_RECTANGLE, normals_texture_);
     glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, y, CLIPMAP_SIZE + 1, 1, GL_RGB, GL_FLOAT, &height_buffer_.row_normals[y][0]);
-    height_buffer_.valid_rows[y] = true;
+    upload_bytes.Add(line_bytes);
   }
 
   // Columns.
@@ -178,54 +306,66 @@ void Clipmap::Update(glm::vec3 player_pos) {
     for (int y = 0; y < CLIPMAP_SIZE + 1; y++) {
       UpdatePoint(x, y, &height_buffer_.column_heights[x][y], &height_buffer_.column_normals[x][y]);
     }
+    height_buffer_.valid_columns[x] = true;
+    texels.Add(CLIPMAP_SIZE + 1);
+    if (!height_texture_) continue;
+
     glBindTexture(GL_TEXTURE_RECTANGLE, height_texture_);
     glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, 0, 1, CLIPMAP_SIZE + 1, GL_RED, GL_FLOAT, &height_buffer_.column_heights[x][0]);
     glBindTexture(GL_TEXTURE_RECTANGLE, normals_texture_);
     glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, 0, 1, CLIPMAP_SIZE + 1, GL_RGB, GL_FLOAT, &height_buffer_.column_normals[x][0]);
-    height_buffer_.valid_columns[x] = true;
+    upload_bytes.Add(line_bytes);
   }
 }
 
+// Tests the box around a subregion, between the given heights.
+bool Clipmap::IsOccluded(
+  int region, 
+  glm::ivec2 offset, 
+  float min_y, 
+  float max_y, 
+  const OcclusionBuffer* occlusion_buffer
+) {
+  if (!occlusion_buffer) return false;
+
+  glm::ivec2 top_lft, bot_rgt;
+  subregions_[region].GetBounds(offset, top_left_, &top_lft, &bot_rgt);
+  return !occlusion_buffer->IsVisible(
+    glm::vec3(top_lft.x, min_y, top_lft.y), 
+    glm::vec3(bot_rgt.x, max_y, bot_rgt.y)
+  );
+}
+
 void Clipmap::Render(
+  CommandList& commands,
   glm::vec3 player_pos, 
   Shader* shader, 
   glm::mat4 ProjectionMatrix, 
   glm::mat4 ViewMatrix,
-  bool center
+  bool center,
+  const OcclusionBuffer* occlusion_buffer
 ) {
   glm::mat4 ModelMatrix = glm::translate(glm::mat4(1.0), glm::vec3(top_left_.x * TILE_SIZE, 0, top_left_.y * TILE_SIZE));
   glm::mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
   glm::mat3 ModelView3x3Matrix = glm::mat3(ModelViewMatrix);
   glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-  glUniformMatrix4fv(shader->GetUniformId("MVP"),   1, GL_FALSE, &MVP[0][0]);
-  glUniformMatrix4fv(shader->GetUniformId("M"),     1, GL_FALSE, &ModelMatrix[0][0]);
-  glUniformMatrix4fv(shader->GetUniformId("V"),     1, GL_FALSE, &ViewMatrix[0][0]);
-  glUniformMatrix3fv(shader->GetUniformId("MV3x3"), 1, GL_FALSE, &ModelView3x3Matrix[0][0]);
-  glUniform1i(shader->GetUniformId("PURE_TILE_SIZE"), TILE_SIZE);
-  glUniform1i(shader->GetUniformId("TILE_SIZE"), TILE_SIZE * GetTileSize());
-  glUniform1i(shader->GetUniformId("CLIPMAP_SIZE"), CLIPMAP_SIZE);
-  glUniform1f(shader->GetUniformId("MAX_HEIGHT"), MAX_HEIGHT);
-  glUniform2iv(shader->GetUniformId("buffer_top_left"), 1, (int*) &height_buffer_.top_left);
-  glUniform2iv(shader->GetUniformId("top_left"), 1, (int*) &top_left_);
-
-  shader->BindBuffer(vertex_buffer_, 0, 3);
-  shader->BindBuffer(uv_buffer_, 1, 2);
-
-  glActiveTexture(GL_TEXTURE7);
-  glBindTexture(GL_TEXTURE_RECTANGLE, height_texture_);
-  glUniform1i(shader->GetUniformId("HeightMapSampler"), 7);
-
-  glActiveTexture(GL_TEXTURE8);
-  glBindTexture(GL_TEXTURE_RECTANGLE, normals_texture_);
-  glUniform1i(shader->GetUniformId("NormalsSampler"), 8);
-
-  glActiveTexture(GL_TEXTURE9);
-  glBindTexture(GL_TEXTURE_RECTANGLE, tangents_texture_);
-  glUniform1i(shader->GetUniformId("TangentSampler"), 9);
-
-  glActiveTexture(GL_TEXTURE10);
-  glBindTexture(GL_TEXTURE_RECTANGLE, bitangents_texture_);
-  glUniform1i(shader->GetUniformId("BitangentSampler"), 10);
+  commands.Uniform("MVP", MVP);
+  commands.Uniform("M", ModelMatrix);
+  commands.Uniform("V", ViewMatrix);
+  commands.Uniform("MV3x3", ModelView3x3Matrix);
+  commands.Uniform("PURE_TILE_SIZE", TILE_SIZE);
+  commands.Uniform("TILE_SIZE", TILE_SIZE * GetTileSize());
+  commands.Uniform("CLIPMAP_SIZE", CLIPMAP_SIZE);
+  commands.Uniform("MAX_HEIGHT", MAX_HEIGHT);
+  commands.Uniform("buffer_top_left", height_buffer_.top_left);
+  commands.Uniform("top_left", top_left_);
+
+  commands.BindVertexArray(vertex_array_);
+
+  commands.BindTexture("HeightMapSampler", height_texture_, GL_TEXTURE_RECTANGLE, 7);
+  commands.BindTexture("NormalsSampler", normals_texture_, GL_TEXTURE_RECTANGLE, 8);
+  commands.BindTexture("TangentSampler", tangents_texture_, GL_TEXTURE_RECTANGLE, 9);
+  commands.BindTexture("BitangentSampler", bitangents_texture_, GL_TEXTURE_RECTANGLE, 10);
 
   glm::ivec2 clipmap_offset = glm::ivec2(0, 0);
   if (!center) {
@@ -237,47 +377,45 @@ void Clipmap::Render(
 
   for (int region = 0 ; region < 5; region++) {
     if (!center && region == 4) continue;
-    subregions_[region].Draw(clipmap_offset, top_left_, false);
+    if (IsOccluded(region, clipmap_offset, min_height_, max_height_, occlusion_buffer)) continue;
+    subregions_[region].Draw(commands, clipmap_offset, top_left_, false);
   }
 } 
 
 void Clipmap::RenderWater(
+  CommandList& commands,
   glm::vec3 player_pos, 
   Shader* shader, 
   glm::mat4 ProjectionMatrix, 
   glm::mat4 ViewMatrix,
   glm::vec3 camera,
-  bool center
+  GLfloat water_move_factor,
+  bool center,
+  const OcclusionBuffer* occlusion_buffer
 ) {
   glm::mat4 ModelMatrix = glm::translate(glm::mat4(1.0), glm::vec3(top_left_.x * TILE_SIZE, 0, top_left_.y * TILE_SIZE));
   glm::mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
   glm::mat3 ModelView3x3Matrix = glm::mat3(ModelViewMatrix);
   glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-  glUniformMatrix4fv(shader->GetUniformId("MVP"),   1, GL_FALSE, &MVP[0][0]);
-  glUniformMatrix4fv(shader->GetUniformId("M"),     1, GL_FALSE, &ModelMatrix[0][0]);
-  glUniformMatrix4fv(shader->GetUniformId("V"),     1, GL_FALSE, &ViewMatrix[0][0]);
-  glUniformMatrix3fv(shader->GetUniformId("MV3x3"), 1, GL_FALSE, &ModelView3x3Matrix[0][0]);
-  glUniform1i(shader->GetUniformId("PURE_TILE_SIZE"), TILE_SIZE);
-  glUniform1i(shader->GetUniformId("TILE_SIZE"), TILE_SIZE * GetTileSize());
-  glUniform1i(shader->GetUniformId("CLIPMAP_SIZE"), CLIPMAP_SIZE);
-  glUniform1f(shader->GetUniformId("MAX_HEIGHT"), MAX_HEIGHT);
-  glUniform2iv(shader->GetUniformId("buffer_top_left"), 1, (int*) &height_buffer_.top_left);
-  glUniform2iv(shader->GetUniformId("top_left"), 1, (int*) &top_left_);
+  commands.Uniform("MVP", MVP);
+  commands.Uniform("M", ModelMatrix);
+  commands.Uniform("V", ViewMatrix);
+  commands.Uniform("MV3x3", ModelView3x3Matrix);
+  commands.Uniform("PURE_TILE_SIZE", TILE_SIZE);
+  commands.Uniform("TILE_SIZE", TILE_SIZE * GetTileSize());
+  commands.Uniform("CLIPMAP_SIZE", CLIPMAP_SIZE);
+  commands.Uniform("MAX_HEIGHT", MAX_HEIGHT);
+  commands.Uniform("buffer_top_left", height_buffer_.top_left);
+  commands.Uniform("top_left", top_left_);
 
   glm::vec3 lightPos = glm::vec3(0, 20000, 0);
-  glUniform3f(shader->GetUniformId("LightPosition_worldspace"), lightPos.x, lightPos.y, lightPos.z);
-  glUniform3fv(shader->GetUniformId("cameraPosition"), 1, (float*) &camera);
-
-  static float water_move_factor = 0;
-  water_move_factor += 0.0001f;
-  glUniform1f(shader->GetUniformId("moveFactor"), water_move_factor);
+  commands.Uniform("LightPosition_worldspace", lightPos);
+  commands.Uniform("cameraPosition", camera);
+  commands.Uniform("moveFactor", water_move_factor);
 
-  shader->BindBuffer(vertex_buffer_, 0, 3);
-  shader->BindBuffer(uv_buffer_, 1, 2);
+  commands.BindVertexArray(vertex_array_);
 
-  glActiveTexture(GL_TEXTURE5);
-  glBindTexture(GL_TEXTURE_RECTANGLE, height_texture_);
-  glUniform1i(shader->GetUniformId("HeightMapSampler"), 5);
+  commands.BindTexture("HeightMapSampler", height_texture_, GL_TEXTURE_RECTANGLE, 5);
 
   glm::ivec2 clipmap_offset = glm::ivec2(0, 0);
   if (!center) {
@@ -289,7 +427,9 @@ void Clipmap::RenderWater(
 
   for (int region = 0 ; region < 5; region++) {
     if (!center && region == 4) continue;
-    subregions_[region].Draw(clipmap_offset, top_left_, true);
+    float water_height = MAX_HEIGHT / 2 + 2;
+    if (IsOccluded(region, clipmap_offset, water_height, water_height, occlusion_buffer)) continue;
+    subregions_[region].Draw(commands, clipmap_offset, top_left_, true);
   }
 } 
 
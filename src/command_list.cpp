@@ -0,0 +1,162 @@
+#include "command_list.hpp"
+
+using namespace std;
+
+namespace Sibyl {
+
+void CommandList::Push(
+  CommandType type, const char* name, GLuint id, GLint a, GLint b, size_t offset
+) {
+  commands_.push_back({ type, shader_, name, id, a, b, offset });
+}
+
+size_t CommandList::PushData(const float* values, int n) {
+  size_t offset = data_.size();
+  data_.insert(data_.end(), values, values + n);
+  return offset;
+}
+
+void CommandList::UseProgram(Shader* shader) {
+  shader_ = shader;
+  Push(CMD_USE_PROGRAM);
+}
+
+void CommandList::Uniform(const char* name, const glm::mat4& m) {
+  Push(CMD_UNIFORM_MAT4, name, 0, 0, 0, PushData(&m[0][0], 16));
+}
+
+void CommandList::Uniform(const char* name, const glm::mat3& m) {
+  Push(CMD_UNIFORM_MAT3, name, 0, 0, 0, PushData(&m[0][0], 9));
+}
+
+void CommandList::Uniform(const char* name, const glm::vec3& v) {
+  Push(CMD_UNIFORM_VEC3, name, 0, 0, 0, PushData(&v[0], 3));
+}
+
+void CommandList::Uniform(const char* name, GLfloat f) {
+  Push(CMD_UNIFORM_FLOAT, name, 0, 0, 0, PushData(&f, 1));
+}
+
+void CommandList::Uniform(const char* name, GLint i) {
+  Push(CMD_UNIFORM_INT, name, 0, i);
+}
+
+void CommandList::Uniform(const char* name, const glm::ivec2& v) {
+  Push(CMD_UNIFORM_IVEC2, name, 0, v.x, v.y);
+}
+
+// Binds the texture to the next free texture slot of the current shader.
+void CommandList::BindTexture(const char* name, GLuint texture_id, GLenum target) {
+  Push(CMD_BIND_TEXTURE, name, texture_id, target);
+}
+
+// Binds the texture to a fixed texture unit.
+void CommandList::BindTexture(const char* name, GLuint texture_id, GLenum target, int unit) {
+  Push(CMD_BIND_TEXTURE_UNIT, name, texture_id, target, unit);
+}
+
+void CommandList::BindVertexArray(GLuint vertex_array) {
+  Push(CMD_BIND_VERTEX_ARRAY, nullptr, vertex_array);
+}
+
+// The first index is an offset into the element buffer, so a range of a
+// baked mesh can be drawn on its own. An element buffer of 0 draws from the
+// one recorded in the bound vertex array.
+void CommandList::DrawElements(GLuint element_buffer, GLsizei count, GLint first) {
+  Push(CMD_DRAW_ELEMENTS, nullptr, element_buffer, count, first);
+}
+
+void CommandList::DrawArrays(GLsizei count) {
+  Push(CMD_DRAW_ARRAYS, nullptr, 0, count);
+}
+
+void CommandList::Enable(GLenum cap) {
+  Push(CMD_ENABLE, nullptr, cap);
+}
+
+void CommandList::Disable(GLenum cap) {
+  Push(CMD_DISABLE, nullptr, cap);
+}
+
+// Releases the texture units taken by the current shader and unbinds the
+// vertex array, so later buffer uploads cannot change it.
+void CommandList::Clear() {
+  Push(CMD_CLEAR);
+}
+
+// Escape hatch for work that has to run on the GL thread at this point of
+// the list, like streaming data into buffers.
+void CommandList::Callback(function<void()> fn) {
+  callbacks_.push_back(fn);
+  Push(CMD_CALLBACK, nullptr, 0, 0, 0, callbacks_.size() - 1);
+}
+
+void CommandList::Execute() {
+  for (auto& c : commands_) {
+    switch (c.type) {
+      case CMD_USE_PROGRAM:
+        glUseProgram(c.shader->program_id());
+        break;
+      case CMD_UNIFORM_MAT4:
+        glUniformMatrix4fv(c.shader->GetUniformId(c.name), 1, GL_FALSE, &data_[c.offset]);
+        break;
+      case CMD_UNIFORM_MAT3:
+        glUniformMatrix3fv(c.shader->GetUniformId(c.name), 1, GL_FALSE, &data_[c.offset]);
+        break;
+      case CMD_UNIFORM_VEC3:
+        glUniform3fv(c.shader->GetUniformId(c.name), 1, &data_[c.offset]);
+        break;
+      case CMD_UNIFORM_FLOAT:
+        glUniform1f(c.shader->GetUniformId(c.name), data_[c.offset]);
+        break;
+      case CMD_UNIFORM_INT:
+        glUniform1i(c.shader->GetUniformId(c.name), c.a);
+        break;
+      case CMD_UNIFORM_IVEC2:
+        glUniform2i(c.shader->GetUniformId(c.name), c.a, c.b);
+        break;
+      case CMD_BIND_TEXTURE:
+        c.shader->BindTexture(c.name, c.id, c.a);
+        break;
+      case CMD_BIND_TEXTURE_UNIT:
+        glActiveTexture(GL_TEXTURE0 + c.b);
+        glBindTexture(c.a, c.id);
+        glUniform1i(c.shader->GetUniformId(c.name), c.b);
+        break;
+      case CMD_BIND_VERTEX_ARRAY:
+        glBindVertexArray(c.id);
+        break;
+      case CMD_DRAW_ELEMENTS:
+        if (c.id) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, c.id);
+        glDrawElements(GL_TRIANGLES, c.a, GL_UNSIGNED_INT, (void*) (c.b * sizeof(GLuint)));
+        CountDraw(c.a);
+        break;
+      case CMD_DRAW_ARRAYS:
+        glDrawArrays(GL_TRIANGLES, 0, c.a);
+        CountDraw(c.a);
+        break;
+      case CMD_ENABLE:
+        glEnable(c.id);
+        break;
+      case CMD_DISABLE:
+        glDisable(c.id);
+        break;
+      case CMD_CLEAR:
+        c.shader->Clear();
+        glBindVertexArray(0);
+        break;
+      case CMD_CALLBACK:
+        callbacks_[c.offset]();
+        break;
+    }
+  }
+}
+
+void CommandList::Reset() {
+  shader_ = nullptr;
+  commands_.clear();
+  data_.clear();
+  callbacks_.clear();
+}
+
+} // End of namespace.
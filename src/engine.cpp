@@ -6,11 +6,13 @@ Engine::Engine(
   shared_ptr<GameState> game_state, 
   shared_ptr<Renderer> renderer, 
   shared_ptr<EntityManager> entity_manager, 
-  shared_ptr<TextEditor> text_editor
+  shared_ptr<TextEditor> text_editor,
+  shared_ptr<ThreadPool> thread_pool
 ) : game_state_(game_state), 
     renderer_(renderer),
     entity_manager_(entity_manager), 
-    text_editor_(text_editor) {
+    text_editor_(text_editor),
+    thread_pool_(thread_pool) {
   CreateWindow();
 }
 
@@ -45,32 +47,157 @@ void Engine::CreateEntities() {
   );
 
   entity_manager_->set_terrain(terrain_);
+
+  simulation_ = make_shared<Simulation>(
+    entity_manager_, 
+    terrain_, 
+    game_state_->player()
+  );
+  CreateBodies(game_state_->options().physics_bodies);
+
+  if (game_state_->options().software) {
+    software_renderer_ = make_shared<SoftwareRenderer>(
+      renderer_, 
+      thread_pool_, 
+      game_state_->width(), 
+      game_state_->height()
+    );
+    software_renderer_->LoadTerrain(terrain_->height_map());
+  }
+
+  if (game_state_->options().heightfield) {
+    heightfield_renderer_ = make_shared<HeightfieldRenderer>(
+      thread_pool_, 
+      terrain_->height_map()
+    );
+    heightfield_framebuffer_.Resize(game_state_->width(), game_state_->height());
+    terrain_->set_draw_terrain(false);
+  }
+}
+
+// Drops a grid of crates and balls around the player (--physics-bodies).
+void Engine::CreateBodies(int num_bodies) {
+  if (num_bodies <= 0) return;
+
+  physics_ = make_shared<Physics>(
+    thread_pool_, 
+    entity_manager_->building(), 
+    terrain_->clipmap()
+  );
+
+  int side = ceil(sqrt(num_bodies));
+  vec3 center = game_state_->player().position;
+  for (int i = 0; i < num_bodies; i++) {
+    float x = center.x + 2.0f * (i % side - side / 2);
+    float z = center.z + 2.0f * (i / side - side / 2);
+    vec3 position(x, terrain_->GetHeight(x, z) + 10.0f + (i % 3), z);
+    if (i % 2) {
+      physics_->AddBody(RigidBody(BODY_SPHERE, position, vec3(0.4f), 1.0f));
+    } else {
+      physics_->AddBody(RigidBody(BODY_BOX, position, vec3(0.5f), 2.0f));
+    }
+  }
+  simulation_->set_physics(physics_);
 }
 
 void Engine::Render() {
+  // The simulation owns the player physics. Take the interpolated position
+  // but keep the local look angles so the mouse stays responsive.
+  if (!game_state_->FollowCameraPath()) {
+    Player& p = game_state_->player();
+    Player state = simulation_->Interpolate(game_state_->time());
+    p.position = state.position;
+    p.speed = state.speed;
+    p.can_jump = state.can_jump;
+  }
+
   game_state_->UpdateViewMatrix();
 
   ProjectionMatrix = game_state_->projection_matrix();
   ViewMatrix = game_state_->view_matrix();
 
-  if (game_state_->mode() == FREE) {
+  if (software_renderer_) {
+    RenderSoftware();
+  } else if (game_state_->mode() == FREE) {
     renderer_->SetFBO("intersect");
     renderer_->Clear(0, 0, 0);
     renderer_->SetFBO("screen");
     renderer_->Clear(0.3f, 0.5f, 0.6f);
 
-    sky_dome_->Draw(ProjectionMatrix, ViewMatrix, camera.position, player_.position);
-    terrain_->Draw(ProjectionMatrix, ViewMatrix, camera.position, player_.position);
-    entity_manager_->Draw();
+    // Texture uploads need the GL context, so they happen before recording.
+    terrain_->Update(player_.position);
+
+    // The building walls hide most of the scene from the inside, so they
+    // are rasterized on the CPU first and the subsystems skip what is 
+    // behind them.
+    frame_occlusion_buffer_ = nullptr;
+    if (game_state_->options().occlusion_culling) {
+      ScopedTimer timer("occlusion");
+      occlusion_buffer_.Begin(ProjectionMatrix, ViewMatrix);
+      entity_manager_->RasterizeOccluders(occlusion_buffer_);
+      frame_occlusion_buffer_ = &occlusion_buffer_;
+    }
+
+    // Each subsystem records its command lists on a worker thread. The lists
+    // are replayed in key order on this thread when the queue is flushed.
+    // The tasks only capture this, so they are built once and copying them
+    // into the pool does not allocate.
+    RenderQueue& queue = renderer_->render_queue();
+    if (record_tasks_.empty()) {
+      record_tasks_ = {
+        [this]() { 
+          ScopedTimer timer("record sky");
+          sky_dome_->Submit(renderer_->render_queue(), ProjectionMatrix, ViewMatrix, camera.position, player_.position, frame_occlusion_buffer_); 
+        },
+        [this]() { 
+          ScopedTimer timer("record terrain");
+          terrain_->Submit(renderer_->render_queue(), ProjectionMatrix, ViewMatrix, camera.position, player_.position, frame_occlusion_buffer_); 
+        },
+        [this]() { 
+          ScopedTimer timer("record entities");
+          entity_manager_->Submit(renderer_->render_queue(), frame_occlusion_buffer_); 
+        }
+      };
+    }
+    thread_pool_->Run(record_tasks_);
+
+    // The ray cast terrain goes in the opaque pass, so the water is still
+    // blended over it.
+    if (heightfield_renderer_) {
+      {
+        ScopedTimer timer("heightfield");
+        heightfield_framebuffer_.Clear(vec3(0));
+        heightfield_renderer_->Render(heightfield_framebuffer_, ProjectionMatrix, ViewMatrix);
+      }
+
+      uint64_t key = RenderQueue::MakeKey(PASS_OPAQUE, 0, 0, 0, 0);
+      queue.Submit(key, "heightfield", [this]() {
+        renderer_->CompositePixels(
+          "screen", 
+          &heightfield_framebuffer_.color[0], 
+          &heightfield_framebuffer_.depth[0]
+        );
+      });
+    }
+
+    queue.Flush((dump_render_queue_) ? &cout : nullptr);
+    dump_render_queue_ = false;
   }
 
-  renderer_->DrawScreen(game_state_->mode() != FREE);
+  if (!software_renderer_) {
+    ScopedTimer timer("screen");
+    GpuTimer gpu_timer("screen");
+    renderer_->DrawScreen(game_state_->mode() != FREE);
+    if (show_metrics_) DrawMetrics();
+  }
 
   switch (game_state_->mode()) {
     case TXT: {
       if (text_editor_->Close()) {
         game_state_->ChangeMode(FREE);
       } else {
+        ScopedTimer timer("text");
+        GpuTimer gpu_timer("text");
         text_editor_->Draw();
       }
       break;
@@ -80,6 +207,46 @@ void Engine::Render() {
   }
 }
 
+// The GL frame rasterized on the CPU. The text editor is still drawn with
+// GL on top of the presented frame.
+void Engine::RenderSoftware() {
+  ScopedTimer timer("software");
+  if (game_state_->mode() == FREE) {
+    software_renderer_->BeginFrame(ProjectionMatrix, ViewMatrix, vec3(0.3f, 0.5f, 0.6f));
+    if (heightfield_renderer_) {
+      software_renderer_->DrawHeightfield(*heightfield_renderer_);
+    } else {
+      software_renderer_->DrawTerrain();
+    }
+    entity_manager_->Draw(*software_renderer_);
+    software_renderer_->DrawWater(game_state_->camera().position);
+  }
+
+  software_renderer_->DrawScreen(game_state_->mode() != FREE);
+  if (show_metrics_) DrawMetrics();
+  software_renderer_->Present();
+}
+
+// DrawText centers each string on x, so the lines are padded to the same
+// width to keep them left aligned. The lines are kept across frames so the
+// HUD does not allocate.
+void Engine::DrawMetrics() {
+  ScopedTimer timer("metrics hud");
+  const int width = 48;
+  float x = 10 + width * 9 / 2;
+  float y = WINDOW_HEIGHT - LINE_HEIGHT - 10;
+  Metrics::GetInstance().GetHudLines(hud_lines_);
+  for (auto& line : hud_lines_) {
+    line.resize(width, ' ');
+    if (software_renderer_) {
+      software_renderer_->DrawText(line, x, y, vec3(1, 1, 0));
+    } else {
+      renderer_->DrawText(line, x, y, vec3(1, 1, 0));
+    }
+    y -= LINE_HEIGHT;
+  }
+}
+
 void Engine::ProcessGameInput(){
   static double last_time = glfwGetTime();
 
@@ -97,6 +264,18 @@ void Engine::ProcessGameInput(){
         case GLFW_KEY_ENTER:
           entity_manager_->Interact(kp.mods & GLFW_MOD_SHIFT);
           break;
+        // Print the sorted render queue for the next frame.
+        case GLFW_KEY_F1:
+          dump_render_queue_ = true;
+          break;
+        // Write the profiler ring buffer as a Chrome trace.
+        case GLFW_KEY_F2:
+          Profiler::GetInstance().ExportChromeTrace(PROFILER_TRACE_FILE);
+          break;
+        // Toggle the metrics overlay.
+        case GLFW_KEY_F3:
+          show_metrics_ = !show_metrics_;
+          break;
       }
     }
   }
@@ -104,42 +283,30 @@ void Engine::ProcessGameInput(){
   // Compute time difference between current and last frame.
   double current_time = glfwGetTime();
   
-  // Move forward.
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_W) == GLFW_PRESS)
-    game_state_->MovePlayer(FORWARD);
-
-  // Move backward.
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_S) == GLFW_PRESS)
-    game_state_->MovePlayer(BACK);
-
-  // Strafe right.
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_D) == GLFW_PRESS)
-    game_state_->MovePlayer(RIGHT);
-
-  // Strafe left.
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_A) == GLFW_PRESS)
-    game_state_->MovePlayer(LEFT);
+  // Movement is applied by the simulation thread once per tick.
+  PlayerInput input;
+  input.move[0] = game_state_->IsKeyDown(GLFW_KEY_W);
+  input.move[1] = game_state_->IsKeyDown(GLFW_KEY_S);
+  input.move[2] = game_state_->IsKeyDown(GLFW_KEY_A);
+  input.move[3] = game_state_->IsKeyDown(GLFW_KEY_D);
 
   float mouse_sensitivity = 0.025f;
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_H) == GLFW_PRESS)
+  if (game_state_->IsKeyDown(GLFW_KEY_H))
     game_state_->Look(LEFT, mouse_sensitivity);
 
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_J) == GLFW_PRESS)
+  if (game_state_->IsKeyDown(GLFW_KEY_J))
     game_state_->Look(DOWN, mouse_sensitivity);
 
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_K) == GLFW_PRESS)
+  if (game_state_->IsKeyDown(GLFW_KEY_K))
     game_state_->Look(UP, mouse_sensitivity);
 
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_L) == GLFW_PRESS)
+  if (game_state_->IsKeyDown(GLFW_KEY_L))
     game_state_->Look(RIGHT, mouse_sensitivity);
 
-  if (glfwGetKey(game_state_->window(), GLFW_KEY_SPACE) == GLFW_PRESS) {
-    game_state_->Jump();
-  }
+  input.jump = game_state_->IsKeyDown(GLFW_KEY_SPACE);
 
   double x_pos, y_pos;
-  glfwGetCursorPos(game_state_->window(), &x_pos, &y_pos);
-  glfwSetCursorPos(game_state_->window(), 0, 0);
+  game_state_->GetMouseDelta(&x_pos, &y_pos);
 
   // Change orientation.
   Player& p = game_state_->player();
@@ -148,44 +315,122 @@ void Engine::ProcessGameInput(){
   if (game_state_->player().v_angle < -1.57f) p.v_angle = -1.57f;
   if (game_state_->player().v_angle >  1.57f) p.v_angle = +1.57f;
 
+  input.h_angle = p.h_angle;
+  input.v_angle = p.v_angle;
+  simulation_->SetInput(input);
+
   last_time = current_time;
 }
 
-void Engine::UpdateForces() {
-  Player& p = game_state_->player();
-
-  glm::vec3 prev_pos = p.position;
+static double Percentile(const vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  int i = std::min(int(p * sorted.size()), int(sorted.size()) - 1);
+  return sorted[i];
+}
 
-  p.speed += glm::vec3(0, -GRAVITY, 0);
+// Frame time statistics after the warmup frames and the mean time per frame
+// spent in each profiled pass, on the CPU and on the GPU.
+// Adds the events recorded since the last call to the per pass totals.
+// Passes are few, so a linear search is enough, and the vectors stop
+// growing once every pass has been seen.
+void Engine::AddBenchmarkPassTimes() {
+  benchmark_events_.clear();
+  if (!Profiler::GetInstance().ReadEvents(&benchmark_events_read_, benchmark_events_)) {
+    benchmark_events_lost_ = true;
+  }
 
-  // Friction.
-  p.speed.x *= 0.9;
-  p.speed.y *= 0.99;
-  p.speed.z *= 0.9;
+  for (auto& e : benchmark_events_) {
+    if (e.start < benchmark_start_) continue;
 
-  p.position += p.speed;
+    vector<pair<string, double>>& times = benchmark_pass_times_[e.track];
+    auto it = times.begin();
+    while (it != times.end() && it->first != e.name) ++it;
+    if (it == times.end()) {
+      times.push_back(make_pair(string(e.name), 0.0));
+      it = times.end() - 1;
+    }
+    it->second += e.duration / 1000.0;
+  }
+}
 
-  // Test collision with building.
-  entity_manager_->Collide(p.position, prev_pos, p.can_jump, p.speed);
+// Returns false if the report could not be written, or if profiler events
+// were lost, in which case the per pass times would be too low.
+bool Engine::WriteBenchmarkReport() {
+  if (benchmark_events_lost_) {
+    cout << "Profiler events were lost, the per pass times are incomplete" << endl;
+    return false;
+  }
 
-  // Test collision with terrain.
-  float height = terrain_->GetHeight(p.position.x, p.position.z);
-  if (p.position.y - p.height < height) {
-    glm::vec3 pos = p.position;
-    pos.y = height + p.height;
-    p.position = pos;
-    glm::vec3 speed = p.speed;
-    if (speed.y < 0) speed.y = 0.0f;
-    p.speed = speed;
-    p.can_jump = true;
+  vector<double> sorted = benchmark_frame_times_;
+  sort(sorted.begin(), sorted.end());
+
+  double sum = 0;
+  for (double t : sorted) sum += t;
+  int num_frames = sorted.size();
+
+  for (auto& times : benchmark_pass_times_) sort(times.begin(), times.end());
+
+  stringstream ss;
+  ss << fixed << setprecision(3);
+  ss << "{" << endl;
+  ss << "  \"frames\": " << num_frames << "," << endl;
+  ss << "  \"warmup_frames\": " << BENCHMARK_WARMUP_FRAMES << "," << endl;
+  ss << "  \"frame_ms\": {" 
+     << "\"mean\": " << ((num_frames) ? sum / num_frames : 0) << ", "
+     << "\"p50\": " << Percentile(sorted, 0.5) << ", "
+     << "\"p95\": " << Percentile(sorted, 0.95) << ", "
+     << "\"p99\": " << Percentile(sorted, 0.99) << ", "
+     << "\"max\": " << ((num_frames) ? sorted.back() : 0) << "}," << endl;
+
+  const char* track_names[] = { "cpu", "gpu" };
+  ss << "  \"passes_ms\": {" << endl;
+  for (int track = 0; track < 2; track++) {
+    ss << "    \"" << track_names[track] << "\": {";
+    bool first = true;
+    for (auto& it : benchmark_pass_times_[track]) {
+      ss << ((first) ? "" : ", ") << "\"" << it.first << "\": " 
+         << ((num_frames) ? it.second / num_frames : 0);
+      first = false;
+    }
+    ss << "}" << ((track == 0) ? "," : "") << endl;
   }
+  ss << "  }" << endl;
+  ss << "}" << endl;
+
+  cout << ss.str();
+  ofstream f(game_state_->options().output);
+  if (!f.is_open()) {
+    cout << "Could not write " << game_state_->options().output << endl;
+    return false;
+  }
+  f << ss.str();
+  return true;
 }
 
-void Engine::Run() {
+// Returns the exit status: 1 if a frame after the warm up went over the
+// allocation budget (--max-frame-allocations), 0 otherwise.
+int Engine::Run() {
   CreateEntities();
 
+  // Replays and camera paths step the simulation from this thread so runs
+  // are repeatable.
+  if (!game_state_->deterministic()) simulation_->Start();
+
   double last_time = glfwGetTime();
+  double last_frame_time = last_time;
   int frames = 0;
+  int over_budget_frames = 0;
+  int max_allocations = game_state_->options().max_frame_allocations;
+  int64_t frame_allocations = heap_allocations.value();
+  Histogram& frame_ms = Metrics::GetInstance().GetHistogram("frame_ms");
+
+  // Benchmarks stop after a known number of frames, so the frame times fit
+  // without growing the vector during the run.
+  bool benchmark = game_state_->options().benchmark;
+  if (benchmark) {
+    benchmark_frame_times_.reserve(game_state_->options().frames);
+    benchmark_events_.reserve(PROFILER_BUFFER_SIZE);
+  }
   do {
     // Measure speed.
     double current_time = glfwGetTime();
@@ -193,12 +438,23 @@ void Engine::Run() {
 
     // If last printf() was more than 1 second ago.
     if (current_time - last_time >= 1.0) { 
-      cout << 1000.0 / double(frames) << " ms/frame" << endl;
+      cout << 1000.0 * (current_time - last_time) / double(frames) << " ms/frame" << endl;
       frames = 0;
-      last_time += 1.0;
+      last_time = current_time;
+    }
+
+    ScopedTimer frame_timer("frame");
+    frame_ms.Record(1000.0 * (current_time - last_frame_time));
+    if (benchmark) {
+      if (game_state_->frame() > BENCHMARK_WARMUP_FRAMES) {
+        benchmark_frame_times_.push_back(1000.0 * (current_time - last_frame_time));
+      } else {
+        benchmark_start_ = Profiler::GetInstance().Now();
+      }
     }
+    last_frame_time = current_time;
 
-    UpdateForces();
+    game_state_->BeginFrame();
     entity_manager_->Update();
 
     switch (game_state_->mode()) {
@@ -209,12 +465,33 @@ void Engine::Run() {
         break;
     }
 
+    if (game_state_->deterministic()) simulation_->StepTo(game_state_->time());
+
     Render();
 
     // Swap buffers.
-    glfwSwapBuffers(game_state_->window());
-    glfwPollEvents();
-  } while (glfwWindowShouldClose(game_state_->window()) == 0);
+    game_state_->SwapBuffers();
+
+    Profiler::GetInstance().Collect();
+    if (benchmark) AddBenchmarkPassTimes();
+    Metrics::GetInstance().EndFrame(current_time);
+
+    int64_t allocations = heap_allocations.value() - frame_allocations;
+    frame_allocations = heap_allocations.value();
+    if (max_allocations >= 0 && game_state_->frame() > BENCHMARK_WARMUP_FRAMES && allocations > max_allocations) {
+      cout << "Frame " << game_state_->frame() << " made " << allocations << " heap allocations" << endl;
+      over_budget_frames++;
+    }
+  } while (!game_state_->ShouldClose());
+
+  simulation_->Stop();
+  Profiler::GetInstance().ExportChromeTrace(PROFILER_TRACE_FILE);
+
+  bool report_failed = false;
+  if (benchmark) {
+    AddBenchmarkPassTimes();
+    report_failed = !WriteBenchmarkReport();
+  }
 
   // Cleanup VBO and shader.
   for (auto it : shaders_)
@@ -225,6 +502,12 @@ void Engine::Run() {
 
   // Close OpenGL window and terminate GLFW.
   glfwTerminate();
+
+  if (over_budget_frames > 0) {
+    cout << over_budget_frames << " frames went over the allocation budget" << endl;
+    return 1;
+  }
+  return (report_failed) ? 1 : 0;
 }
 
 } // End of namespace.
@@ -27,6 +27,7 @@ void EntityManager::Init() {
 void EntityManager::Load(const string& filename) {
   std::ifstream f(filename);
   if (!f.is_open()) return;
+  bvh_dirty_ = true;
   string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
 
   vector<string> lines;
@@ -122,12 +123,18 @@ void EntityManager::Save(const string& filename) {
 int EntityManager::CreatePlot(const string& filename, vec3 position, GLfloat rotation) {
   plots_.push_back(Plot(id_counter++, filename, position, rotation));
   renderer_->CreateFramebuffer(filename, 1024, 1024);
+  bvh_dirty_ = true;
 
   Plot& p = plots_[plots_.size()-1];
   plotter_->UpdatePlot(p.filename, p.filename);
   return id_counter-1;
 }
 
+mat4 EntityManager::GetModelMatrix(const Object& o) {
+  mat4 ModelMatrix = glm::translate(glm::mat4(1.0), o.position_);
+  return ModelMatrix * glm::rotate(glm::mat4(1.0f), o.rotation_, glm::vec3(0.0, 1.0, 0.0));
+}
+
 void EntityManager::Update() {
   mat4 ProjectionMatrix = game_state_->projection_matrix();
   mat4 ViewMatrix = game_state_->view_matrix();
@@ -154,34 +161,7 @@ void EntityManager::Update() {
     text_editor_->create_object = -1;
   }
 
-  for (auto& s : scrolls_) s.highlighted = false;
-  for (auto& p : plots_) p.highlighted = false;
-
-  GLfloat distance = numeric_limits<GLfloat>::max();
-  Object* selected_obj = nullptr;
-
-  vector<Object*> objs;
-  for (auto& s : scrolls_) objs.push_back(&s);
-  for (auto& p : plots_) objs.push_back(&p);
-
-  for (auto& o : objs) {
-    glm::mat4 ModelMatrix = glm::translate(glm::mat4(1.0), o->position_);
-    ModelMatrix *= glm::rotate(glm::mat4(1.0f), o->rotation_, glm::vec3(0.0, 1.0, 0.0));
-    vec4 screen_coords = (ProjectionMatrix * ViewMatrix * ModelMatrix) * vec4(0, 0, 0, 1);
-    if (screen_coords.z < 0) continue;
-
-    GLfloat cur_distance = length2(vec2(screen_coords.x, screen_coords.y));
-    if (cur_distance > 4) continue;
-
-    if (cur_distance < distance) {
-      distance = cur_distance;
-      selected_obj = o;
-    }
-  }
-
-  if (selected_obj) {
-    selected_obj->highlighted = true;
-  }
+  Pick(ProjectionMatrix * ViewMatrix);
 
   if (create_object_ != -1) {
     KeyPress kp;
@@ -191,6 +171,7 @@ void EntityManager::Update() {
           case GLFW_KEY_E:
           case GLFW_KEY_ENTER:
             create_object_ = -1;
+            bvh_dirty_ = true;
             Save("files/entities.txt");
             break;
           case GLFW_KEY_D: {
@@ -199,6 +180,7 @@ void EntityManager::Update() {
               if (plots_[i].id == active_object_id_) {
                 plots_.erase(plots_.begin() + i);
                 create_object_ = -1;
+                bvh_dirty_ = true;
                 Save("files/entities.txt");
                 break;
               }
@@ -212,36 +194,251 @@ void EntityManager::Update() {
 }
 
 void EntityManager::Draw() {
+  RenderQueue& queue = renderer_->render_queue();
+  Submit(queue);
+  queue.Flush();
+}
+
+// World space box around the transformed mesh bounds. Meshes that are not
+// loaded yet get a unit box around the model origin.
+void EntityManager::GetBounds(
+  const string& mesh_name, 
+  const mat4& ModelMatrix, 
+  vec3* min_corner,
+  vec3* max_corner
+) {
+  const Mesh* mesh = renderer_->GetMesh(mesh_name);
+  vec3 mesh_min = (mesh) ? mesh->min_ : vec3(-1);
+  vec3 mesh_max = (mesh) ? mesh->max_ : vec3(1);
+
+  *min_corner = vec3(numeric_limits<float>::max());
+  *max_corner = vec3(-numeric_limits<float>::max());
+  for (int i = 0; i < 8; i++) {
+    vec3 corner(
+      (i & 1) ? mesh_max.x : mesh_min.x,
+      (i & 2) ? mesh_max.y : mesh_min.y,
+      (i & 4) ? mesh_max.z : mesh_min.z
+    );
+    corner = vec3(ModelMatrix * vec4(corner, 1));
+    *min_corner = glm::min(*min_corner, corner);
+    *max_corner = glm::max(*max_corner, corner);
+  }
+}
+
+// Meshes that are not loaded yet are never occluded.
+bool EntityManager::IsOccluded(
+  const string& mesh_name, 
+  const mat4& ModelMatrix, 
+  const OcclusionBuffer* occlusion_buffer
+) {
+  if (!occlusion_buffer) return false;
+  if (!renderer_->GetMesh(mesh_name)) return false;
+
+  vec3 min_corner, max_corner;
+  GetBounds(mesh_name, ModelMatrix, &min_corner, &max_corner);
+  return !occlusion_buffer->IsVisible(min_corner, max_corner);
+}
+
+void EntityManager::BuildBvh() {
+  vector<vec3> mins, maxs;
+  mins.reserve(scrolls_.size() + objects_.size() + plots_.size());
+  maxs.reserve(mins.capacity());
+
+  // Picking looks at the origin, so the boxes must contain it.
+  auto add = [&](Object& o) {
+    vec3 min_corner, max_corner;
+    GetBounds(o.mesh_name_, GetModelMatrix(o), &min_corner, &max_corner);
+    mins.push_back(glm::min(min_corner, o.position_));
+    maxs.push_back(glm::max(max_corner, o.position_));
+    o.highlighted = false;
+  };
+  for (auto& s : scrolls_) add(s);
+  for (auto& o : objects_) add(o);
+  for (auto& p : plots_) add(p);
+
+  bvh_.Build(mins, maxs);
+  bvh_dirty_ = false;
+  highlighted_item_ = -1;
+}
+
+Object* EntityManager::GetItem(int item) {
+  if (item < scrolls_.size()) return &scrolls_[item];
+  item -= scrolls_.size();
+  if (item < objects_.size()) return &objects_[item];
+  return &plots_[item - objects_.size()];
+}
+
+// Highlights the scroll or plot whose origin is nearest to the view axis,
+// within two clip space units of it and in front of the camera. Only the
+// items the hierarchy finds in that prism are tested, and only the last
+// highlighted item is cleared, so the cost barely depends on the number of
+// entities.
+void EntityManager::Pick(const mat4& ViewProjection) {
+  if (bvh_dirty_) BuildBvh();
+  if (highlighted_item_ != -1) GetItem(highlighted_item_)->highlighted = false;
+  highlighted_item_ = -1;
+
+  pick_candidates_.clear();
+  bvh_.Query(Frustum(ViewProjection, 2.0f), pick_candidates_);
+
+  // The plot being placed has moved away from its box.
+  int first_plot = scrolls_.size() + objects_.size();
+  if (create_object_ != -1) {
+    for (int i = 0; i < plots_.size(); i++) {
+      if (plots_[i].id == active_object_id_) pick_candidates_.push_back(first_plot + i);
+    }
+  }
+  sort(pick_candidates_.begin(), pick_candidates_.end());
+
+  GLfloat distance = numeric_limits<GLfloat>::max();
+  for (int item : pick_candidates_) {
+    if (item >= scrolls_.size() && item < first_plot) continue;
+
+    Object* o = GetItem(item);
+    vec4 screen_coords = ViewProjection * vec4(o->position_, 1);
+    if (screen_coords.z < 0) continue;
+
+    GLfloat cur_distance = length2(vec2(screen_coords.x, screen_coords.y));
+    if (cur_distance > 4) continue;
+
+    if (cur_distance < distance) {
+      distance = cur_distance;
+      highlighted_item_ = item;
+    }
+  }
+
+  if (highlighted_item_ != -1) {
+    GetItem(highlighted_item_)->highlighted = true;
+  }
+}
+
+// Fills visible_ with the items inside the view frustum, in order, and
+// visible_plots_ with the plot indices among them. The plot being placed
+// moves every frame, so it is always included.
+void EntityManager::QueryVisible() {
+  if (bvh_dirty_) BuildBvh();
+
+  Frustum frustum(game_state_->projection_matrix() * game_state_->view_matrix());
+  visible_.clear();
+  bvh_.Query(frustum, visible_);
+  sort(visible_.begin(), visible_.end());
+
+  int first_plot = scrolls_.size() + objects_.size();
+  visible_plots_.clear();
+  for (int item : visible_) {
+    int i = item - first_plot;
+    if (i < 0 || i >= plots_.size()) continue;
+    if (create_object_ != -1 && plots_[i].id == active_object_id_) continue;
+    visible_plots_.push_back(i);
+  }
+
+  if (create_object_ == -1) return;
+  for (int i = 0; i < plots_.size(); i++) {
+    if (plots_[i].id == active_object_id_) visible_plots_.push_back(i);
+  }
+}
+
+// Groups the visible scrolls and objects by mesh so each mesh is drawn only
+// once.
+void EntityManager::CollectInstances(const OcclusionBuffer* occlusion_buffer) {
+  for (auto& it : instances_) it.second.clear();
+
+  QueryVisible();
+  for (int item : visible_) {
+    if (item < scrolls_.size()) {
+      auto& s = scrolls_[item];
+      mat4 ModelMatrix = GetModelMatrix(s);
+      if (IsOccluded(s.mesh_name_, ModelMatrix, occlusion_buffer)) continue;
+      instances_[s.mesh_name_].push_back(MeshInstance(ModelMatrix, (s.highlighted) ? 1.0 : 0.0));
+      continue;
+    }
+
+    item -= scrolls_.size();
+    if (item >= objects_.size()) break;
+
+    auto& o = objects_[item];
+    mat4 ModelMatrix = GetModelMatrix(o);
+    if (IsOccluded(o.mesh_name_, ModelMatrix, occlusion_buffer)) continue;
+    instances_[o.mesh_name_].push_back(MeshInstance(ModelMatrix, 0.0));
+  }
+}
+
+void EntityManager::RasterizeOccluders(OcclusionBuffer& occlusion_buffer) {
+  building_->RasterizeOccluders(occlusion_buffer);
+}
+
+// Software renderer counterpart of Submit. Plots are rendered into GL 
+// textures, so they are left out.
+void EntityManager::Draw(SoftwareRenderer& software_renderer) {
+  building_->Draw(software_renderer);
+
+  CollectInstances();
+  for (auto& it : instances_) {
+    software_renderer.DrawMeshInstanced(it.first, it.second);
+  }
+}
+
+// Submits the building, one instanced batch per mesh and the plots to the
+// render queue. Plots are blended, so they go in the translucent pass. The
+// matrix work happens here, so this can run on a worker thread; uploads 
+// are deferred to the GL thread. Instances and plots outside the frustum or
+// hidden behind the occluders are left out.
+void EntityManager::Submit(RenderQueue& queue, const OcclusionBuffer* occlusion_buffer) {
   mat4 ProjectionMatrix = game_state_->projection_matrix();
   mat4 ViewMatrix = game_state_->view_matrix();
   vec3 camera = game_state_->camera().position;
 
-  building_->Draw(ProjectionMatrix, ViewMatrix, camera);
+  CommandList building_commands(queue.arena());
+  building_->Record(building_commands, ProjectionMatrix, ViewMatrix);
+  uint64_t key = RenderQueue::MakeKey(
+    PASS_OPAQUE, renderer_->GetProgramId("building"), 0, 
+    renderer_->GetMeshId("building"), 0
+  );
+  queue.Submit(key, "building", std::move(building_commands));
+
+  CollectInstances(occlusion_buffer);
 
-  for (auto& s : scrolls_) {
-    renderer_->DrawMesh(s.mesh_name_, ProjectionMatrix, ViewMatrix, camera, s.position_, s.rotation_, s.highlighted);
-  }
+  GLuint object_program = renderer_->GetProgramId("object");
+  shared_ptr<Renderer> renderer = renderer_;
+  for (auto& it : instances_) {
+    if (it.second.empty()) continue;
 
-  for (auto& o : objects_) {
-    renderer_->DrawMesh(o.mesh_name_, ProjectionMatrix, ViewMatrix, camera, o.position_, o.rotation_, false);
+    // The instance lists are members, so they outlive the queue flush.
+    const string& mesh_name = it.first;
+    const vector<MeshInstance>* instances = &it.second;
+    key = RenderQueue::MakeKey(
+      PASS_OPAQUE, object_program, 0, renderer_->GetMeshId(mesh_name), 0
+    );
+    queue.Submit(key, mesh_name, [=, &mesh_name]() {
+      renderer->DrawMeshInstanced(mesh_name, ProjectionMatrix, ViewMatrix, *instances);
+    }, "entities");
   }
 
-  for (int i = 0; i < plots_.size(); i++) {
+  GLuint painting_program = renderer_->GetProgramId("painting");
+  for (int i : visible_plots_) {
     auto& p = plots_[i];
+    if (IsOccluded(p.mesh_name_, GetModelMatrix(p), occlusion_buffer)) continue;
 
     FBO fbo = renderer_->GetFBO(p.filename);
+    vec3 position = p.position_;
+    GLfloat rotation = p.rotation_;
+    bool highlighted = p.highlighted;
+    GLfloat alpha = 1.0;
     if (p.highlighted && create_object_ != -1) {
-      renderer_->DrawHighlightedObject(
-        "2d_plot", ProjectionMatrix, ViewMatrix, camera, 
-        p.position_, p.rotation_, p.collision, fbo.texture, 0.8
-      ); 
-      continue;
+      highlighted = p.collision;
+      alpha = 0.8;
     }
 
-    renderer_->DrawHighlightedObject(
-      "2d_plot", ProjectionMatrix, ViewMatrix, camera, 
-      p.position_, p.rotation_, p.highlighted, fbo.texture
+    key = RenderQueue::MakeKey(
+      PASS_TRANSLUCENT, painting_program, fbo.texture, 
+      renderer_->GetMeshId("2d_plot"), length(position - camera)
     );
+    queue.Submit(key, p.filename, [=]() {
+      renderer->DrawHighlightedObject(
+        "2d_plot", ProjectionMatrix, ViewMatrix, camera, 
+        position, rotation, highlighted, fbo.texture, alpha
+      );
+    }, "plots");
   }
 
   if (create_object_ != -1)
@@ -367,4 +564,32 @@ void EntityManager::Collide(glm::vec3& player_pos, glm::vec3 prev_pos, bool& can
   building_->Collide(player_pos, prev_pos, can_jump, speed, p);
 }
 
+// Moves the player without passing through the building, however long the
+// step. Each contact stops the motion along the face normal and the rest
+// of the displacement slides along the face. Landing on a face works like
+// the top face case of Building::CollideFloor.
+void EntityManager::Move(glm::vec3& player_pos, glm::vec3 displacement, bool& can_jump, glm::vec3& speed) {
+  for (int i = 0; i < 3; i++) {
+    BoundingBox p = BoundingBox(
+      player_pos.x - 0.35, 
+      player_pos.y - 1.5, 
+      player_pos.z - 0.35, 
+      0.7, 1.5, 0.7
+    );
+
+    vec3 normal;
+    float toi = building_->Sweep(p, displacement, &normal);
+    player_pos += displacement * toi;
+    if (toi >= 1.0f) return;
+
+    player_pos += normal * 0.0001f;
+    displacement *= 1.0f - toi;
+    displacement -= normal * dot(displacement, normal);
+    if (normal.y > 0) {
+      can_jump = true;
+      speed.y = 0;
+    }
+  }
+}
+
 } // End of namespace.
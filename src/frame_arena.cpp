@@ -0,0 +1,66 @@
+#include "frame_arena.hpp"
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+namespace Sibyl {
+
+FrameArena::FrameArena(size_t capacity)
+  : buffer_(new char[capacity]),
+    capacity_(capacity),
+    offset_(0),
+    destructors_(nullptr) {
+}
+
+FrameArena::~FrameArena() {
+  Reset();
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment) {
+  // Reserving size + alignment - 1 bytes leaves room to align the start.
+  size_t reserved = size + alignment - 1;
+  size_t offset = offset_.fetch_add(reserved, memory_order_relaxed);
+  if (offset + reserved <= capacity_) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(buffer_.get() + offset);
+    p = (p + alignment - 1) & ~uintptr_t(alignment - 1);
+    return reinterpret_cast<void*>(p);
+  }
+
+  static Counter& overflows = Metrics::GetInstance().GetCounter("frame_arena_overflows");
+  overflows.Add();
+
+  // The heap aligns to max_align_t, which covers every type here.
+  void* p = ::operator new(size);
+  lock_guard<mutex> lock(mutex_);
+  overflow_.push_back(p);
+  overflow_bytes_ += reserved;
+  return p;
+}
+
+const char* FrameArena::Copy(const string& s) {
+  char* p = static_cast<char*>(Allocate(s.size() + 1, 1));
+  memcpy(p, s.c_str(), s.size() + 1);
+  return p;
+}
+
+void FrameArena::Reset() {
+  static Gauge& used_bytes = Metrics::GetInstance().GetGauge("frame_arena_bytes");
+  used_bytes.Set(std::min(used(), capacity_) + overflow_bytes_);
+
+  for (Destructor* d = destructors_.load(); d; d = d->next) d->destroy(d->object);
+  destructors_.store(nullptr);
+
+  for (void* p : overflow_) ::operator delete(p);
+  overflow_.clear();
+
+  // Grow once, so the next frame of the same size fits.
+  if (overflow_bytes_ > 0) {
+    capacity_ = std::max(2 * capacity_, capacity_ + overflow_bytes_);
+    buffer_.reset(new char[capacity_]);
+    overflow_bytes_ = 0;
+  }
+  offset_.store(0);
+}
+
+} // End of namespace.
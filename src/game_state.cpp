@@ -7,12 +7,72 @@ namespace Sibyl {
 
 string GameState::write_buffer_;
 queue<KeyPress> GameState::input_queue_;
+Options GameState::options_;
+set<int> GameState::keys_down_;
+FrameInput GameState::frame_input_;
 
 GameState::GameState() {
   Init();
 }
 
+// Consumes the options it knows and returns the remaining arguments.
+vector<string> GameState::ParseOptions(int argc, char** argv) {
+  vector<string> args;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--headless") {
+      options_.headless = true;
+    } else if (arg == "--benchmark") {
+      options_.benchmark = true;
+    } else if (arg == "--software") {
+      options_.software = true;
+    } else if (arg == "--heightfield") {
+      options_.heightfield = true;
+    } else if (arg == "--no-occlusion-culling") {
+      options_.occlusion_culling = false;
+    } else if (arg == "--keep-mesh-data") {
+      options_.keep_mesh_data = true;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      options_.frames = atoi(argv[++i]);
+    } else if (arg == "--max-frame-allocations" && i + 1 < argc) {
+      options_.max_frame_allocations = atoi(argv[++i]);
+    } else if (arg == "--physics-bodies" && i + 1 < argc) {
+      options_.physics_bodies = atoi(argv[++i]);
+    } else if (arg == "--record" && i + 1 < argc) {
+      options_.record = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      options_.replay = argv[++i];
+    } else if (arg == "--camera-path" && i + 1 < argc) {
+      options_.camera_path = argv[++i];
+    } else if (arg == "--output" && i + 1 < argc) {
+      options_.output = argv[++i];
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  // A benchmark without an explicit input source flies the default path.
+  if (options_.benchmark && options_.replay.empty() && options_.camera_path.empty())
+    options_.camera_path = BENCHMARK_CAMERA_PATH;
+
+  // The software renderer draws from the CPU copies of the meshes.
+  if (options_.software) options_.keep_mesh_data = true;
+  return args;
+}
+
 void GameState::Init() {
+  // Headless mode runs without a display or a GPU. GLFW's null platform 
+  // gives us an invisible window so the input code keeps working, and the
+  // context comes from OSMesa (llvmpipe). Frames are rendered into the 
+  // screen FBO and never presented.
+  if (options_.headless) {
+#ifdef GLFW_PLATFORM_NULL
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+    throw "Headless mode requires GLFW 3.4 or newer";
+#endif
+  }
+
   if (!glfwInit()) throw "Failed to initialize GLFW";
 
   glfwWindowHint(GLFW_SAMPLES, 4);
@@ -23,7 +83,15 @@ void GameState::Init() {
   // To make MacOS happy; should not be needed.
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); 
 
-  if (FULLSCREEN)
+  if (options_.headless) {
+#ifdef GLFW_OSMESA_CONTEXT_API
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_SAMPLES, 0);
+  }
+
+  if (FULLSCREEN && !options_.headless)
     window_ = glfwCreateWindow(window_width_, window_height_, APP_NAME, glfwGetPrimaryMonitor(), NULL);
   else
     window_ = glfwCreateWindow(window_width_, window_height_, APP_NAME, NULL, NULL);
@@ -41,7 +109,14 @@ void GameState::Init() {
 
   // Needed for core profile.
   glewExperimental = true; 
-  if (glewInit() != GLEW_OK) {
+  GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  // GLEW also looks for GLX, which is not there without an X server. The 
+  // GL entry points are loaded anyway.
+  if (options_.headless && glew_status == GLEW_ERROR_NO_GLX_DISPLAY) 
+    glew_status = GLEW_OK;
+#endif
+  if (glew_status != GLEW_OK) {
     glfwTerminate();
     throw "Failed to initialize GLEW";
   }
@@ -54,15 +129,106 @@ void GameState::Init() {
   glfwSetCharCallback(window_, GameState::PressCharCallback);
   glfwSetKeyCallback(window_, GameState::PressKeyCallback);
 
+  if (!options_.record.empty()) recorder_.OpenForWriting(options_.record);
+  if (!options_.replay.empty()) recorder_.OpenForReading(options_.replay);
+  if (!options_.camera_path.empty()) camera_path_.Load(options_.camera_path);
+
   projection_matrix_ = glm::perspective(glm::radians(PLAYER_FOV), 4.0f / 3.0f, NEAR_CLIPPING, FAR_CLIPPING);
 }
 
+// Live input is ignored during a replay, so the recording is the only 
+// source of events.
 void GameState::PressCharCallback(GLFWwindow* window, unsigned int char_code) {
+  if (!options_.replay.empty()) return;
   write_buffer_ += (char) char_code;
+  frame_input_.chars += (char) char_code;
 }
 
 void GameState::PressKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+  if (!options_.replay.empty()) return;
   input_queue_.push({ key, scancode, action, mods });
+  frame_input_.keys.push_back({ key, scancode, action, mods });
+  if (action == GLFW_PRESS) keys_down_.insert(key);
+  if (action == GLFW_RELEASE) keys_down_.erase(key);
+}
+
+// Gathers the input for the frame. Live input comes from the GLFW callbacks
+// and the cursor, and is written out when recording. A replay feeds the 
+// recorded events back through the same queues. Replays and camera paths 
+// use recorded or fixed step times, so they do not depend on how fast the
+// frames are rendered.
+void GameState::BeginFrame() {
+  if (recorder_.replaying()) {
+    frame_input_ = FrameInput();
+    if (!recorder_.Read(&frame_input_)) {
+      replay_finished_ = true;
+      return;
+    }
+
+    for (auto& k : frame_input_.keys) {
+      input_queue_.push(k);
+      if (k.action == GLFW_PRESS) keys_down_.insert(k.key);
+      if (k.action == GLFW_RELEASE) keys_down_.erase(k.key);
+    }
+    write_buffer_ += frame_input_.chars;
+    time_ = frame_input_.time;
+    return;
+  }
+
+  glfwGetCursorPos(window_, &frame_input_.mouse_x, &frame_input_.mouse_y);
+  glfwSetCursorPos(window_, 0, 0);
+
+  if (!camera_path_.empty()) {
+    time_ = frame_ / double(SIMULATION_TICK_RATE);
+    frame_input_.mouse_x = frame_input_.mouse_y = 0;
+  } else {
+    time_ = glfwGetTime();
+  }
+  frame_input_.time = time_;
+
+  if (recorder_.recording()) recorder_.Write(frame_input_);
+  frame_input_.keys.clear();
+  frame_input_.chars.clear();
+}
+
+bool GameState::IsKeyDown(int key) {
+  return keys_down_.count(key) > 0;
+}
+
+void GameState::GetMouseDelta(double* x, double* y) {
+  *x = frame_input_.mouse_x;
+  *y = frame_input_.mouse_y;
+}
+
+// Places the player on the camera path for the current frame. Returns false
+// when there is no path to follow.
+bool GameState::FollowCameraPath() {
+  if (camera_path_.empty()) return false;
+
+  CameraKeyframe k = camera_path_.Evaluate(fmod(time_, camera_path_.duration()));
+  player_.position = k.position;
+  player_.h_angle = k.h_angle;
+  player_.v_angle = k.v_angle;
+  player_.speed = vec3(0);
+  return true;
+}
+
+// In headless mode there is nothing to present, so we only wait for the 
+// frame to finish to keep the frame timings comparable with a real swap.
+void GameState::SwapBuffers() {
+  if (options_.headless) {
+    glFinish();
+  } else {
+    glfwSwapBuffers(window_);
+  }
+  glfwPollEvents();
+  frame_++;
+}
+
+bool GameState::ShouldClose() {
+  if (replay_finished_) return true;
+  if (options_.headless || options_.benchmark) return frame_ >= options_.frames;
+  return glfwWindowShouldClose(window_) != 0;
 }
 
 bool GameState::ReadBuffer(string* buffer) {
@@ -0,0 +1,374 @@
+#include "heightfield_renderer.hpp"
+#include <cfloat>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace Sibyl {
+
+HeightfieldRenderer::HeightfieldRenderer(
+  shared_ptr<ThreadPool> thread_pool,
+  const vector< vector<float> >& height_map
+) : thread_pool_(thread_pool),
+    size_(height_map.size()) {
+  heights_.resize(size_ * size_);
+  for (int i = 0; i < size_; i++) {
+    for (int j = 0; j < size_; j++) {
+      heights_[i * size_ + j] = MAX_HEIGHT / 2 + height_map[i][j];
+    }
+  }
+  BuildMaxMips();
+  strip_workers_.assign(std::max(thread_pool_->size(), 1), [this]() { RenderStrips(); });
+}
+
+// Level 0 has one cell per tile. Each level halves the number of cells in
+// both directions, until a single cell covers the whole map.
+void HeightfieldRenderer::BuildMaxMips() {
+  max_mips_.clear();
+  mip_sizes_.clear();
+  if (size_ < 2) return;
+
+  int n = size_ - 1;
+  vector<float> level(n * n);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      const float* h = &heights_[i * size_ + j];
+      level[i * n + j] = std::max(std::max(h[0], h[1]), std::max(h[size_], h[size_ + 1]));
+    }
+  }
+  max_mips_.push_back(std::move(level));
+  mip_sizes_.push_back(n);
+
+  while (n > 1) {
+    int m = (n + 1) / 2;
+    vector<float> next(m * m, -FLT_MAX);
+    const vector<float>& prev = max_mips_.back();
+    for (int i = 0; i < n; i++) {
+      for (int j = 0; j < n; j++) {
+        float& h = next[(i / 2) * m + j / 2];
+        h = std::max(h, prev[i * n + j]);
+      }
+    }
+    max_mips_.push_back(std::move(next));
+    mip_sizes_.push_back(m);
+    n = m;
+  }
+}
+
+// Intersects the ray with one of the two triangles of a tile between a and
+// b. Along the ray both the height of the plane and the height of the ray
+// are linear, so the crossing is exact.
+static bool IntersectTriangle(
+  const glm::vec3& o, const glm::vec3& d, const float* h, bool upper,
+  float a, float b, float* t, float* slope_x, float* slope_z
+) {
+  float h00 = h[0], h01 = h[1], h10 = h[2], h11 = h[3];
+  auto f = [&](float s) {
+    float u = o.x + d.x * s;
+    float v = o.z + d.z * s;
+    float height = (upper)
+      ? h00 + u * (h10 - h00) + v * (h01 - h00)
+      : h11 + (1 - u) * (h01 - h11) + (1 - v) * (h10 - h11);
+    return o.y + d.y * s - height;
+  };
+
+  float fa = f(a);
+  float fb = f(b);
+  if (fa > 0 && fb > 0) return false;
+
+  *t = (fa <= 0) ? a : a + (b - a) * fa / (fa - fb);
+  *slope_x = (upper) ? h10 - h00 : h11 - h01;
+  *slope_z = (upper) ? h01 - h00 : h11 - h10;
+  return true;
+}
+
+// The ray is in grid space: x and z in tiles from the first height map
+// sample, y in world units. The max mip is walked from the top level. A cell
+// whose highest point is below the ray is skipped and the walk moves up a
+// level, otherwise it moves down until it reaches the triangles of a tile.
+// Cells are tracked by their level 0 indices, so every step strictly
+// advances along the axis the ray left through.
+bool HeightfieldRenderer::Intersect(
+  const glm::vec3& o, const glm::vec3& d, float t_min, float t_max, Hit* hit, int* steps
+) const {
+  int n = size_ - 1;
+  int top = max_mips_.size() - 1;
+  float top_height = max_mips_[top][0];
+
+  // Clips the ray to the box around the map.
+  float t0 = t_min;
+  float t1 = t_max;
+  for (int axis = 0; axis < 3; axis += 2) {
+    if (d[axis] == 0) {
+      if (o[axis] < 0 || o[axis] > n) t1 = -1;
+      continue;
+    }
+    float a = -o[axis] / d[axis];
+    float b = (n - o[axis]) / d[axis];
+    t0 = std::max(t0, std::min(a, b));
+    t1 = std::min(t1, std::max(a, b));
+  }
+  if (d.y < 0) t0 = std::max(t0, (top_height - o.y) / d.y);
+  else if (d.y > 0) t1 = std::min(t1, (top_height - o.y) / d.y);
+  else if (o.y > top_height) t1 = -1;
+
+  if (t0 < t1) {
+    int gx = glm::clamp(int(floor(o.x + d.x * t0)), 0, n - 1);
+    int gz = glm::clamp(int(floor(o.z + d.z * t0)), 0, n - 1);
+    int level = top;
+    float t = t0;
+    float inv_dx = 1.0f / d.x;
+    float inv_dz = 1.0f / d.z;
+    while (true) {
+      (*steps)++;
+      int cx = gx >> level;
+      int cz = gz >> level;
+      float tx = FLT_MAX;
+      float tz = FLT_MAX;
+      if (d.x > 0) tx = (((cx + 1) << level) - o.x) * inv_dx;
+      if (d.x < 0) tx = ((cx << level) - o.x) * inv_dx;
+      if (d.z > 0) tz = (((cz + 1) << level) - o.z) * inv_dz;
+      if (d.z < 0) tz = ((cz << level) - o.z) * inv_dz;
+      float t_exit = std::min(std::min(tx, tz), t1);
+
+      float y_min = o.y + d.y * ((d.y < 0) ? t_exit : t);
+      if (y_min <= max_mips_[level][cx * mip_sizes_[level] + cz]) {
+        if (level > 0) {
+          level--;
+          continue;
+        }
+
+        // The tile is split along u + v = 1, like Clipmap::GetHeight.
+        const float* row = &heights_[gx * size_ + gz];
+        float h[4] = { row[0], row[1], row[size_], row[size_ + 1] };
+        glm::vec3 local(o.x - gx, o.y, o.z - gz);
+        float t_split = FLT_MAX;
+        if (d.x + d.z != 0) t_split = (1 - local.x - local.z) / (d.x + d.z);
+
+        bool upper = local.x + local.z + (d.x + d.z) * (t + t_exit) * 0.5f < 1;
+        if (t_split > t && t_split < t_exit) {
+          upper = local.x + local.z + (d.x + d.z) * t < 1;
+          if (IntersectTriangle(local, d, h, upper, t, t_split, &hit->t, &hit->slope_x, &hit->slope_z))
+            return true;
+          t = t_split;
+          upper = !upper;
+        }
+        if (IntersectTriangle(local, d, h, upper, t, t_exit, &hit->t, &hit->slope_x, &hit->slope_z))
+          return true;
+      }
+
+      if (t_exit >= t1) break;
+      t = t_exit;
+      if (tx < tz) {
+        gx = (d.x > 0) ? (cx + 1) << level : (cx << level) - 1;
+        gz = glm::clamp(int(floor(o.z + d.z * t)), cz << level, ((cz + 1) << level) - 1);
+      } else {
+        gz = (d.z > 0) ? (cz + 1) << level : (cz << level) - 1;
+        gx = glm::clamp(int(floor(o.x + d.x * t)), cx << level, ((cx + 1) << level) - 1);
+      }
+      if (gx < 0 || gx >= n || gz < 0 || gz >= n) break;
+      if (level < top) level++;
+    }
+  }
+
+  // The flat ground around the map.
+  if (d.y >= 0) return false;
+  float t = (MAX_HEIGHT / 2 - o.y) / d.y;
+  if (t < t_min || t > t_max) return false;
+
+  float x = o.x + d.x * t;
+  float z = o.z + d.z * t;
+  if (x >= 0 && x <= n && z >= 0 && z <= n) return false;
+
+  hit->t = t;
+  hit->slope_x = 0;
+  hit->slope_z = 0;
+  return true;
+}
+
+// Same material as shaders/f_terrain: grid lines on a gray base, with the
+// light coming from normalize(1, 1, 0).
+static float Shade(float slope_x, float slope_z, float x, float z) {
+  const float weight = 0.01f;
+  float u = x / TILE_SIZE;
+  float v = z / TILE_SIZE;
+  float base = (u - floor(u) < weight || v - floor(v) < weight) ? 0.0f : 0.5f;
+
+  float length = sqrt(slope_x * slope_x + TILE_SIZE * TILE_SIZE + slope_z * slope_z);
+  float cos_theta = glm::clamp((TILE_SIZE - slope_x) / (length * sqrt(2.0f)), 0.0f, 1.0f);
+  return 0.5f * base + base * cos_theta;
+}
+
+#if defined(__SSE2__)
+static inline __m128 Floor(__m128 x) {
+  __m128 f = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  return _mm_sub_ps(f, _mm_and_ps(_mm_cmpgt_ps(f, x), _mm_set1_ps(1.0f)));
+}
+#endif
+
+void HeightfieldRenderer::Render(
+  SoftwareFramebuffer& framebuffer,
+  const glm::mat4& projection,
+  const glm::mat4& view
+) {
+  if (max_mips_.empty()) return;
+
+  const int width = framebuffer.width;
+  const int height = framebuffer.height;
+  view_.framebuffer = &framebuffer;
+  view_.near = projection[3][2] / (projection[2][2] - 1.0f);
+  view_.far = projection[3][2] / (projection[2][2] + 1.0f);
+
+  // Directions are scaled to a unit length along the view direction, so t
+  // is the view depth: direction(x, y) = corner + x * dx + y * dy at pixel
+  // centers.
+  glm::vec3 right(view[0][0], view[1][0], view[2][0]);
+  glm::vec3 up(view[0][1], view[1][1], view[2][1]);
+  glm::vec3 back(view[0][2], view[1][2], view[2][2]);
+  view_.camera = -(right * view[3][0] + up * view[3][1] + back * view[3][2]);
+  view_.dx = right * (2.0f / (width * projection[0][0]));
+  view_.dy = up * (2.0f / (height * projection[1][1]));
+  view_.corner = -back - right / projection[0][0] - up / projection[1][1] + 0.5f * (view_.dx + view_.dy);
+
+  // Same grid as Clipmap::GetGridHeight.
+  view_.grid_scale = glm::vec3(1.0f / TILE_SIZE, 1, 1.0f / TILE_SIZE);
+  float grid_offset = 2000.0f / TILE_SIZE - size_ / 2;
+  view_.origin = view_.camera * view_.grid_scale - glm::vec3(grid_offset, 0, grid_offset);
+
+  view_.p22 = projection[2][2];
+  view_.p32 = projection[3][2];
+  view_.p23 = projection[2][3];
+  view_.p33 = projection[3][3];
+
+  next_strip_ = 0;
+  thread_pool_->Run(strip_workers_);
+}
+
+// Run by each worker of the pool until the strips of the view run out.
+void HeightfieldRenderer::RenderStrips() {
+  static Counter& rays = Metrics::GetInstance().GetCounter("heightfield_rays");
+  static Counter& steps = Metrics::GetInstance().GetCounter("heightfield_steps");
+
+  SoftwareFramebuffer& framebuffer = *view_.framebuffer;
+  const int width = framebuffer.width;
+  const int height = framebuffer.height;
+  const float near = view_.near;
+  const float far = view_.far;
+  const glm::vec3 camera = view_.camera;
+  const glm::vec3 dx = view_.dx;
+  const glm::vec3 dy = view_.dy;
+  const glm::vec3 corner = view_.corner;
+  const glm::vec3 grid_scale = view_.grid_scale;
+  const glm::vec3 origin = view_.origin;
+
+  // Window depth from the view depth, as the GL pipeline computes it.
+  const float p22 = view_.p22;
+  const float p32 = view_.p32;
+  const float p23 = view_.p23;
+  const float p33 = view_.p33;
+  auto depth_of = [&](float t) {
+    return 0.5f * (p32 - p22 * t) / (p33 - p23 * t) + 0.5f;
+  };
+
+  const int num_strips = (width + HEIGHTFIELD_STRIP_WIDTH - 1) / HEIGHTFIELD_STRIP_WIDTH;
+  int num_rays = 0;
+  int num_steps = 0;
+  int strip;
+  while ((strip = next_strip_++) < num_strips) {
+    int x0 = strip * HEIGHTFIELD_STRIP_WIDTH;
+    int x1 = std::min(x0 + HEIGHTFIELD_STRIP_WIDTH, width);
+    for (int y = 0; y < height; y++) {
+      glm::vec3 row = corner + float(y) * dy;
+      int offset = y * width;
+      for (int x = x0; x < x1; x += 4) {
+        int lanes = std::min(4, x1 - x);
+        Hit hits[4];
+        for (int lane = 0; lane < 4; lane++) {
+          glm::vec3 d = row + float(x + lane) * dx;
+          if (lane >= lanes || !Intersect(origin, d * grid_scale, near, far, &hits[lane], &num_steps))
+            hits[lane].t = -1;
+        }
+        num_rays += lanes;
+
+        uint32_t* color = &framebuffer.color[offset + x];
+        float* depth = &framebuffer.depth[offset + x];
+
+#if defined(__SSE2__)
+        // A partial group would write pixels of the next row, which may
+        // belong to another worker.
+        if (lanes == 4) {
+          __m128 zero = _mm_setzero_ps();
+          __m128 t = _mm_set_ps(hits[3].t, hits[2].t, hits[1].t, hits[0].t);
+          __m128 z = _mm_div_ps(
+            _mm_sub_ps(_mm_set1_ps(p32), _mm_mul_ps(_mm_set1_ps(p22), t)),
+            _mm_sub_ps(_mm_set1_ps(p33), _mm_mul_ps(_mm_set1_ps(p23), t))
+          );
+          z = _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(0.5f)), _mm_set1_ps(0.5f));
+
+          __m128 old_depth = _mm_loadu_ps(depth);
+          __m128 pass = _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(z, old_depth));
+          if (!_mm_movemask_ps(pass)) continue;
+
+          // Grid lines.
+          __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), _mm_set_ps(3, 2, 1, 0));
+          __m128 inv_tile = _mm_set1_ps(1.0f / TILE_SIZE);
+          __m128 u = _mm_add_ps(_mm_set1_ps(row.x), _mm_mul_ps(px, _mm_set1_ps(dx.x)));
+          __m128 v = _mm_add_ps(_mm_set1_ps(row.z), _mm_mul_ps(px, _mm_set1_ps(dx.z)));
+          u = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(camera.x), _mm_mul_ps(u, t)), inv_tile);
+          v = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(camera.z), _mm_mul_ps(v, t)), inv_tile);
+          __m128 weight = _mm_set1_ps(0.01f);
+          __m128 line = _mm_or_ps(
+            _mm_cmplt_ps(_mm_sub_ps(u, Floor(u)), weight),
+            _mm_cmplt_ps(_mm_sub_ps(v, Floor(v)), weight)
+          );
+          __m128 base = _mm_andnot_ps(line, _mm_set1_ps(0.5f));
+
+          // Lambert.
+          __m128 sx = _mm_set_ps(hits[3].slope_x, hits[2].slope_x, hits[1].slope_x, hits[0].slope_x);
+          __m128 sz = _mm_set_ps(hits[3].slope_z, hits[2].slope_z, hits[1].slope_z, hits[0].slope_z);
+          __m128 tile = _mm_set1_ps(TILE_SIZE);
+          __m128 length = _mm_sqrt_ps(_mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sz, sz)), _mm_mul_ps(tile, tile)
+          ));
+          __m128 cos_theta = _mm_div_ps(
+            _mm_sub_ps(tile, sx), _mm_mul_ps(length, _mm_set1_ps(sqrt(2.0f)))
+          );
+          cos_theta = _mm_min_ps(_mm_max_ps(cos_theta, zero), _mm_set1_ps(1.0f));
+          __m128 gray = _mm_mul_ps(base, _mm_add_ps(_mm_set1_ps(0.5f), cos_theta));
+
+          // Gray is at most 0.75, so it needs no clamping before packing.
+          __m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(gray, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+          c = _mm_or_si128(_mm_or_si128(c, _mm_slli_epi32(c, 8)), _mm_slli_epi32(c, 16));
+          c = _mm_or_si128(c, _mm_set1_epi32(0xff000000));
+
+          __m128i mask = _mm_castps_si128(pass);
+          __m128i old_color = _mm_loadu_si128((__m128i*) color);
+          c = _mm_or_si128(_mm_and_si128(mask, c), _mm_andnot_si128(mask, old_color));
+          _mm_storeu_si128((__m128i*) color, c);
+          _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old_depth)));
+          continue;
+        }
+#endif
+
+        for (int lane = 0; lane < lanes; lane++) {
+          const Hit& hit = hits[lane];
+          if (hit.t <= 0) continue;
+
+          float z = depth_of(hit.t);
+          if (!(z < depth[lane])) continue;
+
+          glm::vec3 d = row + float(x + lane) * dx;
+          float gray = Shade(hit.slope_x, hit.slope_z, camera.x + d.x * hit.t, camera.z + d.z * hit.t);
+          color[lane] = PackColor(glm::vec4(gray, gray, gray, 1));
+          depth[lane] = z;
+        }
+      }
+    }
+  }
+  rays.Add(num_rays);
+  steps.Add(num_steps);
+}
+
+} // End of namespace.
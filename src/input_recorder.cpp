@@ -0,0 +1,54 @@
+#include "input_recorder.hpp"
+#include <iomanip>
+
+using namespace std;
+
+namespace Sibyl {
+
+void InputRecorder::OpenForWriting(const string& filename) {
+  out_.open(filename);
+  if (!out_.is_open()) throw runtime_error("Could not open " + filename + " for recording.");
+  out_ << setprecision(17);
+}
+
+void InputRecorder::OpenForReading(const string& filename) {
+  in_.open(filename);
+  if (!in_.is_open()) throw runtime_error("Could not open " + filename + " for replay.");
+}
+
+void InputRecorder::Write(const FrameInput& input) {
+  out_ << input.time << " " << input.mouse_x << " " << input.mouse_y;
+
+  out_ << " " << input.keys.size();
+  for (auto& k : input.keys)
+    out_ << " " << k.key << " " << k.scancode << " " << k.action << " " << k.mods;
+
+  out_ << " " << input.chars.size();
+  for (unsigned char c : input.chars) out_ << " " << int(c);
+  out_ << "\n";
+}
+
+bool InputRecorder::Read(FrameInput* input) {
+  FrameInput frame;
+  size_t num_keys;
+  if (!(in_ >> frame.time >> frame.mouse_x >> frame.mouse_y >> num_keys)) 
+    return false;
+
+  frame.keys.resize(num_keys);
+  for (auto& k : frame.keys)
+    in_ >> k.key >> k.scancode >> k.action >> k.mods;
+
+  size_t num_chars;
+  in_ >> num_chars;
+  for (size_t i = 0; i < num_chars; i++) {
+    int c;
+    in_ >> c;
+    frame.chars += char(c);
+  }
+
+  if (!in_) return false;
+  *input = frame;
+  return true;
+}
+
+} // End of namespace.
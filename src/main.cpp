@@ -5,16 +5,18 @@
 
 using namespace Sibyl;
 
-int main() {
+int main(int argc, char** argv) {
+  GameState::ParseOptions(argc, argv);
+
   static IoC::Container& container = IoC::Container::Get();
   container.RegisterInstance<GameState, GameState>();
   container.RegisterInstance<Renderer, Renderer>();
+  container.RegisterInstance<ThreadPool, ThreadPool>();
   container.RegisterInstance<TextEditor, TextEditor, GameState, Renderer>();
   container.RegisterInstance<Building, Building, Renderer>();
   container.RegisterInstance<Plotter, Plotter, GameState, Renderer, TextEditor>();
   container.RegisterInstance<EntityManager, EntityManager, GameState, Renderer, TextEditor, Building, Plotter>();
-  container.RegisterInstance<Engine, Engine, GameState, Renderer, EntityManager, TextEditor>();
+  container.RegisterInstance<Engine, Engine, GameState, Renderer, EntityManager, TextEditor, ThreadPool>();
 
-  container.Resolve<Engine>()->Run();
-  return 0;
+  return container.Resolve<Engine>()->Run();
 }
@@ -0,0 +1,368 @@
+#include "mesh_optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+using namespace std;
+using namespace glm;
+
+namespace Sibyl {
+
+// Scoring constants from Forsyth's article. The cache modelled for scoring
+// is an LRU of 32 entries, larger than the FIFO used to measure, which
+// keeps the ordering good for a range of hardware cache sizes.
+static const int kScoreCacheSize = 32;
+static const int kMaxValence = 32;
+static const float kCacheDecayPower = 1.5f;
+static const float kLastTriangleScore = 0.75f;
+static const float kValenceBoostScale = 2.0f;
+static const float kValenceBoostPower = 0.5f;
+
+struct VertexKey {
+  float data[8];
+};
+
+struct VertexKeyHash {
+  size_t operator()(const VertexKey& key) const {
+    uint32_t words[8];
+    memcpy(words, key.data, sizeof(words));
+    size_t h = 0;
+    for (uint32_t w : words) h ^= w + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+  }
+};
+
+struct VertexKeyEqual {
+  bool operator()(const VertexKey& a, const VertexKey& b) const {
+    return memcmp(a.data, b.data, sizeof(a.data)) == 0;
+  }
+};
+
+float ComputeAcmr(
+  const vector<unsigned int>& indices, size_t num_vertices, int cache_size
+) {
+  if (indices.size() < 3) return 0;
+
+  // A vertex is in the FIFO if fewer than cache_size misses happened since
+  // it was last loaded.
+  vector<unsigned int> loaded_at(num_vertices, 0);
+  unsigned int misses = 0;
+  unsigned int time = cache_size + 1;
+  for (unsigned int v : indices) {
+    if (time - loaded_at[v] > unsigned(cache_size)) {
+      loaded_at[v] = time++;
+      misses++;
+    }
+  }
+  return float(misses) / (indices.size() / 3);
+}
+
+size_t WeldVertices(
+  vector<vec3>& vertices, vector<vec2>& uvs, vector<vec3>& normals,
+  vector<unsigned int>& indices
+) {
+  size_t n = vertices.size();
+  bool has_uvs = uvs.size() == n;
+  bool has_normals = normals.size() == n;
+
+  unordered_map<VertexKey, unsigned int, VertexKeyHash, VertexKeyEqual> unique;
+  unique.reserve(n);
+
+  // The new slot is never past the old one, so vertices move in place.
+  vector<unsigned int> remap(n);
+  unsigned int count = 0;
+  for (size_t i = 0; i < n; i++) {
+    VertexKey key;
+    memset(key.data, 0, sizeof(key.data));
+    memcpy(&key.data[0], &vertices[i], sizeof(vec3));
+    if (has_uvs) memcpy(&key.data[3], &uvs[i], sizeof(vec2));
+    if (has_normals) memcpy(&key.data[5], &normals[i], sizeof(vec3));
+
+    auto it = unique.emplace(key, count);
+    if (it.second) {
+      vertices[count] = vertices[i];
+      if (has_uvs) uvs[count] = uvs[i];
+      if (has_normals) normals[count] = normals[i];
+      count++;
+    }
+    remap[i] = it.first->second;
+  }
+
+  vertices.resize(count);
+  if (has_uvs) uvs.resize(count);
+  if (has_normals) normals.resize(count);
+  for (unsigned int& i : indices) i = remap[i];
+  return count;
+}
+
+void OptimizeVertexCache(vector<unsigned int>& indices, size_t num_vertices) {
+  size_t num_triangles = indices.size() / 3;
+  if (num_triangles < 2) return;
+
+  float cache_scores[kScoreCacheSize];
+  for (int i = 0; i < kScoreCacheSize; i++) {
+    if (i < 3) {
+      cache_scores[i] = kLastTriangleScore;
+    } else {
+      float x = 1.0f - float(i - 3) / (kScoreCacheSize - 3);
+      cache_scores[i] = pow(x, kCacheDecayPower);
+    }
+  }
+
+  float valence_scores[kMaxValence + 1];
+  valence_scores[0] = -1.0f;
+  for (int i = 1; i <= kMaxValence; i++)
+    valence_scores[i] = kValenceBoostScale * pow(float(i), -kValenceBoostPower);
+
+  // Triangles of each vertex. The first remaining[v] entries of a vertex's
+  // range are the ones not emitted yet.
+  vector<unsigned int> offsets(num_vertices + 1, 0);
+  for (unsigned int v : indices) offsets[v + 1]++;
+  for (size_t v = 0; v < num_vertices; v++) offsets[v + 1] += offsets[v];
+
+  vector<unsigned int> adjacency(indices.size());
+  vector<unsigned int> remaining(num_vertices, 0);
+  for (size_t t = 0; t < num_triangles; t++) {
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[3 * t + k];
+      adjacency[offsets[v] + remaining[v]++] = t;
+    }
+  }
+
+  vector<int> cache_position(num_vertices, -1);
+  vector<float> vertex_scores(num_vertices);
+  auto score = [&](unsigned int v) {
+    if (remaining[v] == 0) return -1.0f;
+    float s = valence_scores[std::min<unsigned int>(remaining[v], kMaxValence)];
+    if (cache_position[v] >= 0) s += cache_scores[cache_position[v]];
+    return s;
+  };
+  for (size_t v = 0; v < num_vertices; v++) vertex_scores[v] = score(v);
+
+  vector<float> triangle_scores(num_triangles);
+  vector<char> emitted(num_triangles, 0);
+  int best = 0;
+  for (size_t t = 0; t < num_triangles; t++) {
+    const unsigned int* tri = &indices[3 * t];
+    triangle_scores[t] = vertex_scores[tri[0]] + vertex_scores[tri[1]] + vertex_scores[tri[2]];
+    if (triangle_scores[t] > triangle_scores[best]) best = t;
+  }
+
+  vector<unsigned int> result;
+  result.reserve(indices.size());
+  unsigned int cache[kScoreCacheSize + 3];
+  int cache_count = 0;
+  size_t next_unemitted = 0;
+  while (result.size() < indices.size()) {
+    // Nothing in the cache has triangles left, so restart anywhere.
+    if (best < 0) {
+      while (emitted[next_unemitted]) next_unemitted++;
+      best = next_unemitted;
+    }
+
+    const unsigned int* tri = &indices[3 * best];
+    emitted[best] = 1;
+    result.insert(result.end(), tri, tri + 3);
+
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = tri[k];
+      unsigned int* begin = &adjacency[offsets[v]];
+      unsigned int* end = begin + remaining[v];
+      swap(*find(begin, end, unsigned(best)), *(end - 1));
+      remaining[v]--;
+    }
+
+    // The triangle's vertices move to the front of the LRU.
+    unsigned int new_cache[kScoreCacheSize + 3];
+    int n = 0;
+    for (int k = 0; k < 3; k++) {
+      if (find(new_cache, new_cache + n, tri[k]) == new_cache + n) new_cache[n++] = tri[k];
+    }
+    for (int i = 0; i < cache_count; i++) {
+      unsigned int v = cache[i];
+      if (v != tri[0] && v != tri[1] && v != tri[2]) new_cache[n++] = v;
+    }
+
+    for (int i = 0; i < n; i++) {
+      unsigned int v = new_cache[i];
+      cache_position[v] = (i < kScoreCacheSize) ? i : -1;
+      vertex_scores[v] = score(v);
+    }
+    cache_count = std::min(n, kScoreCacheSize);
+    for (int i = 0; i < cache_count; i++) cache[i] = new_cache[i];
+
+    // Only triangles touching the cache, including the vertices that just
+    // fell out of it, changed score.
+    best = -1;
+    float best_score = -1.0f;
+    for (int i = 0; i < n; i++) {
+      unsigned int v = new_cache[i];
+      for (unsigned int j = 0; j < remaining[v]; j++) {
+        unsigned int t = adjacency[offsets[v] + j];
+        const unsigned int* u = &indices[3 * t];
+        float s = vertex_scores[u[0]] + vertex_scores[u[1]] + vertex_scores[u[2]];
+        triangle_scores[t] = s;
+        if (s > best_score) {
+          best_score = s;
+          best = t;
+        }
+      }
+    }
+  }
+  indices.swap(result);
+}
+
+void OptimizeOverdraw(
+  vector<unsigned int>& indices, const vector<vec3>& vertices, float threshold
+) {
+  size_t num_triangles = indices.size() / 3;
+  if (num_triangles < 2) return;
+
+  // Hard boundaries are where a triangle misses on all three vertices, so
+  // the cache starts cold there anyway. Runs between them are split
+  // further as soon as the run, starting from a cold cache, is within the
+  // threshold of the ACMR of the whole mesh, which bounds what reordering
+  // the clusters can cost.
+  float acmr = ComputeAcmr(indices, vertices.size());
+  vector<size_t> hard;
+  vector<unsigned int> loaded_at(vertices.size(), 0);
+  unsigned int time = MESH_CACHE_SIZE + 1;
+  for (size_t t = 0; t < num_triangles; t++) {
+    int misses = 0;
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[3 * t + k];
+      if (time - loaded_at[v] > MESH_CACHE_SIZE) {
+        loaded_at[v] = time++;
+        misses++;
+      }
+    }
+    if (t == 0 || misses == 3) hard.push_back(t);
+  }
+  hard.push_back(num_triangles);
+
+  vector<size_t> clusters;
+  for (size_t h = 0; h + 1 < hard.size(); h++) {
+    size_t start = hard[h];
+    unsigned int misses = 0;
+    time += MESH_CACHE_SIZE + 1;
+    clusters.push_back(start);
+    for (size_t t = start; t < hard[h + 1]; t++) {
+      for (int k = 0; k < 3; k++) {
+        unsigned int v = indices[3 * t + k];
+        if (time - loaded_at[v] > MESH_CACHE_SIZE) {
+          loaded_at[v] = time++;
+          misses++;
+        }
+      }
+
+      if (t + 1 < hard[h + 1] && misses <= acmr * threshold * (t + 1 - start)) {
+        start = t + 1;
+        misses = 0;
+        time += MESH_CACHE_SIZE + 1;
+        clusters.push_back(start);
+      }
+    }
+  }
+  if (clusters.size() < 2) return;
+  clusters.push_back(num_triangles);
+
+  // Area weighted centroids and normals. The cross product is twice the
+  // area along the normal, so summing it weighs by area already.
+  size_t num_clusters = clusters.size() - 1;
+  vector<vec3> centroids(num_clusters, vec3(0));
+  vector<vec3> directions(num_clusters, vec3(0));
+  vector<float> areas(num_clusters, 0);
+  vec3 mesh_centroid(0);
+  float mesh_area = 0;
+  for (size_t c = 0; c < num_clusters; c++) {
+    for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+      const vec3& a = vertices[indices[3 * t]];
+      const vec3& b = vertices[indices[3 * t + 1]];
+      const vec3& d = vertices[indices[3 * t + 2]];
+      vec3 n = cross(b - a, d - a);
+      float area = length(n);
+      centroids[c] += area * (a + b + d) / 3.0f;
+      directions[c] += n;
+      areas[c] += area;
+    }
+    mesh_centroid += centroids[c];
+    mesh_area += areas[c];
+  }
+  if (mesh_area <= 0) return;
+  mesh_centroid /= mesh_area;
+
+  vector<float> scores(num_clusters, 0);
+  for (size_t c = 0; c < num_clusters; c++) {
+    float l = length(directions[c]);
+    if (areas[c] <= 0 || l <= 0) continue;
+    scores[c] = dot(centroids[c] / areas[c] - mesh_centroid, directions[c] / l);
+  }
+
+  vector<size_t> order(num_clusters);
+  for (size_t c = 0; c < num_clusters; c++) order[c] = c;
+  stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return scores[a] > scores[b];
+  });
+
+  vector<unsigned int> result;
+  result.reserve(indices.size());
+  for (size_t c : order) {
+    result.insert(result.end(),
+      indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+  }
+
+  if (ComputeAcmr(result, vertices.size()) <= acmr * threshold) indices.swap(result);
+}
+
+void OptimizeVertexFetch(
+  vector<vec3>& vertices, vector<vec2>& uvs, vector<vec3>& normals,
+  vector<unsigned int>& indices
+) {
+  size_t n = vertices.size();
+  bool has_uvs = uvs.size() == n;
+  bool has_normals = normals.size() == n;
+
+  const unsigned int kUnused = ~0u;
+  vector<unsigned int> remap(n, kUnused);
+  unsigned int count = 0;
+  for (unsigned int& i : indices) {
+    if (remap[i] == kUnused) remap[i] = count++;
+    i = remap[i];
+  }
+
+  // Vertices no triangle uses are dropped.
+  vector<vec3> new_vertices(count);
+  vector<vec2> new_uvs(has_uvs ? count : 0);
+  vector<vec3> new_normals(has_normals ? count : 0);
+  for (size_t v = 0; v < n; v++) {
+    if (remap[v] == kUnused) continue;
+    new_vertices[remap[v]] = vertices[v];
+    if (has_uvs) new_uvs[remap[v]] = uvs[v];
+    if (has_normals) new_normals[remap[v]] = normals[v];
+  }
+  vertices.swap(new_vertices);
+  if (has_uvs) uvs.swap(new_uvs);
+  if (has_normals) normals.swap(new_normals);
+}
+
+MeshStats OptimizeMesh(
+  vector<vec3>& vertices, vector<vec2>& uvs, vector<vec3>& normals,
+  vector<unsigned int>& indices
+) {
+  MeshStats stats;
+  stats.vertices_before = vertices.size();
+  stats.acmr_before = ComputeAcmr(indices, vertices.size());
+
+  size_t num_vertices = WeldVertices(vertices, uvs, normals, indices);
+  OptimizeVertexCache(indices, num_vertices);
+  OptimizeOverdraw(indices, vertices);
+  OptimizeVertexFetch(vertices, uvs, normals, indices);
+
+  stats.vertices_after = vertices.size();
+  stats.acmr_after = ComputeAcmr(indices, vertices.size());
+  return stats;
+}
+
+} // End of namespace.
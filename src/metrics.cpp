@@ -0,0 +1,186 @@
+#include "metrics.hpp"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+namespace Sibyl {
+
+// Constant initialized, so it is safe to use before main.
+Counter heap_allocations;
+
+Histogram::Histogram(double max, int num_buckets) 
+  : max_(max),
+    buckets_(num_buckets),
+    count_(0) {
+}
+
+void Histogram::Record(double value) {
+  int i = int(value / max_ * buckets_.size());
+  i = std::min(std::max(i, 0), int(buckets_.size()) - 1);
+  buckets_[i].fetch_add(1, memory_order_relaxed);
+  count_.fetch_add(1, memory_order_relaxed);
+}
+
+// Returns the upper bound of the bucket holding the p-th percentile.
+double Histogram::Percentile(double p) {
+  uint32_t total = count();
+  if (total == 0) return 0;
+
+  uint32_t target = uint32_t(p * total);
+  uint32_t sum = 0;
+  for (int i = 0; i < buckets_.size(); i++) {
+    sum += buckets_[i].load(memory_order_relaxed);
+    if (sum > target) return (i + 1) * max_ / buckets_.size();
+  }
+  return max_;
+}
+
+void Histogram::Reset() {
+  for (auto& b : buckets_) b.store(0, memory_order_relaxed);
+  count_.store(0, memory_order_relaxed);
+}
+
+Metrics::Metrics() {
+  counters_["heap_allocations"] = &heap_allocations;
+}
+
+Metrics& Metrics::GetInstance() {
+  static Metrics instance; 
+  return instance;
+}
+
+Counter& Metrics::GetCounter(const string& name) {
+  lock_guard<mutex> lock(mutex_);
+  auto it = counters_.find(name);
+  if (it != counters_.end()) return *it->second;
+
+  owned_counters_.push_back(unique_ptr<Counter>(new Counter()));
+  counters_[name] = owned_counters_.back().get();
+  return *owned_counters_.back();
+}
+
+Gauge& Metrics::GetGauge(const string& name) {
+  lock_guard<mutex> lock(mutex_);
+  unique_ptr<Gauge>& gauge = gauges_[name];
+  if (!gauge) gauge.reset(new Gauge());
+  return *gauge;
+}
+
+Histogram& Metrics::GetHistogram(const string& name, double max, int num_buckets) {
+  lock_guard<mutex> lock(mutex_);
+  unique_ptr<Histogram>& histogram = histograms_[name];
+  if (!histogram) histogram.reset(new Histogram(max, num_buckets));
+  return *histogram;
+}
+
+static void AppendFormat(string& s, const char* format, ...) {
+  char buffer[64];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  s += buffer;
+}
+
+// Called once per frame on the main thread. Counters are reported per frame
+// on the HUD and per second in the CSV.
+void Metrics::EndFrame(double time) {
+  lock_guard<mutex> lock(mutex_);
+  for (auto& it : counters_) {
+    int64_t value = it.second->value();
+    frame_values_[it.first] = value - frame_start_[it.first];
+    frame_start_[it.first] = value;
+  }
+
+  if (last_row_time_ < 0) {
+    last_row_time_ = time;
+    for (auto& it : counters_) second_start_[it.first] = it.second->value();
+    return;
+  }
+  if (time - last_row_time_ < 1.0) return;
+
+  // The row is built into buffers that keep their capacity, so writing it
+  // does not allocate once the set of metrics stops changing.
+  csv_header_buffer_ = "time";
+  csv_row_.clear();
+  AppendFormat(csv_row_, "%g", time);
+  for (auto& it : counters_) {
+    int64_t value = it.second->value();
+    csv_header_buffer_ += ",";
+    csv_header_buffer_ += it.first;
+    AppendFormat(csv_row_, ",%lld", (long long) (value - second_start_[it.first]));
+    second_start_[it.first] = value;
+  }
+  for (auto& it : gauges_) {
+    csv_header_buffer_ += ",";
+    csv_header_buffer_ += it.first;
+    AppendFormat(csv_row_, ",%g", it.second->value());
+  }
+  for (auto& it : histograms_) {
+    csv_header_buffer_ += ",";
+    csv_header_buffer_ += it.first;
+    csv_header_buffer_ += "_p50,";
+    csv_header_buffer_ += it.first;
+    csv_header_buffer_ += "_p99";
+    AppendFormat(csv_row_, ",%g,%g", it.second->Percentile(0.5), it.second->Percentile(0.99));
+    it.second->Reset();
+  }
+
+  if (!csv_.is_open()) {
+    csv_.open(METRICS_CSV_FILE);
+    if (!csv_.is_open()) cout << "Could not open " << METRICS_CSV_FILE << endl;
+  }
+
+  // Metrics registered late add columns, so repeat the header when it changes.
+  if (csv_header_buffer_ != csv_header_) {
+    csv_header_ = csv_header_buffer_;
+    csv_ << csv_header_ << endl;
+  }
+  csv_ << csv_row_ << endl;
+  last_row_time_ = time;
+}
+
+// Fills the caller's lines in place, so once they have grown to the longest
+// line the HUD formats without allocating.
+void Metrics::GetHudLines(vector<string>& lines) {
+  lock_guard<mutex> lock(mutex_);
+
+  lines.resize(frame_values_.size() + gauges_.size() + histograms_.size());
+  int i = 0;
+  char line[128];
+  for (auto& it : frame_values_) {
+    snprintf(line, sizeof(line), "%-24s %lld", it.first.c_str(), (long long) it.second);
+    lines[i++].assign(line);
+  }
+  for (auto& it : gauges_) {
+    snprintf(line, sizeof(line), "%-24s %.2f", it.first.c_str(), it.second->value());
+    lines[i++].assign(line);
+  }
+  for (auto& it : histograms_) {
+    snprintf(
+      line, sizeof(line), "%-24s p50 %.2f p99 %.2f", it.first.c_str(), 
+      it.second->Percentile(0.5), it.second->Percentile(0.99)
+    );
+    lines[i++].assign(line);
+  }
+}
+
+} // End of namespace.
+
+// Counts every heap allocation. The array and nothrow forms end up here 
+// through the standard library defaults.
+void* operator new(size_t size) {
+  Sibyl::heap_allocations.Add();
+  if (size == 0) size = 1;
+  void* p = malloc(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
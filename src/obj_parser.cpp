@@ -0,0 +1,243 @@
+#include "obj_parser.hpp"
+#include <cmath>
+#include <cstdint>
+#include "mapped_file.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace Sibyl {
+
+// Face corner as indices into the lookup arrays, -1 where missing.
+struct ObjCorner {
+  int v, vt, vn;
+};
+
+static const double kPowersOfTen[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+static inline bool IsSpace(char c) { return c == ' ' || c == '\t'; }
+static inline bool IsEndOfLine(char c) { return c == '\n' || c == '\r' || c == '#'; }
+
+static inline bool IsTerminator(const char* p, const char* end) {
+  return p == end || IsSpace(*p) || IsEndOfLine(*p) || *p == '/';
+}
+
+static inline void SkipSpaces(const char*& p, const char* end) {
+  while (p < end && IsSpace(*p)) p++;
+}
+
+static inline void SkipLine(const char*& p, const char* end) {
+  while (p < end && *p != '\n') p++;
+  if (p < end) p++;
+}
+
+// Decimal with optional sign, fraction and exponent. Up to 19 significant
+// digits go into an integer mantissa, which is then scaled once by a power
+// of ten, so values with up to 15 digits and small exponents (everything
+// an exporter writes) come out correctly rounded.
+static bool ParseFloat(const char*& p, const char* end, float& out) {
+  SkipSpaces(p, end);
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for (; p < end && IsDigit(*p); p++, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if (mantissa) digits++;
+    } else {
+      exponent++;
+    }
+  }
+
+  if (p < end && *p == '.') {
+    for (p++; p < end && IsDigit(*p); p++, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa) digits++;
+        exponent--;
+      }
+    }
+  }
+  if (!any) return false;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negative_exponent = false;
+    if (q < end && (*q == '-' || *q == '+')) negative_exponent = *q++ == '-';
+    if (q < end && IsDigit(*q)) {
+      int e = 0;
+      for (; q < end && IsDigit(*q); q++) {
+        if (e < 10000) e = e * 10 + (*q - '0');
+      }
+      exponent += negative_exponent ? -e : e;
+      p = q;
+    }
+  }
+  if (!IsTerminator(p, end)) return false;
+
+  double value = double(mantissa);
+  if (exponent >= 0 && exponent <= 22) {
+    value *= kPowersOfTen[exponent];
+  } else if (exponent < 0 && exponent >= -22) {
+    value /= kPowersOfTen[-exponent];
+  } else if (mantissa != 0) {
+    value *= pow(10.0, exponent);
+  }
+  out = float(negative ? -value : value);
+  return true;
+}
+
+static bool ParseInt(const char*& p, const char* end, int& out) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+  if (p == end || !IsDigit(*p)) return false;
+
+  int64_t value = 0;
+  for (; p < end && IsDigit(*p); p++) {
+    if (value <= INT32_MAX) value = value * 10 + (*p - '0');
+  }
+  if (value > INT32_MAX || !IsTerminator(p, end)) return false;
+  out = int(negative ? -value : value);
+  return true;
+}
+
+// Converts a one based or negative (relative) OBJ index into an offset
+// into an array of the given size.
+static inline bool Resolve(int index, size_t size, int& out) {
+  if (index > 0 && size_t(index) <= size) {
+    out = index - 1;
+    return true;
+  }
+  if (index < 0 && size_t(-int64_t(index)) <= size) {
+    out = int(size) + index;
+    return true;
+  }
+  return false;
+}
+
+// Reads "v", "v/vt", "v//vn" or "v/vt/vn".
+static bool ParseCorner(
+  const char*& p, const char* end, size_t num_vertices, size_t num_uvs,
+  size_t num_normals, ObjCorner& corner
+) {
+  int index;
+  corner.vt = corner.vn = -1;
+  if (!ParseInt(p, end, index) || !Resolve(index, num_vertices, corner.v))
+    return false;
+
+  if (p == end || *p != '/') return true;
+  p++;
+  if (p < end && *p != '/' && !IsSpace(*p) && !IsEndOfLine(*p)) {
+    if (!ParseInt(p, end, index) || !Resolve(index, num_uvs, corner.vt))
+      return false;
+  }
+
+  if (p == end || *p != '/') return true;
+  p++;
+  if (p < end && !IsSpace(*p) && !IsEndOfLine(*p)) {
+    if (!ParseInt(p, end, index) || !Resolve(index, num_normals, corner.vn))
+      return false;
+  }
+  return true;
+}
+
+bool ParseObj(
+  const char* data, size_t size, vector<vec3>& vertices, vector<vec2>& uvs,
+  vector<vec3>& normals, vector<unsigned int>& indices
+) {
+  vector<vec3> vertex_lookup;
+  vector<vec2> uv_lookup;
+  vector<vec3> normal_lookup;
+
+  auto emit_triangle = [&](const ObjCorner& a, const ObjCorner& b, const ObjCorner& c) {
+    const ObjCorner* corners[] = { &a, &b, &c };
+
+    vec3 face_normal(0, 0, 0);
+    if (a.vn < 0 || b.vn < 0 || c.vn < 0) {
+      const vec3& p0 = vertex_lookup[a.v];
+      vec3 n = cross(vertex_lookup[b.v] - p0, vertex_lookup[c.v] - p0);
+      float length = glm::length(n);
+      if (length > 0) face_normal = n / length;
+    }
+
+    for (const ObjCorner* corner : corners) {
+      vertices.push_back(vertex_lookup[corner->v]);
+      uvs.push_back(corner->vt < 0 ? vec2(0, 0) : uv_lookup[corner->vt]);
+      normals.push_back(corner->vn < 0 ? face_normal : normal_lookup[corner->vn]);
+      indices.push_back(vertices.size() - 1);
+    }
+  };
+
+  const char* p = data;
+  const char* end = data + size;
+  while (p < end) {
+    SkipSpaces(p, end);
+    if (p == end) break;
+
+    const char* q = p;
+    if (*q == 'v') {
+      q++;
+      if (q < end && IsSpace(*q)) {
+        vec3 v;
+        if (!ParseFloat(q, end, v.x) || !ParseFloat(q, end, v.y) ||
+            !ParseFloat(q, end, v.z)) return false;
+        vertex_lookup.push_back(v);
+      } else if (q < end && *q == 't' && q + 1 < end && IsSpace(q[1])) {
+        q++;
+        vec2 uv(0, 0);
+        if (!ParseFloat(q, end, uv.x)) return false;
+        SkipSpaces(q, end);
+        if (q < end && !IsEndOfLine(*q) && !ParseFloat(q, end, uv.y))
+          return false;
+        uv_lookup.push_back(uv);
+      } else if (q < end && *q == 'n' && q + 1 < end && IsSpace(q[1])) {
+        q++;
+        vec3 n;
+        if (!ParseFloat(q, end, n.x) || !ParseFloat(q, end, n.y) ||
+            !ParseFloat(q, end, n.z)) return false;
+        normal_lookup.push_back(n);
+      }
+    } else if (*q == 'f' && q + 1 < end && IsSpace(q[1])) {
+      q++;
+
+      // Triangulates as a fan around the first corner while reading, so
+      // no corner list is kept.
+      ObjCorner first, previous, current;
+      int num_corners = 0;
+      for (SkipSpaces(q, end); q < end && !IsEndOfLine(*q); SkipSpaces(q, end)) {
+        if (!ParseCorner(q, end, vertex_lookup.size(), uv_lookup.size(),
+          normal_lookup.size(), current)) return false;
+
+        if (num_corners == 0) first = current;
+        else if (num_corners >= 2) emit_triangle(first, previous, current);
+        previous = current;
+        num_corners++;
+      }
+      if (num_corners < 3) return false;
+    }
+
+    p = q;
+    SkipLine(p, end);
+  }
+  return true;
+}
+
+bool ParseObj(
+  const string& filename, vector<vec3>& vertices, vector<vec2>& uvs,
+  vector<vec3>& normals, vector<unsigned int>& indices
+) {
+  MappedFile file(filename);
+  if (!file.is_open()) return false;
+  return ParseObj(file.data(), file.size(), vertices, uvs, normals, indices);
+}
+
+} // End of namespace.
@@ -0,0 +1,265 @@
+#include "occlusion_buffer.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace Sibyl {
+
+// Signed distance to the near plane and to a guard band around the screen,
+// which keeps the screen coordinates small enough for a precise depth plane.
+static float PlaneDistance(int plane, const glm::vec4& p) {
+  const float g = OCCLUSION_GUARD_BAND;
+  switch (plane) {
+    case 0: return p.z + p.w;
+    case 1: return g * p.w + p.x;
+    case 2: return g * p.w - p.x;
+    case 3: return g * p.w + p.y;
+    default: return g * p.w - p.y;
+  }
+}
+
+// The buffer is padded so four pixels can be loaded past the end of the
+// last row.
+OcclusionBuffer::OcclusionBuffer(
+  int width,
+  int height
+) : width_(width),
+    height_(height),
+    depth_(width * height + 4, 1.0f) {
+}
+
+// Points are transformed relative to the camera. The world coordinates are
+// in the thousands, so going through the full view matrix would cancel
+// most of the depth precision.
+void OcclusionBuffer::Begin(const glm::mat4& projection, const glm::mat4& view) {
+  glm::vec3 right(view[0][0], view[1][0], view[2][0]);
+  glm::vec3 up(view[0][1], view[1][1], view[2][1]);
+  glm::vec3 back(view[0][2], view[1][2], view[2][2]);
+  camera_ = -(right * view[3][0] + up * view[3][1] + back * view[3][2]);
+
+  glm::mat4 rotation = view;
+  rotation[3] = glm::vec4(0, 0, 0, 1);
+  view_projection_ = projection * rotation;
+
+  fill(depth_.begin(), depth_.end(), 1.0f);
+}
+
+void OcclusionBuffer::RasterizeBox(const glm::vec3& min, const glm::vec3& max) {
+  static Counter& occluders = Metrics::GetInstance().GetCounter("occluder_boxes");
+  occluders.Add();
+
+  glm::vec4 corners[8];
+  for (int i = 0; i < 8; i++) {
+    glm::vec3 p((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+    corners[i] = view_projection_ * glm::vec4(p - camera_, 1);
+  }
+
+  // Corners of the min and max faces along each axis, in order around the
+  // face. A face is only seen when the camera is on its outer side.
+  static const int kFaces[3][2][4] = {
+    { { 0, 2, 6, 4 }, { 1, 3, 7, 5 } },
+    { { 0, 1, 5, 4 }, { 2, 3, 7, 6 } },
+    { { 0, 1, 3, 2 }, { 4, 5, 7, 6 } }
+  };
+  for (int axis = 0; axis < 3; axis++) {
+    int side = -1;
+    if (camera_[axis] < min[axis]) side = 0;
+    else if (camera_[axis] > max[axis]) side = 1;
+    if (side == -1) continue;
+
+    glm::vec4 quad[4];
+    for (int i = 0; i < 4; i++) quad[i] = corners[kFaces[axis][side][i]];
+    RasterizeQuad(quad);
+  }
+}
+
+// Clips the quad and draws it. The far plane and the screen edges are
+// handled by the bounding box of the polygon.
+void OcclusionBuffer::RasterizeQuad(const glm::vec4* quad) {
+  glm::vec4 polygon[9];
+  glm::vec4 clipped[9];
+  int n = 4;
+  copy(quad, quad + 4, polygon);
+  for (int plane = 0; plane < 5 && n >= 3; plane++) {
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+      const glm::vec4& a = polygon[i];
+      const glm::vec4& b = polygon[(i + 1) % n];
+      float da = PlaneDistance(plane, a);
+      float db = PlaneDistance(plane, b);
+      if (da >= 0) clipped[m++] = a;
+      if ((da >= 0) != (db >= 0)) clipped[m++] = a + (b - a) * (da / (da - db));
+    }
+    copy(clipped, clipped + m, polygon);
+    n = m;
+  }
+  if (n < 3) return;
+
+  glm::vec3 screen[9];
+  for (int i = 0; i < n; i++) {
+    glm::vec3 ndc = glm::vec3(polygon[i]) / polygon[i].w;
+    screen[i] = glm::vec3(
+      (ndc.x * 0.5f + 0.5f) * width_,
+      (ndc.y * 0.5f + 0.5f) * height_,
+      ndc.z * 0.5f + 0.5f
+    );
+  }
+  RasterizePolygon(screen, n);
+}
+
+// Same edge functions as SoftwareRasterizer::RasterizeTriangle, four pixels
+// at a time, with one edge per side of the convex polygon. Each edge is
+// moved inwards by half a pixel, so the test at the pixel center passes
+// only when the whole pixel is inside. Splitting the polygon in triangles
+// would not work, since a pixel on a diagonal is inside neither of them.
+void OcclusionBuffer::RasterizePolygon(const glm::vec3* v, int n) {
+  // The depth plane comes from the largest triangle of the fan, which has
+  // the least rounding error.
+  float area = 0;
+  int apex = 1;
+  for (int i = 1; i + 1 < n; i++) {
+    float fan = (v[i].x - v[0].x) * (v[i + 1].y - v[0].y) - (v[i + 1].x - v[0].x) * (v[i].y - v[0].y);
+    if (fabs(fan) > fabs(area)) {
+      area = fan;
+      apex = i;
+    }
+  }
+  if (fabs(area) < 1e-8f) return;
+
+  // Counter clockwise, so the edge functions are positive inside.
+  float sign = (area < 0) ? -1.0f : 1.0f;
+  float a[9], b[9], c[9];
+  for (int i = 0; i < n; i++) {
+    const glm::vec3& p = v[i];
+    const glm::vec3& q = v[(i + 1) % n];
+    a[i] = sign * (p.y - q.y);
+    b[i] = sign * (q.x - p.x);
+    c[i] = sign * (p.x * q.y - q.x * p.y) - 0.5f * (fabs(a[i]) + fabs(b[i]));
+  }
+
+  // The depth plane, moved to the farthest corner of each pixel.
+  const glm::vec3& r = v[0];
+  const glm::vec3& s = v[apex];
+  const glm::vec3& t = v[apex + 1];
+  float dzdx = ((s.z - r.z) * (t.y - r.y) - (t.z - r.z) * (s.y - r.y)) / area;
+  float dzdy = ((s.x - r.x) * (t.z - r.z) - (t.x - r.x) * (s.z - r.z)) / area;
+  float z0 = r.z + 0.5f * (fabs(dzdx) + fabs(dzdy));
+
+  float lo_x = v[0].x, hi_x = v[0].x;
+  float lo_y = v[0].y, hi_y = v[0].y;
+  for (int i = 1; i < n; i++) {
+    lo_x = std::min(lo_x, v[i].x);
+    hi_x = std::max(hi_x, v[i].x);
+    lo_y = std::min(lo_y, v[i].y);
+    hi_y = std::max(hi_y, v[i].y);
+  }
+  int min_x = std::max(int(ceil(lo_x - 0.5f)), 0) & ~3;
+  int max_x = std::min(int(floor(hi_x - 0.5f)), width_ - 1);
+  int min_y = std::max(int(ceil(lo_y - 0.5f)), 0);
+  int max_y = std::min(int(floor(hi_y - 0.5f)), height_ - 1);
+
+  for (int y = min_y; y <= max_y; y++) {
+    float py = y + 0.5f;
+    float row[9];
+    for (int i = 0; i < n; i++) row[i] = b[i] * py + c[i];
+    float z_row = z0 + dzdy * (py - r.y);
+
+    for (int x = min_x; x <= max_x; x += 4) {
+      float* depth = &depth_[y * width_ + x];
+
+      // Lanes past the bounding box may wrap to the next row.
+      int lanes = std::min(max_x - x + 1, 4);
+
+#if defined(__SSE2__)
+      __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3, 2, 1, 0));
+      __m128 inside = _mm_cmplt_ps(_mm_set_ps(3, 2, 1, 0), _mm_set1_ps(float(lanes)));
+      for (int i = 0; i < n; i++) {
+        __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), px), _mm_set1_ps(row[i]));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(e, _mm_setzero_ps()));
+      }
+      if (!_mm_movemask_ps(inside)) continue;
+
+      __m128 z = _mm_sub_ps(px, _mm_set1_ps(r.x));
+      z = _mm_add_ps(_mm_set1_ps(z_row), _mm_mul_ps(_mm_set1_ps(dzdx), z));
+      __m128 old_z = _mm_loadu_ps(depth);
+      __m128 new_z = _mm_min_ps(old_z, z);
+      _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(inside, new_z), _mm_andnot_ps(inside, old_z)));
+#else
+      for (int lane = 0; lane < lanes; lane++) {
+        float px = x + lane + 0.5f;
+        bool inside = true;
+        for (int i = 0; i < n; i++) inside = inside && a[i] * px + row[i] >= 0;
+        if (!inside) continue;
+
+        float z = z_row + dzdx * (px - r.x);
+        depth[lane] = std::min(depth[lane], z);
+      }
+#endif
+    }
+  }
+}
+
+bool OcclusionBuffer::IsVisible(const glm::vec3& min, const glm::vec3& max) const {
+  static Counter& tests = Metrics::GetInstance().GetCounter("occlusion_tests");
+  static Counter& culled = Metrics::GetInstance().GetCounter("occlusion_culled");
+  tests.Add();
+
+  float lo_x = numeric_limits<float>::max(), hi_x = -lo_x;
+  float lo_y = lo_x, hi_y = hi_x;
+  float min_z = lo_x;
+  for (int i = 0; i < 8; i++) {
+    glm::vec3 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+    glm::vec4 p = view_projection_ * glm::vec4(corner - camera_, 1);
+    if (p.z < -p.w) return true;
+
+    float x = (p.x / p.w * 0.5f + 0.5f) * width_;
+    float y = (p.y / p.w * 0.5f + 0.5f) * height_;
+    lo_x = std::min(lo_x, x);
+    hi_x = std::max(hi_x, x);
+    lo_y = std::min(lo_y, y);
+    hi_y = std::max(hi_y, y);
+    min_z = std::min(min_z, p.z / p.w * 0.5f + 0.5f);
+  }
+
+  // Every pixel the box touches, not only the covered centers.
+  int min_x = std::max(int(floor(lo_x)), 0);
+  int max_x = std::min(int(ceil(hi_x)) - 1, width_ - 1);
+  int min_y = std::max(int(floor(lo_y)), 0);
+  int max_y = std::min(int(ceil(hi_y)) - 1, height_ - 1);
+
+  for (int y = min_y; y <= max_y; y++) {
+    const float* depth = &depth_[y * width_];
+    int x = min_x;
+#if defined(__SSE2__)
+    __m128 z = _mm_set1_ps(min_z);
+    for (; x + 3 <= max_x; x += 4) {
+      if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(depth + x), z))) return true;
+    }
+#endif
+    for (; x <= max_x; x++) {
+      if (depth[x] >= min_z) return true;
+    }
+  }
+
+  culled.Add();
+  return false;
+}
+
+bool OcclusionBuffer::IsBackgroundVisible() const {
+  const int size = width_ * height_;
+  int i = 0;
+#if defined(__SSE2__)
+  __m128 one = _mm_set1_ps(1.0f);
+  for (; i + 4 <= size; i += 4) {
+    if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(&depth_[i]), one))) return true;
+  }
+#endif
+  for (; i < size; i++) {
+    if (depth_[i] >= 1.0f) return true;
+  }
+  return false;
+}
+
+} // End of namespace.
@@ -0,0 +1,359 @@
+#include "physics.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace Sibyl {
+
+Physics::Physics(
+  shared_ptr<ThreadPool> thread_pool,
+  shared_ptr<Building> building,
+  Clipmap* clipmap
+) : thread_pool_(thread_pool),
+    building_(building),
+    clipmap_(clipmap),
+    floors_(&no_floors_) {
+  integrate_chunks_ = [this](int begin, int end) {
+    for (int chunk = begin; chunk < end; chunk++) Integrate(chunk);
+  };
+  find_pairs_chunks_ = [this](int begin, int end) {
+    for (int chunk = begin; chunk < end; chunk++) FindPairs(chunk);
+  };
+
+  // Islands are dealt round robin, since their sizes vary.
+  solve_chunks_ = [this](int begin, int end) {
+    int num_islands = this->num_islands();
+    for (int chunk = begin; chunk < end; chunk++) {
+      for (int island = chunk; island < num_islands; island += num_chunks_) {
+        SolveIsland(island);
+      }
+    }
+  };
+}
+
+int Physics::AddBody(const RigidBody& body) {
+  bodies_.push_back(body);
+  return bodies_.size() - 1;
+}
+
+void Physics::Clear() {
+  bodies_.clear();
+  order_.clear();
+  band_.clear();
+  pairs_.clear();
+  island_start_.clear();
+}
+
+// Normal (out of the box) and depth of a body overlapping the box [lo, hi].
+// A sphere is pushed away from the closest point of the box unless its
+// center is inside, where it is handled like a box.
+static bool BoxContact(
+  const RigidBody& body, const vec3& lo, const vec3& hi, vec3* normal, float* depth
+) {
+  if (body.shape == BODY_SPHERE) {
+    float radius = body.half_extents.x;
+    vec3 closest = clamp(body.position, lo, hi);
+    vec3 d = body.position - closest;
+    float distance2 = dot(d, d);
+    if (distance2 >= radius * radius) return false;
+    if (distance2 > 0) {
+      float distance = sqrt(distance2);
+      *normal = d / distance;
+      *depth = radius - distance;
+      return true;
+    }
+  }
+
+  vec3 body_lo = body.position - body.half_extents;
+  vec3 body_hi = body.position + body.half_extents;
+  *depth = numeric_limits<float>::max();
+  for (int axis = 0; axis < 3; axis++) {
+    float below = body_hi[axis] - lo[axis];
+    float above = hi[axis] - body_lo[axis];
+    if (below <= 0 || above <= 0) return false;
+
+    float d = std::min(below, above);
+    if (d < *depth) {
+      *depth = d;
+      *normal = vec3(0);
+      (*normal)[axis] = (below < above) ? -1 : 1;
+    }
+  }
+  return true;
+}
+
+// Normal from a to b and depth of two overlapping bodies.
+static bool Contact(const RigidBody& a, const RigidBody& b, vec3* normal, float* depth) {
+  if (a.shape == BODY_SPHERE && b.shape == BODY_SPHERE) {
+    vec3 d = b.position - a.position;
+    float radii = a.half_extents.x + b.half_extents.x;
+    float distance2 = dot(d, d);
+    if (distance2 >= radii * radii) return false;
+
+    float distance = sqrt(distance2);
+    *normal = (distance > 0) ? d / distance : vec3(0, 1, 0);
+    *depth = radii - distance;
+    return true;
+  }
+
+  if (a.shape == BODY_SPHERE) {
+    if (!BoxContact(a, b.position - b.half_extents, b.position + b.half_extents, normal, depth)) return false;
+    *normal = -*normal;
+    return true;
+  }
+  return BoxContact(b, a.position - a.half_extents, a.position + a.half_extents, normal, depth);
+}
+
+// Moves the body out of a static surface and removes the velocity into it.
+// Resting on top of something slows the body down like the player.
+static void ResolveStatic(RigidBody& body, const vec3& normal, float depth) {
+  body.position += normal * depth;
+
+  float vn = dot(body.velocity, normal);
+  if (vn < 0) body.velocity -= normal * (vn * (1.0f + PHYSICS_RESTITUTION));
+  if (normal.y > 0.5f) {
+    body.velocity.x *= PHYSICS_FRICTION;
+    body.velocity.z *= PHYSICS_FRICTION;
+  }
+}
+
+// Integrates the bodies of a chunk and pushes them out of the floors and
+// the terrain. Terrain heights are fetched for a batch of bodies at a time.
+void Physics::Integrate(int chunk) {
+  const Bvh& floors = *floors_;
+  vector<int>& candidates = chunk_candidates_[chunk];
+  int begin = bodies_.size() * chunk / num_chunks_;
+  int end = bodies_.size() * (chunk + 1) / num_chunks_;
+  vec3 points[PHYSICS_HEIGHT_BATCH];
+  float heights[PHYSICS_HEIGHT_BATCH];
+
+  for (int first = begin; first < end; first += PHYSICS_HEIGHT_BATCH) {
+    int n = std::min(end - first, PHYSICS_HEIGHT_BATCH);
+    for (int i = 0; i < n; i++) {
+      RigidBody& body = bodies_[first + i];
+      points[i] = body.position;
+      if (body.inverse_mass == 0) continue;
+
+      body.velocity.y -= GRAVITY;
+      body.velocity *= PHYSICS_DAMPING;
+      body.position += body.velocity;
+
+      candidates.clear();
+      floors.Query(body.position - body.half_extents, body.position + body.half_extents, candidates);
+      for (int f : candidates) {
+        vec3 normal;
+        float depth;
+        if (BoxContact(body, floors.mins()[f], floors.maxs()[f], &normal, &depth)) {
+          ResolveStatic(body, normal, depth);
+        }
+      }
+      points[i] = body.position;
+    }
+
+    if (!clipmap_) continue;
+    clipmap_->GetHeights(points, n, heights);
+    for (int i = 0; i < n; i++) {
+      RigidBody& body = bodies_[first + i];
+      if (body.inverse_mass == 0) continue;
+
+      float depth = heights[i] - (body.position.y - body.half_extents.y);
+      if (depth > 0) ResolveStatic(body, vec3(0, 1, 0), depth);
+    }
+  }
+}
+
+bool Physics::Before(int a, int b) const {
+  if (band_[a] != band_[b]) return band_[a] < band_[b];
+  return min_x_[a] < min_x_[b];
+}
+
+// Bands are as deep as the deepest body, so overlapping bodies are in the
+// same band or in neighbouring ones. The order of the last tick is almost
+// sorted, so insertion sort runs in about linear time. New bodies restart
+// from a full sort.
+void Physics::SortAxis() {
+  int n = bodies_.size();
+  float band_depth = 0;
+  max_width_ = 0;
+  for (auto& body : bodies_) {
+    band_depth = std::max(band_depth, 2.0f * body.half_extents.z);
+    max_width_ = std::max(max_width_, 2.0f * body.half_extents.x);
+  }
+  band_depth = std::max(band_depth, 0.001f);
+
+  band_.resize(n);
+  min_x_.resize(n);
+  max_x_.resize(n);
+  for (int i = 0; i < n; i++) {
+    band_[i] = floor(bodies_[i].position.z / band_depth);
+    min_x_[i] = bodies_[i].position.x - bodies_[i].half_extents.x;
+    max_x_[i] = bodies_[i].position.x + bodies_[i].half_extents.x;
+  }
+
+  if (order_.size() != n) {
+    order_.resize(n);
+    for (int i = 0; i < n; i++) order_[i] = i;
+    sort(order_.begin(), order_.end(), [&](int a, int b) { return Before(a, b); });
+    return;
+  }
+
+  for (int i = 1; i < n; i++) {
+    int body = order_[i];
+    int j = i - 1;
+    while (j >= 0 && Before(body, order_[j])) {
+      order_[j + 1] = order_[j];
+      j--;
+    }
+    order_[j + 1] = body;
+  }
+}
+
+// Each chunk sweeps its own range of the sorted order. A body is tested
+// against the rest of its band and against the next band, from the first
+// body there that may reach it, until the bodies start past it.
+void Physics::FindPairs(int chunk) {
+  int n = order_.size();
+  vector<ivec2>& pairs = chunk_pairs_[chunk];
+  pairs.clear();
+
+  auto test = [&](int a, int b) {
+    const RigidBody& body_a = bodies_[a];
+    const RigidBody& body_b = bodies_[b];
+    if (body_a.inverse_mass == 0 && body_b.inverse_mass == 0) return;
+    if (max_x_[b] < min_x_[a]) return;
+
+    vec3 d = abs(body_b.position - body_a.position);
+    vec3 extent = body_a.half_extents + body_b.half_extents;
+    if (d.y >= extent.y || d.z >= extent.z) return;
+
+    pairs.push_back(ivec2(a, b));
+  };
+
+  int begin = n * chunk / num_chunks_;
+  int end = n * (chunk + 1) / num_chunks_;
+  for (int i = begin; i < end; i++) {
+    int a = order_[i];
+    int band = band_[a];
+    for (int j = i + 1; j < n && band_[order_[j]] == band && min_x_[order_[j]] <= max_x_[a]; j++) {
+      test(a, order_[j]);
+    }
+
+    float x = min_x_[a] - max_width_;
+    auto first = lower_bound(order_.begin() + i + 1, order_.end(), a, [&](int body, int) {
+      if (band_[body] != band + 1) return band_[body] < band + 1;
+      return min_x_[body] < x;
+    });
+    for (int j = first - order_.begin(); j < n && band_[order_[j]] == band + 1 && min_x_[order_[j]] <= max_x_[a]; j++) {
+      test(a, order_[j]);
+    }
+  }
+}
+
+void Physics::FindPairs() {
+  thread_pool_->ParallelFor(0, num_chunks_, find_pairs_chunks_);
+
+  pairs_.clear();
+  for (auto& pairs : chunk_pairs_) pairs_.insert(pairs_.end(), pairs.begin(), pairs.end());
+}
+
+int Physics::Find(int body) {
+  while (parent_[body] != body) {
+    parent_[body] = parent_[parent_[body]];
+    body = parent_[body];
+  }
+  return body;
+}
+
+// Union find over the pairs. Static bodies are never moved by the solver,
+// so they do not join islands and can be shared between them.
+void Physics::BuildIslands() {
+  int n = bodies_.size();
+  parent_.resize(n);
+  for (int i = 0; i < n; i++) parent_[i] = i;
+
+  for (auto& p : pairs_) {
+    if (bodies_[p.x].inverse_mass == 0 || bodies_[p.y].inverse_mass == 0) continue;
+
+    int a = Find(p.x);
+    int b = Find(p.y);
+    if (a != b) parent_[a] = b;
+  }
+
+  // Counting sort of the pairs by island.
+  island_.assign(n, -1);
+  island_start_.assign(1, 0);
+  pair_islands_.resize(pairs_.size());
+  for (int i = 0; i < pairs_.size(); i++) {
+    int body = (bodies_[pairs_[i].x].inverse_mass == 0) ? pairs_[i].y : pairs_[i].x;
+    int root = Find(body);
+    if (island_[root] == -1) {
+      island_[root] = island_start_.size() - 1;
+      island_start_.push_back(0);
+    }
+    pair_islands_[i] = island_[root];
+    island_start_[island_[root] + 1]++;
+  }
+
+  for (int i = 1; i < island_start_.size(); i++) island_start_[i] += island_start_[i - 1];
+
+  island_pairs_.resize(pairs_.size());
+  island_next_.assign(island_start_.begin(), island_start_.end() - 1);
+  for (int i = 0; i < pairs_.size(); i++) {
+    island_pairs_[island_next_[pair_islands_[i]]++] = pairs_[i];
+  }
+}
+
+// Pushes the bodies of each pair apart in proportion to their inverse
+// masses and removes their approaching velocity, a few times over so that
+// stacks settle.
+void Physics::SolveIsland(int island) {
+  for (int iteration = 0; iteration < PHYSICS_SOLVER_ITERATIONS; iteration++) {
+    for (int i = island_start_[island]; i < island_start_[island + 1]; i++) {
+      RigidBody& a = bodies_[island_pairs_[i].x];
+      RigidBody& b = bodies_[island_pairs_[i].y];
+
+      vec3 normal;
+      float depth;
+      if (!Contact(a, b, &normal, &depth)) continue;
+
+      // Static bodies may be shared with islands on other threads, so they
+      // must not even be written.
+      float weight = a.inverse_mass + b.inverse_mass;
+      vec3 correction = normal * (depth / weight);
+      float vn = dot(b.velocity - a.velocity, normal);
+      vec3 impulse = normal * ((vn < 0) ? -(1.0f + PHYSICS_RESTITUTION) * vn / weight : 0.0f);
+      if (a.inverse_mass > 0) {
+        a.position -= correction * a.inverse_mass;
+        a.velocity -= impulse * a.inverse_mass;
+      }
+      if (b.inverse_mass > 0) {
+        b.position += correction * b.inverse_mass;
+        b.velocity += impulse * b.inverse_mass;
+      }
+    }
+  }
+}
+
+void Physics::Step(int ticks) {
+  static Gauge& pair_gauge = Metrics::GetInstance().GetGauge("physics_pairs");
+  static Gauge& island_gauge = Metrics::GetInstance().GetGauge("physics_islands");
+  if (bodies_.empty()) return;
+
+  floors_ = (building_) ? &building_->floor_bvh() : &no_floors_;
+  num_chunks_ = std::max(thread_pool_->size(), 1);
+  chunk_candidates_.resize(num_chunks_);
+  chunk_pairs_.resize(num_chunks_);
+
+  for (int tick = 0; tick < ticks; tick++) {
+    thread_pool_->ParallelFor(0, num_chunks_, integrate_chunks_);
+    SortAxis();
+    FindPairs();
+    BuildIslands();
+    thread_pool_->ParallelFor(0, num_chunks_, solve_chunks_);
+  }
+
+  pair_gauge.Set(pairs_.size());
+  island_gauge.Set(num_islands());
+}
+
+} // End of namespace.
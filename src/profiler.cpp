@@ -0,0 +1,180 @@
+#include "profiler.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace Sibyl {
+
+Profiler::Profiler() 
+  : start_time_(chrono::steady_clock::now()),
+    slots_(PROFILER_BUFFER_SIZE),
+    head_(0),
+    next_thread_id_(0) {
+}
+
+Profiler& Profiler::GetInstance() {
+  static Profiler instance; 
+  return instance;
+}
+
+double Profiler::Now() {
+  return chrono::duration<double, micro>(
+    chrono::steady_clock::now() - start_time_
+  ).count();
+}
+
+int Profiler::ThreadId() {
+  thread_local int id = next_thread_id_++;
+  return id;
+}
+
+// Writers claim a slot with a single fetch_add. The slot sequence works as
+// a seqlock: it is odd while the event is being written, so a concurrent
+// export can tell torn events apart and skip them.
+void Profiler::Record(
+  const char* name, ProfileTrack track, double start, double duration
+) {
+  uint64_t index = head_.fetch_add(1, memory_order_relaxed);
+  Slot& slot = slots_[index % slots_.size()];
+
+  slot.sequence.store(2 * index + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  strncpy(slot.event.name, name, sizeof(slot.event.name) - 1);
+  slot.event.name[sizeof(slot.event.name) - 1] = '\0';
+  slot.event.track = track;
+  slot.event.thread_id = (track == TRACK_GPU) ? 0 : ThreadId();
+  slot.event.start = start;
+  slot.event.duration = duration;
+
+  slot.sequence.store(2 * index + 2, memory_order_release);
+}
+
+void Profiler::BeginGpu(const char* name) {
+  if (gpu_depth_++ > 0) return;
+
+  GpuQuery q;
+  if (free_queries_.empty()) {
+    glGenQueries(1, &q.query);
+  } else {
+    q.query = free_queries_.back();
+    free_queries_.pop_back();
+  }
+  strncpy(q.name, name, sizeof(q.name) - 1);
+  q.name[sizeof(q.name) - 1] = '\0';
+  q.start = Now();
+
+  glBeginQuery(GL_TIME_ELAPSED, q.query);
+  pending_queries_.push_back(q);
+}
+
+void Profiler::EndGpu() {
+  if (--gpu_depth_ > 0) return;
+  glEndQuery(GL_TIME_ELAPSED);
+}
+
+// Reads back the GPU queries that have finished, in issue order. GPU work
+// runs serially, so an event cannot start before the previous one ended.
+// The start times are the CPU submission times pushed back to fit that 
+// order, which is close enough to line up passes in the trace.
+void Profiler::Collect() {
+  size_t num_finished = 0;
+  for (; num_finished < pending_queries_.size(); num_finished++) {
+    GpuQuery& q = pending_queries_[num_finished];
+
+    GLint available = 0;
+    glGetQueryObjectiv(q.query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) break;
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(q.query, GL_QUERY_RESULT, &elapsed);
+
+    double start = std::max(q.start, gpu_end_);
+    double duration = elapsed / 1000.0;
+    gpu_end_ = start + duration;
+    Record(q.name, TRACK_GPU, start, duration);
+
+    free_queries_.push_back(q.query);
+  }
+  pending_queries_.erase(pending_queries_.begin(), pending_queries_.begin() + num_finished);
+}
+
+vector<ProfileEvent> Profiler::GetEvents() {
+  vector<ProfileEvent> events;
+
+  uint64_t head = head_.load(memory_order_acquire);
+  uint64_t size = slots_.size();
+  uint64_t first = (head > size) ? head - size : 0;
+  for (uint64_t i = first; i < head; i++) {
+    Slot& slot = slots_[i % size];
+    uint64_t sequence = slot.sequence.load(memory_order_acquire);
+    if (sequence != 2 * i + 2) continue;
+
+    ProfileEvent event = slot.event;
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.sequence.load(memory_order_relaxed) != sequence) continue;
+    events.push_back(event);
+  }
+  return events;
+}
+
+// Appends the events recorded since the cursor and moves the cursor past
+// them. An event still being written stops the read, so the next call picks
+// it up. Returns false if the ring wrapped past the cursor and some events
+// were overwritten before they were read.
+bool Profiler::ReadEvents(uint64_t* cursor, vector<ProfileEvent>& events) {
+  bool complete = true;
+  uint64_t head = head_.load(memory_order_acquire);
+  uint64_t size = slots_.size();
+  if (head > size && *cursor < head - size) {
+    *cursor = head - size;
+    complete = false;
+  }
+
+  for (; *cursor < head; (*cursor)++) {
+    Slot& slot = slots_[*cursor % size];
+    uint64_t sequence = slot.sequence.load(memory_order_acquire);
+    if (sequence < 2 * *cursor + 2) break;
+
+    ProfileEvent event = slot.event;
+    atomic_thread_fence(memory_order_acquire);
+    if (sequence != 2 * *cursor + 2 || slot.sequence.load(memory_order_relaxed) != sequence) {
+      complete = false;
+      continue;
+    }
+    events.push_back(event);
+  }
+  return complete;
+}
+
+void Profiler::ExportChromeTrace(const string& filename) {
+  ofstream f(filename);
+  if (!f.is_open()) {
+    cout << "Could not write trace to " << filename << endl;
+    return;
+  }
+
+  vector<ProfileEvent> events = GetEvents();
+
+  // CPU threads go under process 0 and the GPU gets its own process, so
+  // Perfetto shows them as separate tracks.
+  f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+  f << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}}," << endl;
+  f << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}";
+  for (auto& e : events) {
+    f << "," << endl << "{\"name\":\"" << e.name << "\""
+      << ",\"cat\":\"" << ((e.track == TRACK_GPU) ? "gpu" : "cpu") << "\""
+      << ",\"ph\":\"X\""
+      << ",\"ts\":" << fixed << e.start
+      << ",\"dur\":" << e.duration
+      << ",\"pid\":" << int(e.track)
+      << ",\"tid\":" << e.thread_id << "}";
+  }
+  f << endl << "]}" << endl;
+
+  cout << "Wrote " << events.size() << " trace events to " << filename << endl;
+}
+
+} // End of namespace.
@@ -0,0 +1,140 @@
+#include "render_queue.hpp"
+
+using namespace std;
+
+namespace Sibyl {
+
+static const int kDepthBits = 24;
+static const int kIdBits = 12;
+static const uint64_t kIdMask = (1 << kIdBits) - 1;
+static const uint64_t kDepthMask = (1 << kDepthBits) - 1;
+
+uint64_t RenderQueue::MakeKey(
+  RenderPass pass, GLuint program, GLuint texture, GLuint mesh, float depth
+) {
+  // Quantize the view space distance to the depth bits.
+  float d = std::min(std::max(depth / FAR_CLIPPING, 0.0f), 1.0f);
+  uint64_t depth_bits = uint64_t(d * kDepthMask);
+
+  uint64_t state = (uint64_t(program & kIdMask) << (2 * kIdBits)) |
+                   (uint64_t(texture & kIdMask) << kIdBits) |
+                    uint64_t(mesh & kIdMask);
+
+  uint64_t key = uint64_t(pass) << 60;
+  if (pass == PASS_TRANSLUCENT) {
+    // Back to front, so farther items must come first.
+    key |= (kDepthMask - depth_bits) << (3 * kIdBits);
+    key |= state;
+  } else {
+    key |= state << kDepthBits;
+    key |= depth_bits;
+  }
+  return key;
+}
+
+void RenderQueue::Submit(
+  uint64_t key, const string& name, void (*draw)(void*), void* closure, const char* group
+) {
+  const char* arena_name = arena_.Copy(name);
+  lock_guard<mutex> lock(mutex_);
+  items_.push_back(DrawItem(key, arena_name, draw, closure, group));
+}
+
+void RenderQueue::Submit(
+  uint64_t key, const string& name, CommandList&& commands, const char* group
+) {
+  const char* arena_name = arena_.Copy(name);
+  lock_guard<mutex> lock(mutex_);
+  items_.push_back(DrawItem(key, arena_name, std::move(commands), group));
+}
+
+// Sorts (key, submission index) pairs instead of the items, which keeps
+// equal keys in submission order like a stable sort without its temporary
+// buffer.
+void RenderQueue::Sort() {
+  order_.resize(items_.size());
+  for (int i = 0; i < items_.size(); i++) order_[i] = make_pair(items_[i].key, i);
+  sort(order_.begin(), order_.end());
+}
+
+void RenderQueue::Clear() {
+  items_.clear();
+  order_.clear();
+  arena_.Reset();
+}
+
+static uint64_t GetState(uint64_t key) {
+  uint64_t state_mask = (uint64_t(1) << (3 * kIdBits)) - 1;
+  return (RenderQueue::GetPass(key) == PASS_TRANSLUCENT) 
+    ? key & state_mask : (key >> kDepthBits) & state_mask;
+}
+
+void RenderQueue::Execute() {
+  Profiler& profiler = Profiler::GetInstance();
+  static Counter& state_changes = Metrics::GetInstance().GetCounter("state_changes");
+  static Gauge& queue_items = Metrics::GetInstance().GetGauge("render_queue_items");
+  queue_items.Set(items_.size());
+
+  uint64_t last_state = 0;
+
+  const char* group = nullptr;
+  double start = 0;
+  for (auto& o : order_) {
+    DrawItem& item = items_[o.second];
+    const char* item_group = (item.group) ? item.group : item.name;
+    if (!group || strcmp(group, item_group) != 0) {
+      if (group) {
+        profiler.EndGpu();
+        profiler.Record(group, TRACK_CPU, start, profiler.Now() - start);
+      }
+      group = item_group;
+      start = profiler.Now();
+      profiler.BeginGpu(group);
+    }
+
+    uint64_t state = GetState(item.key);
+    if (&o == &order_[0] || state != last_state) state_changes.Add();
+    last_state = state;
+
+    if (item.draw) item.draw(item.closure);
+    item.commands.Execute();
+  }
+
+  if (group) {
+    profiler.EndGpu();
+    profiler.Record(group, TRACK_CPU, start, profiler.Now() - start);
+  }
+}
+
+void RenderQueue::Flush(ostream* dump) {
+  Sort();
+  if (dump) Dump(*dump);
+  Execute();
+  Clear();
+}
+
+void RenderQueue::Dump(ostream& os) {
+  const char* pass_names[] = { "sky", "opaque", "water", "translucent", "overlay" };
+
+  int state_changes = 0;
+  uint64_t last_state = 0;
+  os << "Render queue (" << items_.size() << " items)" << endl;
+  for (int i = 0; i < order_.size(); i++) {
+    const DrawItem& item = items_[order_[i].second];
+    RenderPass pass = GetPass(item.key);
+
+    uint64_t state = GetState(item.key);
+    if (i == 0 || state != last_state) state_changes++;
+    last_state = state;
+
+    os << i << "\t" << pass_names[pass] 
+       << "\tprogram=" << ((state >> (2 * kIdBits)) & kIdMask)
+       << "\ttexture=" << ((state >> kIdBits) & kIdMask)
+       << "\tmesh=" << (state & kIdMask)
+       << "\tkey=0x" << hex << item.key << dec
+       << "\t" << item.name << endl;
+  }
+  os << state_changes << " state changes" << endl;
+}
+
+} // End of namespace.
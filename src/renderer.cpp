@@ -1,22 +1,18 @@
 #include "renderer.hpp"
+#include "game_state.hpp"
 
 using namespace std;
 using namespace glm;
 
 namespace Sibyl {
 
-Renderer::Renderer()  {
+Renderer::Renderer() 
+  : keep_mesh_data_(GameState::options().keep_mesh_data) {
   glEnable(GL_DEPTH_TEST);
   glDepthFunc(GL_LESS); 
   glEnable(GL_CULL_FACE);
   glEnable(GL_MULTISAMPLE);
 
-  // Why is this necessary? Should look on shaders. 
-  // Vertex arrays group VBOs.
-  GLuint VertexArrayID;
-  glGenVertexArrays(1, &VertexArrayID);
-  glBindVertexArray(VertexArrayID);
-
   shader_ = Shader("text");
   CreateShaders();
   CreateVBOs();
@@ -39,6 +35,7 @@ void Renderer::CreateShaders() {
   shaders_["mask"     ] = Shader("mask");
   shaders_["screen"   ] = Shader("screen");
   shaders_["plot"   ] = Shader("plot");
+  shaders_["composite"] = Shader("composite", "v_screen", "f_composite");
 }
 
 void Renderer::CreateVBOs() {
@@ -50,16 +47,6 @@ void Renderer::CreateVBOs() {
   glBindBuffer(GL_ARRAY_BUFFER, uv_);
   glBufferData(GL_ARRAY_BUFFER, 32 * sizeof(glm::vec2), nullptr, GL_DYNAMIC_DRAW);
 
-  vbos_["cube_v"] = 0;
-  glGenBuffers(1, &vbos_["cube_v"]);
-  glBindBuffer(GL_ARRAY_BUFFER, vbos_["cube_v"]);
-  glBufferData(GL_ARRAY_BUFFER, 36 * sizeof(glm::vec3), nullptr, GL_DYNAMIC_DRAW);
-
-  vbos_["cube_uv"] = 0;
-  glGenBuffers(1, &vbos_["cube_uv"]);
-  glBindBuffer(GL_ARRAY_BUFFER, vbos_["cube_uv"]);
-  glBufferData(GL_ARRAY_BUFFER, 36 * sizeof(glm::vec2), nullptr, GL_DYNAMIC_DRAW);
-
   vbos_["mask_uv"] = 0;
   glGenBuffers(1, &vbos_["mask_uv"]);
   vector<vec2> vertices { 
@@ -70,6 +57,17 @@ void Renderer::CreateVBOs() {
   glBindBuffer(GL_ARRAY_BUFFER, vbos_["mask_uv"]);
   glBufferData(GL_ARRAY_BUFFER, 6 * sizeof(glm::vec2), &vertices[0], GL_STATIC_DRAW);
 
+  // The streamed quads share vbo_ and uv_, but each shader reads its own
+  // set of slots.
+  vaos_["polygon"] = CreateVertexArray();
+  SetVertexAttribute(vbo_, 0, 3);
+  vaos_["plot"] = CreateVertexArray();
+  SetVertexAttribute(vbo_, 0, 3);
+  SetVertexAttribute(uv_, 1, 2);
+  vaos_["mask"] = CreateVertexArray();
+  SetVertexAttribute(vbos_["mask_uv"], 0, 2);
+  glBindVertexArray(0);
+
   vector<vec3> vertices2 {
     { -1, -1, 0.0 },
     { -1,  1, 0.0 },
@@ -89,35 +87,129 @@ void Renderer::CreateVBOs() {
   LoadMesh("screen", vertices2, uvs, indices);
 }
 
-void Renderer::LoadMesh(
+static void UploadIndices(Mesh& m, const unsigned int* indices, size_t num_indices) {
+  m.num_indices_ = num_indices;
+  glGenBuffers(1, &m.element_buffer_);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.element_buffer_); glBufferData(
+    GL_ELEMENT_ARRAY_BUFFER, 
+    num_indices * sizeof(unsigned int), 
+    indices, 
+    GL_STATIC_DRAW
+  );
+}
+
+// Separate position and uv streams, for meshes drawn by shaders other than
+// the object shader. The arrays only need to live until the call returns.
+Mesh& Renderer::UploadMesh(
   const string& name, 
-  vector<vec3>& vertices, 
-  vector<vec2>& uvs, 
-  vector<unsigned int>& indices
+  const vec3* vertices, 
+  const vec2* uvs, 
+  size_t num_vertices,
+  const unsigned int* indices, 
+  size_t num_indices
 ) {
-  Mesh m;
+  DeleteMesh(name);
+
+  Mesh& m = meshes_[name];
+  m.num_vertices_ = num_vertices;
+  if (num_vertices > 0) {
+    m.min_ = m.max_ = vertices[0];
+    for (size_t i = 1; i < num_vertices; i++) {
+      m.min_ = glm::min(m.min_, vertices[i]);
+      m.max_ = glm::max(m.max_, vertices[i]);
+    }
+  }
+
+  m.vertex_array_ = CreateVertexArray();
   glGenBuffers(1, &m.vertex_buffer_);
+  glBindBuffer(GL_ARRAY_BUFFER, m.vertex_buffer_);
+  glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(glm::vec3), vertices, GL_STATIC_DRAW);
+
   glGenBuffers(1, &m.uv_buffer_);
-  glGenBuffers(1, &m.element_buffer_);
+  glBindBuffer(GL_ARRAY_BUFFER, m.uv_buffer_);
+  glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(glm::vec2), uvs, GL_STATIC_DRAW);
+  SetVertexAttribute(m.vertex_buffer_, 0, 3);
+  SetVertexAttribute(m.uv_buffer_, 1, 2);
+  UploadIndices(m, indices, num_indices);
+  glBindVertexArray(0);
+
+  if (keep_mesh_data_) {
+    m.vertices_.assign(vertices, vertices + num_vertices);
+    m.uvs_.assign(uvs, uvs + num_vertices);
+    m.indices_.assign(indices, indices + num_indices);
+  }
+  return m;
+}
+
+// Packed vertices (see vertex_format.hpp), which can point into a mapped
+// .smesh file.
+Mesh& Renderer::UploadMesh(
+  const string& name, 
+  const VertexFormat& format,
+  const char* vertices, 
+  size_t num_vertices,
+  const unsigned int* indices, 
+  size_t num_indices
+) {
+  DeleteMesh(name);
 
-  m.vertices_ = vertices;
-  m.uvs_ = uvs;
-  m.indices_ = indices;
+  Mesh& m = meshes_[name];
+  m.num_vertices_ = num_vertices;
+  m.interleaved_ = true;
+  m.format_ = format;
+  m.min_ = format.min;
+  m.max_ = format.max;
 
+  VertexLayout layout = GetVertexLayout(format.encoding);
+  m.vertex_array_ = CreateVertexArray();
+  glGenBuffers(1, &m.vertex_buffer_);
   glBindBuffer(GL_ARRAY_BUFFER, m.vertex_buffer_);
-  glBufferData(GL_ARRAY_BUFFER, m.vertices_.size() * sizeof(glm::vec3), &m.vertices_[0], GL_STATIC_DRAW);
+  glBufferData(GL_ARRAY_BUFFER, num_vertices * layout.stride, vertices, GL_STATIC_DRAW);
+
+  // The object shader turns the stored positions back into object space
+  // and decodes the octahedral normals. Normal bytes go in as plain
+  // integers so the shader can map them to [-1, 1] exactly.
+  GLenum position_type = GL_FLOAT;
+  if (format.encoding == POSITION_HALF) position_type = GL_HALF_FLOAT;
+  if (format.encoding == POSITION_UNORM16) position_type = GL_UNSIGNED_SHORT;
+  SetVertexAttribute(
+    m.vertex_buffer_, 0, 3, position_type, 
+    format.encoding == POSITION_UNORM16, layout.stride, layout.position
+  );
+  SetVertexAttribute(m.vertex_buffer_, 1, 2, GL_HALF_FLOAT, GL_FALSE, layout.stride, layout.uv);
+  SetVertexAttribute(m.vertex_buffer_, 2, 2, GL_BYTE, GL_FALSE, layout.stride, layout.normal);
+
+  // The instance buffer has no storage until the first instanced draw, but
+  // growing it later keeps its name, so the attributes can be set now. A
+  // mat4 attribute takes four consecutive slots, one per column.
+  glGenBuffers(1, &m.instance_buffer_);
+  GLsizei instance_stride = sizeof(MeshInstance);
+  for (int i = 0; i < 4; i++) {
+    SetInstanceAttribute(m.instance_buffer_, 3 + i, 4, instance_stride, i * sizeof(glm::vec4));
+  }
+  SetInstanceAttribute(m.instance_buffer_, 7, 1, instance_stride, offsetof(MeshInstance, highlight));
 
-  glBindBuffer(GL_ARRAY_BUFFER, m.uv_buffer_);
-  glBufferData(GL_ARRAY_BUFFER, m.uvs_.size() * sizeof(glm::vec2), &m.uvs_[0], GL_STATIC_DRAW);
+  UploadIndices(m, indices, num_indices);
+  glBindVertexArray(0);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.element_buffer_); glBufferData(
-    GL_ELEMENT_ARRAY_BUFFER, 
-    m.indices_.size() * sizeof(unsigned int), 
-    &m.indices_[0], 
-    GL_STATIC_DRAW
-  );
+  // The CPU copies are decoded, so they match what the GPU draws.
+  if (keep_mesh_data_) {
+    UnpackVertices(format, vertices, num_vertices, m.vertices_, m.uvs_, m.normals_);
+    m.indices_.assign(indices, indices + num_indices);
+  }
+  return m;
+}
 
-  meshes_[name] = m;
+void Renderer::LoadMesh(
+  const string& name, 
+  vector<vec3>& vertices, 
+  vector<vec2>& uvs, 
+  vector<unsigned int>& indices
+) {
+  UploadMesh(
+    name, vertices.data(), uvs.data(), vertices.size(), 
+    indices.data(), indices.size()
+  );
 }
 
 void Renderer::LoadMesh(
@@ -127,100 +219,79 @@ void Renderer::LoadMesh(
   vector<vec3>& normals, 
   vector<unsigned int>& indices
 ) {
-  Mesh m;
-  glGenBuffers(1, &m.vertex_buffer_);
-  glGenBuffers(1, &m.uv_buffer_);
-  glGenBuffers(1, &m.normal_buffer_);
-  glGenBuffers(1, &m.element_buffer_);
-
-  m.vertices_ = vertices;
-  m.uvs_ = uvs;
-  m.normals_ = normals;
-  m.indices_ = indices;
-
-  glBindBuffer(GL_ARRAY_BUFFER, m.vertex_buffer_);
-  glBufferData(GL_ARRAY_BUFFER, m.vertices_.size() * sizeof(glm::vec3), &m.vertices_[0], GL_STATIC_DRAW);
-
-  glBindBuffer(GL_ARRAY_BUFFER, m.uv_buffer_);
-  glBufferData(GL_ARRAY_BUFFER, m.uvs_.size() * sizeof(glm::vec2), &m.uvs_[0], GL_STATIC_DRAW);
-
-  glBindBuffer(GL_ARRAY_BUFFER, m.normal_buffer_);
-  glBufferData(GL_ARRAY_BUFFER, m.normals_.size() * sizeof(glm::vec3), &m.normals_[0], GL_STATIC_DRAW);
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.element_buffer_); glBufferData(
-    GL_ELEMENT_ARRAY_BUFFER, 
-    m.indices_.size() * sizeof(unsigned int), 
-    &m.indices_[0], 
-    GL_STATIC_DRAW
+  VertexFormat format;
+  vector<char> packed;
+  PackVertices(
+    MESH_POSITION_ENCODING, vertices.data(), uvs.data(), normals.data(), 
+    vertices.size(), format, packed
   );
+  UploadMesh(
+    name, format, packed.data(), vertices.size(), indices.data(), indices.size()
+  );
+}
 
-  meshes_[name] = m;
+void Renderer::DeleteMesh(const string& name) {
+  auto it = meshes_.find(name);
+  if (it == meshes_.end()) return;
+
+  Mesh& m = it->second;
+  glDeleteVertexArrays(1, &m.vertex_array_);
+  glDeleteBuffers(1, &m.vertex_buffer_);
+  glDeleteBuffers(1, &m.uv_buffer_);
+  glDeleteBuffers(1, &m.element_buffer_);
+  glDeleteBuffers(1, &m.instance_buffer_);
+  meshes_.erase(it);
 }
 
+// Loads meshes/<name>.obj through its .smesh cache next to it. A missing
+// or stale cache is rebuilt from the OBJ; if it cannot be written (say, a
+// read only checkout) the mesh is still loaded from the parsed arrays.
 void Renderer::LoadMesh(const string& name) {
-  string filename = "meshes/" + name + ".obj";
-  ifstream f(filename);
-  if (!f.is_open()) return;
-
-  vector<glm::vec3> vertex_lookup;
-  vector<glm::vec2> uv_lookup;
-  vector<glm::vec3> normal_lookup;
-
-  vector<glm::vec3> vertices;
-  vector<glm::vec2> uvs;
-  vector<glm::vec3> normals;
-  vector<unsigned int> indices;
-
-  string line;
-  while (getline(f, line)) {
-    vector<string> tokens;
-    boost::split(tokens, line, boost::is_any_of(" "));
-    if (!tokens.size()) continue;
-
-    string type = tokens[0];
-    if (type == "v") {
-      glm::vec3 vertex;
-      vertex.x = boost::lexical_cast<float>(tokens[1]); 
-      vertex.y = boost::lexical_cast<float>(tokens[2]);
-      vertex.z = boost::lexical_cast<float>(tokens[3]);
-      vertex_lookup.push_back(vertex);
-    } else if (type == "vt") {
-      glm::vec2 uv_coordinate;
-      uv_coordinate.x = boost::lexical_cast<float>(tokens[1]); 
-      uv_coordinate.y = boost::lexical_cast<float>(tokens[2]);
-      uv_lookup.push_back(uv_coordinate);
-    } else if (type == "vn") {
-      glm::vec3 normal;
-      normal.x = boost::lexical_cast<float>(tokens[1]); 
-      normal.y = boost::lexical_cast<float>(tokens[2]);
-      normal.z = boost::lexical_cast<float>(tokens[3]);
-      normal_lookup.push_back(normal);
-    } else if (type == "f") {
-      vector<unsigned int> vertex_ids;
-      vector<unsigned int> uv_ids;
-      vector<unsigned int> normal_ids;
-      for (int i = 1; i < tokens.size(); i++) {
-        string& s = tokens[i];
-        size_t j = s.find_first_of("/", 0);
-        vertex_ids.push_back(boost::lexical_cast<unsigned int>(s.substr(0, j)) - 1); 
-
-        size_t k = s.find_first_of("/", j+1);
-        uv_ids.push_back(boost::lexical_cast<unsigned int>(s.substr(j+1, k-j-1)) - 1); 
-
-        normal_ids.push_back(boost::lexical_cast<unsigned int>(s.substr(k+1)) - 1); 
-      }
-  
-      for (int i = 0; i < 3; i++) { 
-        vertices.push_back(vertex_lookup[vertex_ids[i]]);
-        uvs.push_back(uv_lookup[uv_ids[i]]);
-        normals.push_back(vertex_lookup[normal_ids[i]]);
-        indices.push_back(vertices.size()-1);
-      }
+  string source = "meshes/" + name + ".obj";
+  string cache = "meshes/" + name + ".smesh";
+
+  SmeshFile smesh;
+  if (!smesh.Open(cache, source, MESH_POSITION_ENCODING)) {
+    vector<glm::vec3> vertices;
+    vector<glm::vec2> uvs;
+    vector<glm::vec3> normals;
+    vector<unsigned int> indices;
+    if (!ParseObj(source, vertices, uvs, normals, indices)) return;
+
+    // The parser emits one vertex per face corner in face order.
+    MeshStats stats = OptimizeMesh(vertices, uvs, normals, indices);
+
+    VertexFormat format;
+    vector<char> packed;
+    PackVertices(
+      MESH_POSITION_ENCODING, vertices.data(), uvs.data(), normals.data(), 
+      vertices.size(), format, packed
+    );
+    SmeshFile::Write(cache, source, format, packed, indices, stats);
+
+    if (!smesh.Open(cache, source, MESH_POSITION_ENCODING)) {
+      Mesh& m = UploadMesh(
+        name, format, packed.data(), vertices.size(), indices.data(), indices.size()
+      );
+      m.stats_ = stats;
+      return;
     }
   }
-  f.close();
 
-  LoadMesh(name, vertices, uvs, normals, indices);
+  Mesh& m = UploadMesh(
+    name, smesh.format(), smesh.vertices(), smesh.num_vertices(), 
+    smesh.indices(), smesh.num_indices()
+  );
+  m.stats_ = smesh.stats();
+}
+
+// Reads an OBJ file into unindexed vertex arrays (see obj_parser.hpp). Does
+// not touch GL, so it can run without a context.
+bool Renderer::ParseObj(
+  const string& filename, vector<vec3>& vertices, vector<vec2>& uvs, 
+  vector<vec3>& normals, vector<unsigned int>& indices
+) {
+  return Sibyl::ParseObj(filename, vertices, uvs, normals, indices);
 }
 
 void Renderer::CreateFramebuffer(const string& name, int width, int height) {
@@ -378,6 +449,15 @@ void Renderer::LoadFonts() {
       glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
       (GLuint) face->glyph->advance.x
     };
+
+    // The cursor glyph is a solid block stretched over the quad.
+    Character& ch = characters_[c];
+    if (c == 150) {
+      ch.Bitmap.assign(ch.Size.x * ch.Size.y, 255);
+    } else {
+      unsigned char* bitmap = face->glyph->bitmap.buffer;
+      ch.Bitmap.assign(bitmap, bitmap + ch.Size.x * ch.Size.y);
+    }
   }
 
   FT_Done_Face(face);
@@ -386,8 +466,9 @@ void Renderer::LoadFonts() {
   glGenBuffers(1, &text_vbo_);
   glBindBuffer(GL_ARRAY_BUFFER, text_vbo_);
   glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+  vaos_["text"] = CreateVertexArray();
+  SetVertexAttribute(text_vbo_, 0, 4);
+  glBindVertexArray(0);
 
   projection_ = glm::ortho(0.0f, (float) WINDOW_WIDTH, 0.0f, (float) WINDOW_HEIGHT); 
 }
@@ -427,13 +508,16 @@ void Renderer::DrawChar(char c, float x, float y, vec3 color, GLfloat scale) {
   glBindTexture(GL_TEXTURE_2D, ch.TextureID);
 
   // Update content of VBO memory
-  shader_.BindBuffer(text_vbo_, 0, 4);
+  glBindVertexArray(vaos_["text"]);
+  glBindBuffer(GL_ARRAY_BUFFER, text_vbo_);
   glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); 
 
   // Render quad
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
 
   shader_.Clear();
+  glBindVertexArray(0);
   glDisable(GL_BLEND);
   glEnable(GL_DEPTH_TEST);
 }
@@ -459,7 +543,7 @@ void Renderer::DrawRectangle(GLfloat x, GLfloat y, GLfloat width, GLfloat height
   glDisable(GL_DEPTH_TEST);
   glUseProgram(shaders_["polygon"].program_id());
 
-  vector<vec3> vertices = {
+  vec3 vertices[6] = {
     { x        , y         , 0.0 },
     { x        , y - height, 0.0 },
     { x + width, y         , 0.0 },
@@ -471,107 +555,165 @@ void Renderer::DrawRectangle(GLfloat x, GLfloat y, GLfloat width, GLfloat height
   glUniform3f(shaders_["polygon"].GetUniformId("lineColor"), color.x, color.y, color.z);
   glUniformMatrix4fv(shaders_["polygon"].GetUniformId("projection"), 1, GL_FALSE, &projection_[0][0]);
   glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(glm::vec3), &vertices[0]); 
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); 
 
-  shaders_["polygon"].BindBuffer(vbo_, 0, 3);
+  glBindVertexArray(vaos_["polygon"]);
   glDrawArrays(GL_TRIANGLES, 0, 6);
-  shaders_["polygon"].Clear();
+  CountDraw(6);
+  glBindVertexArray(0);
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
 }
 
 void Renderer::DrawMesh(
-  string mesh_name, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  const string& mesh_name, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
   glm::vec3 camera, glm::vec3 position, GLfloat rotation, bool highlighted
 ) {
-  glEnable(GL_DEPTH_TEST);
-  glDisable(GL_CULL_FACE);
-  Mesh& mesh = meshes_[mesh_name];
-  glUseProgram(shaders_["object"].program_id());
-
   glm::mat4 ModelMatrix = glm::translate(glm::mat4(1.0), position);
   ModelMatrix *= glm::rotate(glm::mat4(1.0f), rotation, glm::vec3(0.0, 1.0, 0.0));
-  glm::mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
-  glm::mat4 MVP = ProjectionMatrix * ModelViewMatrix;
 
-  glUniformMatrix4fv(shaders_["object"].GetUniformId("MVP"), 1, GL_FALSE, &MVP[0][0]);
-  glUniformMatrix4fv(shaders_["object"].GetUniformId("M"), 1, GL_FALSE, &ModelMatrix[0][0]);
-  glUniformMatrix4fv(shaders_["object"].GetUniformId("V"), 1, GL_FALSE, &ViewMatrix[0][0]);
+  MeshInstance instance(ModelMatrix, (highlighted) ? 1.0 : 0.0);
+  DrawMeshInstanced(mesh_name, ProjectionMatrix, ViewMatrix, &instance, 1);
+}
 
-  if (highlighted) {
-    glUniform1f(shaders_["object"].GetUniformId("highlight"), 1.0);
-  } else {
-    glUniform1f(shaders_["object"].GetUniformId("highlight"), 0.0);
+void Renderer::DrawMeshInstanced(
+  const string& mesh_name, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  const vector<MeshInstance>& instances
+) {
+  if (instances.empty()) return;
+  DrawMeshInstanced(mesh_name, ProjectionMatrix, ViewMatrix, &instances[0], instances.size());
+}
+
+// Draws every instance of a mesh with a single call. The model matrices and
+// highlight flags are streamed into a per mesh instance buffer that only 
+// grows when the number of instances exceeds its capacity.
+void Renderer::DrawMeshInstanced(
+  const string& mesh_name, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  const MeshInstance* instances, int num_instances
+) {
+  if (num_instances == 0) return;
+
+  // The object shader reads the interleaved layout only.
+  auto it = meshes_.find(mesh_name);
+  if (it == meshes_.end() || !it->second.interleaved_) return;
+  Mesh& mesh = it->second;
+
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.instance_buffer_);
+  if (size_t(num_instances) > mesh.instance_capacity_) {
+    mesh.instance_capacity_ = std::max(size_t(num_instances), 2 * mesh.instance_capacity_);
+    glBufferData(GL_ARRAY_BUFFER, mesh.instance_capacity_ * sizeof(MeshInstance), nullptr, GL_STREAM_DRAW);
   }
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_instances * sizeof(MeshInstance), instances);
 
-  shaders_["object"].BindBuffer(mesh.vertex_buffer_, 0, 3);
-  shaders_["object"].BindBuffer(mesh.uv_buffer_, 1, 2);
-  shaders_["object"].BindBuffer(mesh.normal_buffer_, 2, 3);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.element_buffer_);
-  glDrawElements(GL_TRIANGLES, mesh.indices_.size(), GL_UNSIGNED_INT, (void*) 0);
+  glEnable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  Shader& shader = shaders_["object"];
+  glUseProgram(shader.program_id());
+
+  glm::mat4 VP = ProjectionMatrix * ViewMatrix;
+  glUniformMatrix4fv(shader.GetUniformId("VP"), 1, GL_FALSE, &VP[0][0]);
+  glUniformMatrix4fv(shader.GetUniformId("V"), 1, GL_FALSE, &ViewMatrix[0][0]);
+
+  // Maps the stored positions back into object space.
+  const VertexFormat& format = mesh.format_;
+  glUniform3fv(shader.GetUniformId("position_offset"), 1, &format.position_offset[0]);
+  glUniform3fv(shader.GetUniformId("position_scale"), 1, &format.position_scale[0]);
+
+  // The vertex array has the vertex and instance attributes and the 
+  // element buffer.
+  glBindVertexArray(mesh.vertex_array_);
+  glDrawElementsInstanced(
+    GL_TRIANGLES, mesh.num_indices_, GL_UNSIGNED_INT, (void*) 0, num_instances
+  );
+  CountDraw(mesh.num_indices_, num_instances);
 
-  shaders_["object"].Clear();
-  // meshes_[mesh_name].Draw(ProjectionMatrix, ViewMatrix, camera, position, rotation, highlighted);
+  shader.Clear();
+  glBindVertexArray(0);
 }
 
-void Renderer::DrawCube(
-  glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, glm::vec3 camera,
-  glm::vec3 position, vec3 dimensions, GLfloat rotation
+// Appends an axis aligned box to an indexed mesh. Each face gets its own
+// four vertices so that the UVs can be scaled by the face dimensions.
+void Renderer::AppendCube(
+  vec3 position, vec3 dimensions, vector<vec3>& vertices, 
+  vector<vec2>& uvs, vector<unsigned int>& indices
 ) {
   float w = dimensions.x;
   float l = dimensions.y;
   float h = dimensions.z;
  
-  vector<vec3> v {
+  vec3 v[] {
     // Back face.
     vec3(0, h, 0), vec3(w, h, 0), vec3(0, 0, 0), vec3(w, 0, 0),
     // Front face.
     vec3(0, h, l), vec3(w, h, l), vec3(0, 0, l), vec3(w, 0, l),
   };
 
-  vector<vec3> vertices = {
-    v[0], v[4], v[1], v[1], v[4], v[5], // Top.
-    v[1], v[3], v[0], v[0], v[3], v[2], // Back.
-    v[0], v[2], v[4], v[4], v[2], v[6], // Left.
-    v[5], v[7], v[1], v[1], v[7], v[3], // Right.
-    v[4], v[6], v[5], v[5], v[6], v[7], // Front.
-    v[6], v[2], v[7], v[7], v[2], v[3]  // Bottom.
+  // Four corners per face, triangulated as (0, 1, 2) and (2, 1, 3).
+  int faces[6][4] = {
+    { 0, 4, 1, 5 }, // Top.
+    { 1, 3, 0, 2 }, // Back.
+    { 0, 2, 4, 6 }, // Left.
+    { 5, 7, 1, 3 }, // Right.
+    { 4, 6, 5, 7 }, // Front.
+    { 6, 2, 7, 3 }  // Bottom.
   };
 
-  vector<vec2> u = {
+  vec2 u[] {
     vec2(0, 0), vec2(0, l), vec2(w, 0), vec2(w, l), // Top.
     vec2(0, 0), vec2(0, h), vec2(w, 0), vec2(w, h), // Back.
     vec2(0, 0), vec2(0, h), vec2(l, 0), vec2(l, h)  // Left.
   };
 
-  vector<glm::vec2> uvs {
-    u[0], u[1], u[2],  u[2],  u[1], u[3],  // Top.
-    u[4], u[5], u[6],  u[6],  u[5], u[7],  // Back.
-    u[8], u[9], u[10], u[10], u[9], u[11], // Left.
-    u[8], u[9], u[10], u[10], u[9], u[11], // Right.
-    u[4], u[5], u[6],  u[6],  u[5], u[7],  // Front.
-    u[0], u[1], u[2],  u[2],  u[1], u[3]   // Bottom.
-  };
+  // Index of the first UV used by each face.
+  int face_uvs[6] = { 0, 4, 8, 8, 4, 0 };
+
+  for (int i = 0; i < 6; i++) {
+    unsigned int first = vertices.size();
+    for (int j = 0; j < 4; j++) {
+      vertices.push_back(position + v[faces[i][j]]);
+      uvs.push_back(u[face_uvs[i] + j]);
+    }
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbos_["cube_v"]);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(glm::vec3), &vertices[0]); 
+    unsigned int quad[6] = { 0, 1, 2, 2, 1, 3 };
+    for (int j = 0; j < 6; j++) indices.push_back(first + quad[j]);
+  }
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbos_["cube_uv"]);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, uvs.size() * sizeof(glm::vec2), &uvs[0]); 
+void Renderer::DrawBuilding(
+  const string& mesh_name, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix
+) {
+  CommandList commands;
+  RecordBuilding(commands, mesh_name, ProjectionMatrix, ViewMatrix);
+  commands.Execute();
+}
 
-  glUseProgram(shaders_["building"].program_id());
+// Only reads the mesh and shader maps, so it can be called from a worker 
+// thread while no mesh is being loaded. When ranges are given, only those
+// (first, count) index ranges of the mesh are drawn.
+void Renderer::RecordBuilding(
+  CommandList& commands, const string& mesh_name, 
+  glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix,
+  const vector<ivec2>* ranges
+) {
+  auto it = meshes_.find(mesh_name);
+  if (it == meshes_.end()) return;
+  Mesh& mesh = it->second;
 
-  glm::mat4 ModelMatrix = glm::translate(glm::mat4(1.0), position);
-  glm::mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
-  glm::mat4 MVP = ProjectionMatrix * ModelViewMatrix;
+  commands.UseProgram(GetShader("building"));
 
-  glUniformMatrix4fv(shaders_["building"].GetUniformId("MVP"), 1, GL_FALSE, &MVP[0][0]);
-  glUniformMatrix4fv(shaders_["building"].GetUniformId("M"), 1, GL_FALSE, &ModelMatrix[0][0]);
+  // Vertices are already in world space.
+  glm::mat4 ModelMatrix = glm::mat4(1.0);
+  glm::mat4 MVP = ProjectionMatrix * ViewMatrix;
+  commands.Uniform("MVP", MVP);
+  commands.Uniform("M", ModelMatrix);
 
-  shaders_["building"].BindBuffer(vbos_["cube_v"], 0, 3);
-  shaders_["building"].BindBuffer(vbos_["cube_uv"], 1, 2);
-  glDrawArrays(GL_TRIANGLES, 0, 36);
-  shaders_["building"].Clear();
+  commands.BindVertexArray(mesh.vertex_array_);
+  if (ranges) {
+    for (auto& r : *ranges) commands.DrawElements(0, r.y, r.x);
+  } else {
+    commands.DrawElements(0, mesh.num_indices_);
+  }
+  commands.Clear();
 }
 
 void Renderer::DrawLine(
@@ -583,7 +725,7 @@ void Renderer::DrawLine(
   GLfloat s = thickness / 2.0f;
   vec2 step = normalize(p2 - p1);
 
-  vector<vec2> v {
+  vec2 v[4] {
     p1 + s * (vec2(-step.y, step.x)), p1 + s * (vec2(step.y, -step.x)),
     p2 + s * (vec2(-step.y, step.x)), p2 + s * (vec2(step.y, -step.x))
   };
@@ -591,17 +733,19 @@ void Renderer::DrawLine(
   glUniform3f(shaders_["polygon"].GetUniformId("lineColor"), color.x, color.y, color.z);
   glUniformMatrix4fv(shaders_["polygon"].GetUniformId("projection"), 1, GL_FALSE, &projection_[0][0]);
 
-  std::vector<glm::vec3> lines = {
+  vec3 lines[6] = {
     vec3(v[0], 0), vec3(v[1], 0), vec3(v[2], 0), vec3(v[2], 0), vec3(v[1], 0), vec3(v[3], 0)
   };
 
-  shaders_["polygon"].BindBuffer(vbo_, 0, 3);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, lines.size() * sizeof(glm::vec3), &lines[0]); 
+  glBindVertexArray(vaos_["polygon"]);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(lines), lines); 
 
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
   glEnable(GL_CULL_FACE);
   glEnable(GL_DEPTH_TEST);
-  shaders_["polygon"].Clear();
+  glBindVertexArray(0);
 }
 
 void Renderer::DrawPoint(
@@ -612,26 +756,28 @@ void Renderer::DrawPoint(
   glUseProgram(shaders_["polygon"].program_id());
   set_projection(glm::ortho(-512, 512, 512, -512));
   GLfloat s = thickness / 2.0f;
-  vector<vec2> v {
+  vec2 v[4] {
     point + vec2(-s, -s), point + vec2(-s, s), 
     point + vec2(s, -s), point + vec2(s, s)
   };
 
   glUniform3f(shaders_["polygon"].GetUniformId("lineColor"), color.x, color.y, color.z);
 
-  std::vector<glm::vec3> verts {
+  vec3 verts[6] {
     vec3(v[0], 0), vec3(v[1], 0), vec3(v[2], 0),
     vec3(v[2], 0), vec3(v[1], 0), vec3(v[3], 0)
   };
 
-  shaders_["polygon"].BindBuffer(vbo_, 0, 3);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, verts.size() * sizeof(glm::vec3), &verts[0]); 
+  glBindVertexArray(vaos_["polygon"]);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(verts), verts); 
 
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
   set_projection();
   glEnable(GL_CULL_FACE);
   glEnable(GL_DEPTH_TEST);
-  shaders_["polygon"].Clear();
+  glBindVertexArray(0);
 }
 
 void Renderer::DrawArrow(
@@ -647,7 +793,7 @@ void Renderer::DrawArrow(
   vec2 step = normalize(p2 - p1);
   DrawLine(p1, p2 - step * (height * steepness), thickness, color);
 
-  vector<vec2> v {
+  vec2 v[4] {
     p2, 
     (p2 - step * (height * steepness)),
     (p2 - step * height) + (width * vec2(-step.y, step.x)),
@@ -657,22 +803,24 @@ void Renderer::DrawArrow(
   glUniform3f(shaders_["polygon"].GetUniformId("lineColor"), color.x, color.y, color.z);
   glUniformMatrix4fv(shaders_["polygon"].GetUniformId("projection"), 1, GL_FALSE, &projection_[0][0]);
 
-  std::vector<glm::vec3> lines = {
+  vec3 lines[6] = {
     vec3(v[0], 0), vec3(v[1], 0), vec3(v[2], 0),
     vec3(v[3], 0), vec3(v[1], 0), vec3(v[0], 0)
   };
 
-  shaders_["polygon"].BindBuffer(vbo_, 0, 3);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, lines.size() * sizeof(glm::vec3), &lines[0]); 
+  glBindVertexArray(vaos_["polygon"]);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(lines), lines); 
 
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
   glEnable(GL_CULL_FACE);
   glEnable(GL_DEPTH_TEST);
-  shaders_["polygon"].Clear();
+  glBindVertexArray(0);
 }
 
 void Renderer::DrawHighlightedObject(
-  string mesh_name, 
+  const string& mesh_name, 
   mat4 ProjectionMatrix, 
   mat4 ViewMatrix, 
   vec3 camera, 
@@ -693,10 +841,9 @@ void Renderer::DrawHighlightedObject(
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glUseProgram(shaders_["intersect"].program_id());
     glUniformMatrix4fv(shaders_["intersect"].GetUniformId("MVP"), 1, GL_FALSE, &MVP[0][0]);
-    shaders_["intersect"].BindBuffer(m.vertex_buffer_, 0, 3);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.element_buffer_);
-    glDrawElements(GL_TRIANGLES, m.indices_.size(), GL_UNSIGNED_INT, (void*) 0);
-    shaders_["intersect"].Clear();
+    glBindVertexArray(m.vertex_array_);
+    glDrawElements(GL_TRIANGLES, m.num_indices_, GL_UNSIGNED_INT, (void*) 0);
+    CountDraw(m.num_indices_);
 
     // Draw outline.
     glEnable(GL_BLEND);
@@ -711,9 +858,10 @@ void Renderer::DrawHighlightedObject(
     glUniform3f(shaders_["mask"].GetUniformId("outline_color"), 1.0, 0.69, 0.23);
   }
 
-  shaders_["mask"].BindBuffer(vbos_["mask_uv"], 0, 2);
+  glBindVertexArray(vaos_["mask"]);
   shaders_["mask"].BindTexture("TextureSampler", fbos_["intersect"].texture);
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
   shaders_["mask"].Clear();
   glDisable(GL_BLEND);
   glEnable(GL_DEPTH_TEST);
@@ -725,11 +873,11 @@ void Renderer::DrawHighlightedObject(
   glUniformMatrix4fv(shaders_["painting"].GetUniformId("M"), 1, GL_FALSE, &ModelMatrix[0][0]);
   glUniform1f(shaders_["painting"].GetUniformId("alpha"), alpha);
   shaders_["painting"].BindTexture("TextureSampler", main_texture);
-  shaders_["painting"].BindBuffer(m.vertex_buffer_, 0, 3);
-  shaders_["painting"].BindBuffer(m.uv_buffer_, 1, 2);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.element_buffer_);
-  glDrawElements(GL_TRIANGLES, m.indices_.size(), GL_UNSIGNED_INT, (void*) 0);
+  glBindVertexArray(m.vertex_array_);
+  glDrawElements(GL_TRIANGLES, m.num_indices_, GL_UNSIGNED_INT, (void*) 0);
+  CountDraw(m.num_indices_);
   shaders_["painting"].Clear();
+  glBindVertexArray(0);
   glDisable(GL_BLEND);
 }
 
@@ -749,15 +897,18 @@ void Renderer::DrawScreen(bool blur) {
   glUseProgram(shaders_["screen"].program_id());
   glUniform1f(glGetUniformLocation(shaders_["screen"].program_id(), "blur"), (blur) ? 1.0 : 0.0);
   shaders_["screen"].BindTexture("TextureSampler", fbos_["screen"].texture);
-  shaders_["screen"].BindBuffer(m.vertex_buffer_, 0, 3);
-  shaders_["screen"].BindBuffer(m.uv_buffer_, 1, 2);
+  glBindVertexArray(m.vertex_array_);
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
   shaders_["screen"].Clear();
+  glBindVertexArray(0);
   glEnable(GL_CULL_FACE);
 }
 
+// A linear scan over a constant table, so looking up a color does not
+// allocate. Unknown names are black.
 vec3 Renderer::GetColor(const string& color_name) {
-  unordered_map<string, vec3> colors {
+  static const struct { const char* name; vec3 color; } colors[] {
     { "red",  vec3(1, 0, 0) },
     { "green",  vec3(0, 1, 0) },
     { "blue",  vec3(0, 0, 1) },
@@ -766,7 +917,10 @@ vec3 Renderer::GetColor(const string& color_name) {
     { "white",  vec3(1, 1, 1) },
     { "black",  vec3(0, 0, 0) }
   };
-  return colors[color_name];
+  for (auto& c : colors) {
+    if (color_name == c.name) return c.color;
+  }
+  return vec3(0);
 }
 
 void Renderer::DrawFBO(const string& fbo_name, ivec2 position) {
@@ -781,38 +935,102 @@ void Renderer::DrawFBO(const string& fbo_name, ivec2 position) {
   int width = fbo.width;
   int height= fbo.height;
 
-  vector<vec3> vertices = {
-    { x        , y         , 0.0 },
-    { x        , y - height, 0.0 },
-    { x + width, y         , 0.0 },
-    { x + width, y         , 0.0 },
-    { x        , y - height, 0.0 },
-    { x + width, y - height, 0.0 }
+  vec3 vertices[6] = {
+    vec3(x        , y         , 0.0),
+    vec3(x        , y - height, 0.0),
+    vec3(x + width, y         , 0.0),
+    vec3(x + width, y         , 0.0),
+    vec3(x        , y - height, 0.0),
+    vec3(x + width, y - height, 0.0)
   };
 
   glm::mat4 projection = glm::ortho(0.0f, (float) WINDOW_WIDTH, 0.0f, (float) WINDOW_HEIGHT);
-  for (int i = 0; i < vertices.size(); i++) {
+  for (int i = 0; i < 6; i++) {
     vertices[i] = vec3(projection * vec4(vertices[i], 1.0));
   }
 
   glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(glm::vec3), &vertices[0]); 
-  shaders_["plot"].BindBuffer(vbo_, 0, 3);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); 
 
-  vector<vec2> uvs = {
+  vec2 uvs[6] = {
     { 0, 0 }, { 0, 1 }, { 1, 0 },
     { 1, 0 }, { 0, 1 }, { 1, 1 }
   };
 
   glBindBuffer(GL_ARRAY_BUFFER, uv_);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, uvs.size() * sizeof(glm::vec2), &uvs[0]); 
-  shaders_["plot"].BindBuffer(uv_, 1, 2);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(uvs), uvs); 
 
+  glBindVertexArray(vaos_["plot"]);
   shaders_["plot"].BindTexture("TextureSampler", fbo.texture);
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
   shaders_["plot"].Clear();
+  glBindVertexArray(0);
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
 }
 
+// Uploads RGBA8 pixels into the FBO texture and copies it to the window.
+void Renderer::DrawPixels(const string& fbo_name, const void* pixels) {
+  FBO& fbo = fbos_[fbo_name];
+  glBindTexture(GL_TEXTURE_2D, fbo.texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, fbo.width, fbo.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  Metrics::GetInstance().GetCounter("texture_upload_bytes").Add(fbo.width * fbo.height * 4);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo.framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(
+    0, 0, fbo.width, fbo.height, 0, 0, fbo.width, fbo.height, 
+    GL_COLOR_BUFFER_BIT, GL_NEAREST
+  );
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Draws pixels rendered on the CPU into the FBO with their window depth, so
+// they are depth tested against the GL geometry. Pixels with a depth of 1
+// are left untouched.
+void Renderer::CompositePixels(const string& fbo_name, const void* pixels, const float* depth) {
+  FBO& fbo = fbos_[fbo_name];
+  if (!fbo.composite_color) {
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    fbo.composite_color = textures[0];
+    fbo.composite_depth = textures[1];
+    for (int i = 0; i < 2; i++) {
+      glBindTexture(GL_TEXTURE_2D, textures[i]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, fbo.composite_color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, fbo.width, fbo.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindTexture(GL_TEXTURE_2D, fbo.composite_depth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, fbo.width, fbo.height, 0, GL_RED, GL_FLOAT, 0);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, fbo.composite_color);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, fbo.width, fbo.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  glBindTexture(GL_TEXTURE_2D, fbo.composite_depth);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, fbo.width, fbo.height, GL_RED, GL_FLOAT, depth);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  Metrics::GetInstance().GetCounter("texture_upload_bytes").Add(fbo.width * fbo.height * 8);
+
+  SetFBO(fbo_name);
+  Mesh& m = meshes_["screen"];
+  Shader& shader = shaders_["composite"];
+
+  glDisable(GL_CULL_FACE);
+  glUseProgram(shader.program_id());
+  shader.BindTexture("ColorSampler", fbo.composite_color);
+  shader.BindTexture("DepthSampler", fbo.composite_depth);
+  glBindVertexArray(m.vertex_array_);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+  CountDraw(6);
+  shader.Clear();
+  glBindVertexArray(0);
+  glEnable(GL_CULL_FACE);
+}
+
 } // End of namespace.
@@ -269,18 +269,48 @@ void Shader::BindTexture(const std::string& name, const GLuint& texture_id, cons
   available_texture_slot_++;
 }
 
-void Shader::BindBuffer(const GLuint& buffer_id, int slot, int dimension) {
+// Only resets the texture units. Attributes live in vertex arrays, which
+// stay configured between draws.
+void Shader::Clear() {
+  available_texture_slot_ = GL_TEXTURE0;
+}
+
+// Creates a vertex array and binds it, so the attributes set next are
+// recorded in it.
+GLuint CreateVertexArray() {
+  GLuint vertex_array;
+  glGenVertexArrays(1, &vertex_array);
+  glBindVertexArray(vertex_array);
+  return vertex_array;
+}
+
+void SetVertexAttribute(const GLuint& buffer_id, int slot, int dimension) {
   glEnableVertexAttribArray(slot);
   glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
   glVertexAttribPointer(slot, dimension, GL_FLOAT, GL_FALSE, 0, (void*) 0);
-  buffer_slots_.push_back(slot);
 }
 
-void Shader::Clear() {
-  for (auto slot : buffer_slots_)
-    glDisableVertexAttribArray(slot);
-  buffer_slots_.clear();
-  available_texture_slot_ = GL_TEXTURE0;
+// Sets one attribute of an interleaved buffer, stored as the given type.
+// Integer types are converted to floats, mapped to [0, 1] or [-1, 1] when
+// normalized is set.
+void SetVertexAttribute(
+  const GLuint& buffer_id, int slot, int dimension, GLenum type, 
+  GLboolean normalized, GLsizei stride, size_t offset
+) {
+  glEnableVertexAttribArray(slot);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+  glVertexAttribPointer(slot, dimension, type, normalized, stride, (void*) offset);
+}
+
+// Sets an interleaved attribute that advances once per instance instead of
+// once per vertex.
+void SetInstanceAttribute(
+  const GLuint& buffer_id, int slot, int dimension, GLsizei stride, size_t offset
+) {
+  glEnableVertexAttribArray(slot);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+  glVertexAttribPointer(slot, dimension, GL_FLOAT, GL_FALSE, stride, (void*) offset);
+  glVertexAttribDivisor(slot, 1);
 }
 
 } // End of namespace.
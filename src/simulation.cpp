@@ -0,0 +1,187 @@
+#include "simulation.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace Sibyl {
+
+Simulation::Simulation(
+  shared_ptr<EntityManager> entity_manager,
+  shared_ptr<Terrain> terrain,
+  const Player& player
+) : entity_manager_(entity_manager),
+    terrain_(terrain),
+    player_(player),
+    running_(false),
+    tick_duration_(1.0 / SIMULATION_TICK_RATE) {
+  input_.h_angle = player.h_angle;
+  input_.v_angle = player.v_angle;
+  Publish(glfwGetTime());
+  snapshots_.Update();
+  previous_ = current_ = snapshots_.front();
+}
+
+Simulation::~Simulation() {
+  Stop();
+}
+
+void Simulation::Start() {
+  if (running_) return;
+  running_ = true;
+  thread_ = thread(&Simulation::Run, this);
+}
+
+void Simulation::Stop() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+}
+
+void Simulation::SetInput(const PlayerInput& input) {
+  lock_guard<mutex> lock(input_mutex_);
+  bool jump = input_.jump;
+  input_ = input;
+
+  // Jumps are latched until the next tick consumes them.
+  input_.jump = jump || input.jump;
+}
+
+void Simulation::Run() {
+  auto tick = chrono::duration_cast<chrono::steady_clock::duration>(
+    chrono::duration<double>(tick_duration_)
+  );
+
+  auto next_tick = chrono::steady_clock::now();
+  int ticks = 1;
+  while (running_) {
+    PlayerInput input;
+    {
+      lock_guard<mutex> lock(input_mutex_);
+      input = input_;
+      input_.jump = false;
+    }
+
+    Step(input, ticks);
+    Publish(glfwGetTime());
+
+    // If we fell behind, the missed ticks are caught up in one large step.
+    // Collisions are swept, so it cannot pass through walls. Anything past
+    // SIMULATION_MAX_STEP_TICKS is skipped instead of spiraling.
+    next_tick += tick;
+    auto now = chrono::steady_clock::now();
+    ticks = 1;
+    if (next_tick < now) {
+      long missed = (now - next_tick) / tick;
+      ticks += std::min(missed, long(SIMULATION_MAX_STEP_TICKS - 1));
+      next_tick = now;
+    }
+    this_thread::sleep_until(next_tick);
+  }
+}
+
+// Runs the ticks up to a given time on the calling thread instead of the 
+// simulation thread. Used by replays and benchmarks, where the results must
+// not depend on thread scheduling.
+void Simulation::StepTo(double time) {
+  if (next_tick_time_ < 0) next_tick_time_ = time;
+
+  while (next_tick_time_ <= time) {
+    PlayerInput input;
+    {
+      lock_guard<mutex> lock(input_mutex_);
+      input = input_;
+      input_.jump = false;
+    }
+
+    Step(input);
+    Publish(next_tick_time_);
+    next_tick_time_ += tick_duration_;
+  }
+}
+
+// Advances the player by a number of ticks in a single step. The speed is a
+// displacement per tick and friction scales it after each tick's
+// acceleration, so the speed is integrated tick by tick, as separate steps
+// would, and only the summed displacement is swept against the building
+// and the terrain.
+void Simulation::Step(const PlayerInput& input, int ticks) {
+  Player& p = player_;
+  p.h_angle = input.h_angle;
+  p.v_angle = input.v_angle;
+
+  vec3 front = vec3(cos(p.v_angle) * sin(p.h_angle), 0, cos(p.v_angle) * cos(p.h_angle));
+  vec3 right = vec3(sin(p.h_angle - 3.14f/2.0f), 0, cos(p.h_angle - 3.14f/2.0f));
+  vec3 acceleration = vec3(0, -GRAVITY, 0);
+  if (input.move[0]) acceleration += front * PLAYER_SPEED;
+  if (input.move[1]) acceleration -= front * PLAYER_SPEED;
+  if (input.move[2]) acceleration -= right * PLAYER_SPEED;
+  if (input.move[3]) acceleration += right * PLAYER_SPEED;
+
+  if (input.jump && p.can_jump) {
+    p.can_jump = false;
+    p.speed.y += 0.3f;
+  }
+
+  glm::vec3 prev_pos = p.position;
+
+  vec3 displacement = vec3(0);
+  for (int i = 0; i < ticks; i++) {
+    p.speed += acceleration;
+
+    // Friction.
+    p.speed.x *= 0.9;
+    p.speed.y *= 0.99;
+    p.speed.z *= 0.9;
+    displacement += p.speed;
+  }
+
+  // Sweep through the building, then push out of any floor the player
+  // started inside of.
+  entity_manager_->Move(p.position, displacement, p.can_jump, p.speed);
+  entity_manager_->Collide(p.position, prev_pos, p.can_jump, p.speed);
+
+  // In the air, the path is tested against the ground so a long step
+  // cannot go under a slope. On the ground the player just follows it.
+  vec3 feet = prev_pos - vec3(0, p.height, 0);
+  if (feet.y > terrain_->GetHeight(feet.x, feet.z) + TERRAIN_MIN_ADVANCE) {
+    float toi = terrain_->GetTimeOfImpact(feet, p.position - prev_pos);
+    if (toi < 1.0f) p.position = prev_pos + (p.position - prev_pos) * toi;
+  }
+
+  // Test collision with terrain.
+  float height = terrain_->GetHeight(p.position.x, p.position.z);
+  if (p.position.y - p.height < height) {
+    p.position.y = height + p.height;
+    if (p.speed.y < 0) p.speed.y = 0.0f;
+    p.can_jump = true;
+  }
+
+  if (physics_) physics_->Step(ticks);
+  tick_ += ticks;
+}
+
+void Simulation::Publish(double time) {
+  Snapshot& s = snapshots_.back();
+  s.tick = tick_;
+  s.time = time;
+  s.player = player_;
+  snapshots_.Publish();
+}
+
+// Called from the render thread. Returns the player state between the two
+// latest snapshots, so the rendered position trails the simulation by at
+// most one tick but moves smoothly at any frame rate.
+Player Simulation::Interpolate(double time) {
+  if (snapshots_.Update()) {
+    previous_ = current_;
+    current_ = snapshots_.front();
+  }
+
+  float alpha = (time - current_.time) / tick_duration_;
+  alpha = std::min(std::max(alpha, 0.0f), 1.0f);
+
+  Player p = current_.player;
+  p.position = mix(previous_.player.position, current_.player.position, alpha);
+  return p;
+}
+
+} // End of namespace.
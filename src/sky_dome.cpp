@@ -4,6 +4,7 @@ namespace Sibyl {
 
 SkyDome::SkyDome() 
   : shader_("sky", "v_sky", "f_sky") {
+  vertex_array_ = CreateVertexArray();
   glGenBuffers(1, &vertex_buffer_);
   glGenBuffers(1, &uv_buffer_);
   glGenBuffers(1, &element_buffer_);
@@ -22,6 +23,7 @@ SkyDome::SkyDome()
   glGenTextures(1, &texture_);
   glBindTexture(GL_TEXTURE_2D, texture_);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2048, 2048, 0, GL_RGB, GL_UNSIGNED_BYTE, data_);
+  Metrics::GetInstance().GetCounter("texture_upload_bytes").Add(2048 * 2048 * 3);
   
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -56,6 +58,8 @@ void SkyDome::CreateMesh() {
 
   glBindBuffer(GL_ARRAY_BUFFER, uv_buffer_);
   glBufferData(GL_ARRAY_BUFFER, uvs_.size() * sizeof(glm::vec2), &uvs_[0], GL_STATIC_DRAW);
+  SetVertexAttribute(vertex_buffer_, 0, 3);
+  SetVertexAttribute(uv_buffer_, 1, 2);
 
 
   for (int j = 0; j < NUM_POINTS_IN_CIRCLE; j++) {
@@ -84,13 +88,35 @@ void SkyDome::CreateMesh() {
     &indices_[0], 
     GL_STATIC_DRAW
   );
+  glBindVertexArray(0);
+}
+
+// The dome is behind everything, so it is only skipped when the occluders
+// cover the whole screen.
+void SkyDome::Submit(
+  RenderQueue& queue, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  glm::vec3 camera, glm::vec3 player_pos, const OcclusionBuffer* occlusion_buffer
+) {
+  if (occlusion_buffer && !occlusion_buffer->IsBackgroundVisible()) return;
+
+  CommandList commands(queue.arena());
+  Record(commands, ProjectionMatrix, ViewMatrix, camera, player_pos);
+  uint64_t key = RenderQueue::MakeKey(PASS_SKY, shader_.program_id(), texture_, vertex_buffer_, 0);
+  queue.Submit(key, "sky", std::move(commands));
 }
 
 void SkyDome::Draw(glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, glm::vec3 camera, glm::vec3 player_pos) {
-  glUseProgram(shader_.program_id());
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture_);
-  glUniform1i(shader_.GetUniformId("SkyTextureSampler"), 0);
+  CommandList commands;
+  Record(commands, ProjectionMatrix, ViewMatrix, camera, player_pos);
+  commands.Execute();
+}
+
+void SkyDome::Record(
+  CommandList& commands, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  glm::vec3 camera, glm::vec3 player_pos
+) {
+  commands.UseProgram(&shader_);
+  commands.BindTexture("SkyTextureSampler", texture_, GL_TEXTURE_2D, 0);
 
   glm::vec3 position = player_pos;
   position.y = -10000.0f;
@@ -98,17 +124,14 @@ void SkyDome::Draw(glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, glm::vec3 c
   glm::mat4 ModelViewMatrix = ViewMatrix * ModelMatrix;
   glm::mat3 ModelView3x3Matrix = glm::mat3(ModelViewMatrix);
   glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-  glUniformMatrix4fv(shader_.GetUniformId("MVP"),   1, GL_FALSE, &MVP[0][0]);
-  glUniformMatrix4fv(shader_.GetUniformId("M"),     1, GL_FALSE, &ModelMatrix[0][0]);
-  glUniformMatrix4fv(shader_.GetUniformId("V"),     1, GL_FALSE, &ViewMatrix[0][0]);
-  glUniformMatrix3fv(shader_.GetUniformId("MV3x3"), 1, GL_FALSE, &ModelView3x3Matrix[0][0]);
-
-  shader_.BindBuffer(vertex_buffer_, 0, 3);
-  shader_.BindBuffer(uv_buffer_, 1, 2);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_);
-  glDrawElements(GL_TRIANGLES, indices_.size(), GL_UNSIGNED_INT, (void*) 0);
-
-  shader_.Clear();
+  commands.Uniform("MVP", MVP);
+  commands.Uniform("M", ModelMatrix);
+  commands.Uniform("V", ViewMatrix);
+  commands.Uniform("MV3x3", ModelView3x3Matrix);
+
+  commands.BindVertexArray(vertex_array_);
+  commands.DrawElements(0, indices_.size());
+  commands.Clear();
 }
 
 } // End of namespace.
@@ -0,0 +1,124 @@
+#include "smesh_file.hpp"
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace glm;
+
+namespace Sibyl {
+
+static const char kMagic[4] = { 'S', 'M', 'S', 'H' };
+
+static bool StatSource(const string& source, int64_t* mtime, uint64_t* size) {
+  struct stat st;
+  if (stat(source.c_str(), &st) != 0) return false;
+  *mtime = st.st_mtime;
+  *size = st.st_size;
+  return true;
+}
+
+static size_t PayloadSize(
+  PositionEncoding encoding, size_t num_vertices, size_t num_indices
+) {
+  return num_vertices * GetVertexLayout(encoding).stride +
+    num_indices * sizeof(unsigned int);
+}
+
+bool SmeshFile::Open(
+  const string& filename, const string& source, PositionEncoding encoding
+) {
+  file_.reset();
+  header_ = nullptr;
+
+  int64_t mtime;
+  uint64_t size;
+  if (!StatSource(source, &mtime, &size)) return false;
+
+  unique_ptr<MappedFile> file(new MappedFile(filename));
+  if (!file->is_open() || file->size() < sizeof(SmeshHeader)) return false;
+
+  const SmeshHeader* header = reinterpret_cast<const SmeshHeader*>(file->data());
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) return false;
+  if (header->version != SMESH_VERSION) return false;
+  if (header->source_mtime != mtime || header->source_size != size) return false;
+  if (header->encoding != uint32_t(encoding)) return false;
+
+  size_t expected = sizeof(SmeshHeader) +
+    PayloadSize(encoding, header->num_vertices, header->num_indices);
+  if (file->size() != expected) return false;
+
+  file_ = move(file);
+  header_ = header;
+  return true;
+}
+
+bool SmeshFile::Write(
+  const string& filename, const string& source, const VertexFormat& format,
+  const vector<char>& vertices, const vector<unsigned int>& indices,
+  const MeshStats& stats
+) {
+  size_t stride = GetVertexLayout(format.encoding).stride;
+  if (vertices.size() % stride != 0) return false;
+
+  SmeshHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = SMESH_VERSION;
+  if (!StatSource(source, &header.source_mtime, &header.source_size)) return false;
+  header.num_vertices = vertices.size() / stride;
+  header.num_indices = indices.size();
+
+  header.vertices_before = stats.vertices_before;
+  header.acmr_before = stats.acmr_before;
+  header.acmr_after = stats.acmr_after;
+
+  header.encoding = format.encoding;
+  memcpy(header.position_offset, &format.position_offset, sizeof(header.position_offset));
+  memcpy(header.position_scale, &format.position_scale, sizeof(header.position_scale));
+  memcpy(header.min, &format.min, sizeof(header.min));
+  memcpy(header.max, &format.max, sizeof(header.max));
+
+  string temporary = filename + ".tmp";
+  FILE* f = fopen(temporary.c_str(), "wb");
+  if (!f) return false;
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  if (!vertices.empty())
+    ok = ok && fwrite(&vertices[0], 1, vertices.size(), f) == vertices.size();
+  if (!indices.empty())
+    ok = ok && fwrite(&indices[0], sizeof(unsigned int), indices.size(), f) == indices.size();
+  ok = (fclose(f) == 0) && ok;
+
+  if (!ok || rename(temporary.c_str(), filename.c_str()) != 0) {
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+MeshStats SmeshFile::stats() const {
+  MeshStats stats;
+  stats.vertices_before = header_->vertices_before;
+  stats.vertices_after = header_->num_vertices;
+  stats.acmr_before = header_->acmr_before;
+  stats.acmr_after = header_->acmr_after;
+  return stats;
+}
+
+VertexFormat SmeshFile::format() const {
+  VertexFormat format;
+  format.encoding = PositionEncoding(header_->encoding);
+  memcpy(&format.position_offset, header_->position_offset, sizeof(header_->position_offset));
+  memcpy(&format.position_scale, header_->position_scale, sizeof(header_->position_scale));
+  memcpy(&format.min, header_->min, sizeof(header_->min));
+  memcpy(&format.max, header_->max, sizeof(header_->max));
+  return format;
+}
+
+const unsigned int* SmeshFile::indices() const {
+  size_t stride = GetVertexLayout(PositionEncoding(header_->encoding)).stride;
+  return reinterpret_cast<const unsigned int*>(vertices() + num_vertices() * stride);
+}
+
+} // End of namespace.
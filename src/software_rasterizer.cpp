@@ -0,0 +1,472 @@
+#include "software_rasterizer.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace Sibyl {
+
+enum ClipPlane {
+  CLIP_LEFT = 1,
+  CLIP_RIGHT = 2,
+  CLIP_BOTTOM = 4,
+  CLIP_TOP = 8,
+  CLIP_NEAR = 16,
+  CLIP_FAR = 32,
+  GUARD_LEFT = 64,
+  GUARD_RIGHT = 128,
+  GUARD_BOTTOM = 256,
+  GUARD_TOP = 512
+};
+
+// Triangles are only clipped against the near plane and a guard band that
+// keeps the screen coordinates small enough for float edge functions. The
+// other planes are handled by the tile bounds and the depth test.
+static const unsigned int kClipMask =
+  CLIP_NEAR | GUARD_LEFT | GUARD_RIGHT | GUARD_BOTTOM | GUARD_TOP;
+
+static unsigned int Outcode(const glm::vec4& p) {
+  const float g = SOFTWARE_GUARD_BAND;
+  unsigned int code = 0;
+  if (p.x < -p.w) code |= CLIP_LEFT;
+  if (p.x >  p.w) code |= CLIP_RIGHT;
+  if (p.y < -p.w) code |= CLIP_BOTTOM;
+  if (p.y >  p.w) code |= CLIP_TOP;
+  if (p.z < -p.w) code |= CLIP_NEAR;
+  if (p.z >  p.w) code |= CLIP_FAR;
+  if (p.x < -g * p.w) code |= GUARD_LEFT;
+  if (p.x >  g * p.w) code |= GUARD_RIGHT;
+  if (p.y < -g * p.w) code |= GUARD_BOTTOM;
+  if (p.y >  g * p.w) code |= GUARD_TOP;
+  return code;
+}
+
+// Signed distance to the clip planes in kClipMask, in that order.
+static float PlaneDistance(int plane, const glm::vec4& p) {
+  const float g = SOFTWARE_GUARD_BAND;
+  switch (plane) {
+    case 0: return p.z + p.w;
+    case 1: return g * p.w + p.x;
+    case 2: return g * p.w - p.x;
+    case 3: return g * p.w + p.y;
+    default: return g * p.w - p.y;
+  }
+}
+
+// The buffers are padded so the rasterizer can load four pixels past the
+// end of the last row.
+void SoftwareFramebuffer::Resize(int w, int h) {
+  width = w;
+  height = h;
+  color.resize(w * h + 4);
+  depth.resize(w * h + 4);
+}
+
+void SoftwareFramebuffer::Clear(glm::vec3 c, float d) {
+  fill(color.begin(), color.end(), PackColor(glm::vec4(c, 1)));
+  fill(depth.begin(), depth.end(), d);
+}
+
+glm::vec4 SoftwareTexture::Sample(glm::vec2 uv) const {
+  if (texels.empty()) return glm::vec4(0);
+  if (repeat) uv = uv - glm::floor(uv);
+
+  float x = glm::clamp(uv.x * width - 0.5f, 0.0f, float(width - 1));
+  float y = glm::clamp(uv.y * height - 0.5f, 0.0f, float(height - 1));
+  int x0 = int(x);
+  int y0 = int(y);
+  int x1 = std::min(x0 + 1, width - 1);
+  int y1 = std::min(y0 + 1, height - 1);
+  float fx = x - x0;
+  float fy = y - y0;
+
+  glm::vec4 result(0, 0, 0, 1);
+  for (int i = 0; i < channels; i++) {
+    float t00 = texels[(y0 * width + x0) * channels + i];
+    float t10 = texels[(y0 * width + x1) * channels + i];
+    float t01 = texels[(y1 * width + x0) * channels + i];
+    float t11 = texels[(y1 * width + x1) * channels + i];
+    float top = t00 + (t10 - t00) * fx;
+    float bottom = t01 + (t11 - t01) * fx;
+    result[i] = (top + (bottom - top) * fy) / 255.0f;
+  }
+  return result;
+}
+
+SoftwareRasterizer::SoftwareRasterizer(
+  shared_ptr<ThreadPool> thread_pool,
+  int width,
+  int height
+) : thread_pool_(thread_pool),
+    width_(width),
+    height_(height),
+    tiles_x_((width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE),
+    tiles_y_((height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE),
+    next_tile_(0) {
+  vertex_stage_ = [this](int begin, int end) {
+    for (int i = begin; i < end; i++) draw_shader_->Vertex(i, &vertices_[i]);
+  };
+  setup_stage_ = [this](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      int first = i * draw_chunk_size_;
+      int last = std::min(first + draw_chunk_size_, draw_num_triangles_);
+      Setup(*draw_shader_, draw_indices_, first, last, batches_[draw_first_batch_ + i]);
+    }
+  };
+  tile_workers_.assign(std::max(thread_pool_->size(), 1), [this]() { RasterizeTiles(); });
+}
+
+// Batches and their bins keep their capacity across frames.
+int SoftwareRasterizer::NewBatch() {
+  if (num_batches_ == batches_.size()) {
+    batches_.push_back(Batch());
+    batches_.back().bins.resize(tiles_x_ * tiles_y_);
+  }
+
+  Batch& batch = batches_[num_batches_];
+  batch.triangles.clear();
+  for (auto& bin : batch.bins) bin.clear();
+  return num_batches_++;
+}
+
+void SoftwareRasterizer::Draw(
+  const SoftwareShader& shader,
+  int num_vertices,
+  const unsigned int* indices,
+  int num_indices
+) {
+  static Counter& triangles = Metrics::GetInstance().GetCounter("software_triangles");
+
+  vertices_.resize(num_vertices);
+  draw_shader_ = &shader;
+
+  // Waking the workers costs more than shading a small draw.
+  if (num_vertices > SOFTWARE_CHUNK_SIZE) {
+    thread_pool_->ParallelFor(0, num_vertices, vertex_stage_);
+  } else {
+    vertex_stage_(0, num_vertices);
+  }
+
+  int num_triangles = num_indices / 3;
+  if (num_triangles == 0) return;
+
+  int num_chunks = (num_triangles + SOFTWARE_CHUNK_SIZE - 1) / SOFTWARE_CHUNK_SIZE;
+  num_chunks = std::min(num_chunks, std::max(thread_pool_->size(), 1));
+  draw_indices_ = indices;
+  draw_num_triangles_ = num_triangles;
+  draw_chunk_size_ = (num_triangles + num_chunks - 1) / num_chunks;
+
+  // Batches are created up front because the vector may reallocate.
+  draw_first_batch_ = NewBatch();
+  for (int i = 1; i < num_chunks; i++) NewBatch();
+
+  if (num_chunks > 1) {
+    thread_pool_->ParallelFor(0, num_chunks, setup_stage_);
+  } else {
+    setup_stage_(0, 1);
+  }
+  triangles.Add(num_triangles);
+}
+
+void SoftwareRasterizer::Draw(const SoftwareShader& shader, int num_vertices) {
+  Draw(shader, num_vertices, nullptr, num_vertices);
+}
+
+void SoftwareRasterizer::Setup(
+  const SoftwareShader& shader,
+  const unsigned int* indices,
+  int begin,
+  int end,
+  Batch& batch
+) {
+  for (int i = begin; i < end; i++) {
+    const SoftwareVertex* v[3];
+    unsigned int out_and = ~0u;
+    unsigned int out_or = 0;
+    for (int k = 0; k < 3; k++) {
+      v[k] = &vertices_[(indices) ? indices[3 * i + k] : 3 * i + k];
+      unsigned int code = Outcode(v[k]->position);
+      out_and &= code;
+      out_or |= code;
+    }
+
+    // Completely outside one of the planes.
+    if (out_and) continue;
+
+    if (out_or & kClipMask) {
+      ClipTriangle(shader, v, batch);
+    } else {
+      SetupTriangle(shader, v, batch);
+    }
+  }
+}
+
+// Sutherland-Hodgman against the near plane and the guard band. The result
+// is a convex polygon that is triangulated as a fan.
+void SoftwareRasterizer::ClipTriangle(
+  const SoftwareShader& shader,
+  const SoftwareVertex** v,
+  Batch& batch
+) {
+  SoftwareVertex polygons[2][9];
+  int n = 3;
+  for (int k = 0; k < 3; k++) polygons[0][k] = *v[k];
+
+  int current = 0;
+  for (int plane = 0; plane < 5; plane++) {
+    SoftwareVertex* in = polygons[current];
+    SoftwareVertex* out = polygons[1 - current];
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+      const SoftwareVertex& a = in[i];
+      const SoftwareVertex& b = in[(i + 1) % n];
+      float da = PlaneDistance(plane, a.position);
+      float db = PlaneDistance(plane, b.position);
+      if (da >= 0) out[m++] = a;
+      if ((da >= 0) != (db >= 0)) {
+        float t = da / (da - db);
+        SoftwareVertex& p = out[m++];
+        p.position = a.position + (b.position - a.position) * t;
+        for (int j = 0; j < shader.num_varyings; j++)
+          p.varyings[j] = a.varyings[j] + (b.varyings[j] - a.varyings[j]) * t;
+      }
+    }
+
+    n = m;
+    current = 1 - current;
+    if (n < 3) return;
+  }
+
+  SoftwareVertex* polygon = polygons[current];
+  for (int i = 1; i + 1 < n; i++) {
+    const SoftwareVertex* triangle[3] = { &polygon[0], &polygon[i], &polygon[i + 1] };
+    SetupTriangle(shader, triangle, batch);
+  }
+}
+
+void SoftwareRasterizer::SetupTriangle(
+  const SoftwareShader& shader,
+  const SoftwareVertex** v,
+  Batch& batch
+) {
+  float x[3], y[3], z[3], inv_w[3];
+  for (int k = 0; k < 3; k++) {
+    const glm::vec4& p = v[k]->position;
+    inv_w[k] = 1.0f / p.w;
+    x[k] = (p.x * inv_w[k] * 0.5f + 0.5f) * width_;
+    y[k] = (p.y * inv_w[k] * 0.5f + 0.5f) * height_;
+    z[k] = p.z * inv_w[k] * 0.5f + 0.5f;
+  }
+
+  // Counter clockwise triangles have a positive area and face the camera.
+  float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (!(area != 0)) return;
+
+  Triangle t;
+  t.z0 = z[0];
+  t.ref_x = x[0];
+  t.ref_y = y[0];
+  t.dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+  t.dzdy = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+
+  int order[3] = { 0, 1, 2 };
+  if (area < 0) {
+    if (shader.cull_back) return;
+    swap(order[1], order[2]);
+    area = -area;
+  }
+
+  float min_x = std::min(x[0], std::min(x[1], x[2]));
+  float max_x = std::max(x[0], std::max(x[1], x[2]));
+  float min_y = std::min(y[0], std::min(y[1], y[2]));
+  float max_y = std::max(y[0], std::max(y[1], y[2]));
+
+  t.shader = &shader;
+  t.min_x = std::max(int(floor(min_x)), 0);
+  t.min_y = std::max(int(floor(min_y)), 0);
+  t.max_x = std::min(int(ceil(max_x)), width_ - 1);
+  t.max_y = std::min(int(ceil(max_y)), height_ - 1);
+  if (t.min_x > t.max_x || t.min_y > t.max_y) return;
+
+  // A shared edge gives exactly negated coefficients in both triangles, so
+  // the tie breaking rule assigns pixels on it to exactly one of them.
+  for (int i = 0; i < 3; i++) {
+    int a = order[(i + 1) % 3];
+    int b = order[(i + 2) % 3];
+    t.a[i] = y[a] - y[b];
+    t.b[i] = x[b] - x[a];
+    t.c[i] = x[a] * y[b] - y[a] * x[b];
+    t.top_left[i] = t.a[i] > 0 || (t.a[i] == 0 && t.b[i] < 0);
+  }
+  t.inv_area = 1.0f / area;
+
+  for (int k = 0; k < 3; k++) {
+    int o = order[k];
+    t.inv_w[k] = inv_w[o];
+    for (int j = 0; j < shader.num_varyings; j++)
+      t.varyings[k][j] = v[o]->varyings[j] * inv_w[o];
+  }
+
+  uint32_t index = batch.triangles.size();
+  batch.triangles.push_back(t);
+
+  int tile_x0 = t.min_x / SOFTWARE_TILE_SIZE;
+  int tile_x1 = t.max_x / SOFTWARE_TILE_SIZE;
+  int tile_y0 = t.min_y / SOFTWARE_TILE_SIZE;
+  int tile_y1 = t.max_y / SOFTWARE_TILE_SIZE;
+  for (int ty = tile_y0; ty <= tile_y1; ty++) {
+    for (int tx = tile_x0; tx <= tile_x1; tx++) {
+      batch.bins[ty * tiles_x_ + tx].push_back(index);
+    }
+  }
+}
+
+void SoftwareRasterizer::Flush(SoftwareFramebuffer& framebuffer) {
+  if (framebuffer.width != width_ || framebuffer.height != height_)
+    throw "Framebuffer size does not match the rasterizer";
+
+  flush_clear_ = (clear_target_ == &framebuffer);
+  if (flush_clear_) clear_target_ = nullptr;
+
+  flush_target_ = &framebuffer;
+  next_tile_ = 0;
+  thread_pool_->Run(tile_workers_);
+  num_batches_ = 0;
+}
+
+// Tiles are handed out one at a time since their cost varies a lot.
+void SoftwareRasterizer::RasterizeTiles() {
+  int num_tiles = tiles_x_ * tiles_y_;
+  int tile;
+  while ((tile = next_tile_++) < num_tiles) RasterizeTile(tile, *flush_target_, flush_clear_);
+}
+
+void SoftwareRasterizer::Clear(SoftwareFramebuffer& framebuffer, glm::vec3 color) {
+  clear_target_ = &framebuffer;
+  clear_color_ = PackColor(glm::vec4(color, 1));
+}
+
+void SoftwareRasterizer::RasterizeTile(int tile, SoftwareFramebuffer& framebuffer, bool clear) {
+  static Counter& pixels = Metrics::GetInstance().GetCounter("software_pixels");
+
+  int x0 = (tile % tiles_x_) * SOFTWARE_TILE_SIZE;
+  int y0 = (tile / tiles_x_) * SOFTWARE_TILE_SIZE;
+  int x1 = std::min(x0 + SOFTWARE_TILE_SIZE, width_) - 1;
+  int y1 = std::min(y0 + SOFTWARE_TILE_SIZE, height_) - 1;
+
+  if (clear) {
+    for (int y = y0; y <= y1; y++) {
+      int offset = y * width_;
+      fill(&framebuffer.color[offset + x0], &framebuffer.color[offset + x1 + 1], clear_color_);
+      fill(&framebuffer.depth[offset + x0], &framebuffer.depth[offset + x1 + 1], 1.0f);
+    }
+  }
+
+  int shaded = 0;
+  for (int i = 0; i < num_batches_; i++) {
+    const Batch& batch = batches_[i];
+    for (uint32_t index : batch.bins[tile]) {
+      shaded += RasterizeTriangle(batch.triangles[index], x0, y0, x1, y1, framebuffer);
+    }
+  }
+  pixels.Add(shaded);
+}
+
+// Walks the bounding box four pixels at a time. The edge functions and the
+// depth test are evaluated for the four pixels at once, and only the
+// covered pixels that pass the depth test are shaded.
+int SoftwareRasterizer::RasterizeTriangle(
+  const Triangle& t,
+  int x0, int y0, int x1, int y1,
+  SoftwareFramebuffer& framebuffer
+) {
+  const SoftwareShader& shader = *t.shader;
+  int min_x = std::max(t.min_x, x0) & ~3;
+  int max_x = std::min(t.max_x, x1);
+  int min_y = std::max(t.min_y, y0);
+  int max_y = std::min(t.max_y, y1);
+  int num_varyings = shader.num_varyings;
+
+  int shaded = 0;
+  for (int y = min_y; y <= max_y; y++) {
+    float py = y + 0.5f;
+    float row[3];
+    for (int i = 0; i < 3; i++) row[i] = t.b[i] * py + t.c[i];
+    float z_row = t.z0 + t.dzdy * (py - t.ref_y);
+
+    int offset = y * width_;
+    for (int x = min_x; x <= max_x; x += 4) {
+      float e[3][4];
+      float z[4];
+      int mask = 0;
+      float* depth = &framebuffer.depth[offset + x];
+
+#if defined(__SSE2__)
+      __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3, 2, 1, 0));
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      __m128 zero = _mm_setzero_ps();
+      for (int i = 0; i < 3; i++) {
+        __m128 ei = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[i]), px), _mm_set1_ps(row[i]));
+        __m128 test = (t.top_left[i]) ? _mm_cmpge_ps(ei, zero) : _mm_cmpgt_ps(ei, zero);
+        inside = _mm_and_ps(inside, test);
+        _mm_storeu_ps(e[i], ei);
+      }
+
+      __m128 vz = _mm_sub_ps(px, _mm_set1_ps(t.ref_x));
+      vz = _mm_add_ps(_mm_set1_ps(z_row), _mm_mul_ps(_mm_set1_ps(t.dzdx), vz));
+      inside = _mm_and_ps(inside, _mm_cmple_ps(vz, _mm_set1_ps(1.0f)));
+      if (shader.depth_test)
+        inside = _mm_and_ps(inside, _mm_cmplt_ps(vz, _mm_loadu_ps(depth)));
+      _mm_storeu_ps(z, vz);
+      mask = _mm_movemask_ps(inside);
+#else
+      for (int lane = 0; lane < 4; lane++) {
+        float px = x + lane + 0.5f;
+        bool inside = true;
+        for (int i = 0; i < 3; i++) {
+          e[i][lane] = t.a[i] * px + row[i];
+          inside = inside && ((t.top_left[i]) ? e[i][lane] >= 0 : e[i][lane] > 0);
+        }
+        z[lane] = z_row + t.dzdx * (px - t.ref_x);
+        inside = inside && z[lane] <= 1.0f;
+        if (shader.depth_test) inside = inside && z[lane] < depth[lane];
+        if (inside) mask |= 1 << lane;
+      }
+#endif
+
+      // Lanes past the bounding box belong to another tile.
+      mask &= (1 << std::min(max_x - x + 1, 4)) - 1;
+      if (!mask) continue;
+
+      for (int lane = 0; lane < 4; lane++) {
+        if (!(mask & (1 << lane))) continue;
+
+        float b0 = e[0][lane] * t.inv_area;
+        float b1 = e[1][lane] * t.inv_area;
+        float b2 = e[2][lane] * t.inv_area;
+        float w = 1.0f / (t.inv_w[0] * b0 + t.inv_w[1] * b1 + t.inv_w[2] * b2);
+
+        float varyings[SOFTWARE_MAX_VARYINGS];
+        for (int j = 0; j < num_varyings; j++) {
+          varyings[j] = (t.varyings[0][j] * b0 + t.varyings[1][j] * b1 + t.varyings[2][j] * b2) * w;
+        }
+
+        glm::vec4 color;
+        if (!shader.Fragment(varyings, &color)) continue;
+
+        uint32_t& dst = framebuffer.color[offset + x + lane];
+        if (shader.blend) {
+          glm::vec4 background = UnpackColor(dst);
+          color = glm::vec4(glm::vec3(background) + (glm::vec3(color) - glm::vec3(background)) * color.w, 1.0f);
+        }
+        dst = PackColor(color);
+        if (shader.depth_write) depth[lane] = z[lane];
+        shaded++;
+      }
+    }
+  }
+  return shaded;
+}
+
+} // End of namespace.
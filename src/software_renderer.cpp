@@ -0,0 +1,257 @@
+#include "software_renderer.hpp"
+
+using namespace std;
+
+namespace Sibyl {
+
+SoftwareRenderer::SoftwareRenderer(
+  shared_ptr<Renderer> renderer,
+  shared_ptr<ThreadPool> thread_pool,
+  int width,
+  int height
+) : renderer_(renderer),
+    rasterizer_(thread_pool, width, height) {
+  scene_.Resize(width, height);
+  screen_.Resize(width, height);
+
+  CreateGlyphAtlas();
+  LoadTexture("textures/water_dudv.bmp", water_dudv_);
+  LoadTexture("textures/water_normal.bmp", water_normal_);
+
+  water_shader_.dudv_map = &water_dudv_;
+  water_shader_.normal_map = &water_normal_;
+  water_shader_.vertices = &water_vertices_;
+  terrain_shader_.vertices = &terrain_vertices_;
+  terrain_shader_.normals = &terrain_normals_;
+  text_shader_.vertices = &text_vertices_;
+  text_shader_.glyphs = &glyphs_;
+  text_shader_.projection = glm::ortho(0.0f, (float) WINDOW_WIDTH, 0.0f, (float) WINDOW_HEIGHT);
+  screen_shader_.source = &scene_;
+}
+
+// Packs every glyph bitmap into a single texture so a string can be drawn
+// with one call.
+void SoftwareRenderer::CreateGlyphAtlas() {
+  const unordered_map<GLchar, Character>& characters = renderer_->characters();
+
+  int cell_width = 1;
+  int cell_height = 1;
+  for (auto& it : characters) {
+    cell_width = std::max(cell_width, it.second.Size.x + 1);
+    cell_height = std::max(cell_height, it.second.Size.y + 1);
+  }
+
+  glyphs_.width = 16 * cell_width;
+  glyphs_.height = 16 * cell_height;
+  glyphs_.channels = 1;
+  glyphs_.texels.assign(glyphs_.width * glyphs_.height, 0);
+
+  for (auto& it : characters) {
+    const Character& ch = it.second;
+    unsigned char c = it.first;
+    int x0 = (c % 16) * cell_width;
+    int y0 = (c / 16) * cell_height;
+    if (ch.Bitmap.size() < ch.Size.x * ch.Size.y) continue;
+
+    for (int y = 0; y < ch.Size.y; y++) {
+      for (int x = 0; x < ch.Size.x; x++) {
+        glyphs_.texels[(y0 + y) * glyphs_.width + x0 + x] = ch.Bitmap[y * ch.Size.x + x];
+      }
+    }
+
+    glyph_uvs_[it.first] = glm::vec4(
+      x0 / float(glyphs_.width), y0 / float(glyphs_.height),
+      (x0 + ch.Size.x) / float(glyphs_.width), (y0 + ch.Size.y) / float(glyphs_.height)
+    );
+  }
+}
+
+void SoftwareRenderer::LoadTexture(const string& path, SoftwareTexture& texture) {
+  unsigned int width, height;
+  if (!Texture::ReadBitmap(path.c_str(), texture.texels, width, height)) return;
+
+  texture.width = width;
+  texture.height = height;
+  texture.channels = 3;
+  texture.repeat = true;
+  for (int i = 0; i + 2 < texture.texels.size(); i += 3) {
+    swap(texture.texels[i], texture.texels[i + 2]);
+  }
+}
+
+// Builds a grid with one vertex per height map sample, using the same world
+// coordinates as Clipmap::GetGridHeight. Outside the map the terrain is
+// flat and under water, so the grid stops at the map border.
+void SoftwareRenderer::LoadTerrain(const vector< vector<float> >& height_map) {
+  int size = height_map.size();
+  if (size < 2) return;
+
+  auto height = [&](int i, int j) {
+    i = glm::clamp(i, 0, size - 1);
+    j = glm::clamp(j, 0, size - 1);
+    return MAX_HEIGHT / 2 + height_map[i][j];
+  };
+
+  terrain_vertices_.clear();
+  terrain_normals_.clear();
+  terrain_indices_.clear();
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      float x = 2000 + (i - size / 2) * TILE_SIZE;
+      float z = 2000 + (j - size / 2) * TILE_SIZE;
+      terrain_vertices_.push_back(glm::vec3(x, height(i, j), z));
+
+      float dx = height(i + 1, j) - height(i - 1, j);
+      float dz = height(i, j + 1) - height(i, j - 1);
+      terrain_normals_.push_back(glm::normalize(glm::vec3(-dx, 2 * TILE_SIZE, -dz)));
+    }
+  }
+
+  for (int i = 0; i + 1 < size; i++) {
+    for (int j = 0; j + 1 < size; j++) {
+      unsigned int v = i * size + j;
+      unsigned int quad[6] = { v, v + 1, v + size, v + size, v + 1, v + size + 1 };
+      terrain_indices_.insert(terrain_indices_.end(), quad, quad + 6);
+    }
+  }
+}
+
+void SoftwareRenderer::BeginFrame(
+  glm::mat4 ProjectionMatrix,
+  glm::mat4 ViewMatrix,
+  glm::vec3 clear_color
+) {
+  projection_ = ProjectionMatrix;
+  view_ = ViewMatrix;
+  glm::vec4 light_direction = glm::normalize(glm::vec4(1, 1, 0, 0));
+  light_cameraspace_ = glm::normalize(glm::vec3(ViewMatrix * light_direction));
+  water_move_factor_ += 0.0005f;
+
+  rasterizer_.Clear(scene_, clear_color);
+}
+
+void SoftwareRenderer::DrawMeshInstanced(
+  const string& mesh_name,
+  const vector<MeshInstance>& instances
+) {
+  const Mesh* mesh = renderer_->GetMesh(mesh_name);
+  if (!mesh || mesh->indices_.empty()) return;
+
+  object_shader_.vertices = &mesh->vertices_;
+  object_shader_.uvs = &mesh->uvs_;
+  object_shader_.normals = &mesh->normals_;
+  object_shader_.light_cameraspace = light_cameraspace_;
+  for (auto& instance : instances) {
+    object_shader_.MV = view_ * instance.model;
+    object_shader_.MVP = projection_ * object_shader_.MV;
+    object_shader_.highlight = instance.highlight;
+    rasterizer_.Draw(
+      object_shader_, mesh->vertices_.size(),
+      &mesh->indices_[0], mesh->indices_.size()
+    );
+  }
+}
+
+// Vertices are already in world space.
+void SoftwareRenderer::DrawBuilding(const string& mesh_name) {
+  const Mesh* mesh = renderer_->GetMesh(mesh_name);
+  if (!mesh || mesh->indices_.empty()) return;
+
+  building_shader_.vertices = &mesh->vertices_;
+  building_shader_.uvs = &mesh->uvs_;
+  building_shader_.MVP = projection_ * view_;
+  rasterizer_.Draw(
+    building_shader_, mesh->vertices_.size(),
+    &mesh->indices_[0], mesh->indices_.size()
+  );
+}
+
+void SoftwareRenderer::DrawTerrain() {
+  if (terrain_indices_.empty()) return;
+
+  terrain_shader_.MVP = projection_ * view_;
+  terrain_shader_.V = view_;
+  terrain_shader_.light_cameraspace = light_cameraspace_;
+  rasterizer_.Draw(
+    terrain_shader_, terrain_vertices_.size(),
+    &terrain_indices_[0], terrain_indices_.size()
+  );
+}
+
+// The ray caster writes straight into the scene, so the triangles drawn so
+// far have to be resolved first.
+void SoftwareRenderer::DrawHeightfield(HeightfieldRenderer& heightfield) {
+  rasterizer_.Flush(scene_);
+  heightfield.Render(scene_, projection_, view_);
+}
+
+// A single quad around the camera reaching the far plane.
+void SoftwareRenderer::DrawWater(glm::vec3 camera) {
+  float y = MAX_HEIGHT / 2 + 2;
+  float d = FAR_CLIPPING;
+  water_vertices_ = {
+    glm::vec3(camera.x - d, y, camera.z - d), glm::vec3(camera.x - d, y, camera.z + d),
+    glm::vec3(camera.x + d, y, camera.z - d), glm::vec3(camera.x + d, y, camera.z - d),
+    glm::vec3(camera.x - d, y, camera.z + d), glm::vec3(camera.x + d, y, camera.z + d)
+  };
+
+  water_shader_.MVP = projection_ * view_;
+  water_shader_.camera = camera;
+  water_shader_.move_factor = water_move_factor_;
+  rasterizer_.Draw(water_shader_, water_vertices_.size());
+}
+
+// Resolves the scene and runs the screen pass. Draws after this go on top
+// of the screen pass, like the GL text overlays.
+void SoftwareRenderer::DrawScreen(bool blur) {
+  rasterizer_.Flush(scene_);
+  screen_shader_.blur = (blur) ? 1.0f : 0.0f;
+  rasterizer_.Draw(screen_shader_, 6);
+}
+
+// Same layout as Renderer::DrawText.
+void SoftwareRenderer::DrawText(
+  const string& text, float x, float y, glm::vec3 color, GLfloat scale
+) {
+  const unordered_map<GLchar, Character>& characters = renderer_->characters();
+  auto a = characters.find('a');
+  if (a == characters.end()) return;
+
+  int step = (a->second.Advance >> 6);
+  x -= (text.size() * step) / 2 + 1;
+
+  text_vertices_.clear();
+  for (const auto& c : text) {
+    auto it = characters.find(c);
+    if (it == characters.end()) continue;
+    const Character& ch = it->second;
+
+    GLfloat xpos = x + ch.Bearing.x * scale;
+    GLfloat ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
+    GLfloat w = ch.Size.x * scale;
+    GLfloat h = ch.Size.y * scale;
+    x += (ch.Advance >> 6) * scale;
+    if (w == 0 || h == 0) continue;
+
+    glm::vec4 uv = glyph_uvs_[c];
+    glm::vec4 quad[6] = {
+      { xpos,     ypos + h, uv.x, uv.y },
+      { xpos,     ypos,     uv.x, uv.w },
+      { xpos + w, ypos,     uv.z, uv.w },
+      { xpos,     ypos + h, uv.x, uv.y },
+      { xpos + w, ypos,     uv.z, uv.w },
+      { xpos + w, ypos + h, uv.z, uv.y }
+    };
+    text_vertices_.insert(text_vertices_.end(), quad, quad + 6);
+  }
+
+  text_shader_.color = color;
+  rasterizer_.Draw(text_shader_, text_vertices_.size());
+}
+
+void SoftwareRenderer::Present() {
+  rasterizer_.Flush(screen_);
+  renderer_->DrawPixels("screen", &screen_.color[0]);
+}
+
+} // End of namespace.
@@ -0,0 +1,193 @@
+#include "software_shaders.hpp"
+
+using namespace std;
+
+namespace Sibyl {
+
+static float Lambert(const float* normal, const glm::vec3& light) {
+  glm::vec3 n(normal[0], normal[1], normal[2]);
+  float length = glm::length(n);
+  if (length == 0) return 0;
+  return glm::clamp(glm::dot(n / length, light), 0.0f, 1.0f);
+}
+
+// Varyings: uv (2), normal in camera space (3), highlight (1).
+ObjectShader::ObjectShader() {
+  num_varyings = 6;
+  cull_back = false;
+}
+
+void ObjectShader::Vertex(int i, SoftwareVertex* out) const {
+  out->position = MVP * glm::vec4((*vertices)[i], 1);
+
+  glm::vec2 uv = (i < uvs->size()) ? (*uvs)[i] : glm::vec2(0);
+  glm::vec3 normal = (i < normals->size()) ? glm::vec3(MV * glm::vec4((*normals)[i], 0)) : glm::vec3(0);
+  out->varyings[0] = uv.x;
+  out->varyings[1] = uv.y;
+  out->varyings[2] = normal.x;
+  out->varyings[3] = normal.y;
+  out->varyings[4] = normal.z;
+  out->varyings[5] = highlight;
+}
+
+bool ObjectShader::Fragment(const float* in, glm::vec4* out) const {
+  const float weight = 0.01f;
+  float u = in[0];
+  float v = in[1];
+  float base = (u < weight || v < weight || u > 1.0f - weight || v > 1.0f - weight) ? 0.0f : 0.5f;
+
+  float cos_theta = Lambert(&in[2], light_cameraspace);
+  glm::vec3 color = glm::vec3(0.5f * base + base * cos_theta);
+  color = color + (glm::vec3(1, 0.69, 0.23) - color) * in[5];
+  *out = glm::vec4(color, 1);
+  return true;
+}
+
+// Varyings: uv (2).
+BuildingShader::BuildingShader() {
+  num_varyings = 2;
+}
+
+void BuildingShader::Vertex(int i, SoftwareVertex* out) const {
+  out->position = MVP * glm::vec4((*vertices)[i], 1);
+  out->varyings[0] = (*uvs)[i].x;
+  out->varyings[1] = (*uvs)[i].y;
+}
+
+bool BuildingShader::Fragment(const float* in, glm::vec4* out) const {
+  float u = in[0] - int(in[0]);
+  float v = in[1] - int(in[1]);
+  *out = (u < 0.02f || v < 0.02f) ? glm::vec4(0, 0, 0, 1) : glm::vec4(0.5, 0.5, 0.5, 1);
+  return true;
+}
+
+// Varyings: uv (2), normal in camera space (3).
+TerrainShader::TerrainShader() {
+  num_varyings = 5;
+}
+
+void TerrainShader::Vertex(int i, SoftwareVertex* out) const {
+  const glm::vec3& position = (*vertices)[i];
+  glm::vec3 normal = glm::vec3(V * glm::vec4((*normals)[i], 0));
+  out->position = MVP * glm::vec4(position, 1);
+  out->varyings[0] = position.x / TILE_SIZE;
+  out->varyings[1] = position.z / TILE_SIZE;
+  out->varyings[2] = normal.x;
+  out->varyings[3] = normal.y;
+  out->varyings[4] = normal.z;
+}
+
+bool TerrainShader::Fragment(const float* in, glm::vec4* out) const {
+  const float weight = 0.01f;
+  float u = in[0] - floor(in[0]);
+  float v = in[1] - floor(in[1]);
+  float base = (u < weight || v < weight) ? 0.0f : 0.5f;
+
+  float cos_theta = Lambert(&in[2], light_cameraspace);
+  *out = glm::vec4(glm::vec3(0.5f * base + base * cos_theta), 1);
+  return true;
+}
+
+// Varyings: uv (2), vector to the camera (3).
+WaterShader::WaterShader() {
+  num_varyings = 5;
+  cull_back = false;
+}
+
+void WaterShader::Vertex(int i, SoftwareVertex* out) const {
+  const glm::vec3& position = (*vertices)[i];
+  glm::vec3 to_camera = camera - position;
+  out->position = MVP * glm::vec4(position, 1);
+  out->varyings[0] = position.x / TILE_SIZE / 32;
+  out->varyings[1] = position.z / TILE_SIZE / 32;
+  out->varyings[2] = to_camera.x;
+  out->varyings[3] = to_camera.y;
+  out->varyings[4] = to_camera.z;
+}
+
+bool WaterShader::Fragment(const float* in, glm::vec4* out) const {
+  const float reflectivity = 0.3f;
+  glm::vec2 uv(in[0], in[1]);
+
+  glm::vec3 normal(0, 1, 0);
+  if (dudv_map && normal_map) {
+    glm::vec2 distortion = 0.5f * glm::vec2(dudv_map->Sample(glm::vec2(uv.x + move_factor, uv.y)));
+    distortion = distortion + 0.5f * glm::vec2(dudv_map->Sample(
+      glm::vec2(0.5f * uv.x + 1000 + move_factor, 0.5f * (uv.y + 1000))
+    ));
+    glm::vec2 distorted = uv + glm::vec2(distortion.x, distortion.y + move_factor);
+
+    glm::vec4 n = normal_map->Sample(distorted);
+    normal = glm::normalize(glm::vec3(n.x * 2 - 1, 1.5f * (n.z * 2 - 1), n.y * 2 - 1));
+  }
+
+  glm::vec3 view = glm::normalize(glm::vec3(in[2], in[3], in[4]));
+  glm::vec3 from_light = glm::normalize(glm::vec3(-1, -1, 0));
+  glm::vec3 reflected = glm::reflect(from_light, normal);
+  float specular = std::max(glm::dot(reflected, view), 0.0f);
+  specular = specular * specular * reflectivity;
+
+  *out = glm::vec4(specular, 0.3f + specular, 0.5f + specular, 1);
+  return true;
+}
+
+// Varyings: uv (2), color (3).
+TextShader::TextShader() {
+  num_varyings = 5;
+  depth_test = false;
+  depth_write = false;
+  cull_back = false;
+  blend = true;
+}
+
+void TextShader::Vertex(int i, SoftwareVertex* out) const {
+  const glm::vec4& v = (*vertices)[i];
+  out->position = projection * glm::vec4(v.x, v.y, 0, 1);
+  out->varyings[0] = v.z;
+  out->varyings[1] = v.w;
+  out->varyings[2] = color.x;
+  out->varyings[3] = color.y;
+  out->varyings[4] = color.z;
+}
+
+bool TextShader::Fragment(const float* in, glm::vec4* out) const {
+  float alpha = glyphs->Sample(glm::vec2(in[0], in[1])).x;
+  if (alpha <= 0) return false;
+  *out = glm::vec4(in[2], in[3], in[4], alpha);
+  return true;
+}
+
+// Varyings: uv (2).
+ScreenShader::ScreenShader() {
+  num_varyings = 2;
+  depth_test = false;
+  depth_write = false;
+  cull_back = false;
+}
+
+void ScreenShader::Vertex(int i, SoftwareVertex* out) const {
+  static const float quad[6][2] = {
+    { 0, 0 }, { 0, 1 }, { 1, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 }
+  };
+  float u = quad[i % 6][0];
+  float v = quad[i % 6][1];
+  out->position = glm::vec4(u * 2 - 1, v * 2 - 1, 0, 1);
+  out->varyings[0] = u;
+  out->varyings[1] = v;
+}
+
+// The screen FBO texture uses nearest filtering.
+bool ScreenShader::Fragment(const float* in, glm::vec4* out) const {
+  const float time = 1.0f;
+  float u = in[0] + blur * 0.005f * sin(time + 1024.0f * in[0]);
+  float v = in[1] + blur * 0.005f * cos(time + 768.0f * in[1]);
+  int x = glm::clamp(int(u * source->width), 0, source->width - 1);
+  int y = glm::clamp(int(v * source->height), 0, source->height - 1);
+
+  glm::vec3 color = glm::vec3(UnpackColor(source->color[y * source->width + x]));
+  color = color + (glm::vec3(0.6, 0.6, 0.3) - color) * (blur * 0.5f);
+  *out = glm::vec4(color, 1);
+  return true;
+}
+
+} // End of namespace.
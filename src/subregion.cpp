@@ -200,17 +200,23 @@ void Subregion::CreateBuffer(glm::ivec2 offset) {
   );
 }
 
-void Subregion::Draw(glm::ivec2 offset, glm::ivec2 clipmap_top_lft, bool water) {
+void Subregion::GetBounds(
+  glm::ivec2 offset, 
+  glm::ivec2 clipmap_top_lft, 
+  glm::ivec2* top_lft, 
+  glm::ivec2* bot_rgt
+) {
   int num_tiles = 1 << (clipmap_level_ - 1);
-  glm::ivec2 top_lft = clipmap_top_lft * TILE_SIZE + top_left_[offset.x][offset.y] * num_tiles * TILE_SIZE;
-  glm::ivec2 bot_rgt = top_lft + size_[offset.x][offset.y] * num_tiles * TILE_SIZE;
-  
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_[offset.x][offset.y]);
+  *top_lft = clipmap_top_lft * TILE_SIZE + top_left_[offset.x][offset.y] * num_tiles * TILE_SIZE;
+  *bot_rgt = *top_lft + size_[offset.x][offset.y] * num_tiles * TILE_SIZE;
+}
+
+void Subregion::Draw(CommandList& commands, glm::ivec2 offset, glm::ivec2 clipmap_top_lft, bool water) {
   if (subregion_ == SUBREGION_CENTER) {
-    glDrawElements(GL_TRIANGLES, buffer_size_[offset.x][offset.y], GL_UNSIGNED_INT, (void*) 0);
+    commands.DrawElements(buffer_[offset.x][offset.y], buffer_size_[offset.x][offset.y]);
   } else {
     int buffer_size  = size_[offset.x][offset.y].x * size_[offset.x][offset.y].y * 6;
-    glDrawElements(GL_TRIANGLES, buffer_size, GL_UNSIGNED_INT, (void*) (0 * sizeof(unsigned int)));
+    commands.DrawElements(buffer_[offset.x][offset.y], buffer_size);
   }
 }
 
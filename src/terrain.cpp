@@ -24,8 +24,13 @@ Terrain::Terrain(
 }
 
 void Terrain::LoadTerrain(const string& filename) {
+  height_map_ = LoadHeightMap(filename);
+}
+
+vector< vector<float> > Terrain::LoadHeightMap(const string& filename) {
+  vector< vector<float> > height_map;
   ifstream is(filename, ifstream::binary);
-  if (!is) return;
+  if (!is) return height_map;
 
   int size;
   is >> size;
@@ -45,7 +50,7 @@ void Terrain::LoadTerrain(const string& filename) {
   // The step is the gap between sample points in the map grid.
   int step = 5;
   size = (size-1) * step + 1;
-  height_map_ = vector< vector<float> >(size, vector<float>(size, 0.0));
+  height_map = vector< vector<float> >(size, vector<float>(size, 0.0));
 
   // Now we need to do linear interpolation to obtain the 1 x 1 meter wide
   // tile heights.
@@ -62,7 +67,7 @@ void Terrain::LoadTerrain(const string& filename) {
       float bot_rgt = height_data[grid_x+1][grid_y+1];
 
       float height = 0.0;
-      height_map_[i][j] = top_lft;
+      height_map[i][j] = top_lft;
   
       // Top left triangle.
       if (offset_x + offset_y <= step) {
@@ -77,64 +82,96 @@ void Terrain::LoadTerrain(const string& filename) {
         height += (top_rgt - bot_rgt) * (1 - (offset_y / float(step)));
       }
 
-      height_map_[i][j] = height;
+      height_map[i][j] = height;
     }
   }
+  return height_map;
 }
 
 void Terrain::Draw(glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, glm::vec3 camera, glm::vec3 player_pos) {
-  glUseProgram(shader_.program_id());
-  shader_.BindTexture("GrassTextureSampler", grass_texture_id_);
-  shader_.BindTexture("SandTextureSampler", sand_texture_id_);
+  Update(player_pos);
+
+  CommandList commands;
+  RecordTerrain(commands, ProjectionMatrix, ViewMatrix, camera, player_pos);
+  RecordWater(commands, ProjectionMatrix, ViewMatrix, camera, player_pos);
+  commands.Execute();
+}
+
+// Streams the clipmap rings around the player into their textures. Must run
+// on the GL thread before the terrain is recorded.
+void Terrain::Update(glm::vec3 player_pos) {
+  for (int i = 0; i < CLIPMAP_LEVELS; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "clipmap update %d", i);
+    ScopedTimer timer(name);
+    GpuTimer gpu_timer(name);
+    clipmaps_[i].Update(player_pos);
+  }
+}
+
+// Records the terrain and water draws. Safe to call from a worker thread 
+// once Update has run for the frame. Subregions behind the occluders are
+// skipped.
+void Terrain::Submit(
+  RenderQueue& queue, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  glm::vec3 camera, glm::vec3 player_pos, const OcclusionBuffer* occlusion_buffer
+) {
+  if (draw_terrain_) {
+    CommandList terrain_commands(queue.arena());
+    RecordTerrain(terrain_commands, ProjectionMatrix, ViewMatrix, camera, player_pos, occlusion_buffer);
+    uint64_t key = RenderQueue::MakeKey(PASS_OPAQUE, shader_.program_id(), grass_texture_id_, 0, 0);
+    queue.Submit(key, "terrain", std::move(terrain_commands));
+  }
+
+  CommandList water_commands(queue.arena());
+  RecordWater(water_commands, ProjectionMatrix, ViewMatrix, camera, player_pos, occlusion_buffer);
+  uint64_t key = RenderQueue::MakeKey(PASS_WATER, water_shader_.program_id(), water_diffuse_texture_id_, 0, 0);
+  queue.Submit(key, "water", std::move(water_commands));
+}
 
-  // Clipmaps.
-  for (int i = 0; i < CLIPMAP_LEVELS; i++) clipmaps_[i].Update(player_pos);
+void Terrain::RecordTerrain(
+  CommandList& commands, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  glm::vec3 camera, glm::vec3 player_pos, const OcclusionBuffer* occlusion_buffer
+) {
+  commands.UseProgram(&shader_);
+  commands.BindTexture("GrassTextureSampler", grass_texture_id_);
+  commands.BindTexture("SandTextureSampler", sand_texture_id_);
 
   bool first = true;
   for (int i = 0; i < CLIPMAP_LEVELS; i++) {
-    clipmaps_[i].Render(player_pos, &shader_, ProjectionMatrix, ViewMatrix, first);
+    clipmaps_[i].Render(commands, player_pos, &shader_, ProjectionMatrix, ViewMatrix, first, occlusion_buffer);
     first = false;
   }
 
-  shader_.Clear();
+  commands.Clear();
+}
+
+void Terrain::RecordWater(
+  CommandList& commands, glm::mat4 ProjectionMatrix, glm::mat4 ViewMatrix, 
+  glm::vec3 camera, glm::vec3 player_pos, const OcclusionBuffer* occlusion_buffer
+) {
+  commands.UseProgram(&water_shader_);
+  commands.BindTexture("dudvMap", water_diffuse_texture_id_);
+  commands.BindTexture("normalMap", water_normal_texture_id_);
 
-  // Water.
-  glUseProgram(water_shader_.program_id());
-  water_shader_.BindTexture("dudvMap", water_diffuse_texture_id_);
-  water_shader_.BindTexture("normalMap", water_normal_texture_id_);
+  // Advanced once per frame for all levels, as fast as the old per level step.
+  water_move_factor_ += 0.0005f;
 
-  first = true;
+  bool first = true;
   for (int i = 0; i < CLIPMAP_LEVELS; i++) {
-    clipmaps_[i].RenderWater(player_pos, &water_shader_, ProjectionMatrix, ViewMatrix, camera, first);
+    clipmaps_[i].RenderWater(commands, player_pos, &water_shader_, ProjectionMatrix, ViewMatrix, camera, water_move_factor_, first, occlusion_buffer);
     first = false;
   }
 
-  water_shader_.Clear();
+  commands.Clear();
 }
 
 float Terrain::GetHeight(float x , float y) { 
-  glm::ivec2 top_left = (glm::ivec2(x, y) / TILE_SIZE) * TILE_SIZE;
-  if (x < 0 && fabs(top_left.x - x) > 0.00001) top_left.x -= TILE_SIZE;
-  if (y < 0 && fabs(top_left.y - y) > 0.00001) top_left.y -= TILE_SIZE;
-
-  float v[4];
-  v[0] = clipmaps_[0].GetGridHeight(top_left.x                  , top_left.y                  );
-  v[1] = clipmaps_[0].GetGridHeight(top_left.x                  , top_left.y + TILE_SIZE + 0.1);
-  v[2] = clipmaps_[0].GetGridHeight(top_left.x + TILE_SIZE + 0.1, top_left.y + TILE_SIZE + 0.1);
-  v[3] = clipmaps_[0].GetGridHeight(top_left.x + TILE_SIZE + 0.1, top_left.y                  );
-
-  glm::vec2 tile_v = (glm::vec2(x, y) - glm::vec2(top_left)) / float(TILE_SIZE);
-
-  // Top triangle.
-  float h;
-  if (tile_v.x + tile_v.y < 1.0f) {
-    return v[0] + tile_v.x * (v[3] - v[0]) + tile_v.y * (v[1] - v[0]);
-
-  // Bottom triangle.
-  } else {
-    tile_v = glm::vec2(1.0f) - tile_v; 
-    return v[2] + tile_v.x * (v[1] - v[2]) + tile_v.y * (v[3] - v[2]);
-  }
+  return clipmaps_[0].GetHeight(x, y);
+}
+
+float Terrain::GetTimeOfImpact(glm::vec3 start, glm::vec3 displacement) { 
+  return clipmaps_[0].GetTimeOfImpact(start, displacement);
 }
 
 } // End of namespace.
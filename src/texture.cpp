@@ -4,23 +4,24 @@ Texture::Texture(const std::string& path) {
   LoadBitmap(path.c_str());
 }
 
-void Texture::LoadBitmap(const char* imagepath){
+// Reads a 24 bit BMP. The pixels are stored bottom row first, in BGR order.
+bool Texture::ReadBitmap(
+  const char* imagepath, std::vector<unsigned char>& data, 
+  unsigned int& width, unsigned int& height
+) {
   printf("Reading image %s\n", imagepath);
   
   // Data read from the header of the BMP file
   unsigned char header[54];
   unsigned int dataPos;
   unsigned int imageSize;
-  unsigned int width, height;
-  // Actual RGB data
-  unsigned char * data;
   
   // Open the file
   FILE * file = fopen(imagepath,"rb");
   if (!file){
     printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
     getchar();
-    return;
+    return false;
   }
   
   // Read the header, i.e. the 54 first bytes
@@ -29,17 +30,17 @@ void Texture::LoadBitmap(const char* imagepath){
   if ( fread(header, 1, 54, file)!=54 ){ 
     printf("Not a correct BMP file\n");
     fclose(file);
-    return;
+    return false;
   }
   // A BMP files always begins with "BM"
   if ( header[0]!='B' || header[1]!='M' ){
     printf("Not a correct BMP file\n");
     fclose(file);
-    return;
+    return false;
   }
   // Make sure this is a 24bpp file
-  if (*(int*)&(header[0x1E])!=0 ) { printf("Not a correct BMP file\n");    fclose(file); return; }
-  if (*(int*)&(header[0x1C])!=24) { printf("Not a correct BMP file\n");    fclose(file); return; }
+  if (*(int*)&(header[0x1E])!=0 ) { printf("Not a correct BMP file\n");    fclose(file); return false; }
+  if (*(int*)&(header[0x1C])!=24) { printf("Not a correct BMP file\n");    fclose(file); return false; }
   
   // Read the information about the image
   dataPos    = *(int*)&(header[0x0A]);
@@ -51,14 +52,20 @@ void Texture::LoadBitmap(const char* imagepath){
   if (imageSize == 0) imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
   if (dataPos   == 0)   dataPos=54; // The BMP header is done that way
   
-  // Create a buffer
-  data = new unsigned char [imageSize];
-  
   // Read the actual data from the file into the buffer
-  fread(data,1,imageSize,file);
+  data.resize(imageSize);
+  fread(&data[0],1,imageSize,file);
   
   // Everything is in memory now, the file can be closed.
   fclose (file);
+  return true;
+}
+
+void Texture::LoadBitmap(const char* imagepath){
+  std::vector<unsigned char> data;
+  unsigned int width, height;
+  if (!ReadBitmap(imagepath, data, width, height)) return;
+  unsigned int imageSize = data.size();
   
   // Create one OpenGL texture
   glGenTextures(1, &texture_id_);
@@ -67,10 +74,8 @@ void Texture::LoadBitmap(const char* imagepath){
   glBindTexture(GL_TEXTURE_2D, texture_id_);
   
   // Give the image to OpenGL
-  glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
-  
-  // OpenGL has now copied the data. Free our own version
-  delete [] data;
+  glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, &data[0]);
+  Sibyl::Metrics::GetInstance().GetCounter("texture_upload_bytes").Add(imageSize);
   
   // Poor filtering, or ...
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -0,0 +1,104 @@
+#include "thread_pool.hpp"
+
+using namespace std;
+
+namespace Sibyl {
+
+ThreadPool::ThreadPool() : ThreadPool(thread::hardware_concurrency()) {
+}
+
+ThreadPool::ThreadPool(int num_threads) {
+  if (num_threads < 1) num_threads = 1;
+  for (int i = 0; i < num_threads; i++) {
+    workers_.push_back(thread(&ThreadPool::Work, this));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  task_cv_.notify_all();
+  for (auto& w : workers_) w.join();
+}
+
+void ThreadPool::Work() {
+  while (true) {
+    Task task;
+    {
+      unique_lock<mutex> lock(mutex_);
+      task_cv_.wait(lock, [this]() { return stop_ || next_task_ < tasks_.size(); });
+      if (stop_ && next_task_ == tasks_.size()) return;
+      task = move(tasks_[next_task_++]);
+      if (next_task_ == tasks_.size()) {
+        tasks_.clear();
+        next_task_ = 0;
+      }
+    }
+
+    if (task.range_fn) {
+      (*task.range_fn)(task.begin, task.end);
+    } else {
+      task.fn();
+    }
+
+    {
+      lock_guard<mutex> lock(mutex_);
+      pending_--;
+      if (task.batch) (*task.batch)--;
+    }
+    done_cv_.notify_all();
+  }
+}
+
+void ThreadPool::Push(Task task) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    tasks_.push_back(move(task));
+    pending_++;
+  }
+  task_cv_.notify_one();
+}
+
+void ThreadPool::Enqueue(function<void()> task) {
+  Push(Task { move(task), nullptr, 0, 0, nullptr });
+}
+
+// Blocks until every enqueued task has finished, including the batches of
+// other threads.
+void ThreadPool::Wait() {
+  unique_lock<mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+// The batch counter lives on the caller's stack and is only touched under
+// the lock.
+void ThreadPool::WaitBatch(int* batch) {
+  unique_lock<mutex> lock(mutex_);
+  done_cv_.wait(lock, [batch]() { return *batch == 0; });
+}
+
+void ThreadPool::Run(const vector<function<void()>>& tasks) {
+  int batch = tasks.size();
+  for (auto& task : tasks) Push(Task { task, nullptr, 0, 0, &batch });
+  WaitBatch(&batch);
+}
+
+// Splits [begin, end) into one contiguous chunk per worker and calls 
+// fn(chunk_begin, chunk_end) for each of them. The tasks refer to fn, so
+// queuing them does not allocate.
+void ThreadPool::ParallelFor(int begin, int end, const function<void(int, int)>& fn) {
+  int n = end - begin;
+  if (n <= 0) return;
+
+  int num_chunks = std::min(n, size());
+  int chunk_size = (n + num_chunks - 1) / num_chunks;
+  int batch = (n + chunk_size - 1) / chunk_size;
+  for (int i = begin; i < end; i += chunk_size) {
+    Push(Task { function<void()>(), &fn, i, std::min(i + chunk_size, end), &batch });
+  }
+  WaitBatch(&batch);
+}
+
+} // End of namespace.
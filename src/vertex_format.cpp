@@ -0,0 +1,207 @@
+#include "vertex_format.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+using namespace glm;
+
+namespace Sibyl {
+
+static inline uint32_t FloatBits(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+static inline float BitsToFloat(uint32_t u) {
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+static inline float SignNotZero(float x) { return (x >= 0) ? 1.0f : -1.0f; }
+
+VertexLayout GetVertexLayout(PositionEncoding encoding) {
+  // Three floats leave two bytes of padding after the normal, to keep the
+  // uv four byte aligned. The 16 bit encodings fit in 12 bytes.
+  if (encoding == POSITION_FLOAT) return VertexLayout { 20, 0, 12, 16 };
+  return VertexLayout { 12, 0, 6, 8 };
+}
+
+// Rounds to nearest even. Values too large for a half become infinity.
+uint16_t FloatToHalf(float f) {
+  uint32_t u = FloatBits(f);
+  uint32_t sign = u & 0x80000000u;
+  u ^= sign;
+
+  uint16_t h;
+  if (u >= 0x47800000u) {
+    // Infinity, NaN or too large.
+    h = (u > 0x7f800000u) ? 0x7e00 : 0x7c00;
+  } else if (u < 0x38800000u) {
+    // Subnormal or zero. Adding a magic number lines the mantissa bits up
+    // with the half mantissa and lets the FPU do the rounding.
+    const uint32_t magic = 0x3f000000u;
+    h = FloatBits(BitsToFloat(u) + BitsToFloat(magic)) - magic;
+  } else {
+    uint32_t odd = (u >> 13) & 1;
+    u += 0xc8000fffu + odd;
+    h = u >> 13;
+  }
+  return h | (sign >> 16);
+}
+
+float HalfToFloat(uint16_t h) {
+  const uint32_t shifted_exponent = 0x7c00u << 13;
+  uint32_t u = (h & 0x7fffu) << 13;
+  uint32_t exponent = u & shifted_exponent;
+  u += (127 - 15) << 23;
+
+  if (exponent == shifted_exponent) {
+    u += (128 - 16) << 23;
+  } else if (exponent == 0) {
+    const uint32_t magic = 113u << 23;
+    u += 1 << 23;
+    u = FloatBits(BitsToFloat(u) - BitsToFloat(magic));
+  }
+  return BitsToFloat(u | (uint32_t(h & 0x8000u) << 16));
+}
+
+// Matches DecodeOctahedral in shaders/v_object.
+vec3 DecodeOctahedral(const int8_t* e) {
+  float x = std::max(e[0] / 127.0f, -1.0f);
+  float y = std::max(e[1] / 127.0f, -1.0f);
+  vec3 n(x, y, 1.0f - fabs(x) - fabs(y));
+  if (n.z < 0) {
+    n.x = (1.0f - fabs(y)) * SignNotZero(x);
+    n.y = (1.0f - fabs(x)) * SignNotZero(y);
+  }
+  return normalize(n);
+}
+
+// Projects onto the octahedron, folds the lower half over the upper one
+// and keeps whichever of the four nearest byte pairs decodes closest to
+// the input.
+void EncodeOctahedral(const vec3& n, int8_t* out) {
+  out[0] = out[1] = 0;
+  float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+  if (l1 <= 0) return;
+
+  float x = n.x / l1;
+  float y = n.y / l1;
+  if (n.z < 0) {
+    float folded_x = (1.0f - fabs(y)) * SignNotZero(x);
+    y = (1.0f - fabs(x)) * SignNotZero(y);
+    x = folded_x;
+  }
+
+  float best = -2.0f;
+  float fx = floor(x * 127.0f), fy = floor(y * 127.0f);
+  for (int i = 0; i < 4; i++) {
+    int8_t candidate[2] = {
+      int8_t(std::min(std::max(fx + (i & 1), -127.0f), 127.0f)),
+      int8_t(std::min(std::max(fy + (i >> 1), -127.0f), 127.0f))
+    };
+    float d = dot(DecodeOctahedral(candidate), n);
+    if (d > best) {
+      best = d;
+      out[0] = candidate[0];
+      out[1] = candidate[1];
+    }
+  }
+}
+
+void PackVertices(
+  PositionEncoding encoding, const vec3* vertices, const vec2* uvs,
+  const vec3* normals, size_t num_vertices, VertexFormat& format,
+  vector<char>& data
+) {
+  VertexLayout layout = GetVertexLayout(encoding);
+
+  format = VertexFormat();
+  format.encoding = encoding;
+  if (num_vertices > 0) format.min = format.max = vertices[0];
+  for (size_t i = 1; i < num_vertices; i++) {
+    format.min = glm::min(format.min, vertices[i]);
+    format.max = glm::max(format.max, vertices[i]);
+  }
+
+  // Halves are most precise near zero, so they store the offset from the
+  // center. Shorts spread their 65536 steps over the bounds.
+  if (encoding == POSITION_HALF) {
+    format.position_offset = (format.min + format.max) * 0.5f;
+  } else if (encoding == POSITION_UNORM16) {
+    format.position_offset = format.min;
+    format.position_scale = format.max - format.min;
+  }
+
+  data.assign(num_vertices * layout.stride, 0);
+  for (size_t i = 0; i < num_vertices; i++) {
+    char* v = &data[i * layout.stride];
+    vec3 p = vertices[i] - format.position_offset;
+
+    if (encoding == POSITION_FLOAT) {
+      memcpy(v + layout.position, &p, sizeof(vec3));
+    } else {
+      uint16_t q[3];
+      for (int k = 0; k < 3; k++) {
+        if (encoding == POSITION_HALF) {
+          q[k] = FloatToHalf(p[k]);
+        } else {
+          float s = format.position_scale[k];
+          float t = (s > 0) ? p[k] / s : 0.0f;
+          q[k] = uint16_t(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+        }
+      }
+      memcpy(v + layout.position, q, sizeof(q));
+    }
+
+    int8_t normal[2] = { 0, 0 };
+    if (normals) EncodeOctahedral(normals[i], normal);
+    memcpy(v + layout.normal, normal, sizeof(normal));
+
+    uint16_t uv[2] = { 0, 0 };
+    if (uvs) {
+      uv[0] = FloatToHalf(uvs[i].x);
+      uv[1] = FloatToHalf(uvs[i].y);
+    }
+    memcpy(v + layout.uv, uv, sizeof(uv));
+  }
+}
+
+void UnpackVertices(
+  const VertexFormat& format, const char* data, size_t num_vertices,
+  vector<vec3>& vertices, vector<vec2>& uvs, vector<vec3>& normals
+) {
+  VertexLayout layout = GetVertexLayout(format.encoding);
+  vertices.resize(num_vertices);
+  uvs.resize(num_vertices);
+  normals.resize(num_vertices);
+
+  for (size_t i = 0; i < num_vertices; i++) {
+    const char* v = data + i * layout.stride;
+
+    vec3 p;
+    if (format.encoding == POSITION_FLOAT) {
+      memcpy(&p, v + layout.position, sizeof(vec3));
+    } else {
+      uint16_t q[3];
+      memcpy(q, v + layout.position, sizeof(q));
+      for (int k = 0; k < 3; k++) {
+        p[k] = (format.encoding == POSITION_HALF) ? HalfToFloat(q[k]) : q[k] / 65535.0f;
+      }
+    }
+    vertices[i] = format.position_offset + format.position_scale * p;
+
+    int8_t normal[2];
+    memcpy(normal, v + layout.normal, sizeof(normal));
+    normals[i] = DecodeOctahedral(normal);
+
+    uint16_t uv[2];
+    memcpy(uv, v + layout.uv, sizeof(uv));
+    uvs[i] = vec2(HalfToFloat(uv[0]), HalfToFloat(uv[1]));
+  }
+}
+
+} // End of namespace.
@@ -36,16 +36,16 @@ void Run(
     renderer_->DrawScreen(false);
 
     // Swap buffers.
-    glfwSwapBuffers(game_state_->window());
-    glfwPollEvents();
-  } while (!text_editor_->Close() && glfwWindowShouldClose(game_state_->window()) == 0);
+    game_state_->SwapBuffers();
+  } while (!text_editor_->Close() && !game_state_->ShouldClose());
 
   // Close OpenGL window and terminate GLFW.
   glfwTerminate();
 }
 
 int main(int argc, char** argv) {
-  if (argc < 2) return 1;
+  vector<string> args = GameState::ParseOptions(argc, argv);
+  if (args.empty()) return 1;
 
   static IoC::Container& container = IoC::Container::Get();
   container.RegisterInstance<GameState, GameState>();
@@ -55,6 +55,6 @@ int main(int argc, char** argv) {
   shared_ptr<GameState> game_state = container.Resolve<GameState>();
   shared_ptr<TextEditor> text_editor = container.Resolve<TextEditor>();
   shared_ptr<Renderer> renderer = container.Resolve<Renderer>();
-  Run(game_state, text_editor, renderer, string(argv[1]));
+  Run(game_state, text_editor, renderer, args[0]);
   return 0;
 }